@@ -0,0 +1,504 @@
+//============================================================================
+// Name        : Aggregator.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Central aggregator daemon. Receives the readings of every
+//               sensor and keeps per-device state, sharded by MAC across
+//               worker cores
+//============================================================================
+
+// Data flow:
+//
+//   sensors --UDP--> receiver threads --SPSC rings--> shard threads
+//
+// Every receiver owns a SO_REUSEPORT socket on the listening port and one
+// ring per shard. A device always hashes to the same shard, whose thread is
+// the only one to touch that device's state, so shards share nothing and
+// need no locks. With anchors configured each shard also runs the particle
+// filter over its own devices.
+//
+// Anchors whose MAC is known also hear each other, and those readings
+// calibrate their path loss online: shards forward them over one more ring
+// each to the main thread, the calibrator's only writer, and pick up what
+// it publishes between steps without waiting for it.
+//
+// With -m the position of every tracked device also goes into a shared
+// memory snapshot. Its writer is single-threaded, so shards hand their
+// estimates to the main thread over a third kind of ring.
+
+#include <pthread.h> // for pthread_setaffinity_np()
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>  // for getopt(), usleep()
+
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Calibration.h"
+#include "ParticleFilter.h"
+#include "Sample.h"
+#include "SharedSnapshot.h"
+#include "SpscRing.h"
+#include "WireProtocol.h"
+
+using namespace std;
+
+struct agg_item {
+	struct rl_sample sample;
+	uint32_t sensor_id;
+	uint64_t received_us; // aggregator clock; sensor clocks aren't aligned
+};
+
+struct agg_device {
+	uint64_t last_us;
+	uint64_t samples;
+	uint64_t published_us; // newest reading behind the last position published
+	uint32_t last_sensor;
+	int8_t last_signal;
+};
+
+// One anchor hearing another, on its way to the calibrator
+struct agg_link {
+	int rx_id;
+	mac_key tx;
+	float rssi;
+	uint64_t received_us;
+};
+
+// A device's latest position, on its way to the snapshot
+struct agg_position {
+	mac_key mac;
+	float x, y;
+	uint64_t timestamp_us;
+};
+
+struct agg_shard {
+	int index;
+	spsc_ring<agg_item> *inputs; // one per receiver
+	unordered_map<mac_key, agg_device> devices;
+	struct pf_tracker *tracker;   // NULL without anchors
+	spsc_ring<agg_link> links;    // to the calibrator
+	uint32_t calibration;         // generation the tracker has applied
+	spsc_ring<agg_position> positions; // to the snapshot
+	atomic<uint64_t> samples;
+	atomic<uint64_t> device_count;
+	thread worker;
+};
+
+struct agg_receiver {
+	int index;
+	struct wire_receiver *rx;
+	vector<vector<agg_item> > staged; // per shard, filled per datagram
+	atomic<uint64_t> dropped;         // a shard's ring was full
+	thread worker;
+};
+
+struct agg_config {
+	const char *listen;
+	int receivers;
+	int shards;
+	uint32_t ring_capacity;
+	bool pin;
+	int duration;             // seconds, 0 runs until signalled
+	uint64_t step_interval_us;
+	uint64_t device_timeout_us;
+};
+
+// Anchors are the sensors at surveyed positions; sensor id -> anchor index
+static vector<struct anchor> g_anchors;
+static unordered_map<uint32_t, int> g_anchor_of_sensor;
+static unordered_map<mac_key, int> g_anchor_of_mac;
+static struct calibrator *g_calibrator; // NULL unless some anchor has a MAC
+static struct snapshot_writer *g_snapshot; // NULL unless -m
+static struct agg_config g_config;
+static vector<agg_shard*> g_shards;
+static atomic<bool> g_quit(false);
+
+static void on_signal(int)
+{
+	g_quit.store(true);
+}
+
+// Reads lines of "anchor <sensor id> <x> <y> <ref power dBm> <exponent> [mac]".
+// The MAC is what other anchors hear it as, for calibration
+static bool load_anchors(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Failed to open anchor file %s.\n", path);
+		return false;
+	}
+	char line[256];
+	int lineno = 0;
+	while (fgets(line, sizeof(line), file)) {
+		lineno++;
+		char *hash = strchr(line, '#');
+		if (hash)
+			*hash = '\0';
+		unsigned int id;
+		struct anchor a;
+		char word[16], mac[32];
+		mac_key key = 0;
+		if (sscanf(line, "%15s", word) != 1)
+			continue;
+		const int fields = sscanf(line, " anchor %u %f %f %f %f %31s", &id, &a.x, &a.y,
+		                          &a.model.ref_power, &a.model.exponent, mac);
+		if (fields < 5 || (fields == 6 && !mac_parse(mac, &key))) {
+			fprintf(stderr, "%s:%d: malformed line.\n", path, lineno);
+			fclose(file);
+			return false;
+		}
+		if (key)
+			g_anchor_of_mac[key] = (int) g_anchors.size();
+		g_anchor_of_sensor[id] = (int) g_anchors.size();
+		g_anchors.push_back(a);
+	}
+	fclose(file);
+	return true;
+}
+
+static void pin_to_cpu(thread &t, int cpu)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu % (cpus > 0 ? cpus : 1), &set);
+	if (pthread_setaffinity_np(t.native_handle(), sizeof(set), &set))
+		fprintf(stderr, "Failed to pin thread to CPU %d.\n", cpu);
+}
+
+/***************
+ *  Receivers  *
+ ***************/
+static void on_datagram(void *arg, uint32_t sensor_id, const struct rl_sample *samples, int count)
+{
+	agg_receiver *r = (agg_receiver*) arg;
+	const uint64_t now = monotonic_us();
+	const uint32_t shards = (uint32_t) g_shards.size();
+
+	for (int i = 0; i < count; i++) {
+		agg_item item = { samples[i], sensor_id, now };
+		r->staged[mac_hash(samples[i].mac) % shards].push_back(item);
+	}
+	// One release store per shard and datagram
+	for (uint32_t s = 0; s < shards; s++) {
+		vector<agg_item> &batch = r->staged[s];
+		if (batch.empty())
+			continue;
+		uint32_t pushed = spsc_push(&g_shards[s]->inputs[r->index], &batch[0], (uint32_t) batch.size());
+		if (pushed < batch.size())
+			r->dropped.fetch_add(batch.size() - pushed, memory_order_relaxed);
+		batch.clear();
+	}
+}
+
+static void receiver_main(agg_receiver *r)
+{
+	while (!g_quit.load(memory_order_relaxed))
+		if (wire_receiver_poll(r->rx, 100, on_datagram, r) < 0)
+			perror("recvmmsg");
+}
+
+/************
+ *  Shards  *
+ ************/
+static void shard_process(agg_shard *shard, const agg_item *item)
+{
+	agg_device &d = shard->devices[item->sample.mac];
+	d.last_us = item->received_us;
+	d.samples++;
+	d.last_sensor = item->sensor_id;
+	d.last_signal = item->sample.signal;
+
+	if (shard->tracker) {
+		unordered_map<uint32_t, int>::const_iterator it = g_anchor_of_sensor.find(item->sensor_id);
+		if (it == g_anchor_of_sensor.end())
+			return;
+		pf_tracker_observe(shard->tracker, item->sample.mac, it->second, item->sample.signal, item->received_us);
+		// A full ring only loses readings the calibrator would mostly
+		// thin out anyway
+		if (g_calibrator && g_anchor_of_mac.count(item->sample.mac)) {
+			agg_link link = { it->second, item->sample.mac, (float) item->sample.signal, item->received_us };
+			spsc_push(&shard->links, &link, 1);
+		}
+	}
+}
+
+// Picks up the anchors the calibrator republished since the last step
+static void shard_calibrate(agg_shard *shard)
+{
+	const uint32_t generation = cal_generation(g_calibrator);
+	if (generation == shard->calibration)
+		return;
+	shard->calibration = generation;
+	for (int i = 0; i < (int) g_anchors.size(); i++) {
+		struct anchor a;
+		if (cal_read_anchor(g_calibrator, i, &a))
+			pf_tracker_set_anchor(shard->tracker, i, &a);
+	}
+}
+
+// Hands over the positions that newer readings moved since the last step.
+// A full ring only delays them to a later step
+static void shard_publish(agg_shard *shard)
+{
+	for (unordered_map<mac_key, agg_device>::iterator it = shard->devices.begin(); it != shard->devices.end(); ++it) {
+		struct pf_estimate estimate;
+		if (!pf_tracker_estimate(shard->tracker, it->first, &estimate) ||
+		    estimate.timestamp_us <= it->second.published_us)
+			continue;
+		agg_position position = { it->first, estimate.x, estimate.y, estimate.timestamp_us };
+		if (!spsc_push(&shard->positions, &position, 1))
+			break;
+		it->second.published_us = estimate.timestamp_us;
+	}
+}
+
+static void shard_expire(agg_shard *shard, uint64_t now)
+{
+	for (unordered_map<mac_key, agg_device>::iterator it = shard->devices.begin(); it != shard->devices.end(); ) {
+		if (it->second.last_us + g_config.device_timeout_us < now)
+			it = shard->devices.erase(it);
+		else
+			++it;
+	}
+}
+
+static void shard_main(agg_shard *shard)
+{
+	const int receivers = g_config.receivers;
+	agg_item batch[256];
+	uint64_t next_step = monotonic_us() + g_config.step_interval_us;
+	int idle = 0;
+
+	while (!g_quit.load(memory_order_relaxed)) {
+		uint64_t n = 0;
+		for (int r = 0; r < receivers; r++) {
+			uint32_t k;
+			while ((k = spsc_pop(&shard->inputs[r], batch, 256)) > 0) {
+				for (uint32_t i = 0; i < k; i++)
+					shard_process(shard, &batch[i]);
+				n += k;
+			}
+		}
+		if (n)
+			shard->samples.fetch_add(n, memory_order_relaxed);
+
+		uint64_t now = monotonic_us();
+		if (now >= next_step) {
+			if (shard->tracker) {
+				if (g_calibrator)
+					shard_calibrate(shard);
+				pf_tracker_step(shard->tracker, now);
+				if (g_snapshot)
+					shard_publish(shard);
+			}
+			shard_expire(shard, now);
+			shard->device_count.store(shard->devices.size(), memory_order_relaxed);
+			next_step = now + g_config.step_interval_us;
+		}
+
+		// Spin briefly on an empty ring before giving the core back
+		if (n)
+			idle = 0;
+		else if (++idle > 64)
+			usleep(100);
+	}
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-l [host]:port] [-r receivers] [-s shards] [-A anchor_file] [-m /name] [-p] [-t seconds]\n"
+	                "  -l  address to listen on (default :47000)\n"
+	                "  -r  receiver threads sharing the port (default 1)\n"
+	                "  -s  shard threads owning the device state (default: remaining CPUs)\n"
+	                "  -A  anchor positions; enables tracking, and calibration\n"
+	                "      of the anchors listed with their MAC\n"
+	                "  -m  publish the position of every tracked device in shared memory /name (needs -A)\n"
+	                "  -p  pin every thread to its own CPU\n"
+	                "  -t  exit after this many seconds\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	g_config.listen = ":47000";
+	g_config.receivers = 1;
+	g_config.shards = 0;
+	g_config.ring_capacity = 1 << 16;
+	g_config.pin = false;
+	g_config.duration = 0;
+	g_config.step_interval_us = 100000;
+	g_config.device_timeout_us = 60 * 1000000ULL;
+	const char *anchor_file = NULL;
+	const char *snapshot = NULL;
+	const uint32_t snapshot_capacity = 1 << 16; // devices
+
+	int opt;
+	while ((opt = getopt(argc, argv, "l:r:s:A:m:pt:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'l': g_config.listen = optarg; break;
+		case 'r': g_config.receivers = atoi(optarg); break;
+		case 's': g_config.shards = atoi(optarg); break;
+		case 'A': anchor_file = optarg; break;
+		case 'm': snapshot = optarg; break;
+		case 'p': g_config.pin = true; break;
+		case 't': g_config.duration = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (g_config.receivers < 1)
+		g_config.receivers = 1;
+	if (g_config.shards < 1)
+		g_config.shards = cpus > g_config.receivers ? (int) cpus - g_config.receivers : 1;
+	if (anchor_file && !load_anchors(anchor_file))
+		return -1;
+	if (snapshot && g_anchors.empty()) {
+		fprintf(stderr, "-m needs anchors (-A) to track positions.\n");
+		return -1;
+	}
+	if (snapshot && !(g_snapshot = snapshot_create(snapshot, snapshot_capacity)))
+		return -1;
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	if (!g_anchor_of_mac.empty()) {
+		struct cal_config cal;
+		cal_default_config(&cal);
+		g_calibrator = cal_create(&cal, &g_anchors[0], (int) g_anchors.size());
+		for (unordered_map<mac_key, int>::const_iterator it = g_anchor_of_mac.begin(); it != g_anchor_of_mac.end(); ++it)
+			cal_set_anchor_mac(g_calibrator, it->second, it->first);
+	}
+
+	// Shards first: receivers push into their rings as soon as they start
+	struct pf_config pf;
+	pf_default_config(&pf);
+	for (int s = 0; s < g_config.shards; s++) {
+		agg_shard *shard = new agg_shard;
+		shard->index = s;
+		shard->inputs = new spsc_ring<agg_item>[g_config.receivers];
+		for (int r = 0; r < g_config.receivers; r++) {
+			if (!spsc_init(&shard->inputs[r], g_config.ring_capacity)) {
+				fprintf(stderr, "Failed to allocate shard queues.\n");
+				return -1;
+			}
+		}
+		shard->tracker = g_anchors.empty() ? NULL : pf_tracker_create(&pf, &g_anchors[0], (int) g_anchors.size(), NULL);
+		if (!spsc_init(&shard->links, 4096) || !spsc_init(&shard->positions, 4096)) {
+			fprintf(stderr, "Failed to allocate shard queues.\n");
+			return -1;
+		}
+		shard->calibration = 0;
+		shard->samples.store(0);
+		shard->device_count.store(0);
+		g_shards.push_back(shard);
+	}
+
+	vector<agg_receiver*> receivers;
+	for (int r = 0; r < g_config.receivers; r++) {
+		agg_receiver *rx = new agg_receiver;
+		rx->index = r;
+		rx->rx = wire_receiver_create(g_config.listen, 8 << 20, g_config.receivers > 1);
+		if (!rx->rx)
+			return -1;
+		rx->staged.resize(g_config.shards);
+		for (int s = 0; s < g_config.shards; s++)
+			rx->staged[s].reserve(WIRE_MAX_RECORDS);
+		rx->dropped.store(0);
+		receivers.push_back(rx);
+	}
+
+	for (int s = 0; s < g_config.shards; s++) {
+		g_shards[s]->worker = thread(shard_main, g_shards[s]);
+		if (g_config.pin)
+			pin_to_cpu(g_shards[s]->worker, g_config.receivers + s);
+	}
+	for (int r = 0; r < g_config.receivers; r++) {
+		receivers[r]->worker = thread(receiver_main, receivers[r]);
+		if (g_config.pin)
+			pin_to_cpu(receivers[r]->worker, r);
+	}
+	printf("Listening on %s with %d receiver(s), %d shard(s), %d anchor(s).\n",
+	       g_config.listen, g_config.receivers, g_config.shards, (int) g_anchors.size());
+
+	// Calibrate and publish every step, and report once a second
+	uint64_t start = monotonic_us(), last_samples = 0;
+	uint64_t next_report = start + 1000000;
+	while (!g_quit.load()) {
+		usleep(g_config.step_interval_us);
+		if (g_calibrator) {
+			agg_link links[256];
+			for (int s = 0; s < g_config.shards; s++) {
+				uint32_t k;
+				while ((k = spsc_pop(&g_shards[s]->links, links, 256)) > 0)
+					for (uint32_t i = 0; i < k; i++)
+						cal_observe(g_calibrator, links[i].rx_id, links[i].tx, links[i].rssi, links[i].received_us);
+			}
+		}
+		if (g_snapshot) {
+			agg_position positions[256];
+			for (int s = 0; s < g_config.shards; s++) {
+				uint32_t k;
+				while ((k = spsc_pop(&g_shards[s]->positions, positions, 256)) > 0)
+					for (uint32_t i = 0; i < k; i++)
+						snapshot_publish_position(g_snapshot, positions[i].mac, positions[i].x, positions[i].y,
+						                          positions[i].timestamp_us);
+			}
+		}
+		if (monotonic_us() < next_report)
+			continue;
+		next_report += 1000000;
+		uint64_t samples = 0, devices = 0, dropped = 0;
+		for (int s = 0; s < g_config.shards; s++) {
+			samples += g_shards[s]->samples.load(memory_order_relaxed);
+			devices += g_shards[s]->device_count.load(memory_order_relaxed);
+		}
+		for (int r = 0; r < g_config.receivers; r++)
+			dropped += receivers[r]->dropped.load(memory_order_relaxed);
+		printf("%llu samples/s, %llu devices, %llu dropped\n", (unsigned long long) (samples - last_samples),
+		       (unsigned long long) devices, (unsigned long long) dropped);
+		fflush(stdout);
+		last_samples = samples;
+		if (g_config.duration && monotonic_us() - start >= (uint64_t) g_config.duration * 1000000)
+			g_quit.store(true);
+	}
+
+	for (int r = 0; r < g_config.receivers; r++) {
+		receivers[r]->worker.join();
+		struct wire_receiver_stats stats;
+		wire_receiver_get_stats(receivers[r]->rx, &stats);
+		printf("Receiver %d: %llu samples in %llu datagrams (%llu recvmmsg), %llu lost, %llu reordered, %llu malformed\n",
+		       r, (unsigned long long) stats.samples, (unsigned long long) stats.datagrams,
+		       (unsigned long long) stats.syscalls, (unsigned long long) stats.lost,
+		       (unsigned long long) stats.reordered, (unsigned long long) stats.malformed);
+		wire_receiver_destroy(receivers[r]->rx);
+		delete receivers[r];
+	}
+	for (int s = 0; s < g_config.shards; s++) {
+		agg_shard *shard = g_shards[s];
+		shard->worker.join();
+		pf_tracker_destroy(shard->tracker);
+		for (int r = 0; r < g_config.receivers; r++)
+			spsc_free(&shard->inputs[r]);
+		spsc_free(&shard->links);
+		spsc_free(&shard->positions);
+		delete[] shard->inputs;
+		delete shard;
+	}
+	for (int i = 0; g_calibrator && i < (int) g_anchors.size(); i++) {
+		struct anchor a;
+		cal_read_anchor(g_calibrator, i, &a);
+		printf("Anchor %d: %.1f dBm at 1 m, exponent %.2f\n", i, a.model.ref_power, a.model.exponent);
+	}
+	cal_destroy(g_calibrator);
+	snapshot_destroy(g_snapshot, true);
+	return 0;
+}
@@ -0,0 +1,276 @@
+//============================================================================
+// Name        : Assignment.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Sparse linear assignment (Hungarian method) for matching
+//               observations to tracks
+//============================================================================
+
+#include "Assignment.h"
+
+#include <float.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+// Cost of a forbidden pair inside a component's dense matrix. Large enough
+// that the solver only uses one when no allowed pair remains
+#define FORBIDDEN 1e9
+
+struct assign_solver {
+	int max_cells;
+
+	// Union-find over rows [0, rows) and columns [rows, rows + cols)
+	vector<int> parent;
+	// Edges grouped by component
+	vector<int> order;
+	vector<int> comp_of_edge;
+	// Local numbering inside the component being solved
+	vector<int> local_row, local_col;
+	vector<int> rows_of, cols_of;
+	// Dense matrix and Hungarian potentials
+	vector<double> cost;
+	vector<double> u, v, minv;
+	vector<int> p, way;
+	vector<char> used;
+	// Columns taken by the greedy fallback
+	vector<char> taken;
+};
+
+struct assign_solver *assign_solver_create(int max_cells)
+{
+	assign_solver *solver = new assign_solver;
+	solver->max_cells = max_cells > 0 ? max_cells : 256 * 256;
+	return solver;
+}
+
+void assign_solver_destroy(struct assign_solver *solver)
+{
+	delete solver;
+}
+
+static int find(vector<int> &parent, int x)
+{
+	while (parent[x] != x) {
+		parent[x] = parent[parent[x]];
+		x = parent[x];
+	}
+	return x;
+}
+
+// Shortest augmenting path Hungarian method on an n x m matrix, n <= m,
+// 1-based internally. Leaves the column matched to every row in p
+static void hungarian(assign_solver *s, int n, int m)
+{
+	s->u.assign(n + 1, 0.0);
+	s->v.assign(m + 1, 0.0);
+	s->p.assign(m + 1, 0);
+	s->way.assign(m + 1, 0);
+	const double *a = &s->cost[0];
+
+	for (int i = 1; i <= n; i++) {
+		s->p[0] = i;
+		int j0 = 0;
+		s->minv.assign(m + 1, DBL_MAX);
+		s->used.assign(m + 1, 0);
+		do {
+			s->used[j0] = 1;
+			int i0 = s->p[j0], j1 = 0;
+			double delta = DBL_MAX;
+			for (int j = 1; j <= m; j++) {
+				if (s->used[j])
+					continue;
+				double cur = a[(i0 - 1) * m + (j - 1)] - s->u[i0] - s->v[j];
+				if (cur < s->minv[j]) {
+					s->minv[j] = cur;
+					s->way[j] = j0;
+				}
+				if (s->minv[j] < delta) {
+					delta = s->minv[j];
+					j1 = j;
+				}
+			}
+			for (int j = 0; j <= m; j++) {
+				if (s->used[j]) {
+					s->u[s->p[j]] += delta;
+					s->v[j] -= delta;
+				} else {
+					s->minv[j] -= delta;
+				}
+			}
+			j0 = j1;
+		} while (s->p[j0] != 0);
+		do {
+			int j1 = s->way[j0];
+			s->p[j0] = s->p[j1];
+			j0 = j1;
+		} while (j0);
+	}
+}
+
+struct edge_by_cost {
+	const assign_edge *edges;
+	bool operator()(int a, int b) const
+	{
+		return edges[a].cost < edges[b].cost;
+	}
+};
+
+static int solve_greedy(assign_solver *s, const assign_edge *edges, int *first, int *last,
+                        int *row_to_col)
+{
+	edge_by_cost less = { edges };
+	sort(first, last, less);
+	int assigned = 0;
+	for (int *e = first; e != last; e++) {
+		const assign_edge *edge = &edges[*e];
+		if (row_to_col[edge->row] < 0 && !s->taken[edge->col]) {
+			row_to_col[edge->row] = edge->col;
+			s->taken[edge->col] = 1;
+			assigned++;
+		}
+	}
+	return assigned;
+}
+
+static int solve_exact(assign_solver *s, const assign_edge *edges, int *first, int *last,
+                       int *row_to_col)
+{
+	// Number the component's rows and columns locally
+	s->rows_of.clear();
+	s->cols_of.clear();
+	for (int *e = first; e != last; e++) {
+		const assign_edge *edge = &edges[*e];
+		if (s->local_row[edge->row] < 0) {
+			s->local_row[edge->row] = (int) s->rows_of.size();
+			s->rows_of.push_back(edge->row);
+		}
+		if (s->local_col[edge->col] < 0) {
+			s->local_col[edge->col] = (int) s->cols_of.size();
+			s->cols_of.push_back(edge->col);
+		}
+	}
+
+	// The method wants no more rows than columns; transpose if needed
+	const bool transpose = s->rows_of.size() > s->cols_of.size();
+	const int n = (int) (transpose ? s->cols_of.size() : s->rows_of.size());
+	const int m = (int) (transpose ? s->rows_of.size() : s->cols_of.size());
+	s->cost.assign((size_t) n * m, FORBIDDEN);
+	for (int *e = first; e != last; e++) {
+		const assign_edge *edge = &edges[*e];
+		int r = s->local_row[edge->row], c = s->local_col[edge->col];
+		double *cell = transpose ? &s->cost[(size_t) c * m + r] : &s->cost[(size_t) r * m + c];
+		if (edge->cost < *cell)
+			*cell = edge->cost;
+	}
+
+	hungarian(s, n, m);
+
+	int assigned = 0;
+	for (int j = 1; j <= m; j++) {
+		int i = s->p[j];
+		if (!i || s->cost[(size_t) (i - 1) * m + (j - 1)] >= FORBIDDEN)
+			continue;
+		int r = transpose ? j - 1 : i - 1;
+		int c = transpose ? i - 1 : j - 1;
+		row_to_col[s->rows_of[r]] = s->cols_of[c];
+		assigned++;
+	}
+
+	for (size_t i = 0; i < s->rows_of.size(); i++)
+		s->local_row[s->rows_of[i]] = -1;
+	for (size_t i = 0; i < s->cols_of.size(); i++)
+		s->local_col[s->cols_of[i]] = -1;
+	return assigned;
+}
+
+struct edge_by_component {
+	const int *comp;
+	bool operator()(int a, int b) const
+	{
+		return comp[a] < comp[b];
+	}
+};
+
+int assign_solve(struct assign_solver *s, const struct assign_edge *edges, int edge_count,
+                 int rows, int cols, int *row_to_col, struct assign_stats *stats)
+{
+	for (int i = 0; i < rows; i++)
+		row_to_col[i] = -1;
+	if (stats)
+		memset(stats, 0, sizeof(*stats));
+	if (edge_count <= 0)
+		return 0;
+
+	s->parent.resize(rows + cols);
+	for (int i = 0; i < rows + cols; i++)
+		s->parent[i] = i;
+	for (int e = 0; e < edge_count; e++) {
+		int a = find(s->parent, edges[e].row), b = find(s->parent, rows + edges[e].col);
+		if (a != b)
+			s->parent[a] = b;
+	}
+
+	s->order.resize(edge_count);
+	s->comp_of_edge.resize(edge_count);
+	for (int e = 0; e < edge_count; e++) {
+		s->order[e] = e;
+		s->comp_of_edge[e] = find(s->parent, edges[e].row);
+	}
+	edge_by_component by_comp = { &s->comp_of_edge[0] };
+	sort(s->order.begin(), s->order.end(), by_comp);
+
+	s->local_row.assign(rows, -1);
+	s->local_col.assign(cols, -1);
+	s->taken.assign(cols, 0);
+
+	int assigned = 0;
+	for (int begin = 0; begin < edge_count; ) {
+		int end = begin + 1;
+		while (end < edge_count && s->comp_of_edge[s->order[end]] == s->comp_of_edge[s->order[begin]])
+			end++;
+		int *first = &s->order[0] + begin, *last = &s->order[0] + end;
+
+		if (end - begin == 1) {
+			// By far the common case: an isolated track and observation
+			row_to_col[edges[*first].row] = edges[*first].col;
+			assigned++;
+		} else {
+			// Size the component from its distinct rows and columns
+			int r = 0, c = 0;
+			for (int *e = first; e != last; e++) {
+				if (s->local_row[edges[*e].row] < 0) {
+					s->local_row[edges[*e].row] = 0;
+					r++;
+				}
+				if (s->local_col[edges[*e].col] < 0) {
+					s->local_col[edges[*e].col] = 0;
+					c++;
+				}
+			}
+			for (int *e = first; e != last; e++) {
+				s->local_row[edges[*e].row] = -1;
+				s->local_col[edges[*e].col] = -1;
+			}
+
+			if (stats && r + c > stats->largest)
+				stats->largest = r + c;
+			if ((long) r * c <= s->max_cells) {
+				assigned += solve_exact(s, edges, first, last, row_to_col);
+			} else {
+				assigned += solve_greedy(s, edges, first, last, row_to_col);
+				if (stats)
+					stats->greedy++;
+			}
+		}
+		if (stats) {
+			stats->components++;
+			if (end - begin == 1 && stats->largest < 2)
+				stats->largest = 2;
+		}
+		begin = end;
+	}
+	return assigned;
+}
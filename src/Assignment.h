@@ -0,0 +1,39 @@
+//============================================================================
+// Name        : Assignment.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Sparse linear assignment (Hungarian method) for matching
+//               observations to tracks
+//============================================================================
+
+#ifndef RADIOLOCATE_ASSIGNMENT_H
+#define RADIOLOCATE_ASSIGNMENT_H
+
+// An allowed pairing; pairs that aren't listed are forbidden
+struct assign_edge {
+	int row, col;
+	float cost;
+};
+
+struct assign_stats {
+	int components;       // independent sub-problems the edges fell into
+	int largest;          // rows + cols of the largest one
+	int greedy;           // components too large for the exact solver
+};
+
+struct assign_solver;
+
+// Components with more than max_cells entries in their dense cost matrix
+// are matched greedily instead, which bounds the worst-case cost of a cycle
+struct assign_solver *assign_solver_create(int max_cells);
+void assign_solver_destroy(struct assign_solver *solver);
+
+// Finds the assignment of rows to columns that uses as many allowed pairs
+// as possible and, among those, has the least total cost. row_to_col
+// receives the column of every row or -1. Gated tracking problems are very
+// sparse, so the edges are first split into connected components and each
+// is solved on its own, O(k^3) in its size k rather than in rows + cols.
+// The solver keeps its scratch memory between calls. Returns pairs assigned
+int assign_solve(struct assign_solver *solver, const struct assign_edge *edges, int edge_count,
+                 int rows, int cols, int *row_to_col, struct assign_stats *stats);
+
+#endif // RADIOLOCATE_ASSIGNMENT_H
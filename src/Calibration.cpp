@@ -0,0 +1,200 @@
+//============================================================================
+// Name        : Calibration.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Online path-loss calibration from anchor-to-anchor RSSI
+//============================================================================
+
+#include "Calibration.h"
+#include "Seqlock.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// What readers see. Kept separate from the RLS state so that the
+// estimator can move freely between publishes
+struct cal_published {
+	struct seqlock lock;
+	struct path_loss_model model;
+};
+
+// Two-parameter RLS state; P is symmetric so three numbers suffice
+struct cal_rls {
+	double ref, exp;
+	double p00, p01, p11;
+};
+
+struct calibrator {
+	cal_config config;
+	vector<anchor> anchors;            // positions are fixed
+	vector<cal_rls> rls;
+	vector<path_loss_model> last;      // last published, writer's copy
+	cal_published *published;
+	vector<uint64_t> link_last_us;     // anchors * anchors
+	unordered_map<mac_key, int> by_mac;
+	uint32_t generation;
+};
+
+void cal_default_config(struct cal_config *config)
+{
+	config->forgetting = 0.999f;
+	config->max_residual = 20.0f;
+	config->min_exponent = 1.5f;
+	config->max_exponent = 6.0f;
+	config->publish_ref_step = 0.25f;
+	config->publish_exp_step = 0.02f;
+	config->link_interval_us = 1000000;
+}
+
+struct calibrator *cal_create(const struct cal_config *config, const struct anchor *anchors, int anchor_count)
+{
+	if (anchor_count <= 0 || config->forgetting <= 0.0f || config->forgetting > 1.0f)
+		return NULL;
+
+	calibrator *cal = new calibrator;
+	cal->config = *config;
+	cal->anchors.assign(anchors, anchors + anchor_count);
+	cal->rls.resize(anchor_count);
+	cal->last.resize(anchor_count);
+	cal->published = new cal_published[anchor_count];
+	cal->link_last_us.assign((size_t) anchor_count * anchor_count, 0);
+	cal->generation = 0;
+
+	for (int i = 0; i < anchor_count; i++) {
+		cal_rls *r = &cal->rls[i];
+		r->ref = anchors[i].model.ref_power;
+		r->exp = anchors[i].model.exponent;
+		// Survey values are a guess within about +-10 dB and +-1
+		r->p00 = 100.0;
+		r->p01 = 0.0;
+		r->p11 = 1.0;
+		cal->last[i] = anchors[i].model;
+		seqlock_init(&cal->published[i].lock);
+		cal->published[i].model = anchors[i].model;
+	}
+	return cal;
+}
+
+void cal_destroy(struct calibrator *cal)
+{
+	if (!cal)
+		return;
+	delete[] cal->published;
+	delete cal;
+}
+
+bool cal_set_anchor_mac(struct calibrator *cal, int anchor_id, mac_key mac)
+{
+	if (anchor_id < 0 || anchor_id >= (int) cal->anchors.size())
+		return false;
+	cal->by_mac[mac] = anchor_id;
+	return true;
+}
+
+static void publish(calibrator *cal, int id, const path_loss_model *model)
+{
+	cal_published *p = &cal->published[id];
+	seqlock_write_begin(&p->lock);
+	seqlock_store_words(&p->model, model, sizeof(*model));
+	seqlock_write_end(&p->lock);
+	cal->last[id] = *model;
+	__atomic_store_n(&cal->generation, cal->generation + 1, __ATOMIC_RELEASE);
+}
+
+bool cal_observe(struct calibrator *cal, int rx_id, mac_key tx, float rssi, uint64_t timestamp_us)
+{
+	const int n = (int) cal->anchors.size();
+	if (rx_id < 0 || rx_id >= n)
+		return false;
+	unordered_map<mac_key, int>::const_iterator it = cal->by_mac.find(tx);
+	if (it == cal->by_mac.end() || it->second == rx_id)
+		return false;
+	const int tx_id = it->second;
+
+	// Anchors hear each other constantly; consecutive readings of a static
+	// link are nearly identical and would only let that link dominate. An
+	// out-of-order timestamp is dropped too rather than wrapping around
+	uint64_t *last = &cal->link_last_us[(size_t) rx_id * n + tx_id];
+	if (*last && timestamp_us < *last + cal->config.link_interval_us)
+		return false;
+	*last = timestamp_us;
+
+	const anchor *a = &cal->anchors[rx_id], *b = &cal->anchors[tx_id];
+	const double dx = a->x - b->x, dy = a->y - b->y;
+	const double d2 = dx * dx + dy * dy;
+	if (d2 < 1.0)
+		return false;
+
+	// Regressor phi = [1, -10 log10(d)]
+	cal_rls *r = &cal->rls[rx_id];
+	const double lambda = cal->config.forgetting;
+	const double h = -5.0 * log10(d2);
+	const double residual = rssi - (r->ref + r->exp * h);
+	if (fabs(residual) > cal->config.max_residual)
+		return false;
+
+	// k = P phi / (lambda + phi' P phi)
+	const double pp0 = r->p00 + r->p01 * h;
+	const double pp1 = r->p01 + r->p11 * h;
+	const double denom = lambda + pp0 + pp1 * h;
+	const double k0 = pp0 / denom, k1 = pp1 / denom;
+
+	r->ref += k0 * residual;
+	r->exp += k1 * residual;
+
+	// P = (P - k phi' P) / lambda
+	r->p00 = (r->p00 - k0 * pp0) / lambda;
+	r->p01 = (r->p01 - k0 * pp1) / lambda;
+	r->p11 = (r->p11 - k1 * pp1) / lambda;
+
+	// With forgetting, P grows without bound on a link that carries no new
+	// information (e.g. all neighbours at one distance). Cap it at the prior
+	if (r->p00 > 100.0 || r->p11 > 1.0) {
+		double s = fmax(r->p00 / 100.0, r->p11 / 1.0);
+		r->p00 /= s;
+		r->p01 /= s;
+		r->p11 /= s;
+	}
+	if (r->exp < cal->config.min_exponent)
+		r->exp = cal->config.min_exponent;
+	else if (r->exp > cal->config.max_exponent)
+		r->exp = cal->config.max_exponent;
+
+	// Publishing invalidates downstream caches, so only do it for changes
+	// that matter
+	const path_loss_model *old = &cal->last[rx_id];
+	if (fabs(r->ref - old->ref_power) < cal->config.publish_ref_step &&
+	    fabs(r->exp - old->exponent) < cal->config.publish_exp_step)
+		return false;
+
+	path_loss_model model = { (float) r->ref, (float) r->exp };
+	publish(cal, rx_id, &model);
+	return true;
+}
+
+bool cal_read_anchor(const struct calibrator *cal, int anchor_id, struct anchor *a)
+{
+	if (anchor_id < 0 || anchor_id >= (int) cal->anchors.size())
+		return false;
+
+	const cal_published *p = &cal->published[anchor_id];
+	path_loss_model model;
+	uint32_t seq;
+	do {
+		seq = seqlock_read_begin(&p->lock);
+		seqlock_load_words(&model, &p->model, sizeof(model));
+	} while (seqlock_read_retry(&p->lock, seq));
+
+	*a = cal->anchors[anchor_id];
+	a->model = model;
+	return true;
+}
+
+uint32_t cal_generation(const struct calibrator *cal)
+{
+	return __atomic_load_n(&cal->generation, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,55 @@
+//============================================================================
+// Name        : Calibration.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Online path-loss calibration from anchor-to-anchor RSSI
+//============================================================================
+
+#ifndef RADIOLOCATE_CALIBRATION_H
+#define RADIOLOCATE_CALIBRATION_H
+
+#include <stdint.h>
+
+#include "Mac.h"
+#include "PathLoss.h"
+
+// Anchors hear each other through the same GET_STATION/GET_SCAN paths as
+// any other device, at distances we know from the site survey. Every such
+// reading is one sample of the receiving anchor's path-loss line
+//     rssi = ref_power - exponent * 10 log10(d)
+// which we fit with a two-parameter recursive least squares filter.
+struct cal_config {
+	float forgetting;        // RLS forgetting factor, e.g. 0.999 (~1000 sample memory)
+	float max_residual;      // dB, readings further off the current fit are ignored
+	float min_exponent;      // the fit is clamped to physically sensible values
+	float max_exponent;
+	float publish_ref_step;  // dB, smallest reference power change worth publishing
+	float publish_exp_step;  // smallest exponent change worth publishing
+	uint64_t link_interval_us; // per anchor pair, readings closer than this are dropped
+};
+
+void cal_default_config(struct cal_config *config);
+
+struct calibrator;
+
+// anchors holds the surveyed positions and the initial calibration
+struct calibrator *cal_create(const struct cal_config *config, const struct anchor *anchors, int anchor_count);
+void cal_destroy(struct calibrator *cal);
+
+// Registers the MAC an anchor transmits with, so its readings can be recognised
+bool cal_set_anchor_mac(struct calibrator *cal, int anchor_id, mac_key mac);
+
+// Feeds one reading taken by anchor rx_id. Readings of devices that aren't
+// anchors are rejected with a single hash lookup, so every reading can be
+// passed through here. Constant cost per reading; never blocks readers.
+// Returns true if it published a new calibration.
+// Single writer: call from one thread only
+bool cal_observe(struct calibrator *cal, int rx_id, mac_key tx, float rssi, uint64_t timestamp_us);
+
+// Lock-free, callable from any thread while cal_observe() runs
+bool cal_read_anchor(const struct calibrator *cal, int anchor_id, struct anchor *a);
+
+// Bumped on every publish; consumers compare it with the value they last
+// applied to decide whether to re-read the anchors
+uint32_t cal_generation(const struct calibrator *cal);
+
+#endif // RADIOLOCATE_CALIBRATION_H
@@ -0,0 +1,232 @@
+//============================================================================
+// Name        : ChannelHopper.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Traffic-weighted channel hopping
+//============================================================================
+
+#include "ChannelHopper.h"
+#include "Nl80211Messages.h"
+#include "nl80211.h"
+
+#include <string.h>
+
+#include <vector>
+
+using namespace std;
+
+// Room for one SET_CHANNEL request: header, genl header, three u32s
+#define HOP_MSG_SIZE 64
+
+struct ch_channel {
+	uint32_t frequency;
+	size_t msg;            // offset of its request in messages
+	uint64_t dwell_us;     // of the current cycle
+	uint64_t listened_us, switched_us;
+	uint64_t visits;
+	uint64_t frames, target_frames;
+	float frame_rate, target_rate;
+	float share;
+};
+
+struct channel_hopper {
+	ch_config config;
+	vector<uint8_t> messages;
+	vector<ch_channel> channels;
+	uint32_t current;
+	bool started;
+	bool switching;
+	bool listening;        // the last switch succeeded
+	uint64_t since_us;     // the switch or the dwell began
+	uint64_t deadline_us;
+	// Heard during the current dwell
+	uint32_t frames, target_frames;
+	ch_stats stats;
+};
+
+void ch_default_config(struct ch_config *config)
+{
+	config->cycle_us = 1000000;
+	config->min_dwell_us = 20000;
+	config->explore = 0.2f;
+	config->target_weight = 10.0f;
+	config->smoothing = 0.25f;
+	config->channel_type = NL80211_CHAN_HT20;
+}
+
+/************
+ *  Shares  *
+ ************/
+// At the start of every cycle: each channel gets its even part of the
+// explored share plus the rest in proportion to what it was worth
+static void plan_cycle(channel_hopper *hopper)
+{
+	const ch_config &c = hopper->config;
+	const size_t n = hopper->channels.size();
+	float total = 0.0f;
+	for (size_t i = 0; i < n; i++) {
+		const ch_channel *ch = &hopper->channels[i];
+		total += ch->frame_rate + c.target_weight * ch->target_rate;
+	}
+	for (size_t i = 0; i < n; i++) {
+		ch_channel *ch = &hopper->channels[i];
+		const float worth = ch->frame_rate + c.target_weight * ch->target_rate;
+		const float earned = total > 0.0f ? worth / total : 1.0f / n;
+		ch->share = c.explore / n + (1.0f - c.explore) * earned;
+		ch->dwell_us = (uint64_t) (ch->share * c.cycle_us);
+		if (ch->dwell_us < c.min_dwell_us)
+			ch->dwell_us = c.min_dwell_us;
+	}
+}
+
+struct channel_hopper *ch_create(const struct ch_config *config, uint16_t family, uint32_t ifindex,
+                                 const uint32_t *freqs, int count)
+{
+	if (count <= 0)
+		return NULL;
+	channel_hopper *hopper = new channel_hopper;
+	hopper->config = *config;
+	hopper->messages.resize((size_t) count * HOP_MSG_SIZE);
+	hopper->channels.resize(count);
+
+	rnl_buffer buf;
+	rnl_buffer_init(&buf, hopper->messages.data(), hopper->messages.size());
+	for (int i = 0; i < count; i++) {
+		ch_channel *ch = &hopper->channels[i];
+		memset(ch, 0, sizeof(*ch));
+		ch->frequency = freqs[i];
+		ch->msg = rnl80211_set_channel(&buf, family, 0, ifindex, freqs[i], config->channel_type);
+		if (ch->msg == RNL_NO_MSG) {
+			delete hopper;
+			return NULL;
+		}
+	}
+	hopper->current = count - 1; // so that the first hop is to the first channel
+	hopper->started = false;
+	hopper->switching = false;
+	hopper->listening = false;
+	hopper->since_us = 0;
+	hopper->deadline_us = 0;
+	hopper->frames = hopper->target_frames = 0;
+	memset(&hopper->stats, 0, sizeof(hopper->stats));
+	plan_cycle(hopper);
+	return hopper;
+}
+
+void ch_destroy(struct channel_hopper *hopper)
+{
+	delete hopper;
+}
+
+/*************
+ *  Hopping  *
+ *************/
+// Credits the dwell that ends at now_us to its channel
+static void end_dwell(channel_hopper *hopper, uint64_t now_us)
+{
+	ch_channel *ch = &hopper->channels[hopper->current];
+	const uint64_t listened = now_us - hopper->since_us;
+	ch->listened_us += listened;
+	hopper->stats.dwell_us += listened;
+	if (listened) {
+		const float alpha = ch->visits > 1 ? hopper->config.smoothing : 1.0f;
+		const float seconds = listened * 1e-6f;
+		ch->frame_rate += alpha * (hopper->frames / seconds - ch->frame_rate);
+		ch->target_rate += alpha * (hopper->target_frames / seconds - ch->target_rate);
+	}
+	hopper->frames = hopper->target_frames = 0;
+}
+
+const struct nlmsghdr *ch_next(struct channel_hopper *hopper, uint64_t now_us)
+{
+	if (hopper->switching || (hopper->started && now_us < hopper->deadline_us))
+		return NULL;
+	if (hopper->listening)
+		end_dwell(hopper, now_us);
+	hopper->started = true;
+	hopper->listening = false;
+	hopper->switching = true;
+	hopper->since_us = now_us;
+	if (++hopper->current == hopper->channels.size()) {
+		hopper->current = 0;
+		plan_cycle(hopper);
+	}
+	hopper->stats.hops++;
+	return (const struct nlmsghdr*) (hopper->messages.data() + hopper->channels[hopper->current].msg);
+}
+
+uint64_t ch_deadline(const struct channel_hopper *hopper)
+{
+	if (hopper->switching)
+		return UINT64_MAX;
+	return hopper->started ? hopper->deadline_us : 0;
+}
+
+void ch_switched(struct channel_hopper *hopper, uint64_t now_us, int error)
+{
+	if (!hopper->switching)
+		return;
+	ch_channel *ch = &hopper->channels[hopper->current];
+	const uint64_t took = now_us - hopper->since_us;
+	ch->switched_us += took;
+	hopper->stats.switch_us += took;
+	hopper->switching = false;
+	hopper->since_us = now_us;
+	// On failure the radio stays wherever it was: sit the dwell out deaf
+	// rather than credit this channel with another's frames
+	if (error)
+		hopper->stats.failures++;
+	else {
+		ch->visits++;
+		hopper->listening = true;
+	}
+	hopper->deadline_us = now_us + ch->dwell_us;
+}
+
+void ch_heard(struct channel_hopper *hopper, uint32_t frames, uint32_t target_frames)
+{
+	if (!hopper->listening)
+		return;
+	ch_channel *ch = &hopper->channels[hopper->current];
+	hopper->frames += frames;
+	hopper->target_frames += target_frames;
+	ch->frames += frames;
+	ch->target_frames += target_frames;
+	hopper->stats.frames += frames;
+	hopper->stats.target_frames += target_frames;
+}
+
+uint32_t ch_current(const struct channel_hopper *hopper)
+{
+	return hopper->listening ? hopper->channels[hopper->current].frequency : 0;
+}
+
+/***********
+ *  Stats  *
+ ***********/
+int ch_get_channel_stats(const struct channel_hopper *hopper, struct ch_channel_stats *channels, int max)
+{
+	const float elapsed = (float) (hopper->stats.dwell_us + hopper->stats.switch_us);
+	int n = 0;
+	for (; n < max && n < (int) hopper->channels.size(); n++) {
+		const ch_channel *ch = &hopper->channels[n];
+		ch_channel_stats *out = &channels[n];
+		out->frequency = ch->frequency;
+		out->visits = ch->visits;
+		out->dwell_us = ch->listened_us;
+		out->switch_us = ch->switched_us;
+		out->frames = ch->frames;
+		out->target_frames = ch->target_frames;
+		out->frame_rate = ch->frame_rate;
+		out->target_rate = ch->target_rate;
+		out->share = ch->share;
+		const uint64_t spent = ch->listened_us + ch->switched_us;
+		out->frames_per_us = spent ? (float) ch->frames / spent : 0.0f;
+		out->coverage = elapsed > 0.0f ? ch->listened_us / elapsed : 0.0f;
+	}
+	return n;
+}
+
+void ch_get_stats(const struct channel_hopper *hopper, struct ch_stats *stats)
+{
+	*stats = hopper->stats;
+}
@@ -0,0 +1,83 @@
+//============================================================================
+// Name        : ChannelHopper.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Hops a monitor interface across channels, dwelling on each
+//               in proportion to the traffic and tracked targets heard there
+//               and keeping a share of every cycle for the quiet ones. The
+//               SET_CHANNEL requests are built once up front; this decides
+//               when to send which and leaves the sending to the caller
+//============================================================================
+
+#ifndef RADIOLOCATE_CHANNELHOPPER_H
+#define RADIOLOCATE_CHANNELHOPPER_H
+
+#include <stdint.h>
+
+#include "NetlinkMessage.h"
+
+struct ch_config {
+	uint64_t cycle_us;     // one round of every channel, switching excluded
+	uint64_t min_dwell_us; // shortest dwell on any channel
+	float explore;         // share of the cycle spread evenly over all channels
+	float target_weight;   // a frame of a tracked target counts as this many frames
+	float smoothing;       // weight of the latest dwell in a channel's rates
+	uint32_t channel_type; // enum nl80211_channel_type to tune with
+};
+
+void ch_default_config(struct ch_config *config);
+
+struct ch_channel_stats {
+	uint32_t frequency;    // MHz
+	uint64_t visits;
+	uint64_t dwell_us;     // listening
+	uint64_t switch_us;    // switching to it, deaf meanwhile
+	uint64_t frames;
+	uint64_t target_frames;
+	float frame_rate;      // per second of listening, smoothed
+	float target_rate;
+	float share;           // of the cycle it gets now
+	// Frames heard per microsecond spent on the channel, switching included
+	float frames_per_us;
+	// Of all the time spent hopping, the part listening here: about the
+	// share of the channel's traffic captured
+	float coverage;
+};
+
+struct ch_stats {
+	uint64_t hops;
+	uint64_t failures;     // SET_CHANNEL requests the kernel refused
+	uint64_t dwell_us;
+	uint64_t switch_us;
+	uint64_t frames;
+	uint64_t target_frames;
+};
+
+struct channel_hopper;
+
+// Hops the interface over the count frequencies (MHz), in the order given.
+// family is nl80211's generic netlink family id
+struct channel_hopper *ch_create(const struct ch_config *config, uint16_t family, uint32_t ifindex,
+                                 const uint32_t *freqs, int count);
+void ch_destroy(struct channel_hopper *hopper);
+
+// The SET_CHANNEL request to submit now (rnl_conn_submit() fills in the
+// sequence number) if the dwell on the current channel has ended by
+// now_us, else NULL. The first call always hops
+const struct nlmsghdr *ch_next(struct channel_hopper *hopper, uint64_t now_us);
+// When ch_next() hops next; UINT64_MAX while a switch is in flight
+uint64_t ch_deadline(const struct channel_hopper *hopper);
+// The SET_CHANNEL request finished at now_us: 0, or a negative errno. The
+// dwell starts now
+void ch_switched(struct channel_hopper *hopper, uint64_t now_us, int error);
+
+// Frames captured, and how many of them came from tracked targets. They
+// count for the channel being listened to; none is while switching
+void ch_heard(struct channel_hopper *hopper, uint32_t frames, uint32_t target_frames);
+// Frequency being listened to, 0 while switching
+uint32_t ch_current(const struct channel_hopper *hopper);
+
+// Fills up to max channels, in hopping order, and returns how many
+int ch_get_channel_stats(const struct channel_hopper *hopper, struct ch_channel_stats *channels, int max);
+void ch_get_stats(const struct channel_hopper *hopper, struct ch_stats *stats);
+
+#endif // RADIOLOCATE_CHANNELHOPPER_H
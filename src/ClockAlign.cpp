@@ -0,0 +1,173 @@
+//============================================================================
+// Name        : ClockAlign.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Online TSF-against-monotonic regression per access point
+//============================================================================
+
+#include "ClockAlign.h"
+
+#include <math.h>
+
+#include <unordered_map>
+
+using namespace std;
+
+// Exponentially weighted least squares kept as means and co-moments
+// (Welford's update with forgetting) rather than raw sums: the times are
+// large and close together, and sums of their squares would cancel away
+// the slope. Both axes are taken relative to the first observation
+struct ca_reference {
+	uint64_t local0, tsf0; // origin
+	uint64_t last_tsf;
+	double weight;         // sum of weights
+	double mean_x, mean_y;
+	double cxx, cxy, cyy;  // weighted co-moments
+	uint32_t points;
+	uint32_t resets;
+};
+
+struct clock_align {
+	ca_config config;
+	unordered_map<mac_key, ca_reference> refs;
+};
+
+void ca_default_config(struct ca_config *config)
+{
+	config->forget = 0.99;
+	config->reset_us = 100000;
+	config->min_points = 8;
+}
+
+struct clock_align *ca_create(const struct ca_config *config)
+{
+	clock_align *align = new clock_align;
+	align->config = *config;
+	return align;
+}
+
+void ca_destroy(struct clock_align *align)
+{
+	delete align;
+}
+
+/*************
+ *  The fit  *
+ *************/
+static void restart(ca_reference *ref, uint64_t local_us, uint64_t tsf_us)
+{
+	ref->local0 = local_us;
+	ref->tsf0 = tsf_us;
+	ref->weight = 0.0;
+	ref->mean_x = ref->mean_y = 0.0;
+	ref->cxx = ref->cxy = ref->cyy = 0.0;
+	ref->points = 0;
+}
+
+static inline double slope_of(const ca_reference *ref)
+{
+	return ref->cxx > 0.0 ? ref->cxy / ref->cxx : 1.0;
+}
+
+static inline double predict(const ca_reference *ref, double x)
+{
+	return ref->mean_y + slope_of(ref) * (x - ref->mean_x);
+}
+
+bool ca_observe(struct clock_align *align, const struct rnl80211_bss *bss, uint64_t read_us)
+{
+	if (!bss->tsf)
+		return false;
+	// When the result was received, to the millisecond the kernel reports.
+	// The age is rounded down, so the middle of that millisecond; the fit
+	// averages out the rest
+	const uint64_t local_us = read_us - (uint64_t) bss->seen_ms_ago * 1000 - 500;
+
+	pair<unordered_map<mac_key, ca_reference>::iterator, bool> it =
+			align->refs.insert(make_pair(bss->bssid, ca_reference()));
+	ca_reference *ref = &it.first->second;
+	if (it.second) {
+		restart(ref, local_us, bss->tsf);
+		ref->resets = 0;
+	} else if (bss->tsf == ref->last_tsf)
+		// Not heard since the last scan: the same beacon again
+		return false;
+	ref->last_tsf = bss->tsf;
+
+	double x = (double) (int64_t) (local_us - ref->local0);
+	double y = (double) (int64_t) (bss->tsf - ref->tsf0);
+	if (ref->points >= 2 && fabs(y - predict(ref, x)) > align->config.reset_us) {
+		// The AP restarted or jumped its TSF: start over from here
+		restart(ref, local_us, bss->tsf);
+		ref->resets++;
+		x = y = 0.0;
+	}
+
+	const double lambda = align->config.forget;
+	ref->weight = lambda * ref->weight + 1.0;
+	const double dx = x - ref->mean_x, dy = y - ref->mean_y;
+	ref->mean_x += dx / ref->weight;
+	ref->mean_y += dy / ref->weight;
+	ref->cxx = lambda * ref->cxx + dx * (x - ref->mean_x);
+	ref->cxy = lambda * ref->cxy + dx * (y - ref->mean_y);
+	ref->cyy = lambda * ref->cyy + dy * (y - ref->mean_y);
+	ref->points++;
+	return true;
+}
+
+/***************
+ *  Estimates  *
+ ***************/
+static void estimate_of(mac_key bssid, const ca_reference *ref, ca_estimate *estimate)
+{
+	const double slope = slope_of(ref);
+	double scatter = ref->cxx > 0.0 ? ref->cyy - slope * ref->cxy : ref->cyy;
+	if (scatter < 0.0)
+		scatter = 0.0;
+	estimate->bssid = bssid;
+	// At the weighted mean of the observations
+	estimate->offset_us = (double) (int64_t) (ref->tsf0 - ref->local0) + ref->mean_y - ref->mean_x;
+	estimate->drift_ppm = (slope - 1.0) * 1e6;
+	estimate->residual_us = ref->weight > 0.0 ? sqrt(scatter / ref->weight) : 0.0;
+	estimate->points = ref->points;
+	estimate->resets = ref->resets;
+}
+
+bool ca_get(const struct clock_align *align, mac_key bssid, struct ca_estimate *estimate)
+{
+	unordered_map<mac_key, ca_reference>::const_iterator it = align->refs.find(bssid);
+	if (it == align->refs.end())
+		return false;
+	estimate_of(bssid, &it->second, estimate);
+	return true;
+}
+
+bool ca_get_mapping(const struct clock_align *align, mac_key bssid, struct ca_mapping *map)
+{
+	const ca_reference *best = NULL;
+	double best_residual = 0.0;
+	for (unordered_map<mac_key, ca_reference>::const_iterator it = align->refs.begin(); it != align->refs.end(); ++it) {
+		if (it->second.points < align->config.min_points || (bssid && it->first != bssid))
+			continue;
+		ca_estimate estimate;
+		estimate_of(it->first, &it->second, &estimate);
+		if (!best || estimate.residual_us < best_residual) {
+			best = &it->second;
+			best_residual = estimate.residual_us;
+			map->bssid = it->first;
+		}
+	}
+	if (!best)
+		return false;
+	// Anchored at the weighted mean of the observations, where the fitted
+	// line is most certain
+	map->local_us = best->local0 + (int64_t) llround(best->mean_x);
+	map->tsf_us = best->tsf0 + (int64_t) llround(predict(best, (double) (int64_t) (map->local_us - best->local0)));
+	map->drift_q32 = llround((slope_of(best) - 1.0) * 4294967296.0);
+	return true;
+}
+
+void ca_retime(const struct ca_mapping *map, struct rl_sample *samples, int count)
+{
+	for (int i = 0; i < count; i++)
+		samples[i].timestamp_us = ca_to_tsf(map, samples[i].timestamp_us);
+}
@@ -0,0 +1,70 @@
+//============================================================================
+// Name        : ClockAlign.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Aligns a sensor's monotonic clock with the TSF clock of
+//               the access points it hears. Every sensor that hears the
+//               same AP can then put its samples on that AP's timeline,
+//               whatever its own clock says, by online linear regression
+//               of TSF against local time from scan results
+//============================================================================
+
+#ifndef RADIOLOCATE_CLOCKALIGN_H
+#define RADIOLOCATE_CLOCKALIGN_H
+
+#include <stdint.h>
+
+#include "Mac.h"
+#include "Nl80211Messages.h"
+#include "Sample.h"
+
+struct ca_config {
+	double forget;         // weight kept by older observations per new one, e.g. 0.99
+	double reset_us;       // a residual this large means the AP's TSF was reset
+	uint32_t min_points;   // before an AP's fit is used
+};
+
+void ca_default_config(struct ca_config *config);
+
+struct ca_estimate {
+	mac_key bssid;
+	double offset_us;      // TSF - local time, over the recent observations
+	double drift_ppm;      // how much faster the TSF runs
+	double residual_us;    // RMS scatter of the observations around the fit
+	uint32_t points;
+	uint32_t resets;
+};
+
+// The fit frozen for the hot path: local time to TSF with integer
+// arithmetic only
+struct ca_mapping {
+	mac_key bssid;
+	uint64_t local_us;     // a point on the fitted line
+	uint64_t tsf_us;
+	int64_t drift_q32;     // drift * 2^32
+};
+
+static inline uint64_t ca_to_tsf(const struct ca_mapping *map, uint64_t local_us)
+{
+	const int64_t dx = (int64_t) (local_us - map->local_us);
+	return map->tsf_us + dx + (int64_t) (((__int128) dx * map->drift_q32) >> 32);
+}
+
+struct clock_align;
+
+struct clock_align *ca_create(const struct ca_config *config);
+void ca_destroy(struct clock_align *align);
+
+// Takes one scan result read at local time read_us (CLOCK_MONOTONIC).
+// Results whose TSF did not move since the last scan are skipped. False if
+// it was not used
+bool ca_observe(struct clock_align *align, const struct rnl80211_bss *bss, uint64_t read_us);
+
+bool ca_get(const struct clock_align *align, mac_key bssid, struct ca_estimate *estimate);
+// The AP's fit, or with bssid 0 the tightest fit there is. False until
+// one has min_points
+bool ca_get_mapping(const struct clock_align *align, mac_key bssid, struct ca_mapping *map);
+
+// Moves samples from local time onto the mapping's TSF timeline
+void ca_retime(const struct ca_mapping *map, struct rl_sample *samples, int count);
+
+#endif // RADIOLOCATE_CLOCKALIGN_H
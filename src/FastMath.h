@@ -0,0 +1,107 @@
+//============================================================================
+// Name        : FastMath.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Branch-free float approximations for the per-particle and
+//               per-cell loops. Everything here is written so that GCC can
+//               auto-vectorize the calling loop. Build with
+//               -O3 -fno-trapping-math, otherwise GCC refuses to if-convert
+//               the float compares and the loops stay scalar
+//============================================================================
+
+#ifndef RADIOLOCATE_FASTMATH_H
+#define RADIOLOCATE_FASTMATH_H
+
+#include <stdint.h>
+#include <string.h>
+
+static inline float fm_bits_to_float(uint32_t i)
+{
+	float f;
+	memcpy(&f, &i, sizeof(f));
+	return f;
+}
+
+static inline uint32_t fm_float_to_bits(float f)
+{
+	uint32_t i;
+	memcpy(&i, &f, sizeof(i));
+	return i;
+}
+
+// fminf()/fmaxf() only vectorize under -ffast-math because of their NaN rules
+static inline float fm_clamp(float x, float lo, float hi)
+{
+	x = x < lo ? lo : x;
+	return x > hi ? hi : x;
+}
+
+// log2(x) for x > 0, absolute error below 1e-5
+static inline float fast_log2f(float x)
+{
+	uint32_t bits = fm_float_to_bits(x);
+	float exponent = (float) ((int) (bits >> 23) - 127);
+	// Mantissa in [1, 2)
+	float m = fm_bits_to_float((bits & 0x007FFFFF) | 0x3F800000);
+	// ln(m) = 2 * atanh((m - 1) / (m + 1)), s is in [0, 1/3)
+	float s = (m - 1.0f) / (m + 1.0f);
+	float s2 = s * s;
+	float ln = 2.0f * s * (1.0f + s2 * (1.0f / 3 + s2 * (1.0f / 5 + s2 * (1.0f / 7 + s2 * (1.0f / 9)))));
+	return exponent + ln * 1.44269504f;
+}
+
+static inline float fast_log10f(float x)
+{
+	return fast_log2f(x) * 0.30102999f;
+}
+
+// 2^x, relative error below 1e-6. Inputs are clamped to [-126, 126]
+static inline float fast_exp2f(float x)
+{
+	x = fm_clamp(x, -126.0f, 126.0f);
+	// Shift into positive range so truncation is floor(). The fraction is
+	// taken from x itself, which is exact; t has lost its low bits
+	float t = x + 127.0f;
+	int i = (int) t;
+	float f = (x - (float) (i - 127)) * 0.69314718f;
+	float p = 1.0f + f * (1.0f + f * (1.0f / 2 + f * (1.0f / 6 + f * (1.0f / 24 + f * (1.0f / 120 + f * (1.0f / 720 + f * (1.0f / 5040)))))));
+	return fm_bits_to_float((uint32_t) i << 23) * p;
+}
+
+// e^x; rounding x * log2(e) adds about |x| * 6e-8 to the relative error
+static inline float fast_expf(float x)
+{
+	return fast_exp2f(x * 1.44269504f);
+}
+
+/**************************************
+ *  Counter-based random numbers      *
+ **************************************/
+// Stateless, so lane i of a vector loop can draw its own number without a
+// serial dependency on a generator state
+
+static inline uint32_t fm_hash32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+// Uniform in [0, 1)
+static inline float fm_uniform(uint32_t seed, uint32_t counter)
+{
+	return (float) (fm_hash32(seed ^ (counter * 0x9E3779B9U)) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Approximately standard normal (Irwin-Hall of four uniforms, tails cut at 3.5 sigma)
+static inline float fm_normal(uint32_t seed, uint32_t counter)
+{
+	uint32_t c = counter * 4;
+	float sum = fm_uniform(seed, c) + fm_uniform(seed, c + 1) +
+	            fm_uniform(seed, c + 2) + fm_uniform(seed, c + 3);
+	return (sum - 2.0f) * 1.7320508f;
+}
+
+#endif // RADIOLOCATE_FASTMATH_H
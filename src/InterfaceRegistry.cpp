@@ -0,0 +1,604 @@
+//============================================================================
+// Name        : InterfaceRegistry.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Wireless interfaces and radios kept current from netlink
+//============================================================================
+
+#include "InterfaceRegistry.h"
+#include "nl80211.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/rtnetlink.h>
+
+#include <vector>
+
+// Index tables are twice the entry count, so probe runs stay short
+#define INDEX_SIZE (2 * RL_MAX_INTERFACES)
+#define WIPHY_INDEX_SIZE (2 * RL_MAX_WIPHYS)
+
+// The first listing: all three dumps run at once
+struct startup {
+	int pending;
+	int error;
+	// Links can be listed before nl80211 has told us they are wireless
+	std::vector<ifinfomsg> early_links;
+};
+
+struct rl_registry {
+	rnl_conn *genl;
+	rnl_family nl80211;
+	rnl_conn *route;
+	rl_iface_fn fn;
+	void *arg;
+
+	// Entries are free while their ifindex / name is 0
+	rl_iface ifaces[RL_MAX_INTERFACES];
+	int16_t free_ifaces[RL_MAX_INTERFACES];
+	int free_count;
+	int16_t by_index[INDEX_SIZE];  // entry numbers, -1 = empty
+	int16_t by_name[INDEX_SIZE];
+
+	rnl80211_wiphy wiphys[RL_MAX_WIPHYS];
+	int16_t wiphy_by_name[WIPHY_INDEX_SIZE];
+
+	startup *starting;     // NULL once listed
+	// Listing the interfaces again after lost notifications: entries not
+	// seen by the time it is done are gone
+	bool resyncing;
+	bool seen[RL_MAX_INTERFACES];
+	rl_registry_stats stats;
+};
+
+/******************
+ *  Index tables  *
+ ******************/
+// Linear probing over entry numbers. Removal shifts the rest of the run
+// back instead of leaving tombstones, so lookups stay as fast however
+// often interfaces come and go
+
+static inline uint32_t hash_index(uint32_t ifindex)
+{
+	return (ifindex * 0x9E3779B1u) >> 16;
+}
+
+static inline uint32_t hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	for (; *name; name++)
+		hash = (hash ^ (uint8_t) *name) * 16777619u;
+	return hash;
+}
+
+static void index_insert(int16_t *slots, uint32_t mask, uint32_t hash, int entry)
+{
+	uint32_t pos = hash & mask;
+	while (slots[pos] >= 0)
+		pos = (pos + 1) & mask;
+	slots[pos] = entry;
+}
+
+// Home(entry) gives the hash of an entry already in the table
+template <typename Home>
+static void index_erase(int16_t *slots, uint32_t mask, uint32_t hash, int entry, Home home)
+{
+	uint32_t hole = hash & mask;
+	while (slots[hole] != entry) {
+		if (slots[hole] < 0)
+			return;
+		hole = (hole + 1) & mask;
+	}
+	for (uint32_t next = (hole + 1) & mask; slots[next] >= 0; next = (next + 1) & mask) {
+		// Moves back if the hole lies between its home slot and itself
+		const uint32_t want = home(slots[next]) & mask;
+		if (((next - want) & mask) >= ((next - hole) & mask)) {
+			slots[hole] = slots[next];
+			hole = next;
+		}
+	}
+	slots[hole] = -1;
+}
+
+static int find_index(const rl_registry *registry, uint32_t ifindex)
+{
+	for (uint32_t pos = hash_index(ifindex) & (INDEX_SIZE - 1); registry->by_index[pos] >= 0;
+	     pos = (pos + 1) & (INDEX_SIZE - 1)) {
+		const int entry = registry->by_index[pos];
+		if (registry->ifaces[entry].ifindex == ifindex)
+			return entry;
+	}
+	return -1;
+}
+
+static int find_name(const rl_registry *registry, const char *name)
+{
+	for (uint32_t pos = hash_name(name) & (INDEX_SIZE - 1); registry->by_name[pos] >= 0;
+	     pos = (pos + 1) & (INDEX_SIZE - 1)) {
+		const int entry = registry->by_name[pos];
+		if (!strcmp(registry->ifaces[entry].name, name))
+			return entry;
+	}
+	return -1;
+}
+
+static int find_wiphy_name(const rl_registry *registry, const char *name)
+{
+	for (uint32_t pos = hash_name(name) & (WIPHY_INDEX_SIZE - 1); registry->wiphy_by_name[pos] >= 0;
+	     pos = (pos + 1) & (WIPHY_INDEX_SIZE - 1)) {
+		const int entry = registry->wiphy_by_name[pos];
+		if (!strcmp(registry->wiphys[entry].name, name))
+			return entry;
+	}
+	return -1;
+}
+
+/****************
+ *  Interfaces  *
+ ****************/
+static void unindex_name(rl_registry *registry, int entry)
+{
+	const rl_iface *ifaces = registry->ifaces;
+	if (ifaces[entry].name[0])
+		index_erase(registry->by_name, INDEX_SIZE - 1, hash_name(ifaces[entry].name), entry,
+		            [ifaces](int e) { return hash_name(ifaces[e].name); });
+}
+
+static void index_name(rl_registry *registry, int entry)
+{
+	const char *name = registry->ifaces[entry].name;
+	if (!name[0])
+		return;
+	// A name another entry still holds was reused before its owner's
+	// rename reached us; the newer one wins
+	const int other = find_name(registry, name);
+	if (other >= 0)
+		unindex_name(registry, other);
+	index_insert(registry->by_name, INDEX_SIZE - 1, hash_name(name), entry);
+}
+
+static void set_name(rl_registry *registry, int entry, const char *name)
+{
+	unindex_name(registry, entry);
+	strncpy(registry->ifaces[entry].name, name, IFNAMSIZ - 1);
+	registry->ifaces[entry].name[IFNAMSIZ - 1] = '\0';
+	index_name(registry, entry);
+}
+
+static void notify(rl_registry *registry, int entry, rl_iface_event event)
+{
+	if (registry->fn)
+		registry->fn(registry->arg, &registry->ifaces[entry], event);
+}
+
+static void add_interface(rl_registry *registry, const rnl80211_interface *info)
+{
+	int entry = find_index(registry, info->ifindex);
+	if (entry >= 0) {
+		rl_iface *iface = &registry->ifaces[entry];
+		const bool renamed = info->name[0] && strcmp(iface->name, info->name);
+		if (!renamed && iface->wiphy == info->wiphy && iface->iftype == info->iftype && iface->mac == info->mac)
+			return;
+		iface->wiphy = info->wiphy;
+		iface->iftype = info->iftype;
+		iface->mac = info->mac;
+		if (renamed) {
+			set_name(registry, entry, info->name);
+			registry->stats.renamed++;
+		}
+		notify(registry, entry, RL_IFACE_CHANGED);
+		return;
+	}
+
+	if (!registry->free_count) {
+		registry->stats.overflows++;
+		return;
+	}
+	entry = registry->free_ifaces[--registry->free_count];
+	rl_iface *iface = &registry->ifaces[entry];
+	memset(iface, 0, sizeof(*iface));
+	iface->ifindex = info->ifindex;
+	iface->wiphy = info->wiphy;
+	iface->iftype = info->iftype;
+	iface->mac = info->mac;
+	index_insert(registry->by_index, INDEX_SIZE - 1, hash_index(iface->ifindex), entry);
+	set_name(registry, entry, info->name);
+	registry->stats.added++;
+	notify(registry, entry, RL_IFACE_ADDED);
+}
+
+static void remove_interface(rl_registry *registry, uint32_t ifindex)
+{
+	const int entry = find_index(registry, ifindex);
+	if (entry < 0)
+		return;
+	notify(registry, entry, RL_IFACE_REMOVED);
+
+	const rl_iface *ifaces = registry->ifaces;
+	unindex_name(registry, entry);
+	index_erase(registry->by_index, INDEX_SIZE - 1, hash_index(ifindex), entry,
+	            [ifaces](int e) { return hash_index(ifaces[e].ifindex); });
+	registry->ifaces[entry].ifindex = 0;
+	registry->free_ifaces[registry->free_count++] = entry;
+	registry->stats.removed++;
+}
+
+/************
+ *  Radios  *
+ ************/
+static int find_wiphy(const rl_registry *registry, uint32_t index)
+{
+	// Radios only change on hot-plug; it's their names that get looked up
+	for (int i = 0; i < RL_MAX_WIPHYS; i++)
+		if (registry->wiphys[i].name[0] && registry->wiphys[i].index == index)
+			return i;
+	return -1;
+}
+
+static void remove_wiphy(rl_registry *registry, uint32_t index)
+{
+	const int entry = find_wiphy(registry, index);
+	if (entry < 0)
+		return;
+	const rnl80211_wiphy *wiphys = registry->wiphys;
+	index_erase(registry->wiphy_by_name, WIPHY_INDEX_SIZE - 1, hash_name(wiphys[entry].name), entry,
+	            [wiphys](int e) { return hash_name(wiphys[e].name); });
+	registry->wiphys[entry].name[0] = '\0';
+}
+
+static void add_wiphy(rl_registry *registry, const rnl80211_wiphy *info)
+{
+	if (!info->name[0])
+		return;
+	int entry = find_wiphy(registry, info->index);
+	if (entry >= 0 && !strcmp(registry->wiphys[entry].name, info->name))
+		return;
+	// Renamed: index it again under the new name
+	remove_wiphy(registry, info->index);
+	for (entry = 0; entry < RL_MAX_WIPHYS && registry->wiphys[entry].name[0]; entry++)
+		;
+	if (entry == RL_MAX_WIPHYS) {
+		registry->stats.overflows++;
+		return;
+	}
+	registry->wiphys[entry] = *info;
+	index_insert(registry->wiphy_by_name, WIPHY_INDEX_SIZE - 1, hash_name(info->name), entry);
+}
+
+/*******************
+ *  Notifications  *
+ *******************/
+static bool dump_links(rl_registry *registry, rnl_done_fn on_done);
+static void resync_interfaces(rl_registry *registry);
+
+// Dump replies and "config" group notifications alike
+static void nl80211_reply(void *arg, const struct nlmsghdr *hdr)
+{
+	rl_registry *registry = (rl_registry*) arg;
+	// A dump that starts over only adds: what it listed before is still there
+	if (!hdr || hdr->nlmsg_type != registry->nl80211.id)
+		return;
+	registry->stats.messages++;
+
+	rnl80211_interface iface;
+	rnl80211_wiphy wiphy;
+	switch (rnl_genl_cmd(hdr)) {
+	case NL80211_CMD_NEW_INTERFACE:
+		if (rnl80211_parse_interface(hdr, &iface)) {
+			add_interface(registry, &iface);
+			if (registry->resyncing) {
+				const int entry = find_index(registry, iface.ifindex);
+				if (entry >= 0)
+					registry->seen[entry] = true;
+			}
+		}
+		break;
+	case NL80211_CMD_DEL_INTERFACE:
+		if (rnl80211_parse_interface(hdr, &iface))
+			remove_interface(registry, iface.ifindex);
+		break;
+	case NL80211_CMD_NEW_WIPHY:
+		if (rnl80211_parse_wiphy(hdr, &wiphy))
+			add_wiphy(registry, &wiphy);
+		break;
+	case NL80211_CMD_DEL_WIPHY:
+		if (rnl80211_parse_wiphy(hdr, &wiphy))
+			remove_wiphy(registry, wiphy.index);
+		break;
+	}
+}
+
+static void nl80211_notify(void *arg, const struct nlmsghdr *hdr)
+{
+	rl_registry *registry = (rl_registry*) arg;
+	if (hdr)
+		nl80211_reply(arg, hdr);
+	else
+		resync_interfaces(registry);
+}
+
+// RTM_NEWLINK / RTM_DELLINK, also from the initial dump. Only interfaces
+// nl80211 told us about are of interest: rtnetlink adds their flags and
+// is the only one to report renames
+static void link_reply(void *arg, const struct nlmsghdr *hdr)
+{
+	rl_registry *registry = (rl_registry*) arg;
+	if (!hdr || (hdr->nlmsg_type != RTM_NEWLINK && hdr->nlmsg_type != RTM_DELLINK) ||
+	    hdr->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+		return;
+	registry->stats.messages++;
+
+	const struct ifinfomsg *info = (const struct ifinfomsg*) NLMSG_DATA(hdr);
+	const int entry = find_index(registry, info->ifi_index);
+	if (entry < 0) {
+		if (registry->starting && hdr->nlmsg_type == RTM_NEWLINK)
+			registry->starting->early_links.push_back(*info);
+		return;
+	}
+	if (hdr->nlmsg_type == RTM_DELLINK) {
+		remove_interface(registry, info->ifi_index);
+		return;
+	}
+
+	const struct nlattr *tb[IFLA_MAX + 1];
+	if (!rnl_parse_msg(hdr, sizeof(struct ifinfomsg), tb, IFLA_MAX))
+		return;
+	rl_iface *iface = &registry->ifaces[entry];
+	char name[IFNAMSIZ] = "";
+	if (tb[IFLA_IFNAME]) {
+		size_t len = rnl_len(tb[IFLA_IFNAME]);
+		if (len >= IFNAMSIZ)
+			len = IFNAMSIZ - 1;
+		memcpy(name, rnl_data(tb[IFLA_IFNAME]), len);
+		name[len] = '\0';
+	}
+	const bool renamed = name[0] && strcmp(name, iface->name);
+	if (!renamed && iface->flags == info->ifi_flags)
+		return;
+	iface->flags = info->ifi_flags;
+	if (renamed) {
+		set_name(registry, entry, name);
+		registry->stats.renamed++;
+	}
+	notify(registry, entry, RL_IFACE_CHANGED);
+}
+
+static void link_notify(void *arg, const struct nlmsghdr *hdr)
+{
+	rl_registry *registry = (rl_registry*) arg;
+	if (hdr) {
+		link_reply(arg, hdr);
+		return;
+	}
+	// Events were lost: list the links again
+	registry->stats.resyncs++;
+	dump_links(registry, NULL);
+}
+
+// Every reply callback takes the registry, so on_done does too
+static bool dump_links(rl_registry *registry, rnl_done_fn on_done)
+{
+	uint8_t storage[64] __attribute__((aligned(4)));
+	rnl_buffer buf;
+	rnl_buffer_init(&buf, storage, sizeof(storage));
+	const rnl_msg msg = rnl_begin(&buf, RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP, 0);
+	return msg != RNL_NO_MSG && rnl_reserve(&buf, msg, sizeof(struct ifinfomsg)) &&
+	       rnl_conn_submit(registry->route, rnl_header(&buf, msg), link_reply, on_done, registry) &&
+	       rnl_conn_flush(registry->route);
+}
+
+static void startup_done(void *arg, int error)
+{
+	startup *start = ((rl_registry*) arg)->starting;
+	start->pending--;
+	if (error && !start->error)
+		start->error = error;
+}
+
+// Sends the three dumps of the first listing together: both nl80211 ones
+// in one send (the kernel starts the second once the first is done) and
+// the link dump alongside them on the other socket, so that startup costs
+// about one round trip rather than three
+static int list_all(rl_registry *registry)
+{
+	startup start;
+	start.pending = 0;
+	start.error = 0;
+	registry->starting = &start;
+
+	// Interfaces first: that dump is short and usually finishes inside the send
+	uint8_t storage[64] __attribute__((aligned(4)));
+	rnl_buffer buf;
+	rnl_buffer_init(&buf, storage, sizeof(storage));
+	const rnl_msg interfaces = rnl80211_get_interfaces(&buf, registry->nl80211.id, 0);
+	const rnl_msg wiphys = rnl80211_get_wiphys(&buf, registry->nl80211.id, 0);
+	if (interfaces == RNL_NO_MSG || wiphys == RNL_NO_MSG)
+		return -ENOBUFS;
+	const rnl_msg requests[2] = { interfaces, wiphys };
+	for (int i = 0; i < 2; i++) {
+		if (!rnl_conn_submit(registry->genl, rnl_header(&buf, requests[i]), nl80211_reply, startup_done, registry))
+			return -ENOBUFS;
+		start.pending++;
+	}
+	if (!rnl_conn_flush(registry->genl) || !dump_links(registry, startup_done))
+		return -EIO;
+	start.pending++;
+
+	int error = 0;
+	struct pollfd pfd[2] = {
+		{ rnl_conn_fd(registry->genl), POLLIN, 0 },
+		{ rnl_conn_fd(registry->route), POLLIN, 0 },
+	};
+	rnl_conn *conns[2] = { registry->genl, registry->route };
+	while (start.pending && !error) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno != EINTR)
+				error = -errno;
+			continue;
+		}
+		for (int i = 0; i < 2 && !error; i++) {
+			if (!pfd[i].revents)
+				continue;
+			const int n = rnl_conn_receive(conns[i], 0);
+			if (n < 0)
+				error = n;
+		}
+	}
+	// On failure requests may still reach start through the registry, but
+	// the caller gives up on the sockets too
+	if (error)
+		return error;
+
+	for (size_t i = 0; i < start.early_links.size(); i++) {
+		const int entry = find_index(registry, start.early_links[i].ifi_index);
+		if (entry >= 0)
+			registry->ifaces[entry].flags = start.early_links[i].ifi_flags;
+	}
+	registry->starting = NULL;
+	return start.error;
+}
+
+static void resync_restarted(void *arg, const struct nlmsghdr *hdr)
+{
+	rl_registry *registry = (rl_registry*) arg;
+	if (hdr)
+		nl80211_reply(arg, hdr);
+	else
+		memset(registry->seen, 0, sizeof(registry->seen));
+}
+
+static void resync_done(void *arg, int error)
+{
+	rl_registry *registry = (rl_registry*) arg;
+	registry->resyncing = false;
+	if (error)
+		return;
+	for (int entry = 0; entry < RL_MAX_INTERFACES; entry++)
+		if (registry->ifaces[entry].ifindex && !registry->seen[entry])
+			remove_interface(registry, registry->ifaces[entry].ifindex);
+}
+
+// nl80211 notifications were lost: list the interfaces again, and drop the
+// ones that are no longer listed. Radios only ever get added this way, but
+// their names are looked up only to find interfaces
+static void resync_interfaces(rl_registry *registry)
+{
+	if (registry->resyncing)
+		return;
+	registry->stats.resyncs++;
+	uint8_t storage[64] __attribute__((aligned(4)));
+	rnl_buffer buf;
+	rnl_buffer_init(&buf, storage, sizeof(storage));
+	const rnl_msg interfaces = rnl80211_get_interfaces(&buf, registry->nl80211.id, 0);
+	const rnl_msg wiphys = rnl80211_get_wiphys(&buf, registry->nl80211.id, 0);
+	if (interfaces == RNL_NO_MSG || wiphys == RNL_NO_MSG)
+		return;
+	memset(registry->seen, 0, sizeof(registry->seen));
+	registry->resyncing = true;
+	if (!rnl_conn_submit(registry->genl, rnl_header(&buf, interfaces), resync_restarted, resync_done, registry)) {
+		registry->resyncing = false;
+		return;
+	}
+	rnl_conn_submit(registry->genl, rnl_header(&buf, wiphys), nl80211_reply, NULL, registry);
+	rnl_conn_flush(registry->genl);
+}
+
+/***************
+ *  Lifecycle  *
+ ***************/
+struct rl_registry *rl_registry_create(struct rnl_conn *genl, const struct rnl_family *nl80211,
+                                       rl_iface_fn fn, void *arg)
+{
+	rl_registry *registry = new rl_registry;
+	memset(registry, 0, sizeof(*registry));
+	registry->genl = genl;
+	registry->nl80211 = *nl80211;
+	registry->fn = fn;
+	registry->arg = arg;
+	for (int i = 0; i < RL_MAX_INTERFACES; i++)
+		registry->free_ifaces[i] = RL_MAX_INTERFACES - 1 - i;
+	registry->free_count = RL_MAX_INTERFACES;
+	memset(registry->by_index, 0xff, sizeof(registry->by_index));
+	memset(registry->by_name, 0xff, sizeof(registry->by_name));
+	memset(registry->wiphy_by_name, 0xff, sizeof(registry->wiphy_by_name));
+
+	// Subscribe before dumping, so that nothing that happens in between
+	// is missed
+	const uint32_t config = rnl_family_group(nl80211, "config");
+	if (!config) {
+		fprintf(stderr, "nl80211 has no config group.\n");
+		delete registry;
+		return NULL;
+	}
+	if (!rnl_conn_join_group(genl, config) || !(registry->route = rnl_conn_open(NETLINK_ROUTE)) ||
+	    !rnl_conn_join_group(registry->route, RTNLGRP_LINK)) {
+		rl_registry_destroy(registry);
+		return NULL;
+	}
+	rnl_conn_set_notify(genl, nl80211_notify, registry);
+	rnl_conn_set_notify(registry->route, link_notify, registry);
+
+	const int error = list_all(registry);
+	if (error) {
+		fprintf(stderr, "Failed to list wireless interfaces: %s\n", strerror(-error));
+		rl_registry_destroy(registry);
+		return NULL;
+	}
+	return registry;
+}
+
+void rl_registry_destroy(struct rl_registry *registry)
+{
+	if (!registry)
+		return;
+	rnl_conn_set_notify(registry->genl, NULL, NULL);
+	rnl_conn_close(registry->route);
+	delete registry;
+}
+
+int rl_registry_fd(const struct rl_registry *registry)
+{
+	return rnl_conn_fd(registry->route);
+}
+
+int rl_registry_receive(struct rl_registry *registry)
+{
+	int total = 0, n;
+	// Lost events come back as a link_notify(NULL) that lists them again
+	while ((n = rnl_conn_receive(registry->route, 0)) > 0)
+		total += n;
+	return n < 0 ? n : total;
+}
+
+/*************
+ *  Lookups  *
+ *************/
+const struct rl_iface *rl_registry_find(const struct rl_registry *registry, uint32_t ifindex)
+{
+	const int entry = find_index(registry, ifindex);
+	return entry < 0 ? NULL : &registry->ifaces[entry];
+}
+
+const struct rl_iface *rl_registry_find_name(const struct rl_registry *registry, const char *name)
+{
+	const int entry = find_name(registry, name);
+	return entry < 0 ? NULL : &registry->ifaces[entry];
+}
+
+uint32_t rl_registry_find_wiphy(const struct rl_registry *registry, const char *name)
+{
+	const int entry = find_wiphy_name(registry, name);
+	return entry < 0 ? UINT32_MAX : registry->wiphys[entry].index;
+}
+
+int rl_registry_count(const struct rl_registry *registry)
+{
+	return RL_MAX_INTERFACES - registry->free_count;
+}
+
+void rl_registry_get_stats(const struct rl_registry *registry, struct rl_registry_stats *stats)
+{
+	*stats = registry->stats;
+}
@@ -0,0 +1,75 @@
+//============================================================================
+// Name        : InterfaceRegistry.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Every wireless interface and radio in the system, filled
+//               once from nl80211 dumps and kept current from nl80211
+//               "config" and rtnetlink link notifications, so that looking
+//               one up by index or name is a memory read rather than an
+//               ioctl or a trip through sysfs
+//============================================================================
+
+#ifndef RADIOLOCATE_INTERFACEREGISTRY_H
+#define RADIOLOCATE_INTERFACEREGISTRY_H
+
+#include <net/if.h>
+#include <stdint.h>
+
+#include "Mac.h"
+#include "NetlinkConn.h"
+#include "Nl80211Messages.h"
+
+#define RL_MAX_INTERFACES 256
+#define RL_MAX_WIPHYS 64
+
+struct rl_iface {
+	uint32_t ifindex;
+	uint32_t wiphy;
+	uint32_t iftype;       // enum nl80211_iftype
+	uint32_t flags;        // IFF_* from rtnetlink, 0 until it reports them
+	mac_key mac;
+	char name[IFNAMSIZ];
+};
+
+enum rl_iface_event {
+	RL_IFACE_ADDED,
+	RL_IFACE_CHANGED,      // renamed, type or flags changed
+	RL_IFACE_REMOVED,      // iface is still readable during the call
+};
+
+typedef void (*rl_iface_fn)(void *arg, const struct rl_iface *iface, enum rl_iface_event event);
+
+struct rl_registry_stats {
+	uint64_t messages;     // nl80211 and rtnetlink messages handled
+	uint64_t added;
+	uint64_t removed;
+	uint64_t renamed;
+	uint64_t overflows;    // interfaces or radios that didn't fit
+	uint64_t resyncs;      // events lost to a full socket, and listed again
+};
+
+struct rl_registry;
+
+// Dumps the interfaces and radios over genl (nl80211 must carry its
+// multicast groups) and subscribes it to the "config" group; genl's
+// notifications then belong to the registry. Link events come from a
+// socket of its own, see rl_registry_fd()
+struct rl_registry *rl_registry_create(struct rnl_conn *genl, const struct rnl_family *nl80211,
+                                       rl_iface_fn fn, void *arg);
+void rl_registry_destroy(struct rl_registry *registry);
+
+// The rtnetlink socket (non-blocking): call rl_registry_receive() when it
+// is readable. Returns the number of messages handled or a negative errno
+int rl_registry_fd(const struct rl_registry *registry);
+int rl_registry_receive(struct rl_registry *registry);
+
+// NULL if there is no such interface. The pointer stays valid until the
+// interface is removed
+const struct rl_iface *rl_registry_find(const struct rl_registry *registry, uint32_t ifindex);
+const struct rl_iface *rl_registry_find_name(const struct rl_registry *registry, const char *name);
+// Radio index by name (e.g. phy0), or UINT32_MAX
+uint32_t rl_registry_find_wiphy(const struct rl_registry *registry, const char *name);
+int rl_registry_count(const struct rl_registry *registry);
+
+void rl_registry_get_stats(const struct rl_registry *registry, struct rl_registry_stats *stats);
+
+#endif // RADIOLOCATE_INTERFACEREGISTRY_H
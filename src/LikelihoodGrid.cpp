@@ -0,0 +1,350 @@
+//============================================================================
+// Name        : LikelihoodGrid.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Cached per-anchor grids of expected RSSI over the site, so
+//               that grid localization becomes table lookups and adds
+//============================================================================
+
+#include "LikelihoodGrid.h"
+#include "WallModel.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+using namespace std;
+
+#define LG_TILE_CELLS (LG_TILE * LG_TILE)
+
+// Expected RSSI of one anchor over one tile, and the calibration it was
+// computed with so that a later change can be applied incrementally
+struct lg_tile {
+	float *rssi;            // LG_TILE_CELLS floats, 64-byte aligned
+	struct anchor basis;
+	uint32_t generation;    // of the anchor when rssi was last brought up to date
+
+	float *walls;           // wall loss per cell, NULL until ray cast
+	float walls_x, walls_y; // anchor position the rays were cast from
+	bool with_walls;        // rssi includes the wall losses
+};
+
+struct lg_anchor {
+	struct anchor current;
+	uint32_t generation;    // bumped whenever current changes
+	vector<lg_tile> tiles;
+};
+
+struct lg_grid {
+	lg_config config;
+	int cells_x, cells_y;
+	int tiles_x, tiles_y;
+	vector<lg_anchor> anchors;
+	float *score;           // one tile of accumulated log-likelihood
+	lg_stats stats;
+
+	const wall_model *walls;
+	work_pool *pool;
+};
+
+/*********************
+ *  Tile refreshing  *
+ *********************/
+// Centres of a tile's cells, row-major
+static void tile_centres(const lg_grid *grid, int tx, int ty, float *px, float *py)
+{
+	const float cell = grid->config.cell_size;
+	for (int row = 0; row < LG_TILE; row++) {
+		for (int col = 0; col < LG_TILE; col++) {
+			px[row * LG_TILE + col] = grid->config.min_x + (tx * LG_TILE + col + 0.5f) * cell;
+			py[row * LG_TILE + col] = grid->config.min_y + (ty * LG_TILE + row + 0.5f) * cell;
+		}
+	}
+}
+
+static bool tile_walls_valid(const lg_tile *tile, const anchor *a)
+{
+	return tile->walls && tile->walls_x == a->x && tile->walls_y == a->y;
+}
+
+static bool tile_walls_alloc(lg_tile *tile)
+{
+	if (tile->walls)
+		return true;
+	void *block;
+	if (posix_memalign(&block, 64, LG_TILE_CELLS * sizeof(float)))
+		return false;
+	tile->walls = (float*) block;
+	return true;
+}
+
+// Ray casts one tile's wall losses on the calling thread
+static bool tile_cast(lg_grid *grid, lg_tile *tile, const anchor *a, int tx, int ty)
+{
+	float px[LG_TILE_CELLS], py[LG_TILE_CELLS];
+	if (!tile_walls_alloc(tile))
+		return false;
+	tile_centres(grid, tx, ty, px, py);
+	wall_model_loss_batch(grid->walls, a->x, a->y, px, py, LG_TILE_CELLS, tile->walls, NULL);
+	tile->walls_x = a->x;
+	tile->walls_y = a->y;
+	grid->stats.tiles_ray_cast++;
+	return true;
+}
+
+static void tile_compute(lg_grid *grid, const anchor *a, int tx, int ty, const float *__restrict walls,
+                         float *__restrict out)
+{
+	const float cell = grid->config.cell_size;
+	const float h2 = grid->config.anchor_height * grid->config.anchor_height;
+	const float ref = a->model.ref_power, slope = 5.0f * a->model.exponent;
+	// Cell centres, relative to the anchor
+	const float x0 = grid->config.min_x + (tx * LG_TILE + 0.5f) * cell - a->x;
+	const float y0 = grid->config.min_y + (ty * LG_TILE + 0.5f) * cell - a->y;
+
+	for (int row = 0; row < LG_TILE; row++) {
+		const float dy = y0 + row * cell;
+		const float dy2h = dy * dy + h2;
+		float *__restrict r = out + row * LG_TILE;
+		for (int col = 0; col < LG_TILE; col++) {
+			float dx = x0 + col * cell;
+			float d2 = dx * dx + dy2h;
+			d2 = d2 < 1.0f ? 1.0f : d2;
+			r[col] = ref - slope * fast_log10f(d2);
+		}
+	}
+	if (walls)
+		for (int i = 0; i < LG_TILE_CELLS; i++)
+			out[i] -= walls[i];
+	grid->stats.tiles_computed++;
+}
+
+// Returns the up-to-date tile, allocating or refreshing it if needed
+static const float *tile_get(lg_grid *grid, lg_anchor *la, int tx, int ty)
+{
+	lg_tile *tile = &la->tiles[ty * grid->tiles_x + tx];
+	if (tile->rssi && tile->generation == la->generation)
+		return tile->rssi;
+
+	if (!tile->rssi) {
+		void *block;
+		if (posix_memalign(&block, 64, LG_TILE_CELLS * sizeof(float)))
+			return NULL;
+		tile->rssi = (float*) block;
+		grid->stats.tiles_resident++;
+	} else if (tile->basis.x == la->current.x && tile->basis.y == la->current.y &&
+	           tile->basis.model.exponent == la->current.model.exponent &&
+	           tile->with_walls == (grid->walls != NULL) &&
+	           (!grid->walls || tile_walls_valid(tile, &la->current))) {
+		// Only the reference power moved, which shifts the whole tile
+		const float delta = la->current.model.ref_power - tile->basis.model.ref_power;
+		float *__restrict r = tile->rssi;
+		for (int i = 0; i < LG_TILE_CELLS; i++)
+			r[i] += delta;
+		tile->basis = la->current;
+		tile->generation = la->generation;
+		grid->stats.tiles_shifted++;
+		return tile->rssi;
+	}
+
+	const float *walls = NULL;
+	if (grid->walls) {
+		if (!tile_walls_valid(tile, &la->current) && !tile_cast(grid, tile, &la->current, tx, ty))
+			return NULL;
+		walls = tile->walls;
+	}
+	tile_compute(grid, &la->current, tx, ty, walls, tile->rssi);
+	tile->with_walls = walls != NULL;
+	tile->basis = la->current;
+	tile->generation = la->generation;
+	return tile->rssi;
+}
+
+/****************
+ *  Public API  *
+ ****************/
+struct lg_grid *lg_create(const struct lg_config *config, const struct anchor *anchors, int anchor_count)
+{
+	if (anchor_count <= 0 || config->cell_size <= 0.0f || config->rssi_sigma <= 0.0f ||
+	    config->max_x <= config->min_x || config->max_y <= config->min_y)
+		return NULL;
+
+	void *score;
+	if (posix_memalign(&score, 64, LG_TILE_CELLS * sizeof(float)))
+		return NULL;
+
+	lg_grid *grid = new lg_grid;
+	grid->config = *config;
+	grid->cells_x = (int) ceilf((config->max_x - config->min_x) / config->cell_size);
+	grid->cells_y = (int) ceilf((config->max_y - config->min_y) / config->cell_size);
+	grid->tiles_x = (grid->cells_x + LG_TILE - 1) / LG_TILE;
+	grid->tiles_y = (grid->cells_y + LG_TILE - 1) / LG_TILE;
+	grid->score = (float*) score;
+	memset(&grid->stats, 0, sizeof(grid->stats));
+	grid->walls = NULL;
+	grid->pool = NULL;
+
+	lg_tile empty;
+	memset(&empty, 0, sizeof(empty));
+	grid->anchors.resize(anchor_count);
+	for (int i = 0; i < anchor_count; i++) {
+		grid->anchors[i].current = anchors[i];
+		grid->anchors[i].generation = 1;
+		grid->anchors[i].tiles.assign(grid->tiles_x * grid->tiles_y, empty);
+	}
+	return grid;
+}
+
+void lg_destroy(struct lg_grid *grid)
+{
+	if (!grid)
+		return;
+	for (size_t a = 0; a < grid->anchors.size(); a++)
+		for (size_t t = 0; t < grid->anchors[a].tiles.size(); t++) {
+			free(grid->anchors[a].tiles[t].rssi);
+			free(grid->anchors[a].tiles[t].walls);
+		}
+	free(grid->score);
+	delete grid;
+}
+
+bool lg_set_anchor(struct lg_grid *grid, int anchor_id, const struct anchor *a)
+{
+	if (anchor_id < 0 || anchor_id >= (int) grid->anchors.size())
+		return false;
+	lg_anchor *la = &grid->anchors[anchor_id];
+	if (memcmp(&la->current, a, sizeof(*a)) == 0)
+		return true;
+	la->current = *a;
+	la->generation++;
+	return true;
+}
+
+void lg_set_walls(struct lg_grid *grid, const struct wall_model *walls, struct work_pool *pool)
+{
+	grid->walls = walls;
+	grid->pool = pool;
+	for (size_t a = 0; a < grid->anchors.size(); a++) {
+		lg_anchor *la = &grid->anchors[a];
+		for (size_t t = 0; t < la->tiles.size(); t++) {
+			free(la->tiles[t].walls);
+			la->tiles[t].walls = NULL;
+		}
+		la->generation++;
+	}
+}
+
+// Casts the rays of every tile of one anchor whose wall losses are missing
+// as one large batch, so that they spread across the pool
+static void cast_all(lg_grid *grid, lg_anchor *la)
+{
+	vector<int> stale;
+	for (int t = 0; t < (int) la->tiles.size(); t++)
+		if (!tile_walls_valid(&la->tiles[t], &la->current))
+			stale.push_back(t);
+	if (stale.empty())
+		return;
+
+	const size_t n = stale.size() * LG_TILE_CELLS;
+	vector<float> px(n), py(n), loss(n);
+	for (size_t i = 0; i < stale.size(); i++)
+		tile_centres(grid, stale[i] % grid->tiles_x, stale[i] / grid->tiles_x,
+		             &px[i * LG_TILE_CELLS], &py[i * LG_TILE_CELLS]);
+
+	wall_model_loss_batch(grid->walls, la->current.x, la->current.y, &px[0], &py[0], (int) n, &loss[0], grid->pool);
+
+	for (size_t i = 0; i < stale.size(); i++) {
+		lg_tile *tile = &la->tiles[stale[i]];
+		if (!tile_walls_alloc(tile))
+			continue; // tile_get() will try again
+		memcpy(tile->walls, &loss[i * LG_TILE_CELLS], LG_TILE_CELLS * sizeof(float));
+		tile->walls_x = la->current.x;
+		tile->walls_y = la->current.y;
+		grid->stats.tiles_ray_cast++;
+	}
+}
+
+void lg_refresh_all(struct lg_grid *grid)
+{
+	for (size_t a = 0; a < grid->anchors.size(); a++) {
+		if (grid->walls)
+			cast_all(grid, &grid->anchors[a]);
+		for (int ty = 0; ty < grid->tiles_y; ty++)
+			for (int tx = 0; tx < grid->tiles_x; tx++)
+				tile_get(grid, &grid->anchors[a], tx, ty);
+	}
+}
+
+bool lg_locate(struct lg_grid *grid, const struct lg_reading *readings, int count,
+               struct lg_fix *fix, float *map)
+{
+	const float k = -0.5f / (grid->config.rssi_sigma * grid->config.rssi_sigma);
+	float best = -INFINITY;
+	int best_x = -1, best_y = -1;
+
+	for (int i = 0; i < count; i++)
+		if (readings[i].anchor_id < 0 || readings[i].anchor_id >= (int) grid->anchors.size())
+			return false;
+
+	for (int ty = 0; ty < grid->tiles_y; ty++) {
+		for (int tx = 0; tx < grid->tiles_x; tx++) {
+			float *__restrict score = grid->score;
+			memset(score, 0, LG_TILE_CELLS * sizeof(float));
+
+			for (int i = 0; i < count; i++) {
+				const float *__restrict expected = tile_get(grid, &grid->anchors[readings[i].anchor_id], tx, ty);
+				if (!expected)
+					return false;
+				const float rssi = readings[i].rssi;
+				for (int row = 0; row < LG_TILE; row++) {
+					float *__restrict s = score + row * LG_TILE;
+					const float *__restrict e = expected + row * LG_TILE;
+					for (int col = 0; col < LG_TILE; col++) {
+						float d = rssi - e[col];
+						s[col] += k * d * d;
+					}
+				}
+			}
+
+			// Edge tiles hang over the site, only look at real cells
+			const int cx = tx * LG_TILE, cy = ty * LG_TILE;
+			const int cols = grid->cells_x - cx < LG_TILE ? grid->cells_x - cx : LG_TILE;
+			const int rows = grid->cells_y - cy < LG_TILE ? grid->cells_y - cy : LG_TILE;
+			for (int row = 0; row < rows; row++) {
+				const float *s = score + row * LG_TILE;
+				if (map)
+					memcpy(map + (size_t) (cy + row) * grid->cells_x + cx, s, cols * sizeof(float));
+				for (int col = 0; col < cols; col++) {
+					if (s[col] > best) {
+						best = s[col];
+						best_x = cx + col;
+						best_y = cy + row;
+					}
+				}
+			}
+		}
+	}
+
+	if (best_x < 0)
+		return false;
+	fix->x = grid->config.min_x + (best_x + 0.5f) * grid->config.cell_size;
+	fix->y = grid->config.min_y + (best_y + 0.5f) * grid->config.cell_size;
+	fix->log_likelihood = best;
+	return true;
+}
+
+int lg_cells_x(const struct lg_grid *grid)
+{
+	return grid->cells_x;
+}
+
+int lg_cells_y(const struct lg_grid *grid)
+{
+	return grid->cells_y;
+}
+
+void lg_get_stats(const struct lg_grid *grid, struct lg_stats *stats)
+{
+	*stats = grid->stats;
+}
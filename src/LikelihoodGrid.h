@@ -0,0 +1,77 @@
+//============================================================================
+// Name        : LikelihoodGrid.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Cached per-anchor grids of expected RSSI over the site, so
+//               that grid localization becomes table lookups and adds
+//============================================================================
+
+#ifndef RADIOLOCATE_LIKELIHOODGRID_H
+#define RADIOLOCATE_LIKELIHOODGRID_H
+
+#include <stdint.h>
+
+#include "PathLoss.h"
+
+// Cells are grouped into square tiles of LG_TILE x LG_TILE. A tile row is
+// 16 floats, i.e. one cache line and a whole number of SIMD registers
+#define LG_TILE 16
+
+struct lg_config {
+	float min_x, min_y;  // site bounds (m)
+	float max_x, max_y;
+	float cell_size;     // m
+	float anchor_height; // m, vertical offset between anchors and targets
+	float rssi_sigma;    // dB, measurement noise of one reading
+};
+
+struct lg_reading {
+	int anchor_id;
+	float rssi;
+};
+
+struct lg_fix {
+	float x, y;           // centre of the most likely cell (m)
+	float log_likelihood; // of that cell
+};
+
+struct lg_stats {
+	uint64_t tiles_computed; // full path-loss evaluations of a tile
+	uint64_t tiles_shifted;  // tiles refreshed by adding a reference power delta
+	uint64_t tiles_resident;
+	uint64_t tiles_ray_cast; // wall losses computed for a tile
+};
+
+struct lg_grid;
+struct wall_model;
+struct work_pool;
+
+// The anchors are copied. Tiles are only filled in the first time a fix needs them
+struct lg_grid *lg_create(const struct lg_config *config, const struct anchor *anchors, int anchor_count);
+void lg_destroy(struct lg_grid *grid);
+
+// Replaces an anchor's position or calibration. Its tiles go stale and are
+// refreshed lazily, one tile at a time, the next time a fix reads them
+bool lg_set_anchor(struct lg_grid *grid, int anchor_id, const struct anchor *a);
+
+// Adds the attenuation of the floor-plan walls between each anchor and each
+// cell to the expected RSSI. Wall losses only depend on geometry, so they
+// are ray cast once per tile and cell and kept until the anchor moves.
+// pool (optional) is used to cast rays in parallel in lg_refresh_all().
+// The model must outlive the grid; NULL switches walls off again
+void lg_set_walls(struct lg_grid *grid, const struct wall_model *walls, struct work_pool *pool);
+
+// Eagerly brings every tile of every anchor up to date (e.g. at startup)
+void lg_refresh_all(struct lg_grid *grid);
+
+// Scores every cell of the site against the readings and returns the most
+// likely one. If map is not NULL it receives the log-likelihood of every
+// cell, row-major, lg_cells_x() * lg_cells_y() floats.
+// A grid is not thread-safe: fixes refresh tiles in place
+bool lg_locate(struct lg_grid *grid, const struct lg_reading *readings, int count,
+               struct lg_fix *fix, float *map);
+
+int lg_cells_x(const struct lg_grid *grid);
+int lg_cells_y(const struct lg_grid *grid);
+void lg_get_stats(const struct lg_grid *grid, struct lg_stats *stats);
+
+#endif // RADIOLOCATE_LIKELIHOODGRID_H
@@ -0,0 +1,65 @@
+//============================================================================
+// Name        : Mac.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Compact MAC address keys shared by the per-device modules
+//============================================================================
+
+#ifndef RADIOLOCATE_MAC_H
+#define RADIOLOCATE_MAC_H
+
+#include <stdint.h>
+
+// A MAC address packed into the low 48 bits of an integer, so it can be used
+// directly as a hash/map key and compared with a single instruction
+typedef uint64_t mac_key;
+
+static inline mac_key mac_to_key(const uint8_t *mac)
+{
+	return ((mac_key) mac[0] << 40) | ((mac_key) mac[1] << 32) |
+	       ((mac_key) mac[2] << 24) | ((mac_key) mac[3] << 16) |
+	       ((mac_key) mac[4] << 8)  |  (mac_key) mac[5];
+}
+
+static inline void mac_from_key(mac_key key, uint8_t *mac)
+{
+	for (int i = 5; i >= 0; i--, key >>= 8)
+		mac[i] = (uint8_t) key;
+}
+
+// Parses "aa:bb:cc:dd:ee:ff". False if text is anything else
+static inline bool mac_parse(const char *text, mac_key *key)
+{
+	mac_key k = 0;
+	for (int i = 0; i < 6; i++) {
+		int byte = 0;
+		for (int j = 0; j < 2; j++, text++) {
+			const char c = *text;
+			const int digit = c >= '0' && c <= '9' ? c - '0' :
+			                  c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+			                  c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+			if (digit < 0)
+				return false;
+			byte = byte * 16 + digit;
+		}
+		k = (k << 8) | byte;
+		if (*text != (i < 5 ? ':' : '\0'))
+			return false;
+		if (i < 5)
+			text++;
+	}
+	*key = k;
+	return true;
+}
+
+// Mixes all 48 bits; the vendor prefix alone is a poor hash
+static inline uint32_t mac_hash(mac_key key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return (uint32_t) key;
+}
+
+#endif // RADIOLOCATE_MAC_H
@@ -0,0 +1,253 @@
+//============================================================================
+// Name        : MotionDetector.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Streaming motion and presence classification
+//============================================================================
+
+#include "MotionDetector.h"
+#include "FastMath.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One cache line per station, in an open-addressing table keyed by MAC:
+// a sample touches nothing else
+struct md_station {
+	mac_key mac;           // 0 = free slot
+	uint64_t last_us;
+	uint64_t signal_us;    // of the last sample with a signal
+	// Exponentially weighted over time, so they mean the same at any
+	// sampling rate
+	float mean;
+	float variance;
+	float velocity;        // of the smoothed signal, dB/s
+	uint32_t ifindex;
+	uint8_t state;         // enum md_state
+	uint8_t pending;       // the state it is being held in before switching
+	uint8_t held;          // samples in a row that wanted pending
+	bool measured;         // mean is of a signal: one sample had one
+} __attribute__((aligned(64)));
+
+struct motion_detector {
+	md_config config;
+	md_event_fn fn;
+	void *arg;
+	float inv_tau;         // 1 / tau in 1/us
+	md_station *table;
+	uint32_t mask;
+	md_stats stats;
+};
+
+void md_default_config(struct md_config *config)
+{
+	config->capacity = 4096;
+	config->tau_us = 2000000;
+	config->moving_variance = 9.0f;
+	config->still_variance = 4.0f;
+	config->moving_rate = 2.0f;
+	config->still_rate = 1.0f;
+	config->hold_samples = 3;
+	config->idle_ms = 10000;
+	config->absent_after_us = 5000000;
+	config->forget_after_us = 600 * 1000000ULL;
+}
+
+struct motion_detector *md_create(const struct md_config *config, md_event_fn fn, void *arg)
+{
+	// Keep the table at most half full so that probes stay short
+	uint32_t slots = 2;
+	while (slots < 2 * config->capacity)
+		slots <<= 1;
+	void *block;
+	if (posix_memalign(&block, 64, (size_t) slots * sizeof(md_station)))
+		return NULL;
+
+	motion_detector *detector = new motion_detector;
+	detector->config = *config;
+	detector->fn = fn;
+	detector->arg = arg;
+	detector->inv_tau = 1.0f / (config->tau_us ? config->tau_us : 1);
+	detector->table = (md_station*) block;
+	memset(detector->table, 0, (size_t) slots * sizeof(md_station));
+	detector->mask = slots - 1;
+	memset(&detector->stats, 0, sizeof(detector->stats));
+	return detector;
+}
+
+void md_destroy(struct motion_detector *detector)
+{
+	if (!detector)
+		return;
+	free(detector->table);
+	delete detector;
+}
+
+/**************
+ *  Stations  *
+ **************/
+static md_station *find(const motion_detector *detector, mac_key mac)
+{
+	for (uint32_t i = mac_hash(mac) & detector->mask; detector->table[i].mac; i = (i + 1) & detector->mask)
+		if (detector->table[i].mac == mac)
+			return &detector->table[i];
+	return NULL;
+}
+
+// Finds the station's slot, claiming a free one on first sight. NULL if the
+// table is at capacity
+static md_station *claim(motion_detector *detector, mac_key mac, bool *fresh)
+{
+	uint32_t i = mac_hash(mac) & detector->mask;
+	for (; detector->table[i].mac; i = (i + 1) & detector->mask)
+		if (detector->table[i].mac == mac) {
+			*fresh = false;
+			return &detector->table[i];
+		}
+	if (detector->stats.stations >= detector->config.capacity)
+		return NULL;
+	detector->stats.stations++;
+	*fresh = true;
+	detector->table[i].mac = mac;
+	return &detector->table[i];
+}
+
+// Backward-shift deletion: no tombstones, so probes stay as short as the
+// table is full
+static void forget(motion_detector *detector, uint32_t hole)
+{
+	md_station *table = detector->table;
+	const uint32_t mask = detector->mask;
+	for (uint32_t next = (hole + 1) & mask; table[next].mac; next = (next + 1) & mask) {
+		const uint32_t want = mac_hash(table[next].mac) & mask;
+		if (((next - want) & mask) >= ((next - hole) & mask)) {
+			table[hole] = table[next];
+			hole = next;
+		}
+	}
+	table[hole].mac = 0;
+	detector->stats.stations--;
+}
+
+static void change(motion_detector *detector, md_station *st, md_state to, uint64_t timestamp_us)
+{
+	if (st->state == MD_MOVING)
+		detector->stats.moving--;
+	if (to == MD_MOVING)
+		detector->stats.moving++;
+	detector->stats.events++;
+	md_event event;
+	event.mac = st->mac;
+	event.ifindex = st->ifindex;
+	event.from = st->state;
+	event.to = to;
+	event.timestamp_us = timestamp_us;
+	event.variance = st->variance;
+	event.rate = fabsf(st->velocity);
+	st->state = to;
+	st->held = 0;
+	if (detector->fn)
+		detector->fn(detector->arg, &event);
+}
+
+/*************
+ *  Samples  *
+ *************/
+enum md_state md_update(struct motion_detector *detector, const struct rl_sample *sample)
+{
+	bool fresh;
+	md_station *st = claim(detector, sample->mac, &fresh);
+	if (!st) {
+		detector->stats.overflows++;
+		return MD_ABSENT;
+	}
+	detector->stats.samples++;
+	st->ifindex = sample->ifindex;
+	if (fresh) {
+		st->last_us = sample->timestamp_us;
+		st->variance = 0.0f;
+		st->velocity = 0.0f;
+		st->state = MD_ABSENT;
+		st->pending = MD_ABSENT;
+		st->held = 0;
+		st->measured = false;
+	}
+	// Samples without a signal (0) leave the signal statistics alone, as
+	// in RollingStats, but their inactive time still counts below
+	if (sample->signal && !st->measured) {
+		st->signal_us = sample->timestamp_us;
+		st->mean = sample->signal;
+		st->measured = true;
+	} else if (sample->signal && sample->timestamp_us > st->signal_us) {
+		// Weighted by the time since the last sample, so repeats of a
+		// reading the driver has not refreshed yet count for little
+		const float dt = (float) (sample->timestamp_us - st->signal_us);
+		st->signal_us = sample->timestamp_us;
+		const float alpha = 1.0f - fast_expf(-dt * detector->inv_tau);
+		const float diff = sample->signal - st->mean;
+		st->mean += alpha * diff;
+		st->variance = (1.0f - alpha) * (st->variance + alpha * diff * diff);
+		// Of the mean rather than the raw readings, whose noise alone
+		// would look like several dB/s
+		st->velocity += alpha * (alpha * diff * 1e6f / dt - st->velocity);
+	}
+	if (sample->timestamp_us > st->last_us)
+		st->last_us = sample->timestamp_us;
+
+	const md_config &c = detector->config;
+	const float rate = fabsf(st->velocity);
+	md_state want;
+	if (sample->inactive_ms >= c.idle_ms)
+		want = MD_ABSENT;
+	else if (st->state == MD_MOVING)
+		want = st->variance < c.still_variance && rate < c.still_rate ? MD_STATIONARY : MD_MOVING;
+	else
+		want = st->variance > c.moving_variance || rate > c.moving_rate ? MD_MOVING : MD_STATIONARY;
+
+	if (want == st->state)
+		st->held = 0;
+	else if (want == MD_ABSENT || st->state == MD_ABSENT)
+		// Presence is reported at once; only motion is held back
+		change(detector, st, want, sample->timestamp_us);
+	else {
+		if (st->pending != want) {
+			st->pending = want;
+			st->held = 0;
+		}
+		if (++st->held >= c.hold_samples)
+			change(detector, st, want, sample->timestamp_us);
+	}
+	return (md_state) st->state;
+}
+
+int md_tick(struct motion_detector *detector, uint64_t now_us)
+{
+	const uint64_t events = detector->stats.events;
+	for (uint32_t i = 0; i <= detector->mask; ) {
+		md_station *st = &detector->table[i];
+		if (!st->mac) {
+			i++;
+			continue;
+		}
+		if (st->state != MD_ABSENT && st->last_us + detector->config.absent_after_us < now_us)
+			change(detector, st, MD_ABSENT, now_us);
+		else if (st->state == MD_ABSENT && st->last_us + detector->config.forget_after_us < now_us) {
+			// Another station may shift into this slot: look at it again
+			forget(detector, i);
+			continue;
+		}
+		i++;
+	}
+	return detector->stats.events - events;
+}
+
+enum md_state md_get(const struct motion_detector *detector, mac_key mac)
+{
+	const md_station *st = find(detector, mac);
+	return st ? (md_state) st->state : MD_ABSENT;
+}
+
+void md_get_stats(const struct motion_detector *detector, struct md_stats *stats)
+{
+	*stats = detector->stats;
+}
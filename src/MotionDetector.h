@@ -0,0 +1,77 @@
+//============================================================================
+// Name        : MotionDetector.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Classifies every station as stationary, moving or absent
+//               from the variance and rate of change of its signal and its
+//               inactive time, updated with each sample in constant time
+//               and with hysteresis, and reports when a station changes
+//============================================================================
+
+#ifndef RADIOLOCATE_MOTIONDETECTOR_H
+#define RADIOLOCATE_MOTIONDETECTOR_H
+
+#include <stdint.h>
+
+#include "Mac.h"
+#include "Sample.h"
+
+enum md_state {
+	MD_ABSENT,             // unknown, gone quiet or idle too long
+	MD_STATIONARY,
+	MD_MOVING,
+};
+
+struct md_config {
+	uint32_t capacity;     // most stations tracked at once
+	uint64_t tau_us;       // time constant of the smoothed statistics
+	// Moving once the signal variance (dB^2) or its rate of change (dB/s)
+	// exceeds the first threshold; stationary again once both are below
+	// the second
+	float moving_variance, still_variance;
+	float moving_rate, still_rate;
+	uint32_t hold_samples; // samples in a row a new state must persist
+	uint32_t idle_ms;      // inactive time at which a listed station counts as absent
+	uint64_t absent_after_us; // not sampled for this long: absent, see md_tick()
+	uint64_t forget_after_us; // absent for this long: forgotten
+};
+
+void md_default_config(struct md_config *config);
+
+struct md_event {
+	mac_key mac;
+	uint32_t ifindex;
+	uint8_t from, to;      // enum md_state
+	uint64_t timestamp_us;
+	float variance;        // dB^2
+	float rate;            // of the smoothed signal, dB/s
+};
+
+// Called from md_update() and md_tick() whenever a station changes state
+typedef void (*md_event_fn)(void *arg, const struct md_event *event);
+
+struct md_stats {
+	uint64_t samples;
+	uint64_t events;
+	uint64_t overflows;    // samples of stations that didn't fit
+	uint32_t stations;
+	uint32_t moving;
+};
+
+struct motion_detector;
+
+struct motion_detector *md_create(const struct md_config *config, md_event_fn fn, void *arg);
+void md_destroy(struct motion_detector *detector);
+
+// Takes one sample, in timestamp order per station, and returns the
+// station's state after it
+enum md_state md_update(struct motion_detector *detector, const struct rl_sample *sample);
+
+// Marks stations that were not sampled for absent_after_us absent and
+// forgets long-absent ones. Call about once a second. Returns the number
+// of events
+int md_tick(struct motion_detector *detector, uint64_t now_us);
+
+enum md_state md_get(const struct motion_detector *detector, mac_key mac);
+void md_get_stats(const struct motion_detector *detector, struct md_stats *stats);
+
+#endif // RADIOLOCATE_MOTIONDETECTOR_H
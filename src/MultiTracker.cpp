@@ -0,0 +1,260 @@
+//============================================================================
+// Name        : MultiTracker.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Multi-target tracking of position fixes: gating, global
+//               nearest neighbour association and track birth/death
+//============================================================================
+
+#include "MultiTracker.h"
+#include "Assignment.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+// Constant-velocity Kalman filter on one axis. The axes are independent,
+// which keeps every matrix 2x2
+struct mtt_axis {
+	float p, v;
+	float pp, pv, vv; // covariance
+};
+
+struct mtt_state {
+	mtt_track track;
+	mtt_axis ax, ay;
+};
+
+struct mtt_tracker {
+	mtt_config config;
+	vector<mtt_state> tracks;
+	uint32_t next_id;
+	uint64_t last_us;
+
+	// Per-cycle scratch, kept to avoid allocating every cycle
+	assign_solver *solver;
+	vector<pair<uint64_t, int> > cells; // (grid cell, track), sorted
+	vector<assign_edge> edges;
+	vector<int> track_to_obs;
+	vector<char> obs_used;
+};
+
+void mtt_default_config(struct mtt_config *config)
+{
+	config->process_noise = 0.5f;
+	config->gate = 9.21f;
+	config->max_gate_radius = 10.0f;
+	config->birth_speed_sigma = 2.0f;
+	config->confirm_hits = 3;
+	config->max_misses = 10;
+	config->tentative_misses = 2;
+	config->max_assign_cells = 256 * 256;
+}
+
+struct mtt_tracker *mtt_create(const struct mtt_config *config)
+{
+	if (config->max_gate_radius <= 0.0f || config->gate <= 0.0f)
+		return NULL;
+	mtt_tracker *tracker = new mtt_tracker;
+	tracker->config = *config;
+	tracker->next_id = 1;
+	tracker->last_us = 0;
+	tracker->solver = assign_solver_create(config->max_assign_cells);
+	return tracker;
+}
+
+void mtt_destroy(struct mtt_tracker *tracker)
+{
+	if (!tracker)
+		return;
+	assign_solver_destroy(tracker->solver);
+	delete tracker;
+}
+
+/********************
+ *  Kalman filter   *
+ ********************/
+static void axis_predict(mtt_axis *a, float dt, float q)
+{
+	const float dt2 = dt * dt, dt3 = dt2 * dt;
+	a->p += a->v * dt;
+	// P = F P F' + Q for F = [1 dt; 0 1] and white-acceleration Q
+	a->pp += 2.0f * dt * a->pv + dt2 * a->vv + q * dt3 / 3.0f;
+	a->pv += dt * a->vv + q * dt2 / 2.0f;
+	a->vv += q * dt;
+}
+
+static void axis_update(mtt_axis *a, float z, float r)
+{
+	const float s = a->pp + r;
+	const float kp = a->pp / s, kv = a->pv / s;
+	const float innovation = z - a->p;
+	a->p += kp * innovation;
+	a->v += kv * innovation;
+	a->vv -= kv * a->pv;
+	a->pv -= kp * a->pv;
+	a->pp -= kp * a->pp;
+}
+
+/**********************
+ *  Spatial indexing  *
+ **********************/
+static inline uint64_t cell_key(int cx, int cy)
+{
+	return ((uint64_t) (uint32_t) cx << 32) | (uint32_t) cy;
+}
+
+static inline int cell_of(float v, float size)
+{
+	return (int) floorf(v / size);
+}
+
+// Lists every track/observation pair inside the gate. Tracks are bucketed
+// in a grid of max_gate_radius cells, so each observation only looks at the
+// 3 x 3 cells around it
+static void gate(mtt_tracker *tracker, const mtt_observation *obs, int count)
+{
+	const float size = tracker->config.max_gate_radius;
+	const float r2max = size * size;
+
+	tracker->cells.resize(tracker->tracks.size());
+	for (size_t i = 0; i < tracker->tracks.size(); i++) {
+		const mtt_state *s = &tracker->tracks[i];
+		tracker->cells[i] = make_pair(cell_key(cell_of(s->ax.p, size), cell_of(s->ay.p, size)), (int) i);
+	}
+	sort(tracker->cells.begin(), tracker->cells.end());
+
+	tracker->edges.clear();
+	for (int o = 0; o < count; o++) {
+		const int cx = cell_of(obs[o].x, size), cy = cell_of(obs[o].y, size);
+		const float r = obs[o].sigma * obs[o].sigma;
+		for (int dx = -1; dx <= 1; dx++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				vector<pair<uint64_t, int> >::const_iterator it =
+					lower_bound(tracker->cells.begin(), tracker->cells.end(), make_pair(cell_key(cx + dx, cy + dy), -1));
+				for (; it != tracker->cells.end() && it->first == cell_key(cx + dx, cy + dy); ++it) {
+					const mtt_state *s = &tracker->tracks[it->second];
+					const float ex = obs[o].x - s->ax.p, ey = obs[o].y - s->ay.p;
+					if (ex * ex + ey * ey > r2max)
+						continue;
+					const float sx = s->ax.pp + r, sy = s->ay.pp + r;
+					const float d2 = ex * ex / sx + ey * ey / sy;
+					if (d2 > tracker->config.gate)
+						continue;
+					// Negative log-likelihood up to a constant, so that a
+					// tight track beats a vague one at equal distance
+					assign_edge e = { it->second, o, d2 + logf(sx * sy) };
+					tracker->edges.push_back(e);
+				}
+			}
+		}
+	}
+}
+
+/****************
+ *  Public API  *
+ ****************/
+void mtt_update(struct mtt_tracker *tracker, const struct mtt_observation *obs, int count,
+                uint64_t now_us, struct mtt_cycle_stats *stats)
+{
+	const mtt_config *c = &tracker->config;
+	mtt_cycle_stats local;
+	if (!stats)
+		stats = &local;
+	memset(stats, 0, sizeof(*stats));
+
+	// Predict
+	const float dt = tracker->last_us && now_us > tracker->last_us ? (float) (now_us - tracker->last_us) * 1e-6f : 0.0f;
+	tracker->last_us = now_us;
+	if (dt > 0.0f) {
+		for (size_t i = 0; i < tracker->tracks.size(); i++) {
+			axis_predict(&tracker->tracks[i].ax, dt, c->process_noise);
+			axis_predict(&tracker->tracks[i].ay, dt, c->process_noise);
+		}
+	}
+
+	// Associate
+	gate(tracker, obs, count);
+	stats->gated_pairs = (int) tracker->edges.size();
+	tracker->track_to_obs.resize(tracker->tracks.size());
+	assign_stats as;
+	stats->assigned = assign_solve(tracker->solver, tracker->edges.empty() ? NULL : &tracker->edges[0],
+	                               (int) tracker->edges.size(), (int) tracker->tracks.size(), count,
+	                               tracker->track_to_obs.empty() ? NULL : &tracker->track_to_obs[0], &as);
+	stats->components = as.components;
+	stats->largest_component = as.largest;
+	stats->greedy_components = as.greedy;
+
+	// Update, and retire tracks that have missed too often
+	tracker->obs_used.assign(count, 0);
+	size_t alive = 0;
+	for (size_t i = 0; i < tracker->tracks.size(); i++) {
+		mtt_state s = tracker->tracks[i];
+		int o = tracker->track_to_obs[i];
+		if (o >= 0) {
+			const float r = obs[o].sigma * obs[o].sigma;
+			axis_update(&s.ax, obs[o].x, r);
+			axis_update(&s.ay, obs[o].y, r);
+			s.track.hits++;
+			s.track.misses = 0;
+			s.track.source = obs[o].source;
+			s.track.updated_us = now_us;
+			if (s.track.hits >= c->confirm_hits)
+				s.track.confirmed = true;
+			tracker->obs_used[o] = 1;
+		} else {
+			s.track.misses++;
+			if (s.track.misses > (s.track.confirmed ? c->max_misses : c->tentative_misses)) {
+				stats->died++;
+				continue;
+			}
+		}
+		tracker->tracks[alive++] = s;
+	}
+	tracker->tracks.resize(alive);
+
+	// Every observation nobody claimed starts a tentative track
+	for (int o = 0; o < count; o++) {
+		if (tracker->obs_used[o])
+			continue;
+		mtt_state s;
+		memset(&s, 0, sizeof(s));
+		const float r = obs[o].sigma * obs[o].sigma;
+		const float vr = c->birth_speed_sigma * c->birth_speed_sigma;
+		s.ax.p = obs[o].x;
+		s.ay.p = obs[o].y;
+		s.ax.pp = s.ay.pp = r;
+		s.ax.vv = s.ay.vv = vr;
+		s.track.id = tracker->next_id++;
+		s.track.hits = 1;
+		s.track.confirmed = c->confirm_hits <= 1;
+		s.track.source = obs[o].source;
+		s.track.born_us = s.track.updated_us = now_us;
+		tracker->tracks.push_back(s);
+		stats->born++;
+	}
+	stats->tracks = (int) tracker->tracks.size();
+}
+
+int mtt_track_count(const struct mtt_tracker *tracker)
+{
+	return (int) tracker->tracks.size();
+}
+
+bool mtt_get_track(const struct mtt_tracker *tracker, int index, struct mtt_track *track)
+{
+	if (index < 0 || index >= (int) tracker->tracks.size())
+		return false;
+	const mtt_state *s = &tracker->tracks[index];
+	*track = s->track;
+	track->x = s->ax.p;
+	track->y = s->ay.p;
+	track->vx = s->ax.v;
+	track->vy = s->ay.v;
+	track->sigma_x = sqrtf(s->ax.pp);
+	track->sigma_y = sqrtf(s->ay.pp);
+	return true;
+}
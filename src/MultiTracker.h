@@ -0,0 +1,71 @@
+//============================================================================
+// Name        : MultiTracker.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Multi-target tracking of position fixes: gating, global
+//               nearest neighbour association and track birth/death
+//============================================================================
+
+#ifndef RADIOLOCATE_MULTITRACKER_H
+#define RADIOLOCATE_MULTITRACKER_H
+
+#include <stdint.h>
+
+#include "Mac.h"
+
+struct mtt_config {
+	float process_noise;       // m^2/s^3, white-acceleration spectral density
+	float gate;                // chi-square gate on the 2-D innovation; 9.21 passes 99 %
+	float max_gate_radius;     // m, no observation further than this can join a track
+	float birth_speed_sigma;   // m/s, velocity uncertainty of a new track
+	int confirm_hits;          // hits before a tentative track is reported as confirmed
+	int max_misses;            // cycles without a hit before a confirmed track dies
+	int tentative_misses;      // the same for tentative tracks
+	int max_assign_cells;      // see assign_solver_create()
+};
+
+void mtt_default_config(struct mtt_config *config);
+
+// One position fix, e.g. from lg_locate() or a particle-filter estimate
+struct mtt_observation {
+	float x, y;                // m
+	float sigma;               // m, 1-sigma position error of the fix
+	mac_key source;            // device the fix was computed for, 0 if unknown
+};
+
+struct mtt_track {
+	uint32_t id;               // never reused
+	float x, y, vx, vy;
+	float sigma_x, sigma_y;    // m, position uncertainty
+	int hits, misses;          // total hits, consecutive misses
+	bool confirmed;
+	mac_key source;            // of the last observation assigned
+	uint64_t born_us, updated_us;
+};
+
+struct mtt_cycle_stats {
+	int tracks;                // alive after the cycle
+	int born, died;
+	int gated_pairs;           // track/observation pairs inside the gate
+	int assigned;
+	int components;            // independent association sub-problems
+	int largest_component;
+	int greedy_components;
+};
+
+struct mtt_tracker;
+
+struct mtt_tracker *mtt_create(const struct mtt_config *config);
+void mtt_destroy(struct mtt_tracker *tracker);
+
+// Runs one cycle: predicts every track to now_us, associates the
+// observations with the tracks, updates, starts tracks for the leftovers
+// and retires tracks that missed too often. Cost is linear in tracks plus
+// observations apart from the association of overlapping gates, which is
+// cubic only in the size of each cluster. stats may be NULL
+void mtt_update(struct mtt_tracker *tracker, const struct mtt_observation *obs, int count,
+                uint64_t now_us, struct mtt_cycle_stats *stats);
+
+int mtt_track_count(const struct mtt_tracker *tracker);
+bool mtt_get_track(const struct mtt_tracker *tracker, int index, struct mtt_track *track);
+
+#endif // RADIOLOCATE_MULTITRACKER_H
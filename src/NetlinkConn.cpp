@@ -0,0 +1,426 @@
+//============================================================================
+// Name        : NetlinkConn.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : One netlink socket with many requests in flight, matched
+//               to their replies by sequence number
+//============================================================================
+
+#include "NetlinkConn.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct rnl_pending {
+	uint32_t seq;          // 0 = free slot
+	bool dump;
+	bool interrupted;      // a reply carried NLM_F_DUMP_INTR
+	uint8_t restarts;
+	uint32_t datagrams;    // that carried replies to it
+	uint64_t last_datagram;
+	rnl_message_fn on_message;
+	rnl_done_fn on_done;
+	void *arg;
+	uint32_t request_len;  // dumps only
+	uint8_t request[RNL_MAX_REQUEST];
+};
+
+struct rnl_conn {
+	int fd;
+	uint32_t port;         // ours; replies carry it, others' notifications don't
+	uint32_t next_seq;
+	int pending;
+	int dumps_running;     // sent and neither finished nor refused
+
+	// Requests ready to send, and refused dumps waiting to be resent
+	uint8_t tx_storage[RNL_SEND_BUFFER];
+	rnl_buffer tx;
+	uint8_t parked_storage[RNL_SEND_BUFFER];
+	rnl_buffer parked;
+
+	rnl_message_fn on_notify;
+	void *notify_arg;
+	uint64_t datagram;     // dispatched so far, to count them per dump
+
+	rnl_pending slots[RNL_MAX_INFLIGHT];
+	uint8_t rx[RNL_RECV_BUFFER] __attribute__((aligned(8)));
+	rnl_conn_stats stats;
+};
+
+struct rnl_conn *rnl_conn_open(int protocol)
+{
+	const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open netlink socket: %s\n", strerror(errno));
+		return NULL;
+	}
+	struct sockaddr_nl local;
+	memset(&local, 0, sizeof(local));
+	local.nl_family = AF_NETLINK;
+	if (bind(fd, (struct sockaddr*) &local, sizeof(local))) {
+		fprintf(stderr, "Failed to bind netlink socket: %s\n", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	// Above the rmem_max sysctl only with CAP_NET_ADMIN
+	const int rcvbuf = RNL_SOCKET_RCVBUF;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)))
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	socklen_t addrlen = sizeof(local);
+	if (getsockname(fd, (struct sockaddr*) &local, &addrlen)) {
+		fprintf(stderr, "Failed to get netlink port: %s\n", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	rnl_conn *conn = new rnl_conn;
+	conn->fd = fd;
+	conn->port = local.nl_pid;
+	conn->on_notify = NULL;
+	conn->notify_arg = NULL;
+	conn->datagram = 0;
+	conn->next_seq = 1;
+	conn->pending = 0;
+	conn->dumps_running = 0;
+	rnl_buffer_init(&conn->tx, conn->tx_storage, sizeof(conn->tx_storage));
+	rnl_buffer_init(&conn->parked, conn->parked_storage, sizeof(conn->parked_storage));
+	memset(conn->slots, 0, sizeof(conn->slots));
+	memset(&conn->stats, 0, sizeof(conn->stats));
+	return conn;
+}
+
+void rnl_conn_close(struct rnl_conn *conn)
+{
+	if (!conn)
+		return;
+	close(conn->fd);
+	delete conn;
+}
+
+int rnl_conn_fd(const struct rnl_conn *conn)
+{
+	return conn->fd;
+}
+
+bool rnl_conn_join_group(struct rnl_conn *conn, uint32_t group)
+{
+	if (setsockopt(conn->fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group))) {
+		fprintf(stderr, "Failed to join netlink group %u: %s\n", group, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void rnl_conn_set_notify(struct rnl_conn *conn, rnl_message_fn on_notify, void *arg)
+{
+	conn->on_notify = on_notify;
+	conn->notify_arg = arg;
+}
+
+static inline bool is_dump(const struct nlmsghdr *hdr)
+{
+	return (hdr->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP;
+}
+
+static bool append(rnl_buffer *buf, const struct nlmsghdr *msg)
+{
+	const size_t len = NLMSG_ALIGN(msg->nlmsg_len);
+	if (buf->len + len > buf->capacity)
+		return false;
+	memcpy(buf->data + buf->len, msg, msg->nlmsg_len);
+	memset(buf->data + buf->len + msg->nlmsg_len, 0, len - msg->nlmsg_len);
+	buf->len += len;
+	return true;
+}
+
+// Once no dump is running, every refused one gets another try, again all
+// in one send
+static void resend_parked(rnl_conn *conn)
+{
+	if (conn->dumps_running || !conn->parked.len || conn->tx.len + conn->parked.len > conn->tx.capacity)
+		return;
+	for (size_t offset = 0; offset < conn->parked.len; ) {
+		const struct nlmsghdr *msg = (const struct nlmsghdr*) (conn->parked.data + offset);
+		append(&conn->tx, msg);
+		conn->dumps_running++;
+		offset += NLMSG_ALIGN(msg->nlmsg_len);
+	}
+	conn->parked.len = 0;
+}
+
+uint32_t rnl_conn_submit(struct rnl_conn *conn, const struct nlmsghdr *msg,
+                         rnl_message_fn on_message, rnl_done_fn on_done, void *arg)
+{
+	const uint32_t seq = conn->next_seq;
+	rnl_pending &slot = conn->slots[seq % RNL_MAX_INFLIGHT];
+	const bool dump = is_dump(msg);
+	if (slot.seq || (dump && msg->nlmsg_len > RNL_MAX_REQUEST))
+		return 0;
+
+	const size_t start = conn->tx.len;
+	if (!append(&conn->tx, msg))
+		return 0;
+	struct nlmsghdr *copy = (struct nlmsghdr*) (conn->tx.data + start);
+	copy->nlmsg_seq = seq;
+	copy->nlmsg_pid = 0;
+	copy->nlmsg_flags |= NLM_F_REQUEST;
+	if (!dump)
+		copy->nlmsg_flags |= NLM_F_ACK;
+
+	slot.seq = seq;
+	slot.dump = dump;
+	slot.interrupted = false;
+	slot.restarts = 0;
+	slot.datagrams = 0;
+	slot.last_datagram = 0;
+	slot.on_message = on_message;
+	slot.on_done = on_done;
+	slot.arg = arg;
+	slot.request_len = 0;
+	if (dump) {
+		slot.request_len = copy->nlmsg_len;
+		memcpy(slot.request, copy, copy->nlmsg_len);
+		conn->dumps_running++;
+	}
+	conn->pending++;
+	conn->stats.requests++;
+	conn->next_seq = seq + 1 ? seq + 1 : 1;
+	return seq;
+}
+
+bool rnl_conn_flush(struct rnl_conn *conn)
+{
+	// Refused dumps may have been left waiting for room in the send buffer
+	resend_parked(conn);
+	while (conn->tx.len) {
+		const ssize_t sent = send(conn->fd, conn->tx.data, conn->tx.len, 0);
+		conn->stats.send_calls++;
+		if (sent >= 0) {
+			conn->tx.len = 0;
+			break;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			struct pollfd pfd = { conn->fd, POLLOUT, 0 };
+			poll(&pfd, 1, -1);
+			continue;
+		}
+		fprintf(stderr, "Failed to send netlink requests: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+size_t rnl_conn_take_output(struct rnl_conn *conn, void *dst)
+{
+	resend_parked(conn);
+	const size_t len = conn->tx.len;
+	memcpy(dst, conn->tx.data, len);
+	conn->tx.len = 0;
+	return len;
+}
+
+static void finish(rnl_conn *conn, rnl_pending *slot, int error)
+{
+	const rnl_pending request = *slot;
+	slot->seq = 0;
+	conn->pending--;
+	if (error)
+		conn->stats.errors++;
+	if (request.dump) {
+		conn->dumps_running--;
+		conn->stats.dumps++;
+		conn->stats.dump_datagrams += request.datagrams;
+		if (request.datagrams > conn->stats.max_dump_datagrams)
+			conn->stats.max_dump_datagrams = request.datagrams;
+	}
+	if (request.on_done)
+		request.on_done(request.arg, error);
+}
+
+// The kernel's listing changed while a dump ran, so some entries may be
+// missing or doubled: have the caller drop what it got and ask again
+static bool restart(rnl_conn *conn, rnl_pending *slot)
+{
+	if (slot->restarts >= RNL_MAX_RESTARTS || !append(&conn->parked, (const struct nlmsghdr*) slot->request))
+		return false;
+	slot->restarts++;
+	slot->interrupted = false;
+	conn->dumps_running--;
+	conn->stats.dumps_restarted++;
+	if (slot->on_message)
+		slot->on_message(slot->arg, NULL);
+	return true;
+}
+
+int rnl_conn_dispatch(struct rnl_conn *conn, const void *data, size_t len)
+{
+	int messages = 0;
+	conn->datagram++;
+	int remaining = (int) len; // NLMSG_NEXT() may step past the end of an unsigned length
+	for (const struct nlmsghdr *hdr = (const struct nlmsghdr*) data; NLMSG_OK(hdr, remaining);
+	     hdr = NLMSG_NEXT(hdr, remaining)) {
+		messages++;
+		if (!hdr->nlmsg_seq || hdr->nlmsg_pid != conn->port) {
+			conn->stats.notifications++;
+			if (conn->on_notify)
+				conn->on_notify(conn->notify_arg, hdr);
+			continue;
+		}
+		rnl_pending *slot = &conn->slots[hdr->nlmsg_seq % RNL_MAX_INFLIGHT];
+		if (slot->seq != hdr->nlmsg_seq) {
+			conn->stats.unexpected++;
+			continue;
+		}
+		if (slot->last_datagram != conn->datagram) {
+			slot->last_datagram = conn->datagram;
+			slot->datagrams++;
+		}
+		if (hdr->nlmsg_flags & NLM_F_DUMP_INTR)
+			slot->interrupted = true;
+
+		switch (hdr->nlmsg_type) {
+		case NLMSG_NOOP:
+		case NLMSG_OVERRUN:
+			break;
+		case NLMSG_ERROR:
+		{
+			const struct nlmsgerr *err = (const struct nlmsgerr*) NLMSG_DATA(hdr);
+			const int error = hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(*err)) ? err->error : -EPROTO;
+			if (error == -EBUSY && slot->dump &&
+			    append(&conn->parked, (const struct nlmsghdr*) slot->request)) {
+				// Another of our dumps was running; try again after it
+				conn->dumps_running--;
+				conn->stats.dumps_refused++;
+				break;
+			}
+			finish(conn, slot, error);
+			break;
+		}
+		case NLMSG_DONE:
+		{
+			int error = 0;
+			if (hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(error)))
+				memcpy(&error, NLMSG_DATA(hdr), sizeof(error));
+			if (slot->interrupted && !error && restart(conn, slot))
+				break;
+			finish(conn, slot, slot->interrupted && !error ? -EINTR : error);
+			break;
+		}
+		default:
+			conn->stats.messages++;
+			if (slot->on_message)
+				slot->on_message(slot->arg, hdr);
+			break;
+		}
+	}
+	resend_parked(conn);
+	return messages;
+}
+
+int rnl_conn_receive(struct rnl_conn *conn, int timeout_ms)
+{
+	if (timeout_ms) {
+		struct pollfd pfd = { conn->fd, POLLIN, 0 };
+		const int ready = poll(&pfd, 1, timeout_ms);
+		if (ready < 0)
+			return errno == EINTR ? 0 : -errno;
+		if (!ready)
+			return 0;
+	}
+
+	// MSG_TRUNC: returns the full length of a datagram too big for rx
+	ssize_t len;
+	do {
+		len = recv(conn->fd, conn->rx, sizeof(conn->rx), MSG_TRUNC);
+		conn->stats.recv_calls++;
+	} while (len < 0 && errno == EINTR);
+	if (len < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : rnl_conn_read_error(conn, -errno);
+	if ((size_t) len > sizeof(conn->rx)) {
+		conn->stats.truncated++;
+		len = sizeof(conn->rx);
+	}
+
+	const int messages = rnl_conn_dispatch(conn, conn->rx, len);
+	if (!rnl_conn_flush(conn))
+		return -EIO;
+	return messages;
+}
+
+int rnl_conn_read_error(struct rnl_conn *conn, int error)
+{
+	if (error != -ENOBUFS)
+		return error;
+	// Only unpaced messages are lost this way: notifications, or the
+	// replies and acks of other requests. Dumps wait for room, but any
+	// other request in flight may never hear back: fail them all rather
+	// than wait forever. Their callbacks may submit more, so pick them
+	// first
+	conn->stats.overruns++;
+	uint32_t lost[RNL_MAX_INFLIGHT];
+	int count = 0;
+	for (int i = 0; i < RNL_MAX_INFLIGHT; i++)
+		if (conn->slots[i].seq && !conn->slots[i].dump)
+			lost[count++] = conn->slots[i].seq;
+	for (int i = 0; i < count; i++) {
+		rnl_pending *slot = &conn->slots[lost[i] % RNL_MAX_INFLIGHT];
+		if (slot->seq == lost[i])
+			finish(conn, slot, -ENOBUFS);
+	}
+	if (conn->on_notify)
+		conn->on_notify(conn->notify_arg, NULL);
+	return 0;
+}
+
+struct rnl_call {
+	rnl_message_fn on_message;
+	void *arg;
+	int done;              // 1, or a negative errno
+};
+
+static void call_message(void *arg, const struct nlmsghdr *hdr)
+{
+	rnl_call *call = (rnl_call*) arg;
+	if (call->on_message)
+		call->on_message(call->arg, hdr);
+}
+
+static void call_done(void *arg, int error)
+{
+	((rnl_call*) arg)->done = error ? error : 1;
+}
+
+int rnl_conn_call(struct rnl_conn *conn, const struct nlmsghdr *msg, rnl_message_fn on_message, void *arg)
+{
+	rnl_call call = { on_message, arg, 0 };
+	if (!rnl_conn_submit(conn, msg, call_message, call_done, &call))
+		return -ENOBUFS;
+	if (!rnl_conn_flush(conn))
+		return -EIO;
+	while (!call.done) {
+		const int n = rnl_conn_receive(conn, -1);
+		if (n < 0)
+			return n;
+	}
+	return call.done < 0 ? call.done : 0;
+}
+
+int rnl_conn_pending(const struct rnl_conn *conn)
+{
+	return conn->pending;
+}
+
+bool rnl_conn_has_output(const struct rnl_conn *conn)
+{
+	return conn->tx.len || (conn->parked.len && !conn->dumps_running);
+}
+
+void rnl_conn_get_stats(const struct rnl_conn *conn, struct rnl_conn_stats *stats)
+{
+	*stats = conn->stats;
+}
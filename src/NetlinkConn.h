@@ -0,0 +1,111 @@
+//============================================================================
+// Name        : NetlinkConn.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : One netlink socket with many requests in flight, matched
+//               to their replies by sequence number. I/O and dispatch are
+//               separate so that other event loops can drive it
+//============================================================================
+
+#ifndef RADIOLOCATE_NETLINKCONN_H
+#define RADIOLOCATE_NETLINKCONN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "NetlinkMessage.h"
+
+// Requests in flight per socket
+#define RNL_MAX_INFLIGHT 256
+// Longest dump request; dumps keep a copy in case they have to be resent
+#define RNL_MAX_REQUEST 128
+#define RNL_SEND_BUFFER 16384
+// The kernel sizes dump datagrams after our reads, up to 32 KB, so this
+// takes the most entries per recv() there is
+#define RNL_RECV_BUFFER 32768
+// Socket receive queue; dumps are paced by our reads, but notifications
+// and the replies to a large batch are not
+#define RNL_SOCKET_RCVBUF (1 << 20)
+// Times an interrupted dump (NLM_F_DUMP_INTR) is started over before it
+// fails with EINTR
+#define RNL_MAX_RESTARTS 3
+
+// Every reply message of a request other than the final ack / NLMSG_DONE.
+// hdr is NULL when a dump starts over: whatever it delivered so far is
+// stale. Notify callbacks get NULL when notifications were lost
+typedef void (*rnl_message_fn)(void *arg, const struct nlmsghdr *hdr);
+// The request is finished: 0, or a negative errno from the kernel
+typedef void (*rnl_done_fn)(void *arg, int error);
+
+struct rnl_conn_stats {
+	uint64_t requests;
+	uint64_t messages;     // reply messages dispatched
+	uint64_t send_calls;
+	uint64_t recv_calls;
+	uint64_t dumps_refused; // dumps the kernel turned away with EBUSY and we resent
+	uint64_t dumps_restarted; // interrupted by a change to what they listed, and resent
+	uint64_t dumps;        // dumps finished
+	uint64_t dump_datagrams; // datagrams (recv() calls) they took, so the mean is this / dumps
+	uint64_t max_dump_datagrams;
+	uint64_t errors;       // requests that finished with an error
+	uint64_t unexpected;   // replies to no request in flight
+	uint64_t notifications; // multicast messages, see rnl_conn_set_notify()
+	uint64_t overruns;     // the receive queue overflowed (ENOBUFS)
+	uint64_t truncated;    // datagrams larger than RNL_RECV_BUFFER
+};
+
+struct rnl_conn;
+
+// protocol is e.g. NETLINK_GENERIC. The socket is non-blocking
+struct rnl_conn *rnl_conn_open(int protocol);
+void rnl_conn_close(struct rnl_conn *conn);
+int rnl_conn_fd(const struct rnl_conn *conn);
+
+// Subscribes to a multicast group: a generic netlink group id from
+// rnl_family_group(), or e.g. RTNLGRP_LINK
+bool rnl_conn_join_group(struct rnl_conn *conn, uint32_t group);
+// Where multicast messages go (they answer no request of ours); without
+// it they are dropped
+void rnl_conn_set_notify(struct rnl_conn *conn, rnl_message_fn on_notify, void *arg);
+
+// Queues a copy of the request in msg (one message, its sequence number is
+// replaced). Non-dump requests get NLM_F_ACK so that they can complete.
+// Everything queued goes out together in the next flush, dumps included,
+// so one cycle of requests costs one send. The kernel runs one dump per
+// socket at a time: one that finds another still running is refused with
+// EBUSY, which this hides by resending it once every dump in flight has
+// finished. Small dumps finish inside the send, so usually none are.
+// Returns the sequence number, or 0 if too much is already in flight
+uint32_t rnl_conn_submit(struct rnl_conn *conn, const struct nlmsghdr *msg,
+                         rnl_message_fn on_message, rnl_done_fn on_done, void *arg);
+
+// Sends everything queued in one send(). Returns false on a socket error
+bool rnl_conn_flush(struct rnl_conn *conn);
+
+// Reads and dispatches one datagram, waiting up to timeout_ms (-1 forever,
+// 0 not at all), then flushes whatever the callbacks queued. Returns the
+// number of messages dispatched, 0 on timeout, or a negative errno
+int rnl_conn_receive(struct rnl_conn *conn, int timeout_ms);
+
+// For other I/O backends: moves everything queued for sending into dst
+// (RNL_SEND_BUFFER bytes) and returns its length, to be sent as one
+// datagram; dispatches a datagram they read; and takes the error a read
+// failed with, returning 0 if it was handled or the error. ENOBUFS is: the
+// requests in flight other than dumps fail with it, since their replies
+// may be the ones lost
+size_t rnl_conn_take_output(struct rnl_conn *conn, void *dst);
+int rnl_conn_dispatch(struct rnl_conn *conn, const void *data, size_t len);
+int rnl_conn_read_error(struct rnl_conn *conn, int error);
+
+// Blocking round trip for setup: submits msg, flushes and receives until
+// it finishes. Other requests in flight are dispatched meanwhile. Returns
+// 0 or a negative errno
+int rnl_conn_call(struct rnl_conn *conn, const struct nlmsghdr *msg, rnl_message_fn on_message, void *arg);
+
+// Requests submitted but not finished
+int rnl_conn_pending(const struct rnl_conn *conn);
+// True if something is waiting for rnl_conn_flush()
+bool rnl_conn_has_output(const struct rnl_conn *conn);
+
+void rnl_conn_get_stats(const struct rnl_conn *conn, struct rnl_conn_stats *stats);
+
+#endif // RADIOLOCATE_NETLINKCONN_H
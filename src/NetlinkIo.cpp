@@ -0,0 +1,622 @@
+//============================================================================
+// Name        : NetlinkIo.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : io_uring and epoll I/O backends driving a NetlinkConn
+//============================================================================
+
+#include "NetlinkIo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+// Output is double-buffered: one buffer is being written while the other fills
+#define RNL_IO_OUTPUT 65536
+#define RNL_IO_ENTRIES 32
+// Reads queued on the netlink socket at once, hard-linked so that they run
+// one after the other: datagrams keep their order, and a dump spread over
+// several of them usually completes in a single io_uring_enter()
+#define RNL_IO_READS 8
+
+enum {
+	TAG_NETLINK_READ = 1,
+	TAG_NETLINK_WRITE,
+	TAG_TIMER_READ,
+	TAG_OUTPUT_WRITE,
+	TAG_WATCH_POLL,
+	TAG_CANCEL,
+};
+
+// Registered with io_uring as fixed buffers, in this order
+enum {
+	BUF_TX,
+	BUF_TIMER,
+	BUF_OUTPUT,            // two of them
+	BUF_RX = BUF_OUTPUT + 2, // RNL_IO_READS of them
+	BUF_COUNT = BUF_RX + RNL_IO_READS
+};
+
+struct io_buffers {
+	uint8_t tx[RNL_SEND_BUFFER] __attribute__((aligned(8)));
+	uint8_t rx[RNL_IO_READS][RNL_RECV_BUFFER] __attribute__((aligned(8)));
+	uint64_t timer;
+	uint8_t output[2][RNL_IO_OUTPUT];
+};
+
+// The parts of the rings we touch, mapped from the kernel
+struct uring {
+	int fd;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned sq_local_tail;
+	unsigned to_submit;
+};
+
+struct rnl_io {
+	rnl_conn *conn;
+	rnl_io_config config;
+	rnl_io_backend backend;
+	int timer_fd;
+	uint64_t timer_deadline; // armed by rnl_io_set_timer(), 0 for none
+	io_buffers *buffers;
+	size_t output_len[2];
+	int output_fill;       // buffer rnl_io_write() appends to
+	rnl_io_stats stats;
+
+	// RNL_IO_EPOLL
+	int epoll_fd;
+
+	// RNL_IO_URING
+	uring ring;
+	int reads_pending;     // of the current chain
+	bool send_pending, timer_pending, watch_pending;
+	int output_pending;    // buffer being written, -1 for none
+};
+
+void rnl_io_default_config(struct rnl_io_config *config)
+{
+	config->use_uring = true;
+	config->timer_us = 0;
+	config->on_timer = NULL;
+	config->arg = NULL;
+	config->output_fd = -1;
+	config->watch_fd = -1;
+	config->on_ready = NULL;
+}
+
+/**************
+ *  io_uring  *
+ **************/
+static void uring_unmap(uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	ring->fd = -1;
+}
+
+static bool uring_setup(rnl_io *io)
+{
+	uring *ring = &io->ring;
+	memset(ring, 0, sizeof(*ring));
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, RNL_IO_ENTRIES, &params);
+	if (ring->fd < 0) {
+		ring->fd = -1;
+		fprintf(stderr, "io_uring unavailable (%s), using epoll.\n", strerror(errno));
+		return false;
+	}
+	// Waiting with a timeout needs IORING_ENTER_EXT_ARG (5.11)
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+		fprintf(stderr, "io_uring too old, using epoll.\n");
+		uring_unmap(ring);
+		return false;
+	}
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                     ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		uring_unmap(ring);
+		return false;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                     ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			uring_unmap(ring);
+			return false;
+		}
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe*) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+	                                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		uring_unmap(ring);
+		return false;
+	}
+
+	uint8_t *sq = (uint8_t*) ring->sq_ring, *cq = (uint8_t*) ring->cq_ring;
+	ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*) (sq + params.sq_off.array);
+	ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+	ring->sq_local_tail = *ring->sq_tail;
+
+	// Registered buffers skip the page pinning of every single read and write
+	struct iovec iov[BUF_COUNT];
+	iov[BUF_TX].iov_base = io->buffers->tx;
+	iov[BUF_TX].iov_len = sizeof(io->buffers->tx);
+	for (int i = 0; i < RNL_IO_READS; i++) {
+		iov[BUF_RX + i].iov_base = io->buffers->rx[i];
+		iov[BUF_RX + i].iov_len = RNL_RECV_BUFFER;
+	}
+	iov[BUF_TIMER].iov_base = &io->buffers->timer;
+	iov[BUF_TIMER].iov_len = sizeof(io->buffers->timer);
+	for (int i = 0; i < 2; i++) {
+		iov[BUF_OUTPUT + i].iov_base = io->buffers->output[i];
+		iov[BUF_OUTPUT + i].iov_len = RNL_IO_OUTPUT;
+	}
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, BUF_COUNT)) {
+		fprintf(stderr, "Failed to register io_uring buffers (%s), using epoll.\n", strerror(errno));
+		uring_unmap(ring);
+		return false;
+	}
+	return true;
+}
+
+// Only ever called with fewer than RNL_IO_ENTRIES outstanding submissions
+static struct io_uring_sqe *uring_prep(uring *ring, uint8_t opcode, int fd, void *addr, size_t len, uint64_t offset,
+                       int buf_index, uint64_t tag, uint8_t flags = 0)
+{
+	const unsigned index = ring->sq_local_tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t) (uintptr_t) addr;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->buf_index = buf_index;
+	sqe->flags = flags;
+	sqe->user_data = tag;
+	ring->sq_array[index] = index;
+	ring->sq_local_tail++;
+	ring->to_submit++;
+	return sqe;
+}
+
+static int uring_enter(rnl_io *io, int64_t timeout_us)
+{
+	uring *ring = &io->ring;
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	if (timeout_us >= 0) {
+		ts.tv_sec = timeout_us / 1000000;
+		ts.tv_nsec = (timeout_us % 1000000) * 1000;
+		arg.ts = (uint64_t) (uintptr_t) &ts;
+	}
+	const unsigned wait = timeout_us == 0 ? 0 : 1;
+	int ret;
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait,
+		              IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		io->stats.syscalls++;
+	} while (ret < 0 && errno == EINTR);
+	if (ret >= 0)
+		ring->to_submit -= ret;
+	else if (errno != ETIME)
+		return -errno;
+	return 0;
+}
+
+static void uring_submit_output(rnl_io *io)
+{
+	const int fill = io->output_fill;
+	if (io->output_pending >= 0 || !io->output_len[fill])
+		return;
+	// -1: at the file position, like write()
+	uring_prep(&io->ring, IORING_OP_WRITE_FIXED, io->config.output_fd, io->buffers->output[fill],
+	           io->output_len[fill], (uint64_t) -1, BUF_OUTPUT + fill, TAG_OUTPUT_WRITE);
+	io->output_pending = fill;
+	io->output_fill = !fill;
+	io->output_len[!fill] = 0;
+	io->stats.writes++;
+	io->stats.write_bytes += io->output_len[fill];
+}
+
+static int uring_poll(rnl_io *io, int64_t timeout_us)
+{
+	uring *ring = &io->ring;
+	const int nl_fd = rnl_conn_fd(io->conn);
+
+	// One send at a time keeps the requests in order
+	if (!io->send_pending) {
+		const size_t len = rnl_conn_take_output(io->conn, io->buffers->tx);
+		if (len) {
+			uring_prep(ring, IORING_OP_WRITE_FIXED, nl_fd, io->buffers->tx, len, 0, BUF_TX, TAG_NETLINK_WRITE);
+			io->send_pending = true;
+		}
+	}
+	// A new chain only once the last one is used up, or two reads could
+	// run at the same time and complete out of order. Hard links, because
+	// a short read (every datagram) would break a normal link
+	if (!io->reads_pending) {
+		for (int i = 0; i < RNL_IO_READS; i++)
+			uring_prep(ring, IORING_OP_READ_FIXED, nl_fd, io->buffers->rx[i], RNL_RECV_BUFFER, 0, BUF_RX + i,
+			           TAG_NETLINK_READ | (i << 8), i + 1 < RNL_IO_READS ? IOSQE_IO_HARDLINK : 0);
+		io->reads_pending = RNL_IO_READS;
+	}
+	if (io->timer_fd >= 0 && !io->timer_pending) {
+		uring_prep(ring, IORING_OP_READ_FIXED, io->timer_fd, &io->buffers->timer, sizeof(io->buffers->timer),
+		           0, BUF_TIMER, TAG_TIMER_READ);
+		io->timer_pending = true;
+	}
+	// One-shot, re-armed after each on_ready()
+	if (io->config.watch_fd >= 0 && !io->watch_pending) {
+		uring_prep(ring, IORING_OP_POLL_ADD, io->config.watch_fd, NULL, 0, 0, 0, TAG_WATCH_POLL)->poll32_events = POLLIN;
+		io->watch_pending = true;
+	}
+	uring_submit_output(io);
+
+	const int ret = uring_enter(io, timeout_us);
+	if (ret < 0)
+		return ret;
+
+	int events = 0;
+	unsigned head = *ring->cq_head;
+	const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	int error = 0;
+	for (; head != tail; head++) {
+		const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		const int res = cqe->res;
+		events++;
+		switch (cqe->user_data & 0xff) {
+		case TAG_NETLINK_READ:
+			io->reads_pending--;
+			if (res > 0) {
+				io->stats.datagrams++;
+				rnl_conn_dispatch(io->conn, io->buffers->rx[cqe->user_data >> 8], res);
+			} else if (res < 0 && res != -EAGAIN && res != -EINTR && rnl_conn_read_error(io->conn, res))
+				error = res;
+			break;
+		case TAG_NETLINK_WRITE:
+			io->send_pending = false;
+			if (res < 0)
+				error = res;
+			break;
+		case TAG_TIMER_READ:
+			io->timer_pending = false;
+			io->timer_deadline = 0;
+			io->stats.timer_reads++;
+			if (res == sizeof(io->buffers->timer) && io->config.on_timer)
+				io->config.on_timer(io->config.arg, io->buffers->timer);
+			break;
+		case TAG_OUTPUT_WRITE:
+			io->output_pending = -1;
+			if (res < 0)
+				fprintf(stderr, "Output write failed: %s\n", strerror(-res));
+			break;
+		case TAG_WATCH_POLL:
+			io->watch_pending = false;
+			io->stats.watch_ready++;
+			if (res > 0 && io->config.on_ready)
+				io->config.on_ready(io->config.arg);
+			break;
+		}
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return error ? error : events;
+}
+
+// The registered buffers must outlive every request that uses them:
+// cancels the reads still waiting and reaps all of them before they go.
+// Returns false if some never completed
+static bool uring_cancel(rnl_io *io)
+{
+	uring *ring = &io->ring;
+	if (io->timer_pending)
+		uring_prep(ring, IORING_OP_ASYNC_CANCEL, -1, (void*) (uintptr_t) TAG_TIMER_READ, 0, 0, 0, TAG_CANCEL);
+	if (io->watch_pending)
+		uring_prep(ring, IORING_OP_ASYNC_CANCEL, -1, (void*) (uintptr_t) TAG_WATCH_POLL, 0, 0, 0, TAG_CANCEL);
+
+	int cancelled = 0;     // reads of the chain
+	while (io->reads_pending || io->timer_pending || io->watch_pending || io->send_pending ||
+	       io->output_pending >= 0) {
+		// A hard link goes on to the next read of the chain when one is
+		// cancelled, so they go one at a time
+		const int current = RNL_IO_READS - io->reads_pending;
+		if (io->reads_pending && cancelled <= current) {
+			uring_prep(ring, IORING_OP_ASYNC_CANCEL, -1, (void*) (uintptr_t) (TAG_NETLINK_READ | (current << 8)),
+			           0, 0, 0, TAG_CANCEL);
+			cancelled = current + 1;
+		}
+		if (uring_enter(io, 100000) < 0)
+			return false;
+		unsigned head = *ring->cq_head;
+		const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+			return false;
+		for (; head != tail; head++)
+			switch (ring->cqes[head & *ring->cq_mask].user_data & 0xff) {
+			case TAG_NETLINK_READ:
+				io->reads_pending--;
+				break;
+			case TAG_NETLINK_WRITE:
+				io->send_pending = false;
+				break;
+			case TAG_TIMER_READ:
+				io->timer_pending = false;
+				break;
+			case TAG_OUTPUT_WRITE:
+				io->output_pending = -1;
+				break;
+			case TAG_WATCH_POLL:
+				io->watch_pending = false;
+				break;
+			}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return true;
+}
+
+/***********
+ *  epoll  *
+ ***********/
+static bool epoll_setup(rnl_io *io)
+{
+	io->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (io->epoll_fd < 0) {
+		fprintf(stderr, "Failed to create epoll instance: %s\n", strerror(errno));
+		return false;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = TAG_NETLINK_READ;
+	if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, rnl_conn_fd(io->conn), &ev))
+		return false;
+	if (io->timer_fd >= 0) {
+		ev.data.u64 = TAG_TIMER_READ;
+		if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, io->timer_fd, &ev))
+			return false;
+	}
+	if (io->config.watch_fd >= 0) {
+		ev.data.u64 = TAG_WATCH_POLL;
+		if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, io->config.watch_fd, &ev))
+			return false;
+	}
+	return true;
+}
+
+static int epoll_poll(rnl_io *io, int64_t timeout_us)
+{
+	rnl_conn_stats before, after;
+	rnl_conn_get_stats(io->conn, &before);
+
+	// Output goes out with a plain write() per wakeup
+	const int fill = io->output_fill;
+	if (io->output_len[fill]) {
+		const ssize_t written = write(io->config.output_fd, io->buffers->output[fill], io->output_len[fill]);
+		io->stats.syscalls++;
+		io->stats.writes++;
+		if (written < 0)
+			fprintf(stderr, "Output write failed: %s\n", strerror(errno));
+		else
+			io->stats.write_bytes += written;
+		io->output_len[fill] = 0;
+	}
+
+	int events = 0, error = 0;
+	if (!rnl_conn_flush(io->conn))
+		error = -EIO;
+
+	// epoll_wait() only knows milliseconds; the epoll fd itself can be
+	// waited on with ppoll() for anything finer
+	int timeout_ms = timeout_us < 0 ? -1 : (int) (timeout_us / 1000);
+	if (timeout_us > 0 && timeout_us % 1000) {
+		struct pollfd pfd = { io->epoll_fd, POLLIN, 0 };
+		struct timespec ts;
+		ts.tv_sec = timeout_us / 1000000;
+		ts.tv_nsec = (timeout_us % 1000000) * 1000;
+		ppoll(&pfd, 1, &ts, NULL);
+		io->stats.syscalls++;
+		timeout_ms = 0;
+	}
+	struct epoll_event ev[3];
+	const int n = epoll_wait(io->epoll_fd, ev, 3, timeout_ms);
+	io->stats.syscalls++;
+	if (n < 0 && errno != EINTR)
+		error = -errno;
+	for (int i = 0; i < n; i++) {
+		events++;
+		if (ev[i].data.u64 == TAG_TIMER_READ) {
+			uint64_t expirations;
+			io->stats.syscalls++;
+			io->stats.timer_reads++;
+			io->timer_deadline = 0;
+			if (read(io->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations) && io->config.on_timer)
+				io->config.on_timer(io->config.arg, expirations);
+			continue;
+		}
+		if (ev[i].data.u64 == TAG_WATCH_POLL) {
+			io->stats.watch_ready++;
+			if (io->config.on_ready)
+				io->config.on_ready(io->config.arg);
+			continue;
+		}
+		// Drain the socket; the last recv() is the one that finds it empty
+		int r;
+		while ((r = rnl_conn_receive(io->conn, 0)) > 0)
+			io->stats.datagrams++;
+		if (r < 0)
+			error = r;
+	}
+
+	rnl_conn_get_stats(io->conn, &after);
+	io->stats.syscalls += (after.send_calls - before.send_calls) + (after.recv_calls - before.recv_calls);
+	return error ? error : events;
+}
+
+/************
+ *  Common  *
+ ************/
+struct rnl_io *rnl_io_create(struct rnl_conn *conn, const struct rnl_io_config *config)
+{
+	rnl_io *io = new rnl_io;
+	memset(io, 0, sizeof(*io));
+	io->conn = conn;
+	io->config = *config;
+	io->timer_fd = -1;
+	io->epoll_fd = -1;
+	io->ring.fd = -1;
+	io->output_pending = -1;
+	io->buffers = new io_buffers;
+
+	if (config->on_timer) {
+		// io_uring waits for a blocking fd itself, while epoll needs it non-blocking
+		io->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | (config->use_uring ? 0 : TFD_NONBLOCK));
+		struct itimerspec spec;
+		spec.it_interval.tv_sec = config->timer_us / 1000000;
+		spec.it_interval.tv_nsec = (config->timer_us % 1000000) * 1000;
+		spec.it_value = spec.it_interval;
+		if (io->timer_fd < 0 || (config->timer_us && timerfd_settime(io->timer_fd, 0, &spec, NULL))) {
+			fprintf(stderr, "Failed to create timer: %s\n", strerror(errno));
+			rnl_io_destroy(io);
+			return NULL;
+		}
+	}
+
+	if (config->use_uring && uring_setup(io)) {
+		io->backend = RNL_IO_URING;
+		// A non-blocking socket would make reads fail with EAGAIN instead of waiting
+		const int nl_fd = rnl_conn_fd(conn);
+		fcntl(nl_fd, F_SETFL, fcntl(nl_fd, F_GETFL) & ~O_NONBLOCK);
+		return io;
+	}
+
+	io->backend = RNL_IO_EPOLL;
+	if (io->timer_fd >= 0)
+		fcntl(io->timer_fd, F_SETFL, fcntl(io->timer_fd, F_GETFL) | O_NONBLOCK);
+	if (!epoll_setup(io)) {
+		rnl_io_destroy(io);
+		return NULL;
+	}
+	return io;
+}
+
+void rnl_io_destroy(struct rnl_io *io)
+{
+	if (!io)
+		return;
+	// Let the last output reach the file
+	if (io->backend == RNL_IO_URING && io->ring.fd >= 0) {
+		while (io->output_pending >= 0 || io->output_len[io->output_fill]) {
+			uring_submit_output(io);
+			if (uring_poll(io, 100000) < 0)
+				break;
+		}
+	} else if (io->backend == RNL_IO_EPOLL && io->output_len[io->output_fill])
+		epoll_poll(io, 0);
+
+	// Closing the ring doesn't wait for the reads still queued, and the
+	// kernel would go on writing into the freed buffers; if they can't be
+	// cancelled they are leaked instead
+	const bool idle = io->backend != RNL_IO_URING || io->ring.fd < 0 || uring_cancel(io);
+	if (!idle)
+		fprintf(stderr, "io_uring requests still pending at teardown.\n");
+	uring_unmap(&io->ring);
+	if (io->epoll_fd >= 0)
+		close(io->epoll_fd);
+	if (io->timer_fd >= 0)
+		close(io->timer_fd);
+	if (idle)
+		delete io->buffers;
+	delete io;
+}
+
+enum rnl_io_backend rnl_io_get_backend(const struct rnl_io *io)
+{
+	return io->backend;
+}
+
+int rnl_io_poll(struct rnl_io *io, int64_t timeout_us)
+{
+	io->stats.wakeups++;
+	return io->backend == RNL_IO_URING ? uring_poll(io, timeout_us) : epoll_poll(io, timeout_us);
+}
+
+bool rnl_io_set_timer(struct rnl_io *io, uint64_t deadline_us)
+{
+	if (io->timer_fd < 0)
+		return false;
+	if (deadline_us == io->timer_deadline)
+		return true;
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = deadline_us / 1000000;
+	spec.it_value.tv_nsec = (deadline_us % 1000000) * 1000;
+	io->stats.syscalls++;
+	io->stats.timer_sets++;
+	if (timerfd_settime(io->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL))
+		return false;
+	io->timer_deadline = deadline_us;
+	return true;
+}
+
+bool rnl_io_write(struct rnl_io *io, const void *data, size_t len)
+{
+	if (io->config.output_fd < 0)
+		return false;
+	size_t &filled = io->output_len[io->output_fill];
+	if (filled + len > RNL_IO_OUTPUT)
+		return false;
+	memcpy(io->buffers->output[io->output_fill] + filled, data, len);
+	filled += len;
+	return true;
+}
+
+void rnl_io_get_stats(const struct rnl_io *io, struct rnl_io_stats *stats)
+{
+	*stats = io->stats;
+}
@@ -0,0 +1,75 @@
+//============================================================================
+// Name        : NetlinkIo.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : I/O backends driving a NetlinkConn: io_uring with registered
+//               buffers, so that sending requests, receiving replies,
+//               reading a timerfd and writing output share one syscall per
+//               wakeup, or epoll where io_uring is unavailable
+//============================================================================
+
+#ifndef RADIOLOCATE_NETLINKIO_H
+#define RADIOLOCATE_NETLINKIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "NetlinkConn.h"
+
+enum rnl_io_backend {
+	RNL_IO_EPOLL,
+	RNL_IO_URING,
+};
+
+// Called with the number of timer periods that elapsed since the last call
+// (1 for a deadline set with rnl_io_set_timer())
+typedef void (*rnl_timer_fn)(void *arg, uint64_t expirations);
+// watch_fd is readable; read it until it would block
+typedef void (*rnl_ready_fn)(void *arg);
+
+struct rnl_io_config {
+	bool use_uring;          // false forces epoll
+	uint64_t timer_us;       // period of the timerfd, 0 for deadlines from rnl_io_set_timer()
+	rnl_timer_fn on_timer;   // NULL for no timerfd
+	void *arg;               // for on_timer and on_ready
+	int output_fd;           // where rnl_io_write() goes, -1 for nowhere
+	int watch_fd;            // another non-blocking fd to wait on (e.g. a second socket), -1 for none
+	rnl_ready_fn on_ready;
+};
+
+void rnl_io_default_config(struct rnl_io_config *config);
+
+struct rnl_io_stats {
+	uint64_t syscalls;       // every syscall the backend made
+	uint64_t wakeups;        // rnl_io_poll() calls
+	uint64_t datagrams;      // netlink datagrams received
+	uint64_t timer_reads;
+	uint64_t timer_sets;     // timerfd_settime() calls of rnl_io_set_timer()
+	uint64_t watch_ready;    // times watch_fd was found readable
+	uint64_t writes;         // output write()s or write submissions
+	uint64_t write_bytes;
+};
+
+struct rnl_io;
+
+// Takes over driving conn (which must outlive it). Falls back to epoll
+// if io_uring can't be set up
+struct rnl_io *rnl_io_create(struct rnl_conn *conn, const struct rnl_io_config *config);
+void rnl_io_destroy(struct rnl_io *io);
+enum rnl_io_backend rnl_io_get_backend(const struct rnl_io *io);
+
+// Sends whatever conn has queued, waits up to timeout_us (-1 forever) for
+// replies, timer ticks, watch_fd or write completions and dispatches them. Returns
+// the number of events handled, 0 on timeout or a negative errno
+int rnl_io_poll(struct rnl_io *io, int64_t timeout_us);
+
+// Has the timerfd fire once at deadline_us (CLOCK_MONOTONIC), 0 to disarm
+// it. Setting the deadline already armed costs no syscall, so it can be
+// called before every poll. False without a timerfd
+bool rnl_io_set_timer(struct rnl_io *io, uint64_t deadline_us);
+
+// Queues bytes for output_fd. Returns false if the output can't keep up
+bool rnl_io_write(struct rnl_io *io, const void *data, size_t len);
+
+void rnl_io_get_stats(const struct rnl_io *io, struct rnl_io_stats *stats);
+
+#endif // RADIOLOCATE_NETLINKIO_H
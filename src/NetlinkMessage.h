@@ -0,0 +1,230 @@
+//============================================================================
+// Name        : NetlinkMessage.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Allocation-free building and parsing of raw (generic)
+//               netlink messages in caller-provided buffers. Prefixed rnl_
+//               so that it can't clash with the nla_ / nlmsg_ names of the
+//               kernel headers or of a netlink library in the same program
+//============================================================================
+
+#ifndef RADIOLOCATE_NETLINKMESSAGE_H
+#define RADIOLOCATE_NETLINKMESSAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+
+// Strips NLA_F_NESTED / NLA_F_NET_BYTEORDER from an attribute type
+#define RNL_ATTR_TYPE(nla) ((nla)->nla_type & NLA_TYPE_MASK)
+
+/**************
+ *  Building  *
+ **************/
+
+// Messages are appended back to back, so that one buffer can carry a whole
+// batch to the kernel in a single send
+struct rnl_buffer {
+	uint8_t *data;
+	size_t len;
+	size_t capacity;
+};
+
+static inline void rnl_buffer_init(struct rnl_buffer *buf, void *storage, size_t capacity)
+{
+	buf->data = (uint8_t*) storage;
+	buf->len = 0;
+	buf->capacity = capacity;
+}
+
+// Offset of the message being built, for the rnl_put*() calls that follow
+typedef size_t rnl_msg;
+#define RNL_NO_MSG ((rnl_msg) -1)
+
+static inline struct nlmsghdr *rnl_header(struct rnl_buffer *buf, rnl_msg msg)
+{
+	return (struct nlmsghdr*) (buf->data + msg);
+}
+
+// Reserves len zeroed bytes at the end of msg, padded to NLMSG_ALIGNTO
+static inline void *rnl_reserve(struct rnl_buffer *buf, rnl_msg msg, size_t len)
+{
+	const size_t aligned = NLMSG_ALIGN(len);
+	if (buf->len + aligned > buf->capacity)
+		return NULL;
+	void *p = buf->data + buf->len;
+	memset(p, 0, aligned);
+	buf->len += aligned;
+	rnl_header(buf, msg)->nlmsg_len = buf->len - msg;
+	return p;
+}
+
+static inline rnl_msg rnl_begin(struct rnl_buffer *buf, uint16_t type, uint16_t flags, uint32_t seq)
+{
+	if (buf->len + NLMSG_HDRLEN > buf->capacity)
+		return RNL_NO_MSG;
+	const rnl_msg msg = buf->len;
+	struct nlmsghdr *hdr = (struct nlmsghdr*) (buf->data + msg);
+	memset(hdr, 0, NLMSG_HDRLEN);
+	hdr->nlmsg_len = NLMSG_HDRLEN;
+	hdr->nlmsg_type = type;
+	hdr->nlmsg_flags = flags;
+	hdr->nlmsg_seq = seq;
+	buf->len += NLMSG_HDRLEN;
+	return msg;
+}
+
+// Starts a generic netlink request for family
+static inline rnl_msg rnl_begin_genl(struct rnl_buffer *buf, uint16_t family, uint16_t flags, uint32_t seq,
+                                     uint8_t cmd, uint8_t version)
+{
+	const size_t start = buf->len;
+	const rnl_msg msg = rnl_begin(buf, family, flags, seq);
+	if (msg == RNL_NO_MSG)
+		return RNL_NO_MSG;
+	struct genlmsghdr *genl = (struct genlmsghdr*) rnl_reserve(buf, msg, GENL_HDRLEN);
+	if (!genl) {
+		buf->len = start;
+		return RNL_NO_MSG;
+	}
+	genl->cmd = cmd;
+	genl->version = version;
+	return msg;
+}
+
+static inline bool rnl_put(struct rnl_buffer *buf, rnl_msg msg, uint16_t type, const void *data, size_t len)
+{
+	struct nlattr *nla = (struct nlattr*) rnl_reserve(buf, msg, NLA_HDRLEN + len);
+	if (!nla)
+		return false;
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	if (len)
+		memcpy((uint8_t*) nla + NLA_HDRLEN, data, len);
+	return true;
+}
+
+static inline bool rnl_put_u8(struct rnl_buffer *buf, rnl_msg msg, uint16_t type, uint8_t value)
+{
+	return rnl_put(buf, msg, type, &value, sizeof(value));
+}
+
+static inline bool rnl_put_u16(struct rnl_buffer *buf, rnl_msg msg, uint16_t type, uint16_t value)
+{
+	return rnl_put(buf, msg, type, &value, sizeof(value));
+}
+
+static inline bool rnl_put_u32(struct rnl_buffer *buf, rnl_msg msg, uint16_t type, uint32_t value)
+{
+	return rnl_put(buf, msg, type, &value, sizeof(value));
+}
+
+static inline bool rnl_put_string(struct rnl_buffer *buf, rnl_msg msg, uint16_t type, const char *value)
+{
+	return rnl_put(buf, msg, type, value, strlen(value) + 1);
+}
+
+/*************
+ *  Parsing  *
+ *************/
+
+// Indexes the attributes in [data, data + len) by type; tb has max + 1
+// entries. Unknown types are skipped, a truncated attribute fails
+static inline bool rnl_parse(const void *data, size_t len, const struct nlattr **tb, int max)
+{
+	memset(tb, 0, (max + 1) * sizeof(*tb));
+	const uint8_t *p = (const uint8_t*) data;
+	while (len >= NLA_HDRLEN) {
+		const struct nlattr *nla = (const struct nlattr*) p;
+		if (nla->nla_len < NLA_HDRLEN || nla->nla_len > len)
+			return false;
+		if (RNL_ATTR_TYPE(nla) <= max)
+			tb[RNL_ATTR_TYPE(nla)] = nla;
+		const size_t step = NLA_ALIGN(nla->nla_len);
+		if (step >= len)
+			break;
+		p += step;
+		len -= step;
+	}
+	return true;
+}
+
+static inline const void *rnl_data(const struct nlattr *nla)
+{
+	return (const uint8_t*) nla + NLA_HDRLEN;
+}
+
+static inline size_t rnl_len(const struct nlattr *nla)
+{
+	return nla->nla_len - NLA_HDRLEN;
+}
+
+static inline bool rnl_parse_nested(const struct nlattr *nla, const struct nlattr **tb, int max)
+{
+	return rnl_parse(rnl_data(nla), rnl_len(nla), tb, max);
+}
+
+// Attributes of a message after its fixed header of hdrlen bytes (e.g.
+// struct ifinfomsg)
+static inline bool rnl_parse_msg(const struct nlmsghdr *hdr, size_t hdrlen, const struct nlattr **tb, int max)
+{
+	if (hdr->nlmsg_len < NLMSG_LENGTH(NLMSG_ALIGN(hdrlen)))
+		return false;
+	return rnl_parse((const uint8_t*) NLMSG_DATA(hdr) + NLMSG_ALIGN(hdrlen),
+	                 hdr->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(hdrlen)), tb, max);
+}
+
+// Attributes of a generic netlink message, after its genlmsghdr
+static inline bool rnl_parse_genl(const struct nlmsghdr *hdr, const struct nlattr **tb, int max)
+{
+	return rnl_parse_msg(hdr, GENL_HDRLEN, tb, max);
+}
+
+// Children of a nested attribute in order, for lists whose entries are
+// numbered rather than typed:
+//   for (const struct nlattr *a = rnl_first(list); a; a = rnl_next(list, a))
+static inline const struct nlattr *rnl_checked(const struct nlattr *parent, const uint8_t *p)
+{
+	const uint8_t *end = (const uint8_t*) parent + parent->nla_len;
+	if (p + NLA_HDRLEN > end)
+		return NULL;
+	const struct nlattr *nla = (const struct nlattr*) p;
+	if (nla->nla_len < NLA_HDRLEN || p + nla->nla_len > end)
+		return NULL;
+	return nla;
+}
+
+static inline const struct nlattr *rnl_first(const struct nlattr *parent)
+{
+	return rnl_checked(parent, (const uint8_t*) rnl_data(parent));
+}
+
+static inline const struct nlattr *rnl_next(const struct nlattr *parent, const struct nlattr *nla)
+{
+	return rnl_checked(parent, (const uint8_t*) nla + NLA_ALIGN(nla->nla_len));
+}
+
+static inline uint8_t rnl_genl_cmd(const struct nlmsghdr *hdr)
+{
+	return ((const struct genlmsghdr*) NLMSG_DATA(hdr))->cmd;
+}
+
+// Fixed-size getters copy, since attribute payloads are only 4-byte aligned
+// and short attributes read as 0
+#define RNL_GETTER(name, type) \
+	static inline type rnl_get_##name(const struct nlattr *nla) \
+	{ \
+		type value = 0; \
+		if (rnl_len(nla) >= sizeof(value)) \
+			memcpy(&value, rnl_data(nla), sizeof(value)); \
+		return value; \
+	}
+RNL_GETTER(u8, uint8_t)
+RNL_GETTER(u16, uint16_t)
+RNL_GETTER(u32, uint32_t)
+RNL_GETTER(u64, uint64_t)
+#undef RNL_GETTER
+
+#endif // RADIOLOCATE_NETLINKMESSAGE_H
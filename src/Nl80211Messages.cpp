@@ -0,0 +1,293 @@
+//============================================================================
+// Name        : Nl80211Messages.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Builders for the nl80211 requests we send and parsers for
+//               their replies
+//============================================================================
+
+#include "Nl80211Messages.h"
+#include "nl80211.h"
+
+#define WLAN_EID_SSID 0
+
+/********************************
+ *  Generic netlink controller  *
+ ********************************/
+rnl_msg rnl_get_family(struct rnl_buffer *buf, uint32_t seq, const char *name)
+{
+	const size_t start = buf->len;
+	const rnl_msg msg = rnl_begin_genl(buf, GENL_ID_CTRL, NLM_F_REQUEST | NLM_F_ACK, seq, CTRL_CMD_GETFAMILY, 1);
+	if (msg == RNL_NO_MSG || !rnl_put_string(buf, msg, CTRL_ATTR_FAMILY_NAME, name)) {
+		buf->len = start;
+		return RNL_NO_MSG;
+	}
+	return msg;
+}
+
+// Copies a string attribute, which need not be terminated, into dst
+static void attr_string(const struct nlattr *nla, char *dst, size_t size)
+{
+	size_t len = rnl_len(nla);
+	if (len >= size)
+		len = size - 1;
+	memcpy(dst, rnl_data(nla), len);
+	dst[len] = '\0';
+}
+
+bool rnl_parse_family(const struct nlmsghdr *hdr, struct rnl_family *family)
+{
+	const struct nlattr *tb[CTRL_ATTR_MAX + 1];
+	if (hdr->nlmsg_type != GENL_ID_CTRL || rnl_genl_cmd(hdr) != CTRL_CMD_NEWFAMILY ||
+	    !rnl_parse_genl(hdr, tb, CTRL_ATTR_MAX) || !tb[CTRL_ATTR_FAMILY_ID])
+		return false;
+	family->id = rnl_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+	family->version = tb[CTRL_ATTR_VERSION] ? rnl_get_u32(tb[CTRL_ATTR_VERSION]) : 0;
+
+	family->group_count = 0;
+	if (!tb[CTRL_ATTR_MCAST_GROUPS])
+		return true;
+	for (const struct nlattr *entry = rnl_first(tb[CTRL_ATTR_MCAST_GROUPS]);
+	     entry && family->group_count < RNL_MAX_GROUPS; entry = rnl_next(tb[CTRL_ATTR_MCAST_GROUPS], entry)) {
+		const struct nlattr *grp[CTRL_ATTR_MCAST_GRP_MAX + 1];
+		if (!rnl_parse_nested(entry, grp, CTRL_ATTR_MCAST_GRP_MAX) || !grp[CTRL_ATTR_MCAST_GRP_ID] ||
+		    !grp[CTRL_ATTR_MCAST_GRP_NAME])
+			continue;
+		struct rnl_group *group = &family->groups[family->group_count++];
+		group->id = rnl_get_u32(grp[CTRL_ATTR_MCAST_GRP_ID]);
+		attr_string(grp[CTRL_ATTR_MCAST_GRP_NAME], group->name, sizeof(group->name));
+	}
+	return true;
+}
+
+uint32_t rnl_family_group(const struct rnl_family *family, const char *name)
+{
+	for (int i = 0; i < family->group_count; i++)
+		if (!strcmp(family->groups[i].name, name))
+			return family->groups[i].id;
+	return 0;
+}
+
+/*************
+ *  nl80211  *
+ *************/
+static rnl_msg dump_ifindex(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint8_t cmd, uint32_t ifindex)
+{
+	const size_t start = buf->len;
+	const rnl_msg msg = rnl_begin_genl(buf, family, NLM_F_REQUEST | NLM_F_DUMP, seq, cmd, 0);
+	if (msg == RNL_NO_MSG || !rnl_put_u32(buf, msg, NL80211_ATTR_IFINDEX, ifindex)) {
+		buf->len = start;
+		return RNL_NO_MSG;
+	}
+	return msg;
+}
+
+static rnl_msg dump_all(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint8_t cmd)
+{
+	return rnl_begin_genl(buf, family, NLM_F_REQUEST | NLM_F_DUMP, seq, cmd, 0);
+}
+
+rnl_msg rnl80211_get_interfaces(struct rnl_buffer *buf, uint16_t family, uint32_t seq)
+{
+	return dump_all(buf, family, seq, NL80211_CMD_GET_INTERFACE);
+}
+
+rnl_msg rnl80211_get_wiphys(struct rnl_buffer *buf, uint16_t family, uint32_t seq)
+{
+	return dump_all(buf, family, seq, NL80211_CMD_GET_WIPHY);
+}
+
+rnl_msg rnl80211_get_station(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex)
+{
+	return dump_ifindex(buf, family, seq, NL80211_CMD_GET_STATION, ifindex);
+}
+
+rnl_msg rnl80211_get_one_station(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex, mac_key mac)
+{
+	const size_t start = buf->len;
+	uint8_t addr[6];
+	mac_from_key(mac, addr);
+	const rnl_msg msg = rnl_begin_genl(buf, family, NLM_F_REQUEST, seq, NL80211_CMD_GET_STATION, 0);
+	if (msg == RNL_NO_MSG || !rnl_put_u32(buf, msg, NL80211_ATTR_IFINDEX, ifindex) ||
+	    !rnl_put(buf, msg, NL80211_ATTR_MAC, addr, sizeof(addr))) {
+		buf->len = start;
+		return RNL_NO_MSG;
+	}
+	return msg;
+}
+
+rnl_msg rnl80211_get_scan(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex)
+{
+	return dump_ifindex(buf, family, seq, NL80211_CMD_GET_SCAN, ifindex);
+}
+
+rnl_msg rnl80211_get_survey(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex)
+{
+	return dump_ifindex(buf, family, seq, NL80211_CMD_GET_SURVEY, ifindex);
+}
+
+rnl_msg rnl80211_set_channel(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex,
+                             uint32_t freq, uint32_t channel_type)
+{
+	const size_t start = buf->len;
+	const rnl_msg msg = rnl_begin_genl(buf, family, NLM_F_REQUEST | NLM_F_ACK, seq, NL80211_CMD_SET_CHANNEL, 0);
+	if (msg == RNL_NO_MSG || !rnl_put_u32(buf, msg, NL80211_ATTR_IFINDEX, ifindex) ||
+	    !rnl_put_u32(buf, msg, NL80211_ATTR_WIPHY_FREQ, freq) ||
+	    !rnl_put_u32(buf, msg, NL80211_ATTR_WIPHY_CHANNEL_TYPE, channel_type)) {
+		buf->len = start;
+		return RNL_NO_MSG;
+	}
+	return msg;
+}
+
+static mac_key attr_mac(const struct nlattr *nla)
+{
+	return rnl_len(nla) >= 6 ? mac_to_key((const uint8_t*) rnl_data(nla)) : 0;
+}
+
+bool rnl80211_parse_station(const struct nlmsghdr *hdr, struct rl_sample *sample)
+{
+	// Indexing stops at the last attribute we read, so the table cleared per
+	// station is a fraction of NL80211_ATTR_MAX: dumps of 1000+ stations
+	// parse on the stack in linear time
+	const int tb_max = NL80211_ATTR_STA_INFO;
+	const struct nlattr *tb[tb_max + 1];
+	const struct nlattr *sinfo[NL80211_STA_INFO_MAX + 1];
+	const struct nlattr *rinfo[NL80211_RATE_INFO_MAX + 1];
+	if (rnl_genl_cmd(hdr) != NL80211_CMD_NEW_STATION || !rnl_parse_genl(hdr, tb, tb_max) ||
+	    !tb[NL80211_ATTR_STA_INFO] || !rnl_parse_nested(tb[NL80211_ATTR_STA_INFO], sinfo, NL80211_STA_INFO_MAX))
+		return false;
+
+	memset(sample, 0, sizeof(*sample));
+	if (tb[NL80211_ATTR_MAC])
+		sample->mac = attr_mac(tb[NL80211_ATTR_MAC]);
+	if (tb[NL80211_ATTR_IFINDEX])
+		sample->ifindex = rnl_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	if (sinfo[NL80211_STA_INFO_SIGNAL])
+		sample->signal = (int8_t) rnl_get_u8(sinfo[NL80211_STA_INFO_SIGNAL]);
+	if (sinfo[NL80211_STA_INFO_SIGNAL_AVG])
+		sample->signal_avg = (int8_t) rnl_get_u8(sinfo[NL80211_STA_INFO_SIGNAL_AVG]);
+	if (sinfo[NL80211_STA_INFO_INACTIVE_TIME])
+		sample->inactive_ms = rnl_get_u32(sinfo[NL80211_STA_INFO_INACTIVE_TIME]);
+	if (sinfo[NL80211_STA_INFO_TX_BITRATE] &&
+	    rnl_parse_nested(sinfo[NL80211_STA_INFO_TX_BITRATE], rinfo, NL80211_RATE_INFO_MAX) &&
+	    rinfo[NL80211_RATE_INFO_BITRATE])
+		sample->tx_bitrate = rnl_get_u16(rinfo[NL80211_RATE_INFO_BITRATE]);
+	return true;
+}
+
+bool rnl80211_parse_interface(const struct nlmsghdr *hdr, struct rnl80211_interface *iface)
+{
+	const struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	const uint8_t cmd = rnl_genl_cmd(hdr);
+	if ((cmd != NL80211_CMD_NEW_INTERFACE && cmd != NL80211_CMD_DEL_INTERFACE) ||
+	    !rnl_parse_genl(hdr, tb, NL80211_ATTR_MAX) || !tb[NL80211_ATTR_IFINDEX])
+		return false;
+
+	memset(iface, 0, sizeof(*iface));
+	iface->ifindex = rnl_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	if (tb[NL80211_ATTR_WIPHY])
+		iface->wiphy = rnl_get_u32(tb[NL80211_ATTR_WIPHY]);
+	if (tb[NL80211_ATTR_IFTYPE])
+		iface->iftype = rnl_get_u32(tb[NL80211_ATTR_IFTYPE]);
+	if (tb[NL80211_ATTR_MAC])
+		iface->mac = attr_mac(tb[NL80211_ATTR_MAC]);
+	if (tb[NL80211_ATTR_IFNAME])
+		attr_string(tb[NL80211_ATTR_IFNAME], iface->name, sizeof(iface->name));
+	return true;
+}
+
+bool rnl80211_parse_wiphy(const struct nlmsghdr *hdr, struct rnl80211_wiphy *wiphy)
+{
+	const struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	const uint8_t cmd = rnl_genl_cmd(hdr);
+	if ((cmd != NL80211_CMD_NEW_WIPHY && cmd != NL80211_CMD_DEL_WIPHY) ||
+	    !rnl_parse_genl(hdr, tb, NL80211_ATTR_MAX) || !tb[NL80211_ATTR_WIPHY])
+		return false;
+
+	memset(wiphy, 0, sizeof(*wiphy));
+	wiphy->index = rnl_get_u32(tb[NL80211_ATTR_WIPHY]);
+	if (tb[NL80211_ATTR_WIPHY_NAME])
+		attr_string(tb[NL80211_ATTR_WIPHY_NAME], wiphy->name, sizeof(wiphy->name));
+	return true;
+}
+
+// The SSID is the first information element
+static void parse_ssid(const struct nlattr *ies, char *ssid)
+{
+	const uint8_t *ie = (const uint8_t*) rnl_data(ies);
+	size_t len = rnl_len(ies);
+	while (len >= 2 && (size_t) ie[1] + 2 <= len) {
+		if (ie[0] == WLAN_EID_SSID) {
+			const size_t n = ie[1] < 32 ? ie[1] : 32;
+			memcpy(ssid, ie + 2, n);
+			ssid[n] = '\0';
+			return;
+		}
+		len -= ie[1] + 2;
+		ie += ie[1] + 2;
+	}
+}
+
+bool rnl80211_parse_bss(const struct nlmsghdr *hdr, struct rnl80211_bss *bss)
+{
+	// As for stations, only as far as the attributes we read
+	const int tb_max = NL80211_ATTR_BSS;
+	const struct nlattr *tb[tb_max + 1];
+	const struct nlattr *binfo[NL80211_BSS_MAX + 1];
+	if (rnl_genl_cmd(hdr) != NL80211_CMD_NEW_SCAN_RESULTS || !rnl_parse_genl(hdr, tb, tb_max) ||
+	    !tb[NL80211_ATTR_BSS] || !rnl_parse_nested(tb[NL80211_ATTR_BSS], binfo, NL80211_BSS_MAX))
+		return false;
+
+	memset(bss, 0, sizeof(*bss));
+	bss->status = UINT32_MAX;
+	if (tb[NL80211_ATTR_IFINDEX])
+		bss->ifindex = rnl_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	if (binfo[NL80211_BSS_BSSID])
+		bss->bssid = attr_mac(binfo[NL80211_BSS_BSSID]);
+	if (binfo[NL80211_BSS_FREQUENCY])
+		bss->frequency = rnl_get_u32(binfo[NL80211_BSS_FREQUENCY]);
+	if (binfo[NL80211_BSS_SIGNAL_MBM])
+		bss->signal_mbm = (int32_t) rnl_get_u32(binfo[NL80211_BSS_SIGNAL_MBM]);
+	if (binfo[NL80211_BSS_TSF])
+		bss->tsf = rnl_get_u64(binfo[NL80211_BSS_TSF]);
+	if (binfo[NL80211_BSS_SEEN_MS_AGO])
+		bss->seen_ms_ago = rnl_get_u32(binfo[NL80211_BSS_SEEN_MS_AGO]);
+	if (binfo[NL80211_BSS_BEACON_INTERVAL])
+		bss->beacon_interval = rnl_get_u16(binfo[NL80211_BSS_BEACON_INTERVAL]);
+	if (binfo[NL80211_BSS_CAPABILITY])
+		bss->capability = rnl_get_u16(binfo[NL80211_BSS_CAPABILITY]);
+	if (binfo[NL80211_BSS_STATUS])
+		bss->status = rnl_get_u32(binfo[NL80211_BSS_STATUS]);
+	if (binfo[NL80211_BSS_INFORMATION_ELEMENTS])
+		parse_ssid(binfo[NL80211_BSS_INFORMATION_ELEMENTS], bss->ssid);
+	return true;
+}
+
+bool rnl80211_parse_survey(const struct nlmsghdr *hdr, struct rnl80211_survey *survey)
+{
+	const struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	const struct nlattr *sinfo[NL80211_SURVEY_INFO_MAX + 1];
+	if (rnl_genl_cmd(hdr) != NL80211_CMD_NEW_SURVEY_RESULTS || !rnl_parse_genl(hdr, tb, NL80211_ATTR_MAX) ||
+	    !tb[NL80211_ATTR_SURVEY_INFO] || !rnl_parse_nested(tb[NL80211_ATTR_SURVEY_INFO], sinfo, NL80211_SURVEY_INFO_MAX))
+		return false;
+
+	memset(survey, 0, sizeof(*survey));
+	if (tb[NL80211_ATTR_IFINDEX])
+		survey->ifindex = rnl_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	if (sinfo[NL80211_SURVEY_INFO_FREQUENCY])
+		survey->frequency = rnl_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]);
+	if (sinfo[NL80211_SURVEY_INFO_NOISE])
+		survey->noise = (int8_t) rnl_get_u8(sinfo[NL80211_SURVEY_INFO_NOISE]);
+	survey->in_use = sinfo[NL80211_SURVEY_INFO_IN_USE] != NULL;
+	if (sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME])
+		survey->time_ms = rnl_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME]);
+	if (sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_BUSY])
+		survey->busy_ms = rnl_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_BUSY]);
+	if (sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_EXT_BUSY])
+		survey->ext_busy_ms = rnl_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_EXT_BUSY]);
+	if (sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_RX])
+		survey->rx_ms = rnl_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_RX]);
+	if (sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_TX])
+		survey->tx_ms = rnl_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_TX]);
+	return true;
+}
@@ -0,0 +1,109 @@
+//============================================================================
+// Name        : Nl80211Messages.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Builders for the nl80211 requests we send and parsers for
+//               their replies, on top of NetlinkMessage.h. Shared by every
+//               I/O path, so none of this touches a socket
+//============================================================================
+
+#ifndef RADIOLOCATE_NL80211MESSAGES_H
+#define RADIOLOCATE_NL80211MESSAGES_H
+
+#include <net/if.h>
+#include <stdint.h>
+
+#include "NetlinkMessage.h"
+#include "Sample.h"
+
+/********************************
+ *  Generic netlink controller  *
+ ********************************/
+#define RNL_MAX_GROUPS 8
+
+struct rnl_group {
+	uint32_t id;
+	char name[GENL_NAMSIZ];
+};
+
+struct rnl_family {
+	uint16_t id;
+	uint32_t version;
+	// Multicast groups, e.g. nl80211's "config", "scan", "mlme"
+	int group_count;
+	struct rnl_group groups[RNL_MAX_GROUPS];
+};
+
+rnl_msg rnl_get_family(struct rnl_buffer *buf, uint32_t seq, const char *name);
+bool rnl_parse_family(const struct nlmsghdr *hdr, struct rnl_family *family);
+// Id of the named multicast group, 0 if the family has none by that name
+uint32_t rnl_family_group(const struct rnl_family *family, const char *name);
+
+/*************
+ *  nl80211  *
+ *************/
+
+// A virtual interface (NL80211_CMD_NEW_INTERFACE / DEL_INTERFACE)
+struct rnl80211_interface {
+	uint32_t ifindex;
+	uint32_t wiphy;
+	uint32_t iftype;       // enum nl80211_iftype
+	mac_key mac;
+	char name[IFNAMSIZ];
+};
+
+// A radio (NL80211_CMD_NEW_WIPHY / DEL_WIPHY)
+struct rnl80211_wiphy {
+	uint32_t index;
+	char name[32];         // e.g. phy0
+};
+
+// One scan result (NL80211_CMD_GET_SCAN)
+struct rnl80211_bss {
+	mac_key bssid;
+	uint32_t ifindex;
+	uint32_t frequency;    // MHz
+	int32_t signal_mbm;    // 1/100 dBm, 0 if not reported
+	uint64_t tsf;          // us, TSF of the last beacon or probe response
+	uint32_t seen_ms_ago;
+	uint16_t beacon_interval; // TU
+	uint16_t capability;
+	uint32_t status;       // nl80211_bss_status, or UINT32_MAX if not associated
+	char ssid[33];
+};
+
+// One channel of a survey (NL80211_CMD_GET_SURVEY)
+struct rnl80211_survey {
+	uint32_t ifindex;
+	uint32_t frequency;    // MHz
+	int8_t noise;          // dBm, 0 if not reported
+	bool in_use;
+	uint64_t time_ms, busy_ms, ext_busy_ms, rx_ms, tx_ms;
+};
+
+// Dumps of every interface / radio
+rnl_msg rnl80211_get_interfaces(struct rnl_buffer *buf, uint16_t family, uint32_t seq);
+rnl_msg rnl80211_get_wiphys(struct rnl_buffer *buf, uint16_t family, uint32_t seq);
+
+// Dump requests for one interface
+rnl_msg rnl80211_get_station(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex);
+rnl_msg rnl80211_get_scan(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex);
+rnl_msg rnl80211_get_survey(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex);
+// One station only, not a dump: a single reply, or ENOENT if the station
+// is not associated
+rnl_msg rnl80211_get_one_station(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex, mac_key mac);
+
+// Tunes the interface (e.g. a monitor) to freq MHz; channel_type is an
+// enum nl80211_channel_type. Acked, not a dump
+rnl_msg rnl80211_set_channel(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex,
+                             uint32_t freq, uint32_t channel_type);
+
+// Reply parsers; false if the message is not the expected kind. The
+// station parser leaves sample->timestamp_us to the caller. The interface
+// and wiphy parsers take both the NEW_ and the DEL_ command
+bool rnl80211_parse_interface(const struct nlmsghdr *hdr, struct rnl80211_interface *iface);
+bool rnl80211_parse_wiphy(const struct nlmsghdr *hdr, struct rnl80211_wiphy *wiphy);
+bool rnl80211_parse_station(const struct nlmsghdr *hdr, struct rl_sample *sample);
+bool rnl80211_parse_bss(const struct nlmsghdr *hdr, struct rnl80211_bss *bss);
+bool rnl80211_parse_survey(const struct nlmsghdr *hdr, struct rnl80211_survey *survey);
+
+#endif // RADIOLOCATE_NL80211MESSAGES_H
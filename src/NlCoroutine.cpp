@@ -0,0 +1,79 @@
+//============================================================================
+// Name        : NlCoroutine.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Drives the nl80211 coroutines from an acquisition session
+//============================================================================
+
+#include "NlCoroutine.h"
+
+#include <stdio.h>
+#include <string.h>
+
+nl_session::nl_session() : session(NULL), live(0), waiting(0)
+{
+}
+
+nl_session::~nl_session()
+{
+	rl_session_destroy(session);
+}
+
+bool nl_session::open(bool use_uring)
+{
+	struct rl_session_config config;
+	rl_session_default_config(&config);
+	config.use_uring = use_uring;
+	// No interfaces of its own, so no batches: only the tasks' requests
+	return (session = rl_session_create(&config, NULL, NULL)) != NULL;
+}
+
+void nl_session::spawn(nl_task task)
+{
+	std::coroutine_handle<nl_task::promise_type> h = std::exchange(task.handle, nullptr);
+	h.promise().live = &live;
+	live++;
+	ready.push_back(h);
+}
+
+bool nl_session::sleep_awaiter::await_suspend(std::coroutine_handle<> h)
+{
+	waiter = h;
+	if (!rl_session_alarm(session->session, deadline_us, on_alarm, this))
+		return false;
+	session->waiting++;
+	return true;
+}
+
+void nl_session::sleep_awaiter::on_alarm(void *arg)
+{
+	sleep_awaiter *self = (sleep_awaiter*) arg;
+	self->session->waiting--;
+	self->session->wake(self->waiter);
+}
+
+void nl_session::run()
+{
+	std::vector<std::coroutine_handle<>> resuming;
+	while (live > 0) {
+		// Resuming may queue more, which wait for the next round
+		resuming.swap(ready);
+		for (size_t i = 0; i < resuming.size(); i++)
+			resuming[i].resume();
+		resuming.clear();
+		if (!ready.empty())
+			continue;
+		if (live <= 0)
+			break;
+		if (!waiting) {
+			fprintf(stderr, "%d tasks are waiting for nothing, stopping.\n", live);
+			break;
+		}
+
+		// Everything the tasks asked for goes out in one send
+		const int n = rl_session_poll(session, -1);
+		if (n < 0) {
+			fprintf(stderr, "Failed to receive from netlink: %s\n", strerror(-n));
+			break;
+		}
+	}
+}
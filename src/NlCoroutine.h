@@ -0,0 +1,260 @@
+//============================================================================
+// Name        : NlCoroutine.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : C++20 coroutine API for nl80211 requests. Coroutines await
+//               dumps as if they were blocking calls while one thread keeps
+//               all of their requests in flight on a single socket:
+//
+//                 nl_task poll(nl_session &s, uint32_t ifindex)
+//                 {
+//                     for (uint64_t t = monotonic_us();; t += 100000) {
+//                         nl_result<rl_sample> stations = co_await s.get_station(ifindex);
+//                         ...
+//                         co_await s.sleep_until(t);
+//                     }
+//                 }
+//
+//               The requests and sleeps run on an acquisition session's
+//               socket and loop (Session.h). Needs -std=c++20; the rest
+//               of the tree is plain C++11
+//============================================================================
+
+#ifndef RADIOLOCATE_NLCOROUTINE_H
+#define RADIOLOCATE_NLCOROUTINE_H
+
+#if __cplusplus < 202002L
+	#error "NlCoroutine.h needs -std=c++20"
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+
+#include <coroutine>
+#include <exception>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "NetlinkConn.h"
+#include "Nl80211Messages.h"
+#include "Sample.h"
+#include "Session.h"
+
+class nl_session;
+
+// A coroutine started with nl_session::spawn(). It runs until it returns;
+// nl_session::run() returns once every spawned task has
+class nl_task {
+public:
+	struct promise_type {
+		int *live = nullptr;
+
+		~promise_type()
+		{
+			if (live)
+				--*live;
+		}
+		nl_task get_return_object() { return nl_task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() { }
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	nl_task(nl_task &&other) : handle(std::exchange(other.handle, nullptr)) { }
+	~nl_task()
+	{
+		if (handle)
+			handle.destroy();
+	}
+
+private:
+	explicit nl_task(std::coroutine_handle<promise_type> h) : handle(h) { }
+	nl_task(const nl_task&) = delete;
+	nl_task &operator=(const nl_task&) = delete;
+
+	friend class nl_session;
+	std::coroutine_handle<promise_type> handle;
+};
+
+// What a dump produced: error is 0 or a negative errno, in which case
+// items holds whatever arrived before the error
+template<typename T>
+struct nl_result {
+	int error = 0;
+	std::vector<T> items;
+};
+
+// Awaitable for one dump request
+template<typename T>
+class nl_dump {
+public:
+	typedef rnl_msg (*build_fn)(struct rnl_buffer *buf, uint16_t family, uint32_t seq, uint32_t ifindex);
+	typedef bool (*parse_fn)(const struct nlmsghdr *hdr, T *item);
+
+	nl_dump(nl_session *session, build_fn build, parse_fn parse, uint32_t ifindex)
+		: session(session), build(build), parse(parse), ifindex(ifindex) { }
+
+	bool await_ready() const { return false; }
+	bool await_suspend(std::coroutine_handle<> h);
+	nl_result<T> await_resume() { return std::move(result); }
+
+	// Used by nl_all: the waiter is woken once the counter drops to 0
+	void join(int *counter) { remaining = counter; }
+
+private:
+	static void on_message(void *arg, const struct nlmsghdr *hdr)
+	{
+		nl_dump *self = (nl_dump*) arg;
+		if (!hdr) {
+			// Started over
+			self->result.items.clear();
+			return;
+		}
+		T item;
+		if (self->parse(hdr, &item))
+			self->result.items.push_back(item);
+	}
+	static void on_done(void *arg, int error);
+
+	nl_session *session;
+	build_fn build;
+	parse_fn parse;
+	uint32_t ifindex;
+	int *remaining = nullptr;
+	std::coroutine_handle<> waiter;
+	nl_result<T> result;
+};
+
+// Awaits several dumps at once. They are all submitted before the
+// coroutine suspends, so they leave in a single send and the kernel
+// answers them in about one round trip:
+//
+//   auto [stations, survey, scan] =
+//       co_await nl_all(s.get_station(i), s.get_survey(i), s.get_scan(i));
+template<typename... Dumps>
+class nl_all {
+public:
+	explicit nl_all(Dumps... dumps) : dumps(std::move(dumps)...) { }
+
+	bool await_ready() const { return false; }
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		remaining = sizeof...(Dumps);
+		std::apply([&](Dumps&... d) {
+			((d.join(&remaining), d.await_suspend(h) ? 0 : --remaining), ...);
+		}, dumps);
+		return remaining > 0;
+	}
+	auto await_resume()
+	{
+		return std::apply([](Dumps&... d) { return std::make_tuple(d.await_resume()...); }, dumps);
+	}
+
+private:
+	std::tuple<Dumps...> dumps;
+	int remaining = 0;
+};
+
+// Station readings are stamped as they are parsed
+inline bool nl_parse_station_now(const struct nlmsghdr *hdr, struct rl_sample *sample)
+{
+	if (!rnl80211_parse_station(hdr, sample))
+		return false;
+	sample->timestamp_us = monotonic_us();
+	return true;
+}
+
+class nl_session {
+public:
+	nl_session();
+	~nl_session();
+
+	// Creates the session underneath (blocking, once). The event loop runs
+	// on io_uring if use_uring and the kernel allows, else epoll
+	bool open(bool use_uring = true);
+
+	// Queues a task to start on the next run()
+	void spawn(nl_task task);
+	// Runs the event loop until every spawned task has returned
+	void run();
+
+	nl_dump<rl_sample> get_station(uint32_t ifindex)
+	{
+		return nl_dump<rl_sample>(this, rnl80211_get_station, nl_parse_station_now, ifindex);
+	}
+	nl_dump<rnl80211_bss> get_scan(uint32_t ifindex)
+	{
+		return nl_dump<rnl80211_bss>(this, rnl80211_get_scan, rnl80211_parse_bss, ifindex);
+	}
+	nl_dump<rnl80211_survey> get_survey(uint32_t ifindex)
+	{
+		return nl_dump<rnl80211_survey>(this, rnl80211_get_survey, rnl80211_parse_survey, ifindex);
+	}
+
+	class sleep_awaiter {
+	public:
+		sleep_awaiter(nl_session *session, uint64_t deadline_us) : session(session), deadline_us(deadline_us) { }
+		bool await_ready() const { return monotonic_us() >= deadline_us; }
+		bool await_suspend(std::coroutine_handle<> h);
+		void await_resume() const { }
+	private:
+		static void on_alarm(void *arg);
+
+		nl_session *session;
+		uint64_t deadline_us;
+		std::coroutine_handle<> waiter;
+	};
+	// CLOCK_MONOTONIC, like monotonic_us()
+	sleep_awaiter sleep_until(uint64_t deadline_us) { return sleep_awaiter(this, deadline_us); }
+
+	uint16_t family_id() const { return rl_session_family(session); }
+
+	// Resumes h from the event loop, never from inside a callback
+	void wake(std::coroutine_handle<> h)
+	{
+		ready.push_back(h);
+		rl_session_wake(session);
+	}
+
+private:
+	nl_session(const nl_session&) = delete;
+	nl_session &operator=(const nl_session&) = delete;
+
+	template<typename T> friend class nl_dump;
+
+	struct rl_session *session;
+	std::vector<std::coroutine_handle<>> ready;
+	int live;
+	int waiting;           // dumps and sleeps that will wake a task
+};
+
+template<typename T>
+bool nl_dump<T>::await_suspend(std::coroutine_handle<> h)
+{
+	uint8_t storage[256] __attribute__((aligned(4)));
+	struct rnl_buffer buf;
+	rnl_buffer_init(&buf, storage, sizeof(storage));
+	const rnl_msg msg = build(&buf, session->family_id(), 0, ifindex);
+	if (msg == RNL_NO_MSG ||
+	    !rl_session_submit(session->session, rnl_header(&buf, msg), on_message, on_done, this)) {
+		result.error = -ENOBUFS;
+		return false;
+	}
+	session->waiting++;
+	waiter = h;
+	return true;
+}
+
+template<typename T>
+void nl_dump<T>::on_done(void *arg, int error)
+{
+	nl_dump *self = (nl_dump*) arg;
+	self->result.error = error;
+	self->session->waiting--;
+	if (self->remaining && --*self->remaining > 0)
+		return;
+	self->session->wake(self->waiter);
+}
+
+#endif // RADIOLOCATE_NLCOROUTINE_H
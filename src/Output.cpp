@@ -0,0 +1,431 @@
+//============================================================================
+// Name        : Output.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Formatters, the writer thread and the pump behind Output.h
+//============================================================================
+
+#include "Output.h"
+#include "SpscRing.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+using namespace std;
+
+// Records taken off the queue at a time; a batch formats to at most
+// OUT_EMIT_BYTES
+#define OUT_BATCH 64
+#define OUT_ERROR_BUFFER 4096
+
+struct out_writer {
+	out_config config;
+	spsc_ring<out_record> queue;
+	thread writer;
+	atomic<bool> stopping;
+
+	// Producer side
+	uint64_t queued;
+	atomic<uint64_t> dropped;
+
+	// Writer side
+	char *buffer;
+	size_t len;
+	char errors[OUT_ERROR_BUFFER];
+	size_t error_len;
+	uint64_t taken;
+	uint32_t emitting;     // records in the buffer emit refused, with emit
+	atomic<uint64_t> written; // records taken off the queue whose output reached write()
+	atomic<uint64_t> records, writes, bytes, write_errors;
+};
+
+void out_default_config(struct out_config *config)
+{
+	config->format = out_format_text;
+	config->output_fd = STDOUT_FILENO;
+	config->error_fd = STDERR_FILENO;
+	config->queue_records = 16384;
+	config->buffer_bytes = 256 * 1024;
+	config->flush_us = 10000;
+	config->emit = NULL;
+	config->emit_arg = NULL;
+}
+
+/***********************
+ *  Number formatting  *
+ ***********************/
+// Two digits per step from a table, and no locale or format parsing:
+// several times faster than printf("%llu")
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static char *put_u64(char *p, uint64_t value)
+{
+	char tmp[20];
+	char *end = tmp + sizeof(tmp), *q = end;
+	while (value >= 100) {
+		const unsigned pair = (unsigned) (value % 100) * 2;
+		value /= 100;
+		*--q = digit_pairs[pair + 1];
+		*--q = digit_pairs[pair];
+	}
+	if (value >= 10) {
+		*--q = digit_pairs[value * 2 + 1];
+		*--q = digit_pairs[value * 2];
+	} else
+		*--q = '0' + (char) value;
+	memcpy(p, q, end - q);
+	return p + (end - q);
+}
+
+static char *put_i64(char *p, int64_t value)
+{
+	if (value < 0) {
+		*p++ = '-';
+		return put_u64(p, 0 - (uint64_t) value);
+	}
+	return put_u64(p, value);
+}
+
+static inline char *put_str(char *p, const char *s, size_t len)
+{
+	memcpy(p, s, len);
+	return p + len;
+}
+#define PUT_LITERAL(p, s) put_str(p, s, sizeof(s) - 1)
+
+static char *put_mac(char *p, mac_key mac)
+{
+	static const char hex[] = "0123456789abcdef";
+	for (int shift = 40; shift >= 0; shift -= 8) {
+		const unsigned byte = (mac >> shift) & 0xff;
+		*p++ = hex[byte >> 4];
+		*p++ = hex[byte & 0xf];
+		if (shift)
+			*p++ = ':';
+	}
+	return p;
+}
+
+/****************
+ *  Formatters  *
+ ****************/
+size_t out_format_text(char *dst, const struct out_record *record)
+{
+	char *p = dst;
+	if (record->kind == OUT_REMOVED) {
+		p = PUT_LITERAL(p, "Station ");
+		p = put_mac(p, record->sample.mac);
+		p = PUT_LITERAL(p, " left");
+	} else if (record->kind != OUT_SAMPLE)
+		p = put_str(p, record->text, strnlen(record->text, OUT_MAX_TEXT));
+	else {
+		p = PUT_LITERAL(p, "Signal strength: ");
+		p = put_i64(p, record->sample.signal);
+		p = PUT_LITERAL(p, " dBm");
+		if (record->scan_ms >= 0) {
+			p = PUT_LITERAL(p, " (Scan: ");
+			p = put_i64(p, record->scan_ms);
+			p = PUT_LITERAL(p, " ms)");
+		}
+	}
+	*p++ = '\n';
+	return p - dst;
+}
+
+size_t out_format_json(char *dst, const struct out_record *record)
+{
+	char *p = dst;
+	if (record->kind != OUT_SAMPLE && record->kind != OUT_REMOVED) {
+		static const char hex[] = "0123456789abcdef";
+		p = PUT_LITERAL(p, "{\"message\":\"");
+		for (size_t i = 0; i < OUT_MAX_TEXT && record->text[i]; i++) {
+			const uint8_t c = record->text[i];
+			if (c == '"' || c == '\\') {
+				*p++ = '\\';
+				*p++ = c;
+			} else if (c < 0x20) {
+				p = PUT_LITERAL(p, "\\u00");
+				*p++ = hex[c >> 4];
+				*p++ = hex[c & 0xf];
+			} else
+				*p++ = c;
+		}
+		p = PUT_LITERAL(p, "\"}\n");
+		return p - dst;
+	}
+
+	const rl_sample &s = record->sample;
+	p = PUT_LITERAL(p, "{\"t\":");
+	p = put_u64(p, s.timestamp_us);
+	p = PUT_LITERAL(p, ",\"mac\":\"");
+	p = put_mac(p, s.mac);
+	p = PUT_LITERAL(p, "\",\"ifindex\":");
+	p = put_u64(p, s.ifindex);
+	if (record->kind == OUT_REMOVED) {
+		p = PUT_LITERAL(p, ",\"removed\":true}\n");
+		return p - dst;
+	}
+	p = PUT_LITERAL(p, ",\"signal\":");
+	p = put_i64(p, s.signal);
+	p = PUT_LITERAL(p, ",\"signal_avg\":");
+	p = put_i64(p, s.signal_avg);
+	p = PUT_LITERAL(p, ",\"tx_bitrate\":");
+	p = put_u64(p, s.tx_bitrate);
+	p = PUT_LITERAL(p, ",\"inactive_ms\":");
+	p = put_u64(p, s.inactive_ms);
+	if (record->scan_ms >= 0) {
+		p = PUT_LITERAL(p, ",\"scan_ms\":");
+		p = put_i64(p, record->scan_ms);
+	}
+	p = PUT_LITERAL(p, "}\n");
+	return p - dst;
+}
+
+static inline void put_le16(char *p, uint16_t v) { v = htole16(v); memcpy(p, &v, 2); }
+static inline void put_le32(char *p, uint32_t v) { v = htole32(v); memcpy(p, &v, 4); }
+static inline void put_le64(char *p, uint64_t v) { v = htole64(v); memcpy(p, &v, 8); }
+
+size_t out_format_binary(char *dst, const struct out_record *record)
+{
+	if (record->kind != OUT_SAMPLE && record->kind != OUT_REMOVED)
+		return 0;
+	const rl_sample &s = record->sample;
+	put_le64(dst, s.timestamp_us);
+	mac_from_key(s.mac, (uint8_t*) dst + 8);
+	dst[14] = s.signal;
+	dst[15] = s.signal_avg;
+	put_le32(dst + 16, s.ifindex);
+	put_le16(dst + 20, s.tx_bitrate);
+	put_le16(dst + 22, record->kind == OUT_REMOVED ? 1 : 0);
+	put_le32(dst + 24, s.inactive_ms);
+	put_le32(dst + 28, (uint32_t) record->scan_ms);
+	return 32;
+}
+
+/*******************
+ *  Writer thread  *
+ *******************/
+static void write_all(out_writer *writer, int fd, const char *data, size_t len)
+{
+	while (len) {
+		const ssize_t n = write(fd, data, len);
+		writer->writes.fetch_add(1, memory_order_relaxed);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			writer->write_errors.fetch_add(1, memory_order_relaxed);
+			return;
+		}
+		writer->bytes.fetch_add(n, memory_order_relaxed);
+		data += n;
+		len -= n;
+	}
+}
+
+static void write_errors(out_writer *writer)
+{
+	if (writer->error_len)
+		write_all(writer, writer->config.error_fd, writer->errors, writer->error_len);
+	writer->error_len = 0;
+}
+
+static void write_buffers(out_writer *writer)
+{
+	if (writer->len)
+		write_all(writer, writer->config.output_fd, writer->buffer, writer->len);
+	writer->len = 0;
+	write_errors(writer);
+}
+
+// The pump's buffer holds a batch, so only the thread ever writes it here
+static void append(out_writer *writer, const out_record *record)
+{
+	if (record->kind == OUT_ERROR) {
+		if (writer->error_len + OUT_MAX_FORMATTED > sizeof(writer->errors))
+			write_errors(writer);
+		writer->error_len += out_format_text(writer->errors + writer->error_len, record);
+	} else {
+		if (writer->len + OUT_MAX_FORMATTED > writer->config.buffer_bytes)
+			write_buffers(writer);
+		writer->len += writer->config.format(writer->buffer + writer->len, record);
+	}
+	writer->records.fetch_add(1, memory_order_relaxed);
+}
+
+// Drains the queue into the buffer, writes it once the queue is empty (or
+// the buffer full), then sleeps; the producer never has to wake it
+static void writer_main(out_writer *writer)
+{
+	out_record batch[OUT_BATCH];
+	for (;;) {
+		const bool stopping = writer->stopping.load(memory_order_acquire);
+		const uint32_t n = spsc_pop(&writer->queue, batch, OUT_BATCH);
+		for (uint32_t i = 0; i < n; i++)
+			append(writer, &batch[i]);
+		writer->taken += n;
+		if (n == OUT_BATCH)
+			continue;
+
+		write_buffers(writer);
+		writer->written.store(writer->taken, memory_order_release);
+		if (stopping)
+			break;
+		usleep(writer->config.flush_us);
+	}
+}
+
+/**********
+ *  Pump  *
+ **********/
+bool out_writer_pump(struct out_writer *writer)
+{
+	if (!writer->config.emit)
+		return true;
+	out_record batch[OUT_BATCH];
+	for (;;) {
+		// A batch emit refused stays formatted for the next pump
+		if (writer->len) {
+			if (!writer->config.emit(writer->config.emit_arg, writer->buffer, writer->len))
+				return false;
+			writer->writes.fetch_add(1, memory_order_relaxed);
+			writer->bytes.fetch_add(writer->len, memory_order_relaxed);
+			writer->len = 0;
+			writer->emitting = 0;
+		}
+		write_errors(writer);
+		writer->written.store(writer->taken, memory_order_release);
+
+		const uint32_t n = spsc_pop(&writer->queue, batch, OUT_BATCH);
+		if (!n)
+			return true;
+		for (uint32_t i = 0; i < n; i++) {
+			append(writer, &batch[i]);
+			writer->emitting += batch[i].kind != OUT_ERROR;
+		}
+		writer->taken += n;
+	}
+}
+
+/***************
+ *  Lifecycle  *
+ ***************/
+struct out_writer *out_writer_create(const struct out_config *config)
+{
+	out_writer *writer = new out_writer;
+	writer->config = *config;
+	if (writer->config.buffer_bytes < 2 * OUT_MAX_FORMATTED)
+		writer->config.buffer_bytes = 2 * OUT_MAX_FORMATTED;
+	if (config->emit)
+		writer->config.buffer_bytes = OUT_EMIT_BYTES;
+	if (!spsc_init(&writer->queue, config->queue_records)) {
+		fprintf(stderr, "Failed to allocate the output queue.\n");
+		delete writer;
+		return NULL;
+	}
+	writer->buffer = new char[writer->config.buffer_bytes];
+	writer->len = 0;
+	writer->error_len = 0;
+	writer->taken = 0;
+	writer->emitting = 0;
+	writer->queued = 0;
+	writer->stopping.store(false);
+	writer->dropped.store(0);
+	writer->written.store(0);
+	writer->records.store(0);
+	writer->writes.store(0);
+	writer->bytes.store(0);
+	writer->write_errors.store(0);
+	if (!config->emit)
+		writer->writer = thread(writer_main, writer);
+	return writer;
+}
+
+void out_writer_destroy(struct out_writer *writer)
+{
+	if (!writer)
+		return;
+	// The thread drains the queue once more before it notices
+	writer->stopping.store(true, memory_order_release);
+	if (writer->writer.joinable())
+		writer->writer.join();
+	else if (!out_writer_pump(writer))
+		writer->dropped.fetch_add(writer->queued - writer->taken + writer->emitting, memory_order_relaxed);
+	spsc_free(&writer->queue);
+	delete[] writer->buffer;
+	delete writer;
+}
+
+/**************
+ *  Producer  *
+ **************/
+bool out_write(struct out_writer *writer, const struct out_record *record)
+{
+	if (!spsc_push(&writer->queue, record, 1)) {
+		writer->dropped.fetch_add(1, memory_order_relaxed);
+		return false;
+	}
+	writer->queued++;
+	return true;
+}
+
+bool out_sample(struct out_writer *writer, const struct rl_sample *sample, int32_t scan_ms)
+{
+	out_record record;
+	record.kind = OUT_SAMPLE;
+	record.scan_ms = scan_ms;
+	record.sample = *sample;
+	record.text[0] = '\0';
+	return out_write(writer, &record);
+}
+
+bool out_removed(struct out_writer *writer, const struct rl_sample *sample)
+{
+	out_record record;
+	record.kind = OUT_REMOVED;
+	record.scan_ms = -1;
+	record.sample = *sample;
+	record.text[0] = '\0';
+	return out_write(writer, &record);
+}
+
+bool out_message(struct out_writer *writer, enum out_kind kind, const char *format, ...)
+{
+	out_record record;
+	record.kind = kind;
+	record.scan_ms = -1;
+	memset(&record.sample, 0, sizeof(record.sample));
+	va_list args;
+	va_start(args, format);
+	vsnprintf(record.text, sizeof(record.text), format, args);
+	va_end(args);
+	return out_write(writer, &record);
+}
+
+void out_writer_flush(struct out_writer *writer)
+{
+	// The pump's sink writes on its own time
+	if (writer->config.emit) {
+		out_writer_pump(writer);
+		return;
+	}
+	while (writer->written.load(memory_order_acquire) < writer->queued)
+		usleep(100);
+}
+
+void out_writer_get_stats(const struct out_writer *writer, struct out_stats *stats)
+{
+	stats->records = writer->records.load(memory_order_relaxed);
+	stats->dropped = writer->dropped.load(memory_order_relaxed);
+	stats->writes = writer->writes.load(memory_order_relaxed);
+	stats->bytes = writer->bytes.load(memory_order_relaxed);
+	stats->write_errors = writer->write_errors.load(memory_order_relaxed);
+}
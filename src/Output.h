@@ -0,0 +1,111 @@
+//============================================================================
+// Name        : Output.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Buffered output on a writer thread of its own. The
+//               acquisition thread only copies records into a bounded
+//               queue, so a slow terminal or pipe costs dropped records
+//               (counted) instead of late samples. Or, with an emit
+//               function, no thread: the acquisition thread pumps the
+//               output into a sink that never blocks, such as the
+//               session's io_uring
+//============================================================================
+
+#ifndef RADIOLOCATE_OUTPUT_H
+#define RADIOLOCATE_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Sample.h"
+
+#define OUT_MAX_TEXT 96
+// Longest a formatter may make one record (an escaped JSON message)
+#define OUT_MAX_FORMATTED 640
+
+enum out_kind {
+	OUT_SAMPLE,
+	OUT_REMOVED,           // a station left; sample is its last reading
+	OUT_MESSAGE,           // goes to output_fd through the formatter
+	OUT_ERROR,             // goes to error_fd as plain text
+};
+
+struct out_record {
+	uint8_t kind;          // enum out_kind
+	int32_t scan_ms;       // OUT_SAMPLE: since the previous one reported, -1 for none
+	struct rl_sample sample;
+	char text[OUT_MAX_TEXT]; // OUT_MESSAGE / OUT_ERROR, without the newline
+};
+
+// Appends one record to dst (room for OUT_MAX_FORMATTED bytes) and returns
+// the number of bytes, 0 to skip it. Runs on the writer thread, or in
+// out_writer_pump()
+typedef size_t (*out_format_fn)(char *dst, const struct out_record *record);
+
+// "Signal strength: -52 dBm (Scan: 104 ms)", as the CLI always printed,
+// or "Station 00:11:22:33:44:55 left"
+size_t out_format_text(char *dst, const struct out_record *record);
+// One JSON object per line:
+//   {"t":…,"mac":"00:11:22:33:44:55","ifindex":3,"signal":-52,"signal_avg":-51,
+//    "tx_bitrate":650,"inactive_ms":12,"scan_ms":104}
+//   {"t":…,"mac":"00:11:22:33:44:55","ifindex":3,"removed":true}  or  {"message":"…"}
+size_t out_format_json(char *dst, const struct out_record *record);
+// Fixed 32-byte little-endian records, samples and removals only:
+//   u64 timestamp (us)  u8[6] MAC  i8 signal  i8 signal avg
+//   u32 ifindex         u16 tx bitrate  u16 flags (1 = removed)
+//   u32 inactive time (ms)  i32 scan (ms)
+size_t out_format_binary(char *dst, const struct out_record *record);
+
+// Takes len bytes of formatted output (at most OUT_EMIT_BYTES) without
+// blocking, or returns false to be offered them again on the next pump
+typedef bool (*out_emit_fn)(void *arg, const void *data, size_t len);
+#define OUT_EMIT_BYTES (64 * OUT_MAX_FORMATTED)
+
+struct out_config {
+	out_format_fn format;
+	int output_fd;
+	int error_fd;
+	uint32_t queue_records; // rounded up to a power of two
+	size_t buffer_bytes;    // written with one write() when full or due
+	uint64_t flush_us;      // longest a record waits on the writer thread
+	// Instead of the thread writing output_fd, e.g. rl_session_write();
+	// errors still go to error_fd with write(). NULL for the thread
+	out_emit_fn emit;
+	void *emit_arg;
+};
+
+void out_default_config(struct out_config *config);
+
+struct out_stats {
+	uint64_t records;      // formatted and buffered
+	uint64_t dropped;      // the queue was full
+	uint64_t writes;
+	uint64_t bytes;
+	uint64_t write_errors;
+};
+
+struct out_writer;
+
+struct out_writer *out_writer_create(const struct out_config *config);
+// Writes out everything still queued, then stops the thread. With emit,
+// what it won't take any more is dropped: pump until it has it all first
+void out_writer_destroy(struct out_writer *writer);
+
+// Producer side, for one thread. Never blocks; false if the record was
+// dropped because the writer is behind
+bool out_write(struct out_writer *writer, const struct out_record *record);
+bool out_sample(struct out_writer *writer, const struct rl_sample *sample, int32_t scan_ms);
+bool out_removed(struct out_writer *writer, const struct rl_sample *sample);
+bool out_message(struct out_writer *writer, enum out_kind kind, const char *format, ...)
+	__attribute__((format(printf, 3, 4)));
+
+// Waits until everything queued so far has been written
+void out_writer_flush(struct out_writer *writer);
+
+// With emit, on the producer's thread: formats what is queued and hands it
+// to emit until the queue is empty (true) or emit refuses (false). Without
+// it there is nothing to do
+bool out_writer_pump(struct out_writer *writer);
+
+void out_writer_get_stats(const struct out_writer *writer, struct out_stats *stats);
+
+#endif // RADIOLOCATE_OUTPUT_H
@@ -0,0 +1,444 @@
+//============================================================================
+// Name        : ParticleFilter.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Particle-filter tracking of moving targets from the RSSI
+//               that fixed anchors measure for them
+//============================================================================
+
+#include "ParticleFilter.h"
+#include "WorkPool.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+struct pf_observation {
+	int anchor_id;
+	float rssi;            // mean of the readings merged into this one
+	int count;
+	uint64_t first_us;     // timestamp of the oldest of them
+	uint64_t timestamp_us; // of the newest of them
+};
+
+// Particles are kept as a structure of arrays so that each step of the
+// filter is a straight loop over contiguous floats
+struct pf_target {
+	mac_key key;
+	float *x, *y, *vx, *vy, *w;
+	float *nx, *ny, *nvx, *nvy; // resampling destination, swapped with the above
+	float *lw;                  // log-likelihood of the current batch
+	int *pick;                  // resampled parent of each particle
+	void *block;
+
+	uint32_t seed;
+	uint32_t draws;             // counter for the random stream
+	bool initialised;
+	uint64_t last_us;           // time the particles were last advanced to
+	uint64_t heard_us;          // time of the last observation queued
+	vector<pf_observation> pending;
+	pf_estimate estimate;
+};
+
+struct pf_tracker {
+	pf_config config;
+	vector<anchor> anchors;
+	work_pool *pool;
+
+	vector<pf_target*> targets;
+	unordered_map<mac_key, int> index;
+	vector<pf_target*> dirty; // targets with pending observations
+};
+
+void pf_default_config(struct pf_config *config)
+{
+	config->particles = 512;
+	config->accel_sigma = 1.0f;
+	config->max_speed = 3.0f;
+	config->rssi_sigma = 6.0f;
+	config->refresh_us = 100000;
+	config->anchor_height = 1.5f;
+	config->min_x = 0.0f;
+	config->min_y = 0.0f;
+	config->max_x = 50.0f;
+	config->max_y = 50.0f;
+	config->resample_ratio = 0.5f;
+	config->drop_after_us = 30 * 1000000ULL;
+	config->seed = 0x5eed;
+}
+
+/******************
+ *  Target setup  *
+ ******************/
+static pf_target *target_alloc(pf_tracker *tracker, mac_key key)
+{
+	const int n = tracker->config.particles;
+	const size_t bytes = (size_t) n * sizeof(float);
+
+	void *block;
+	if (posix_memalign(&block, 64, bytes * 10 + (size_t) n * sizeof(int)))
+		return NULL;
+
+	pf_target *t = new pf_target;
+	float *f = (float*) block;
+	t->x = f;   t->y = f + n;   t->vx = f + 2 * n;   t->vy = f + 3 * n;   t->w = f + 4 * n;
+	t->nx = f + 5 * n;   t->ny = f + 6 * n;   t->nvx = f + 7 * n;   t->nvy = f + 8 * n;
+	t->lw = f + 9 * n;
+	t->pick = (int*) (f + 10 * n);
+	t->block = block;
+
+	t->key = key;
+	t->seed = fm_hash32(tracker->config.seed ^ mac_hash(key));
+	t->draws = 0;
+	t->initialised = false;
+	t->last_us = 0;
+	t->heard_us = 0;
+	memset(&t->estimate, 0, sizeof(t->estimate));
+	return t;
+}
+
+static void target_free(pf_target *t)
+{
+	free(t->block);
+	delete t;
+}
+
+// No prior knowledge: spread the particles uniformly over the site, at rest
+static void target_init(const pf_config *c, pf_target *t)
+{
+	const int n = c->particles;
+	const uint32_t seed = t->seed, base = t->draws;
+	const float x0 = c->min_x, y0 = c->min_y;
+	const float w = c->max_x - x0, h = c->max_y - y0;
+	float *__restrict x = t->x, *__restrict y = t->y;
+	float *__restrict vx = t->vx, *__restrict vy = t->vy, *__restrict wt = t->w;
+
+	for (int i = 0; i < n; i++) {
+		x[i] = x0 + w * fm_uniform(seed, base + 2 * i);
+		y[i] = y0 + h * fm_uniform(seed, base + 2 * i + 1);
+		vx[i] = 0.0f;
+		vy[i] = 0.0f;
+		wt[i] = 1.0f / n;
+	}
+	t->draws += 2 * n;
+	t->initialised = true;
+}
+
+/*********************
+ *  Filter stages    *
+ *********************/
+// Constant-velocity motion with a random acceleration held over the interval
+static void target_predict(const pf_config *c, pf_target *t, float dt)
+{
+	const int n = c->particles;
+	const uint32_t seed = t->seed, base = t->draws;
+	const float sigma = c->accel_sigma, vmax = c->max_speed;
+	const float x0 = c->min_x, x1 = c->max_x, y0 = c->min_y, y1 = c->max_y;
+	const float half_dt2 = 0.5f * dt * dt;
+	float *__restrict x = t->x, *__restrict y = t->y;
+	float *__restrict vx = t->vx, *__restrict vy = t->vy;
+
+	for (int i = 0; i < n; i++) {
+		float ax = sigma * fm_normal(seed, base + 2 * i);
+		float ay = sigma * fm_normal(seed, base + 2 * i + 1);
+		float px = x[i] + vx[i] * dt + ax * half_dt2;
+		float py = y[i] + vy[i] * dt + ay * half_dt2;
+		float nvx = vx[i] + ax * dt;
+		float nvy = vy[i] + ay * dt;
+		x[i] = fm_clamp(px, x0, x1);
+		y[i] = fm_clamp(py, y0, y1);
+		vx[i] = fm_clamp(nvx, -vmax, vmax);
+		vy[i] = fm_clamp(nvy, -vmax, vmax);
+	}
+	t->draws += 2 * n;
+}
+
+// How many of the readings merged into o were measured apart: no more
+// than the driver refreshes the signal in the time they span. Polled any
+// faster, the rest are copies of its cached value
+static int independent_readings(const pf_config *c, const pf_observation *o)
+{
+	if (!c->refresh_us)
+		return o->count;
+	const uint64_t refreshes = (o->timestamp_us - o->first_us) / c->refresh_us + 1;
+	return refreshes < (uint64_t) o->count ? (int) refreshes : o->count;
+}
+
+// Adds the Gaussian log-likelihood of one anchor's reading to every
+// particle. The mean of count independent readings is sqrt(count) times
+// as precise
+static void target_weigh(const pf_config *c, pf_target *t, const anchor *a, float rssi, int count)
+{
+	const int n = c->particles;
+	const float ax = a->x, ay = a->y, h2 = c->anchor_height * c->anchor_height;
+	const float ref = a->model.ref_power, slope = 5.0f * a->model.exponent;
+	const float inv_sigma = sqrtf((float) count) / c->rssi_sigma;
+	const float *__restrict x = t->x, *__restrict y = t->y;
+	float *__restrict lw = t->lw;
+
+	for (int i = 0; i < n; i++) {
+		float dx = x[i] - ax, dy = y[i] - ay;
+		float d2 = dx * dx + dy * dy + h2;
+		d2 = d2 < 1.0f ? 1.0f : d2;
+		float r = (rssi - (ref - slope * fast_log10f(d2))) * inv_sigma;
+		lw[i] -= 0.5f * r * r;
+	}
+}
+
+// Folds the batch likelihood into the weights. Returns false if every
+// particle was ruled out, in which case the weights are left untouched
+static bool target_normalise(const pf_config *c, pf_target *t, float *ess)
+{
+	const int n = c->particles;
+	float *__restrict w = t->w, *__restrict lw = t->lw;
+
+	float top = lw[0];
+	for (int i = 1; i < n; i++)
+		top = lw[i] > top ? lw[i] : top;
+
+	float sum = 0.0f;
+	for (int i = 0; i < n; i++) {
+		lw[i] = w[i] * fast_expf(lw[i] - top);
+		sum += lw[i];
+	}
+	if (!(sum > 0.0f))
+		return false;
+
+	float inv = 1.0f / sum, sq = 0.0f;
+	for (int i = 0; i < n; i++) {
+		w[i] = lw[i] * inv;
+		sq += w[i] * w[i];
+	}
+	*ess = 1.0f / sq;
+	return true;
+}
+
+// Systematic resampling: one random offset, n evenly spaced pointers into the CDF
+static void target_resample(const pf_config *c, pf_target *t)
+{
+	const int n = c->particles;
+	const float step = 1.0f / n;
+	float *__restrict w = t->w;
+	int *__restrict pick = t->pick;
+
+	float u = fm_uniform(t->seed, t->draws++) * step;
+	float cdf = w[0];
+	int j = 0;
+	for (int i = 0; i < n; i++, u += step) {
+		while (u > cdf && j < n - 1)
+			cdf += w[++j];
+		pick[i] = j;
+	}
+
+	// Gather into the spare arrays, then swap them in
+	const float *__restrict x = t->x, *__restrict y = t->y, *__restrict vx = t->vx, *__restrict vy = t->vy;
+	float *__restrict nx = t->nx, *__restrict ny = t->ny, *__restrict nvx = t->nvx, *__restrict nvy = t->nvy;
+	for (int i = 0; i < n; i++) {
+		nx[i] = x[pick[i]];
+		ny[i] = y[pick[i]];
+		nvx[i] = vx[pick[i]];
+		nvy[i] = vy[pick[i]];
+	}
+	for (int i = 0; i < n; i++)
+		w[i] = step;
+
+	float *tmp;
+	tmp = t->x;  t->x = t->nx;   t->nx = tmp;
+	tmp = t->y;  t->y = t->ny;   t->ny = tmp;
+	tmp = t->vx; t->vx = t->nvx; t->nvx = tmp;
+	tmp = t->vy; t->vy = t->nvy; t->nvy = tmp;
+}
+
+static void target_summarise(const pf_config *c, pf_target *t)
+{
+	const int n = c->particles;
+	const float *__restrict x = t->x, *__restrict y = t->y;
+	const float *__restrict vx = t->vx, *__restrict vy = t->vy, *__restrict w = t->w;
+
+	float mx = 0, my = 0, mvx = 0, mvy = 0;
+	for (int i = 0; i < n; i++) {
+		mx += w[i] * x[i];
+		my += w[i] * y[i];
+		mvx += w[i] * vx[i];
+		mvy += w[i] * vy[i];
+	}
+	float var = 0;
+	for (int i = 0; i < n; i++) {
+		float dx = x[i] - mx, dy = y[i] - my;
+		var += w[i] * (dx * dx + dy * dy);
+	}
+
+	t->estimate.x = mx;
+	t->estimate.y = my;
+	t->estimate.vx = mvx;
+	t->estimate.vy = mvy;
+	t->estimate.spread = sqrtf(var);
+	t->estimate.timestamp_us = t->last_us;
+	t->estimate.updates++;
+}
+
+static void target_update(pf_tracker *tracker, pf_target *t)
+{
+	const pf_config *c = &tracker->config;
+
+	// The batch is applied at the time of its newest reading
+	uint64_t now = 0;
+	for (size_t i = 0; i < t->pending.size(); i++)
+		if (t->pending[i].timestamp_us > now)
+			now = t->pending[i].timestamp_us;
+
+	if (!t->initialised) {
+		target_init(c, t);
+	} else if (now > t->last_us) {
+		// Long gaps would let the particles scatter over the whole site in
+		// one step; a few seconds of uncertainty is plenty to reacquire
+		float dt = (float) (now - t->last_us) * 1e-6f;
+		target_predict(c, t, dt < 5.0f ? dt : 5.0f);
+	}
+	if (now > t->last_us)
+		t->last_us = now;
+
+	memset(t->lw, 0, (size_t) c->particles * sizeof(float));
+	for (size_t i = 0; i < t->pending.size(); i++) {
+		const pf_observation *o = &t->pending[i];
+		target_weigh(c, t, &tracker->anchors[o->anchor_id], o->rssi, independent_readings(c, o));
+	}
+	t->pending.clear();
+
+	float ess;
+	if (target_normalise(c, t, &ess) && ess < c->resample_ratio * c->particles)
+		target_resample(c, t);
+	target_summarise(c, t);
+}
+
+static void update_job(void *arg, int index)
+{
+	pf_tracker *tracker = (pf_tracker*) arg;
+	target_update(tracker, tracker->dirty[index]);
+}
+
+/****************
+ *  Public API  *
+ ****************/
+struct pf_tracker *pf_tracker_create(const struct pf_config *config, const struct anchor *anchors,
+                                     int anchor_count, struct work_pool *pool)
+{
+	if (config->particles <= 0 || anchor_count <= 0 || config->rssi_sigma <= 0.0f)
+		return NULL;
+
+	pf_tracker *tracker = new pf_tracker;
+	tracker->config = *config;
+	tracker->config.particles = (config->particles + 15) & ~15;
+	tracker->anchors.assign(anchors, anchors + anchor_count);
+	tracker->pool = pool;
+	return tracker;
+}
+
+void pf_tracker_destroy(struct pf_tracker *tracker)
+{
+	if (!tracker)
+		return;
+	for (size_t i = 0; i < tracker->targets.size(); i++)
+		target_free(tracker->targets[i]);
+	delete tracker;
+}
+
+bool pf_tracker_set_anchor(struct pf_tracker *tracker, int anchor_id, const struct anchor *a)
+{
+	if (anchor_id < 0 || anchor_id >= (int) tracker->anchors.size())
+		return false;
+	tracker->anchors[anchor_id] = *a;
+	return true;
+}
+
+bool pf_tracker_observe(struct pf_tracker *tracker, mac_key target, int anchor_id,
+                        float rssi, uint64_t timestamp_us)
+{
+	if (anchor_id < 0 || anchor_id >= (int) tracker->anchors.size())
+		return false;
+
+	pf_target *t;
+	unordered_map<mac_key, int>::iterator it = tracker->index.find(target);
+	if (it != tracker->index.end()) {
+		t = tracker->targets[it->second];
+	} else {
+		t = target_alloc(tracker, target);
+		if (!t)
+			return false;
+		tracker->index[target] = (int) tracker->targets.size();
+		tracker->targets.push_back(t);
+	}
+
+	if (t->pending.empty())
+		tracker->dirty.push_back(t);
+
+	// Repeated readings of one anchor within a step are averaged, which
+	// keeps the cost of a step proportional to anchors rather than readings
+	for (size_t i = 0; i < t->pending.size(); i++) {
+		pf_observation *o = &t->pending[i];
+		if (o->anchor_id != anchor_id)
+			continue;
+		o->count++;
+		o->rssi += (rssi - o->rssi) / o->count;
+		if (timestamp_us < o->first_us)
+			o->first_us = timestamp_us;
+		if (timestamp_us > o->timestamp_us)
+			o->timestamp_us = timestamp_us;
+		if (timestamp_us > t->heard_us)
+			t->heard_us = timestamp_us;
+		return true;
+	}
+	pf_observation o = { anchor_id, rssi, 1, timestamp_us, timestamp_us };
+	t->pending.push_back(o);
+	if (timestamp_us > t->heard_us)
+		t->heard_us = timestamp_us;
+	return true;
+}
+
+int pf_tracker_step(struct pf_tracker *tracker, uint64_t now_us)
+{
+	int updated = (int) tracker->dirty.size();
+	if (tracker->pool)
+		work_pool_run(tracker->pool, update_job, tracker, updated);
+	else
+		for (int i = 0; i < updated; i++)
+			update_job(tracker, i);
+	tracker->dirty.clear();
+
+	// Swap-remove the targets that went quiet
+	for (size_t i = 0; i < tracker->targets.size(); ) {
+		pf_target *t = tracker->targets[i];
+		if (t->heard_us + tracker->config.drop_after_us >= now_us) {
+			i++;
+			continue;
+		}
+		tracker->index.erase(t->key);
+		target_free(t);
+		tracker->targets[i] = tracker->targets.back();
+		tracker->targets.pop_back();
+		if (i < tracker->targets.size())
+			tracker->index[tracker->targets[i]->key] = (int) i;
+	}
+	return updated;
+}
+
+bool pf_tracker_estimate(const struct pf_tracker *tracker, mac_key target, struct pf_estimate *estimate)
+{
+	unordered_map<mac_key, int>::const_iterator it = tracker->index.find(target);
+	if (it == tracker->index.end())
+		return false;
+	const pf_target *t = tracker->targets[it->second];
+	if (!t->initialised)
+		return false;
+	*estimate = t->estimate;
+	return true;
+}
+
+int pf_tracker_count(const struct pf_tracker *tracker)
+{
+	return (int) tracker->targets.size();
+}
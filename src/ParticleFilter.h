@@ -0,0 +1,68 @@
+//============================================================================
+// Name        : ParticleFilter.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Particle-filter tracking of moving targets from the RSSI
+//               that fixed anchors measure for them
+//============================================================================
+
+#ifndef RADIOLOCATE_PARTICLEFILTER_H
+#define RADIOLOCATE_PARTICLEFILTER_H
+
+#include <stdint.h>
+
+#include "Mac.h"
+#include "PathLoss.h"
+
+struct work_pool;
+
+struct pf_config {
+	int particles;           // per target, rounded up to a multiple of 16
+	float accel_sigma;       // m/s^2, random acceleration of the motion model
+	float max_speed;         // m/s, per axis
+	float rssi_sigma;        // dB, measurement noise of one reading
+	// How often drivers refresh the signal: readings of one anchor closer
+	// together than this repeat one value and count once. 0 counts all
+	uint64_t refresh_us;
+	float anchor_height;     // m, vertical offset between anchors and targets
+	float min_x, min_y;      // site bounds (m), targets are born uniformly
+	float max_x, max_y;      // inside them and never leave
+	float resample_ratio;    // resample when ESS drops below this * particles
+	uint64_t drop_after_us;  // forget targets not heard for this long
+	uint32_t seed;
+};
+
+// Sensible indoor defaults for a 50 x 50 m site
+void pf_default_config(struct pf_config *config);
+
+struct pf_estimate {
+	float x, y;              // weighted mean position (m)
+	float vx, vy;            // weighted mean velocity (m/s)
+	float spread;            // RMS distance of the particles from (x, y)
+	uint64_t timestamp_us;   // time of the newest observation used
+	uint32_t updates;
+};
+
+struct pf_tracker;
+
+// The anchors are copied. pool may be NULL to update targets on the calling thread
+struct pf_tracker *pf_tracker_create(const struct pf_config *config, const struct anchor *anchors,
+                                     int anchor_count, struct work_pool *pool);
+void pf_tracker_destroy(struct pf_tracker *tracker);
+
+// Replaces an anchor's position or calibration (e.g. from the online
+// calibrator). Takes effect from the next pf_tracker_step()
+bool pf_tracker_set_anchor(struct pf_tracker *tracker, int anchor_id, const struct anchor *a);
+
+// Queues one reading; nothing is computed until the next pf_tracker_step().
+// Readings of the same anchor between two steps are averaged into one
+bool pf_tracker_observe(struct pf_tracker *tracker, mac_key target, int anchor_id,
+                        float rssi, uint64_t timestamp_us);
+
+// Advances every target with queued readings (in parallel across the pool)
+// and drops targets that went quiet. Returns the number of targets updated
+int pf_tracker_step(struct pf_tracker *tracker, uint64_t now_us);
+
+bool pf_tracker_estimate(const struct pf_tracker *tracker, mac_key target, struct pf_estimate *estimate);
+int pf_tracker_count(const struct pf_tracker *tracker);
+
+#endif // RADIOLOCATE_PARTICLEFILTER_H
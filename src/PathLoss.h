@@ -0,0 +1,39 @@
+//============================================================================
+// Name        : PathLoss.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Log-distance path-loss model and anchor (sensor) geometry
+//============================================================================
+
+#ifndef RADIOLOCATE_PATHLOSS_H
+#define RADIOLOCATE_PATHLOSS_H
+
+#include "FastMath.h"
+
+// rssi(d) = ref_power - 10 * exponent * log10(d / 1 m)
+struct path_loss_model {
+	float ref_power; // dBm received at 1 m
+	float exponent;  // 2 in free space, typically 2.5 - 4 indoors
+};
+
+// A sensor at a surveyed position on the site floor plan (metres)
+struct anchor {
+	float x, y;
+	struct path_loss_model model;
+};
+
+// Distances below 1 m are clamped, the model is meaningless in the near field
+static inline float path_loss_rssi_d2(const struct path_loss_model *model, float dist2)
+{
+	dist2 = dist2 < 1.0f ? 1.0f : dist2;
+	// 10 * n * log10(d) == 5 * n * log10(d^2), which saves the sqrt
+	return model->ref_power - 5.0f * model->exponent * fast_log10f(dist2);
+}
+
+static inline float path_loss_rssi(const struct anchor *a, float x, float y, float height)
+{
+	float dx = x - a->x;
+	float dy = y - a->y;
+	return path_loss_rssi_d2(&a->model, dx * dx + dy * dy + height * height);
+}
+
+#endif // RADIOLOCATE_PATHLOSS_H
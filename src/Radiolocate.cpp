@@ -6,322 +6,309 @@
 //               http://dev.linuxfoundation.org/moblin-navigator/browse/interface.php?cmd=list-bylibrary&Lid=318&changever=2.0_proposed
 //============================================================================
 
-// Undefine this to lookup the device by physical name
-#define ID_BY_IFNAME
-
-#include <time.h>   // for gettimeofday()
-#include <unistd.h> // for usleep()
-#ifdef ID_BY_IFNAME
-	#include <net/if.h>
-#else
-	#include <fcntl.h>
-#endif
-
-// Install libnl-dev first
-#include <netlink/genl/genl.h>
-#include <netlink/genl/family.h>
-#include <netlink/genl/ctrl.h>
-
-#include "nl80211.h"
+#include <stdio.h>
+#include <stdlib.h> // for strtoul()
+#include <string.h>
+#include <sys/time.h> // for gettimeofday()
+#include <unistd.h> // for getopt()
+
+#include "Output.h"
+#include "Realtime.h"
+#include "Sample.h"
+#include "Session.h"
+#include "SharedSnapshot.h"
+#include "StationDelta.h"
+#include "WireProtocol.h"
 
 using namespace std;
 
-// Stores the result of the scan
-int g_signal_strength = 0;
-
-/**********************************
- *  libnl 2.0 compatibility code  *
- **********************************/
-#ifndef CONFIG_LIBNL20
-
-static inline struct nl_handle *nl_socket_alloc(void)
-{
-	return nl_handle_alloc();
-}
-
-static inline void nl_socket_free(struct nl_sock *h)
-{
-	nl_handle_destroy((nl_handle*) h);
-}
-
-static inline int __genl_ctrl_alloc_cache(struct nl_sock *h, struct nl_cache **cache)
-{
-	struct nl_cache *tmp = genl_ctrl_alloc_cache((nl_handle*) h);
-	if (!tmp)
-		return -1;
-	*cache = tmp;
-	return 0;
-}
-#define genl_ctrl_alloc_cache __genl_ctrl_alloc_cache
-#endif // CONFIG_LIBNL20
-
-
-/*******************
- *  nl80211_state  *
- *******************/
-struct nl80211_state {
-	struct nl_sock *nl_sock;
-	struct nl_cache *nl_cache;
-	struct genl_family *nl80211;
+// Everything the sample callback feeds; acquisition itself lives in the
+// session (see Session.h)
+struct cli_state {
+	// Stores the result of the scan
+	int signal_strength;
+	// The full reading behind signal_strength
+	struct rl_sample sample;
+	int error;
+	// Latest reading of every station, for local readers (NULL unless -m)
+	struct snapshot_writer *snapshot;
+	// Everything printed goes through its thread, so that a slow terminal
+	// doesn't hold up the scans, or on io_uring through the session's ring
+	struct out_writer *output;
+	// Reports every station that came, left or changed instead (NULL
+	// unless -d). One is enough: the CLI polls a single interface
+	struct station_delta *delta;
+	// Readings also go to the aggregator (NULL unless -a)
+	struct wire_sender *sender;
 };
 
-static bool nl80211_init(struct nl80211_state *state)
+static void report_changes(struct cli_state *cli, const struct rl_sample *samples, int count)
 {
-	// Allocate a new socket
-	state->nl_sock = (nl_sock*) nl_socket_alloc();
-	if (!state->nl_sock) {
-		fprintf(stderr, "Failed to allocate netlink socket.\n");
-		return false;
-	}
-
-	// Connect to the generic netlink
-	if (genl_connect((nl_handle*) state->nl_sock)) {
-		fprintf(stderr, "Failed to connect to generic netlink.\n");
-		nl_socket_free(state->nl_sock);
-		return false;
-	}
-
-	// Allocate the generic netlink cache
-	if (genl_ctrl_alloc_cache(state->nl_sock, &state->nl_cache)) {
-		fprintf(stderr, "Failed to allocate generic netlink cache.\n");
-		nl_socket_free(state->nl_sock);
-		return false;
-	}
-
-	// Look up generic netlink family by family name in the provided cache
-	state->nl80211 = genl_ctrl_search_by_name(state->nl_cache, "nl80211");
-	if (!state->nl80211) {
-		fprintf(stderr, "nl80211 not found.\n");
-		nl_cache_free(state->nl_cache);
-		nl_socket_free(state->nl_sock);
-		return false;
+	const struct delta_event *events;
+	const int n = delta_update(cli->delta, samples, count, &events);
+	for (int i = 0; i < n; i++)
+	{
+		if (events[i].kind == DELTA_REMOVED)
+		{
+			out_removed(cli->output, &events[i].sample);
+			continue;
+		}
+		out_sample(cli->output, &events[i].sample, -1);
+		if (cli->sender)
+			wire_sender_add(cli->sender, &events[i].sample);
 	}
-
-	return true;
 }
 
-static void nl80211_cleanup(struct nl80211_state *state)
+// Called with every station of every dump. Like the old print_sta_handler,
+// the last station that reports a signal wins
+static void on_samples(void *arg, uint32_t, const struct rl_sample *samples, int count, int error)
 {
-	genl_family_put(state->nl80211);
-	nl_cache_free(state->nl_cache);
-	nl_socket_free(state->nl_sock);
-}
-
-/*******************************
- *  nl80211 callback handlers  *
- *******************************/
-static int print_sta_handler(struct nl_msg *msg, void *arg)
-{
-	// Normally tb_max would be NL80211_ATTR_MAX. CHANGE THIS IF NECESSARY
-	const int tb_max = NL80211_ATTR_STA_INFO;
-	struct nlattr *tb[tb_max + 1];
-	struct genlmsghdr *gnlh = (genlmsghdr*) nlmsg_data(nlmsg_hdr(msg));
-	// Normally sinfo_max would be NL80211_STA_INFO_MAX. CHANGE THIS IF NECESSARY
-	const int sinfo_max = NL80211_STA_INFO_SIGNAL;
-	struct nlattr *sinfo[sinfo_max + 1];
-	static struct nla_policy stats_policy[sinfo_max + 1];
-	memset(stats_policy, 0, sizeof(stats_policy));
-	stats_policy[NL80211_STA_INFO_SIGNAL].type = NLA_U8;
-
-	// Create attribute index based on stream of attributes.
-	// Iterates over the stream of attributes and stores a pointer to each
-	// attribute in the index array using the attribute type as index to the
-	// array. Attribute with a type greater than the maximum type specified
-	// will be silently ignored in order to maintain backwards compatibility.
-	nla_parse(tb, tb_max, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
-
-	/*
-	 * TODO (from iw scan.c): validate the interface and mac address!
-	 * Otherwise, there's a race condition as soon as
-	 * the kernel starts sending station notifications.
-	 */
-
-	if (!tb[NL80211_ATTR_STA_INFO])
+	struct cli_state *cli = (cli_state*) arg;
+	if (error)
 	{
-		fprintf(stderr, "STA stats missing!\n");
-		return NL_SKIP;
+		cli->error = error;
+		return;
 	}
-	// Create attribute index based on nested attribute.
-	// Feeds the stream of attributes nested into the specified attribute to nla_parse().
-	if (nla_parse_nested(sinfo, sinfo_max, tb[NL80211_ATTR_STA_INFO], stats_policy))
+	for (int i = 0; i < count; i++)
 	{
-		fprintf(stderr, "Failed to parse nested attributes!\n");
-		return NL_SKIP;
+		if (!samples[i].signal)
+			continue;
+		cli->signal_strength = samples[i].signal;
+		cli->sample = samples[i];
+
+		// Every station of the dump, not just the last one in sample
+		if (cli->snapshot)
+			snapshot_publish(cli->snapshot, &samples[i]);
 	}
-
-	/*
-	// Print the station info
-	// TODO: use NL80211_ATTR_IFNAME so we don't rely on if_indextoname()
-#ifdef ID_BY_IFNAME
-	char mac_addr[20], dev[20];
-	unsigned char *byte = (unsigned char*)nla_data(tb[NL80211_ATTR_MAC]);
-	snprintf(mac_addr, sizeof(mac_addr), "%hhX:%hhX:%hhX:%hhX:%hhX:%hhX", byte[0], byte[1], byte[2], byte[3], byte[4], byte[5]);
-	if_indextoname(nla_get_u32(tb[NL80211_ATTR_IFINDEX]), dev); // could also use NL80211_ATTR_IFNAME
-	printf("Station %s (on %s)\n", mac_addr, dev);
-#endif
-	*/
-
-	// Print the signal strength
-	if (sinfo[NL80211_STA_INFO_SIGNAL])
-	{
-		//printf("SIGNAL STRENGTH: %d dBm\n", (int8_t)nla_get_u8(sinfo[NL80211_STA_INFO_SIGNAL]));
-		g_signal_strength = (int8_t)nla_get_u8(sinfo[NL80211_STA_INFO_SIGNAL]);
-	}
-
-	return NL_SKIP;
+	if (cli->delta)
+		report_changes(cli, samples, count);
 }
 
-static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+static void usage(const char *argv0)
 {
-	int *ret = (int*) arg;
-	*ret = err->error;
-	return NL_STOP;
+	fprintf(stderr, "Usage: %s [-i ifname] [-o text|json|binary] [-d] [-A max_us] [-a host:port] [-n sensor_id] [-m /name]\n"
+	                "       [-R priority [-c cpu] [-b spin_us]]\n"
+	                "  -i  interface to poll (default wlan0)\n"
+	                "  -o  output format (default text)\n"
+	                "  -d  report every station that appears, leaves or changes, not just the last\n"
+	                "  -A  adaptive polling: back off up to max_us while no station moves or changes\n"
+	                "  -a  also stream readings to the aggregator at host:port\n"
+	                "  -n  sensor id to report to the aggregator (default 0)\n"
+	                "  -m  publish the latest reading of every station in shared memory /name\n"
+	                "  -R  realtime mode: lock memory and run SCHED_FIFO at this priority\n"
+	                "  -c  realtime mode: pin to this CPU\n"
+	                "  -b  realtime mode: spin up to spin_us for wakeups and replies (default 50)\n", argv0);
 }
 
-static int finish_handler(struct nl_msg *msg, void *arg)
+// The writer's sink on io_uring
+static bool emit_output(void *arg, const void *data, size_t len)
 {
-	int *ret = (int*) arg;
-	*ret = 0;
-	return NL_SKIP;
+	return rl_session_write((struct rl_session*) arg, data, len);
 }
 
-#ifndef ID_BY_IFNAME
-// Converts a physical interface name (e.g. phy0) into an index
-static int phy_lookup(const char *name)
+static void cleanup(struct rl_session *session, struct cli_state *cli)
 {
-	char buf[200];
-	int fd, pos;
-
-	snprintf(buf, sizeof(buf), "/sys/class/ieee80211/%s/index", name);
-
-	fd = open(buf, O_RDONLY);
-	if (fd < 0)
-		return -1;
-	pos = read(fd, buf, sizeof(buf) - 1);
-	if (pos < 0) {
-		close(fd);
-		return -1;
-	}
-	buf[pos] = '\0';
-	close(fd);
-	return atoi(buf);
+	// Output on the session's ring has to get into it before it goes; the
+	// session then waits for the writes
+	if (session && cli->output)
+		while (!out_writer_pump(cli->output) && rl_session_poll(session, 1000) >= 0)
+			;
+	rl_session_destroy(session);
+	// Flushes whatever is still batched
+	wire_sender_destroy(cli->sender);
+	snapshot_destroy(cli->snapshot, true);
+	delta_destroy(cli->delta);
+	// Writes out whatever is still queued
+	out_writer_destroy(cli->output);
 }
-#endif // ID_BY_IFNAME
 
-
-static int do_scan(void)
+int main(int argc, char **argv)
 {
-	struct nl80211_state nlstate;
-	struct nl_cb *cb;
-	struct nl_cb *s_cb;
-	struct nl_msg *msg;
-	const bool debug = false;
-
-	if (!nl80211_init(&nlstate))
+	const int sleep_interval = 1000; // microseconds
+	const uint64_t duration = 5; // seconds
+	const uint64_t max_send_delay = 100000; // microseconds
+	const uint32_t snapshot_capacity = 4096; // stations
+	int prev_signal_strength;
+	struct timeval cur_time, last;
+
+	struct cli_state cli;
+	memset(&cli, 0, sizeof(cli));
+
+	const char *ifname = "wlan0";
+	struct out_config output;
+	out_default_config(&output);
+	const char *aggregator = NULL;
+	uint32_t sensor_id = 0;
+	const char *snapshot = NULL;
+	bool deltas = false;
+	uint64_t max_interval = 0;
+	bool realtime = false;
+	bool realtime_tuned = false; // -c or -b, which only apply with -R
+	struct rt_config rt;
+	rt_default_config(&rt);
+	int opt;
+	while ((opt = getopt(argc, argv, "i:o:dA:a:n:m:R:c:b:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'i':
+			ifname = optarg;
+			break;
+		case 'o':
+			if (!strcmp(optarg, "text"))
+				output.format = out_format_text;
+			else if (!strcmp(optarg, "json"))
+				output.format = out_format_json;
+			else if (!strcmp(optarg, "binary"))
+				output.format = out_format_binary;
+			else
+			{
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'd':
+			deltas = true;
+			break;
+		case 'A':
+			max_interval = strtoull(optarg, NULL, 0);
+			break;
+		case 'a':
+			aggregator = optarg;
+			break;
+		case 'n':
+			sensor_id = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			snapshot = optarg;
+			break;
+		case 'R':
+			realtime = true;
+			rt.priority = atoi(optarg);
+			break;
+		case 'c':
+			rt.cpu = atoi(optarg);
+			realtime_tuned = true;
+			break;
+		case 'b':
+			rt.spin_us = strtoull(optarg, NULL, 0);
+			realtime_tuned = true;
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (realtime_tuned && !realtime)
+	{
+		fprintf(stderr, "-c and -b only apply to realtime mode (-R).\n");
+		usage(argv[0]);
 		return -1;
+	}
 
-	// Allocate a new netlink message with the default maximum payload size.
-	// Allocates a new netlink message without any further payload. The maximum
-	// payload size defaults to PAGESIZE or as otherwise specified with
-	// nlmsg_set_default_size()
-	msg = nlmsg_alloc();
-	if (!msg) {
-		fprintf(stderr, "Failed to allocate netlink message.\n");
+	if ((aggregator && !(cli.sender = wire_sender_create(aggregator, sensor_id, max_send_delay))) ||
+	    (snapshot && !(cli.snapshot = snapshot_create(snapshot, snapshot_capacity))))
+	{
+		cleanup(NULL, &cli);
 		return -1;
 	}
-
-	// Allocate new callback handles
-	cb = nl_cb_alloc(debug ? NL_CB_DEBUG : NL_CB_DEFAULT);
-	s_cb = nl_cb_alloc(debug ? NL_CB_DEBUG : NL_CB_DEFAULT);
-	if (!cb || !s_cb) {
-		fprintf(stderr, "Failed to allocate netlink callbacks.\n");
-		// Release the reference from the netlink message
-		nlmsg_free(msg);
-		return 2;
+	if (deltas)
+	{
+		struct delta_config delta;
+		delta_default_config(&delta);
+		cli.delta = delta_create(&delta);
 	}
 
-	// Add generic netlink header to the netlink message
-	genlmsg_put(msg, 0, 0, genl_family_get_id(nlstate.nl80211), 0, NLM_F_DUMP, NL80211_CMD_GET_STATION, 0);
-
-	// Add 32 bit integer attribute to the netlink message
-#ifdef ID_BY_IFNAME
-	if (nla_put_u32(msg, NL80211_ATTR_IFINDEX, if_nametoindex("wlan0")) != 0)
-#else
-	if (nla_put_u32(msg, NL80211_ATTR_WIPHY, phy_lookup("phy0")) != 0)
-#endif
+	struct rl_session_config config;
+	rl_session_default_config(&config);
+	config.max_interval_us = max_interval;
+	config.output_fd = output.output_fd;
+	if (realtime)
+		config.spin_us = rt.spin_us;
+	struct rl_session *session = rl_session_create(&config, on_samples, &cli);
+	if (!session || !rl_session_add_interface(session, ifname, sleep_interval))
 	{
-		fprintf(stderr, "Building message failed.\n");
-		return 2;
+		cleanup(session, &cli);
+		return -1;
 	}
 
-	// Set up the callbacks
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, print_sta_handler, NULL);
-	nl_socket_set_cb((nl_handle*) nlstate.nl_sock, s_cb);
-
-	// Automatically complete and send the netlink message
-	if (nl_send_auto_complete((nl_handle*) nlstate.nl_sock, msg) < 0)
+	// On io_uring the output is written by the ring, pumped into it before
+	// every poll. Otherwise the writer thread is started before rt_enter(),
+	// so that it stays on the normal scheduler and off the isolated CPU
+	if (rl_session_uses_uring(session))
+	{
+		output.emit = emit_output;
+		output.emit_arg = session;
+	}
+	if (!(cli.output = out_writer_create(&output)))
 	{
-		fprintf(stderr, "Sending netlink message failed.\n");
-		nl_cb_put(cb);
-		nlmsg_free(msg);
+		cleanup(session, &cli);
 		return -1;
 	}
-
-	int err = 1;
-	nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &err);
-	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &err);
-
-	// Receive a set of messages from the netlink socket
-	while (err > 0)
-		nl_recvmsgs((nl_handle*) nlstate.nl_sock, cb);
-
-	nl_cb_put(cb);
-	nlmsg_free(msg);
-
-	nl80211_cleanup(&nlstate);
-	return err;
-}
-
-int main()
-{
-	const int sleep_interval = 1000; // microseconds
-	const int duration = 5; // seconds
-	int prev_signal_strength;
-	g_signal_strength = 0;
-	struct timeval init, cur_time, last;
-	gettimeofday(&init, NULL);
+	// mlockall() also locks what the session has already allocated
+	if (realtime)
+		rt_enter(&rt);
 
 	// Get an initial signal strength value
-	if (do_scan() != 0 || g_signal_strength == 0)
+	if (rl_session_poll(session, -1) < 0 || cli.error || cli.signal_strength == 0)
 	{
-		printf("Initial scan failed, aborting.\n");
+		out_message(cli.output, OUT_MESSAGE, "Initial scan failed, aborting.");
+		cleanup(session, &cli);
 		return -1;
 	}
-	printf("Signal strength: %d dBm\n", g_signal_strength);
-	prev_signal_strength = g_signal_strength;
+	// The first dump already reported every station
+	if (!cli.delta)
+	{
+		out_sample(cli.output, &cli.sample, -1);
+		if (cli.sender)
+			wire_sender_add(cli.sender, &cli.sample);
+	}
+	prev_signal_strength = cli.signal_strength;
 	gettimeofday(&last, NULL);
 
-	do
+	const uint64_t end = monotonic_us() + duration * 1000000;
+	for (uint64_t now = monotonic_us(); now < end; now = monotonic_us())
 	{
-		usleep(sleep_interval);
-		if (do_scan() != 0)
+		// Returns after each dump, or at the end. Wakes up in time for the
+		// readings batched for the aggregator even if no dump completes
+		const uint64_t due = cli.sender ? wire_sender_deadline(cli.sender) : UINT64_MAX;
+		uint64_t until = end;
+		if (due < until)
+			until = due > now ? due : now;
+		// Into the ring right before it waits, which submits the write
+		out_writer_pump(cli.output);
+		if (rl_session_poll(session, until - now) < 0 || cli.error)
 		{
-			printf("Scan failed, aborting.\n");
+			out_message(cli.output, OUT_MESSAGE, "Scan failed, aborting.");
+			cleanup(session, &cli);
 			return -1;
 		}
+		if (cli.sender)
+			wire_sender_poll(cli.sender, monotonic_us());
 
 		gettimeofday(&cur_time, NULL);
-		if (prev_signal_strength != g_signal_strength)
+		if (!cli.delta && prev_signal_strength != cli.signal_strength)
 		{
 			int ms = (cur_time.tv_sec - last.tv_sec) * 1000 + (cur_time.tv_usec - last.tv_usec) / 1000;
-			printf("Signal strength: %d dBm (Scan: %d ms)\n", g_signal_strength, ms);
+			out_sample(cli.output, &cli.sample, ms);
+			if (cli.sender)
+				wire_sender_add(cli.sender, &cli.sample);
 			gettimeofday(&last, NULL);
-			prev_signal_strength = g_signal_strength;
+			prev_signal_strength = cli.signal_strength;
 		}
-	} while (cur_time.tv_sec <= init.tv_sec + duration || cur_time.tv_usec < init.tv_usec);
+	}
 
 	// Result: Drivers refresh the signal strength every 100ms
-
+	struct rl_session_stats stats;
+	rl_session_get_stats(session, &stats);
+	struct out_stats out;
+	out_writer_get_stats(cli.output, &out);
+	cleanup(session, &cli);
+
+	// After the output is flushed; not into a binary stream
+	FILE *report = output.format == out_format_binary ? stderr : stdout;
+	rt_jitter_print(&stats.wakeup, realtime ? "Realtime" : "Normal", report);
+	if (out.dropped)
+		fprintf(report, "Output dropped %llu records\n", (unsigned long long) out.dropped);
 	return 0;
 }
-
@@ -0,0 +1,190 @@
+//============================================================================
+// Name        : Realtime.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Opt-in low-jitter acquisition mode
+//============================================================================
+
+#include "Realtime.h"
+#include "Sample.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+	#define rt_cpu_relax() __builtin_ia32_pause()
+#else
+	#define rt_cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+void rt_default_config(struct rt_config *config)
+{
+	config->priority = 0;
+	config->cpu = -1;
+	config->lock_memory = true;
+	config->prefault_stack = 256 * 1024;
+	config->prefault_heap = 4 * 1024 * 1024;
+	config->spin_us = 50;
+}
+
+// Touching the stack once makes later calls hit resident, locked pages
+static void __attribute__((noinline)) prefault_stack(size_t bytes)
+{
+	volatile char *stack = (volatile char*) alloca(bytes);
+	const long page = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < bytes; i += page)
+		stack[i] = 0;
+}
+
+// With trimming and mmap() disabled, malloc() keeps these pages for later
+// allocations (netlink messages, callbacks) instead of faulting in new ones
+static void prefault_heap(size_t bytes)
+{
+	char *heap = (char*) malloc(bytes);
+	if (!heap)
+		return;
+	const long page = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < bytes; i += page)
+		heap[i] = 0;
+	free(heap);
+}
+
+bool rt_enter(const struct rt_config *config)
+{
+	bool ok = true;
+
+	if (config->lock_memory) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+			fprintf(stderr, "mlockall failed: %s\n", strerror(errno));
+			ok = false;
+		}
+		mallopt(M_TRIM_THRESHOLD, -1);
+		mallopt(M_MMAP_MAX, 0);
+	}
+	if (config->prefault_stack)
+		prefault_stack(config->prefault_stack);
+	if (config->prefault_heap)
+		prefault_heap(config->prefault_heap);
+
+	if (config->cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(config->cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			fprintf(stderr, "Failed to pin to CPU %d: %s\n", config->cpu, strerror(errno));
+			ok = false;
+		}
+	}
+
+	if (config->priority > 0) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = config->priority;
+		if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+			fprintf(stderr, "Failed to set SCHED_FIFO priority %d: %s\n", config->priority, strerror(errno));
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+uint64_t rt_sleep_until(uint64_t deadline_us, uint64_t spin_us)
+{
+	uint64_t now = monotonic_us();
+	if (deadline_us > now + spin_us) {
+		// Absolute deadlines don't accumulate the drift of relative ones
+		const uint64_t wake = deadline_us - spin_us;
+		struct timespec ts;
+		ts.tv_sec = wake / 1000000;
+		ts.tv_nsec = (wake % 1000000) * 1000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+		now = monotonic_us();
+	}
+	while (now < deadline_us) {
+		rt_cpu_relax();
+		now = monotonic_us();
+	}
+	return now;
+}
+
+bool rt_wait_readable(int fd, uint64_t spin_us)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	if (spin_us) {
+		const uint64_t give_up = monotonic_us() + spin_us;
+		do {
+			pfd.revents = 0;
+			const int n = poll(&pfd, 1, 0);
+			if (n > 0)
+				return true;
+			if (n < 0 && errno != EINTR)
+				return false;
+			rt_cpu_relax();
+		} while (monotonic_us() < give_up);
+	}
+
+	for (;;) {
+		pfd.revents = 0;
+		const int n = poll(&pfd, 1, -1);
+		if (n > 0)
+			return true;
+		if (n < 0 && errno != EINTR)
+			return false;
+	}
+}
+
+void rt_jitter_init(struct rt_jitter *jitter)
+{
+	memset(jitter, 0, sizeof(*jitter));
+}
+
+void rt_jitter_add(struct rt_jitter *jitter, uint64_t deadline_us, uint64_t woke_us)
+{
+	const uint64_t late = woke_us > deadline_us ? woke_us - deadline_us : 0;
+	int bucket = late ? 64 - __builtin_clzll(late) : 0;
+	if (bucket >= RT_JITTER_BUCKETS)
+		bucket = RT_JITTER_BUCKETS - 1;
+	jitter->buckets[bucket]++;
+	jitter->count++;
+	jitter->sum_us += late;
+	if (late > jitter->max_us)
+		jitter->max_us = late;
+}
+
+uint64_t rt_jitter_quantile(const struct rt_jitter *jitter, double quantile)
+{
+	const uint64_t rank = (uint64_t) (quantile * jitter->count);
+	uint64_t seen = 0;
+	for (int i = 0; i < RT_JITTER_BUCKETS; i++) {
+		seen += jitter->buckets[i];
+		if (seen > rank) {
+			const uint64_t bound = i ? 1ULL << i : 1;
+			return bound < jitter->max_us ? bound : jitter->max_us;
+		}
+	}
+	return jitter->max_us;
+}
+
+void rt_jitter_print(const struct rt_jitter *jitter, const char *label, FILE *out)
+{
+	if (!jitter->count) {
+		fprintf(out, "%s wakeup jitter: no wakeups\n", label);
+		return;
+	}
+	fprintf(out, "%s wakeup jitter over %llu wakeups: mean %.1f us, p50 < %llu us, p99 < %llu us, "
+	        "p99.9 < %llu us, max %llu us\n", label, (unsigned long long) jitter->count,
+	        (double) jitter->sum_us / jitter->count,
+	        (unsigned long long) rt_jitter_quantile(jitter, 0.5),
+	        (unsigned long long) rt_jitter_quantile(jitter, 0.99),
+	        (unsigned long long) rt_jitter_quantile(jitter, 0.999),
+	        (unsigned long long) jitter->max_us);
+}
@@ -0,0 +1,57 @@
+//============================================================================
+// Name        : Realtime.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Opt-in low-jitter acquisition: locked and prefaulted memory,
+//               SCHED_FIFO, CPU pinning, hybrid sleep/spin wakeups and
+//               busy-polled receives, plus a wakeup jitter report
+//============================================================================
+
+#ifndef RADIOLOCATE_REALTIME_H
+#define RADIOLOCATE_REALTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct rt_config {
+	int priority;         // SCHED_FIFO priority 1-99, 0 keeps the normal scheduler
+	int cpu;              // CPU to pin to (ideally one in isolcpus=), -1 for any
+	bool lock_memory;     // mlockall() and keep malloc from returning memory
+	size_t prefault_stack; // bytes of stack to touch up front
+	size_t prefault_heap;  // bytes of heap to touch up front
+	uint64_t spin_us;     // wake this early and spin the rest, 0 to only sleep
+};
+
+void rt_default_config(struct rt_config *config);
+
+// Applies config to the calling process and thread. Every step is tried;
+// failures (usually missing CAP_SYS_NICE / CAP_IPC_LOCK) are reported on
+// stderr. Returns true if all of them succeeded
+bool rt_enter(const struct rt_config *config);
+
+// Sleeps until deadline_us (CLOCK_MONOTONIC), the last spin_us of it
+// spinning on the clock. Returns the time it woke up
+uint64_t rt_sleep_until(uint64_t deadline_us, uint64_t spin_us);
+
+// Waits for fd to become readable, spinning on a zero-timeout poll() for up
+// to spin_us before blocking. Returns false on error
+bool rt_wait_readable(int fd, uint64_t spin_us);
+
+// Wakeup lateness in log2 buckets: bucket 0 is < 1 us, bucket i covers
+// [2^(i-1), 2^i) us
+#define RT_JITTER_BUCKETS 24
+
+struct rt_jitter {
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint64_t buckets[RT_JITTER_BUCKETS];
+};
+
+void rt_jitter_init(struct rt_jitter *jitter);
+void rt_jitter_add(struct rt_jitter *jitter, uint64_t deadline_us, uint64_t woke_us);
+// Upper bound of the bucket holding the given quantile (0-1), in us
+uint64_t rt_jitter_quantile(const struct rt_jitter *jitter, double quantile);
+void rt_jitter_print(const struct rt_jitter *jitter, const char *label, FILE *out);
+
+#endif // RADIOLOCATE_REALTIME_H
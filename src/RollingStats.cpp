@@ -0,0 +1,274 @@
+//============================================================================
+// Name        : RollingStats.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Sliding-window signal statistics
+//============================================================================
+
+#include "RollingStats.h"
+
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// A window is RS_BUCKETS buckets in a ring; the oldest one's totals are
+// taken back out of the window's when the ring moves on. Signals are whole
+// dBm, so the moments are kept as exact integer sums: taking a bucket back
+// out loses nothing, which running floating-point (Welford) moments could
+// not promise
+struct rs_bucket {
+	uint32_t count;
+	int64_t sum;
+	uint64_t sum_sq;
+	// As wide as count: a bucket of the 60 s window holds 6 s of samples,
+	// thousands of them at a kHz
+	uint32_t bins[RS_BINS];
+};
+
+// A sample that may still be the window's extreme: its bucket and value
+struct rs_extreme {
+	uint64_t bucket;
+	int16_t value;         // negated for the maximum
+};
+
+// Monotonic deque, at most one entry per bucket in the window, so that it
+// fits in a ring of RS_BUCKETS
+struct rs_deque {
+	rs_extreme entries[RS_BUCKETS];
+	uint8_t first, len;
+};
+
+struct rs_state {
+	uint64_t head;         // bucket number of the newest bucket
+	rs_bucket buckets[RS_BUCKETS];
+	uint64_t count;
+	int64_t sum;
+	uint64_t sum_sq;
+	uint32_t bins[RS_BINS];
+	rs_deque min, max;
+};
+
+struct rs_station {
+	mac_key mac;
+	uint64_t heard_us;
+	rs_state windows[RS_WINDOWS];
+};
+
+struct rolling_stats {
+	rs_config config;
+	uint64_t bucket_us[RS_WINDOWS];
+	vector<rs_station*> stations;
+	unordered_map<mac_key, int> index;
+};
+
+void rs_default_config(struct rs_config *config)
+{
+	config->window_us[RS_SHORT] = 1000000;
+	config->window_us[RS_MEDIUM] = 10 * 1000000ULL;
+	config->window_us[RS_LONG] = 60 * 1000000ULL;
+	config->drop_after_us = 120 * 1000000ULL;
+}
+
+static inline int bin_of(int8_t signal)
+{
+	return signal >= 0 ? RS_BINS - 1 : (signal + 128) >> 1;
+}
+
+/*************
+ *  Min/max  *
+ *************/
+static inline rs_extreme &deque_at(rs_deque *d, int i)
+{
+	return d->entries[(d->first + i) % RS_BUCKETS];
+}
+
+// Keeps the entries that can still become the extreme: older ones that
+// are no better than the new value are dropped from the back
+static void deque_push(rs_deque *d, uint64_t bucket, int value)
+{
+	if (d->len && deque_at(d, d->len - 1).bucket == bucket && deque_at(d, d->len - 1).value <= value)
+		return;
+	while (d->len && deque_at(d, d->len - 1).value >= value)
+		d->len--;
+	rs_extreme &e = deque_at(d, d->len++);
+	e.bucket = bucket;
+	e.value = value;
+}
+
+static void deque_expire(rs_deque *d, uint64_t oldest)
+{
+	while (d->len && d->entries[d->first].bucket < oldest) {
+		d->first = (d->first + 1) % RS_BUCKETS;
+		d->len--;
+	}
+}
+
+/*************
+ *  Windows  *
+ *************/
+static void state_init(rs_state *s, uint64_t bucket)
+{
+	memset(s, 0, sizeof(*s));
+	s->head = bucket;
+}
+
+// Moves the window on to end with bucket, dropping the buckets that fall
+// out of it: at most RS_BUCKETS of them, whatever the gap
+static void state_advance(rs_state *s, uint64_t bucket)
+{
+	if (bucket <= s->head)
+		return;
+	if (bucket - s->head >= RS_BUCKETS) {
+		state_init(s, bucket);
+		return;
+	}
+	while (s->head < bucket) {
+		rs_bucket *b = &s->buckets[++s->head % RS_BUCKETS];
+		s->count -= b->count;
+		s->sum -= b->sum;
+		s->sum_sq -= b->sum_sq;
+		for (int i = 0; i < RS_BINS; i++)
+			s->bins[i] -= b->bins[i];
+		memset(b, 0, sizeof(*b));
+	}
+	const uint64_t oldest = bucket >= RS_BUCKETS ? bucket + 1 - RS_BUCKETS : 0;
+	deque_expire(&s->min, oldest);
+	deque_expire(&s->max, oldest);
+}
+
+static void state_add(rs_state *s, uint64_t bucket, int8_t signal)
+{
+	state_advance(s, bucket);
+	rs_bucket *b = &s->buckets[s->head % RS_BUCKETS];
+	b->count++;
+	b->sum += signal;
+	b->sum_sq += signal * signal;
+	s->count++;
+	s->sum += signal;
+	s->sum_sq += signal * signal;
+	const int bin = bin_of(signal);
+	b->bins[bin]++;
+	s->bins[bin]++;
+	deque_push(&s->min, s->head, signal);
+	deque_push(&s->max, s->head, -signal);
+}
+
+// Lower edge of the bin holding the sample of that rank
+static int8_t percentile(const rs_state *s, uint32_t rank)
+{
+	uint32_t seen = 0;
+	for (int i = 0; i < RS_BINS - 1; i++) {
+		seen += s->bins[i];
+		if (seen > rank)
+			return 2 * i - 128;
+	}
+	return 2 * (RS_BINS - 1) - 128;
+}
+
+static void state_summary(const rs_state *s, rs_summary *summary)
+{
+	const uint64_t n = s->count;
+	summary->count = n;
+	summary->mean = (float) s->sum / n;
+	// n * sum_sq - sum^2 is exact in integers: no cancellation
+	summary->variance = n > 1 ? (float) ((int64_t) (n * s->sum_sq) - s->sum * s->sum) / (n * (n - 1)) : 0.0f;
+	summary->min = s->min.len ? s->min.entries[s->min.first].value : 0;
+	summary->max = s->max.len ? -s->max.entries[s->max.first].value : 0;
+
+	uint32_t total = 0;
+	for (int i = 0; i < RS_BINS; i++)
+		total += s->bins[i];
+	summary->p10 = percentile(s, total / 10);
+	summary->p50 = percentile(s, total / 2);
+	summary->p90 = percentile(s, total * 9 / 10);
+}
+
+/************
+ *  Engine  *
+ ************/
+struct rolling_stats *rs_create(const struct rs_config *config)
+{
+	rolling_stats *stats = new rolling_stats;
+	stats->config = *config;
+	for (int w = 0; w < RS_WINDOWS; w++) {
+		stats->bucket_us[w] = config->window_us[w] / RS_BUCKETS;
+		if (!stats->bucket_us[w])
+			stats->bucket_us[w] = 1;
+	}
+	return stats;
+}
+
+void rs_destroy(struct rolling_stats *stats)
+{
+	if (!stats)
+		return;
+	for (size_t i = 0; i < stats->stations.size(); i++)
+		delete stats->stations[i];
+	delete stats;
+}
+
+bool rs_add(struct rolling_stats *stats, const struct rl_sample *sample)
+{
+	if (!sample->signal)
+		return false;
+
+	rs_station *st;
+	unordered_map<mac_key, int>::iterator it = stats->index.find(sample->mac);
+	if (it != stats->index.end())
+		st = stats->stations[it->second];
+	else {
+		st = new rs_station();
+		st->mac = sample->mac;
+		for (int w = 0; w < RS_WINDOWS; w++)
+			state_init(&st->windows[w], sample->timestamp_us / stats->bucket_us[w]);
+		stats->index[sample->mac] = (int) stats->stations.size();
+		stats->stations.push_back(st);
+	}
+	if (sample->timestamp_us > st->heard_us)
+		st->heard_us = sample->timestamp_us;
+	for (int w = 0; w < RS_WINDOWS; w++)
+		state_add(&st->windows[w], sample->timestamp_us / stats->bucket_us[w], sample->signal);
+	return true;
+}
+
+bool rs_query(struct rolling_stats *stats, mac_key mac, enum rs_window window, uint64_t now_us,
+              struct rs_summary *summary)
+{
+	unordered_map<mac_key, int>::const_iterator it = stats->index.find(mac);
+	if (it == stats->index.end() || window < 0 || window >= RS_WINDOWS)
+		return false;
+	rs_state *s = &stats->stations[it->second]->windows[window];
+	state_advance(s, now_us / stats->bucket_us[window]);
+	if (!s->count)
+		return false;
+	state_summary(s, summary);
+	return true;
+}
+
+int rs_expire(struct rolling_stats *stats, uint64_t now_us)
+{
+	int dropped = 0;
+	// Swap-remove the stations that went quiet
+	for (size_t i = 0; i < stats->stations.size(); ) {
+		rs_station *st = stats->stations[i];
+		if (st->heard_us + stats->config.drop_after_us >= now_us) {
+			i++;
+			continue;
+		}
+		stats->index.erase(st->mac);
+		delete st;
+		stats->stations[i] = stats->stations.back();
+		stats->stations.pop_back();
+		if (i < stats->stations.size())
+			stats->index[stats->stations[i]->mac] = (int) i;
+		dropped++;
+	}
+	return dropped;
+}
+
+int rs_count(const struct rolling_stats *stats)
+{
+	return (int) stats->stations.size();
+}
@@ -0,0 +1,65 @@
+//============================================================================
+// Name        : RollingStats.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Per-station signal statistics over sliding windows (1 s,
+//               10 s and 60 s by default): count, mean, variance, min/max
+//               and approximate percentiles, each sample taken in O(1) and
+//               in a fixed amount of memory per station
+//============================================================================
+
+#ifndef RADIOLOCATE_ROLLINGSTATS_H
+#define RADIOLOCATE_ROLLINGSTATS_H
+
+#include <stdint.h>
+
+#include "Mac.h"
+#include "Sample.h"
+
+#define RS_WINDOWS 3
+// A window slides a bucket at a time, so it covers between
+// (RS_BUCKETS - 1) / RS_BUCKETS of its length and all of it
+#define RS_BUCKETS 10
+// Percentile resolution: 2 dB bins over -128..-1 dBm
+#define RS_BINS 64
+
+enum rs_window {
+	RS_SHORT,              // 1 s
+	RS_MEDIUM,             // 10 s
+	RS_LONG,               // 60 s
+};
+
+struct rs_config {
+	uint64_t window_us[RS_WINDOWS];
+	uint64_t drop_after_us; // forget stations not heard for this long
+};
+
+void rs_default_config(struct rs_config *config);
+
+struct rs_summary {
+	uint32_t count;
+	float mean;            // dBm
+	float variance;        // dB^2, 0 below two samples
+	int8_t min, max;       // dBm
+	int8_t p10, p50, p90;  // dBm, to the bin
+};
+
+struct rolling_stats;
+
+struct rolling_stats *rs_create(const struct rs_config *config);
+void rs_destroy(struct rolling_stats *stats);
+
+// Adds the sample's signal at its timestamp; samples without a signal (0)
+// are skipped. Timestamps of one station must not go backwards by more
+// than a bucket: earlier ones count in the newest bucket
+bool rs_add(struct rolling_stats *stats, const struct rl_sample *sample);
+
+// Statistics of the window ending at now_us. False if the station is
+// unknown or had no samples in the window
+bool rs_query(struct rolling_stats *stats, mac_key mac, enum rs_window window, uint64_t now_us,
+              struct rs_summary *summary);
+
+// Forgets the stations that went quiet. Returns how many
+int rs_expire(struct rolling_stats *stats, uint64_t now_us);
+int rs_count(const struct rolling_stats *stats);
+
+#endif // RADIOLOCATE_ROLLINGSTATS_H
@@ -0,0 +1,32 @@
+//============================================================================
+// Name        : Sample.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : One station reading, as it travels through the pipeline
+//============================================================================
+
+#ifndef RADIOLOCATE_SAMPLE_H
+#define RADIOLOCATE_SAMPLE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "Mac.h"
+
+struct rl_sample {
+	mac_key mac;
+	uint64_t timestamp_us; // CLOCK_MONOTONIC of the sensor that took it
+	uint32_t ifindex;
+	int8_t signal;         // dBm, NL80211_STA_INFO_SIGNAL
+	int8_t signal_avg;     // dBm, NL80211_STA_INFO_SIGNAL_AVG, 0 if not reported
+	uint16_t tx_bitrate;   // 100 kbit/s, NL80211_RATE_INFO_BITRATE, 0 if not reported
+	uint32_t inactive_ms;  // NL80211_STA_INFO_INACTIVE_TIME
+};
+
+static inline uint64_t monotonic_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif // RADIOLOCATE_SAMPLE_H
@@ -0,0 +1,80 @@
+//============================================================================
+// Name        : Seqlock.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Single-writer sequence lock. Readers never block the writer
+//               and never write to shared memory; they retry if the writer
+//               was active while they copied
+//============================================================================
+
+#ifndef RADIOLOCATE_SEQLOCK_H
+#define RADIOLOCATE_SEQLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+	#define seqlock_cpu_relax() __builtin_ia32_pause()
+#else
+	#define seqlock_cpu_relax() do { } while (0)
+#endif
+
+// Plain struct so that it can live in shared memory; only touched through
+// the __atomic builtins below
+struct seqlock {
+	uint32_t sequence; // odd while a write is in progress
+};
+
+static inline void seqlock_init(struct seqlock *lock)
+{
+	__atomic_store_n(&lock->sequence, 0, __ATOMIC_RELAXED);
+}
+
+static inline void seqlock_write_begin(struct seqlock *lock)
+{
+	uint32_t seq = __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED);
+	__atomic_store_n(&lock->sequence, seq + 1, __ATOMIC_RELAXED);
+	// The odd count must be visible before any of the payload stores
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(struct seqlock *lock)
+{
+	uint32_t seq = __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED);
+	__atomic_store_n(&lock->sequence, seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t seqlock_read_begin(const struct seqlock *lock)
+{
+	uint32_t seq;
+	while ((seq = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE)) & 1)
+		seqlock_cpu_relax();
+	return seq;
+}
+
+// True if the copy taken since seqlock_read_begin() may be torn
+static inline bool seqlock_read_retry(const struct seqlock *lock, uint32_t seq)
+{
+	// Keep the payload loads from sinking below the re-check
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED) != seq;
+}
+
+// Payload copies go word by word through relaxed atomics, so that the
+// reader's racing loads are well defined. Sizes must be multiples of 4
+static inline void seqlock_store_words(void *dst, const void *src, size_t bytes)
+{
+	uint32_t *d = (uint32_t*) dst;
+	const uint32_t *s = (const uint32_t*) src;
+	for (size_t i = 0; i < bytes / 4; i++)
+		__atomic_store_n(&d[i], s[i], __ATOMIC_RELAXED);
+}
+
+static inline void seqlock_load_words(void *dst, const void *src, size_t bytes)
+{
+	uint32_t *d = (uint32_t*) dst;
+	const uint32_t *s = (const uint32_t*) src;
+	for (size_t i = 0; i < bytes / 4; i++)
+		d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+}
+
+#endif // RADIOLOCATE_SEQLOCK_H
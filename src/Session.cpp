@@ -0,0 +1,561 @@
+//============================================================================
+// Name        : Session.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : libradiolocate acquisition session
+//============================================================================
+
+#include "Session.h"
+#include "InterfaceRegistry.h"
+#include "MotionDetector.h"
+#include "NetlinkConn.h"
+#include "NetlinkIo.h"
+#include "Nl80211Messages.h"
+#include "StationDelta.h"
+#include "TimerWheel.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <vector>
+
+#define SESSION_TICK_US 50
+// Timer key of the motion detector's housekeeping, once a second
+#define MOTION_TICK_KEY UINT64_MAX
+#define MOTION_TICK_US 1000000
+// Timer keys of alarms, ALARM_KEY_BASE + slot; interfaces are keyed by
+// index, below it. An alarm's wheel entry is cancelled as it fires, so its
+// period is never used
+#define ALARM_KEY_BASE (1ULL << 32)
+#define ALARM_PERIOD_US 1000000
+
+struct rl_interface {
+	rl_session *session;
+	char name[IFNAMSIZ];
+	uint32_t ifindex;      // 0 while no interface has the name
+	mac_key mac;           // 0: dump every station, else query just this one
+	tw_id timer;
+	uint64_t interval_us;  // its own
+	uint64_t current_us;   // after backing off
+	station_delta *delta;  // changes since the last query, if adaptive
+	bool in_flight;        // a dump is running
+	bool held;             // the batch is out with rl_session_next()
+	std::vector<rl_sample> batch;
+	int error;
+};
+
+struct rl_alarm {
+	rl_alarm_fn fn;
+	void *arg;
+};
+
+struct rl_session {
+	rl_session_config config;
+	rl_sample_fn fn;
+	void *arg;
+
+	rnl_conn *conn;
+	rnl_io *io;
+	bool uring;              // the wheel is woken by the ring's timerfd
+	rnl_family nl80211;
+	rl_registry *registry;
+	timer_wheel *wheel;
+	motion_detector *motion; // NULL unless adaptive
+	rl_interface *adapting;  // whose batch the detector is taking
+	std::vector<rl_interface*> interfaces;
+	std::vector<rl_alarm> alarms;        // by slot
+	std::vector<uint32_t> free_alarms;   // slots to reuse
+
+	std::deque<rl_interface*> completed; // for rl_session_next()
+	rl_interface *returned;              // batch last handed out by it
+	int delivered;                       // batches during this poll
+	bool woken;                          // rl_session_wake() during this poll
+	bool stopping;                       // atomic
+
+	rl_session_stats stats;
+};
+
+void rl_session_default_config(struct rl_session_config *config)
+{
+	config->use_uring = true;
+	config->spin_us = 0;
+	config->max_interval_us = 0;
+	config->backoff = 2.0f;
+	config->change_db = 4;
+	config->output_fd = -1;
+}
+
+static void family_reply(void *arg, const struct nlmsghdr *hdr)
+{
+	rnl_parse_family(hdr, (rnl_family*) arg);
+}
+
+// Asks the controller about nl80211 alone instead of listing every family.
+// The reply also carries the multicast group ids the registry joins
+static bool resolve_nl80211(rl_session *session)
+{
+	uint8_t storage[128] __attribute__((aligned(4)));
+	rnl_buffer buf;
+	rnl_buffer_init(&buf, storage, sizeof(storage));
+	const rnl_msg msg = rnl_get_family(&buf, 0, "nl80211");
+	memset(&session->nl80211, 0, sizeof(session->nl80211));
+	if (msg == RNL_NO_MSG || rnl_conn_call(session->conn, rnl_header(&buf, msg), family_reply, &session->nl80211) ||
+	    !session->nl80211.id) {
+		fprintf(stderr, "nl80211 not found.\n");
+		return false;
+	}
+	return true;
+}
+
+// Interfaces are polled by name: follow them when they come and go or the
+// name moves to another one
+static void interface_event(void *arg, const struct rl_iface *event, enum rl_iface_event type)
+{
+	rl_session *session = (rl_session*) arg;
+	for (size_t i = 0; i < session->interfaces.size(); i++) {
+		rl_interface *iface = session->interfaces[i];
+		if (type != RL_IFACE_REMOVED && !strcmp(iface->name, event->name))
+			iface->ifindex = event->ifindex;
+		else if (iface->ifindex == event->ifindex)
+			iface->ifindex = 0;
+	}
+}
+
+static void registry_ready(void *arg)
+{
+	rl_session *session = (rl_session*) arg;
+	rl_registry_receive(session->registry);
+}
+
+/**************
+ *  Adapting  *
+ **************/
+static void snap_back(rl_session *session, rl_interface *iface, uint64_t next_us)
+{
+	if (iface->current_us == iface->interval_us)
+		return;
+	iface->current_us = iface->interval_us;
+	tw_reschedule(session->wheel, iface->timer, iface->current_us, 0, next_us);
+	session->stats.snapbacks++;
+}
+
+static void back_off(rl_session *session, rl_interface *iface, uint64_t now_us)
+{
+	uint64_t next = iface->current_us * session->config.backoff;
+	if (next > session->config.max_interval_us)
+		next = session->config.max_interval_us;
+	if (next <= iface->current_us)
+		return;
+	iface->current_us = next;
+	tw_reschedule(session->wheel, iface->timer, next, 1, now_us + next);
+	session->stats.backoffs++;
+}
+
+// A station started moving: whichever target follows it is queried right
+// away, however far it had backed off
+static void motion_event(void *arg, const struct md_event *event)
+{
+	rl_session *session = (rl_session*) arg;
+	if (event->to != MD_MOVING)
+		return;
+	for (size_t i = 0; i < session->interfaces.size(); i++) {
+		rl_interface *iface = session->interfaces[i];
+		if (iface->mac == event->mac && iface != session->adapting)
+			snap_back(session, iface, monotonic_us());
+	}
+}
+
+// After every query: stations that move, come, go or change their signal
+// or activity bring it back to its own interval; a quiet one backs off.
+// Bitrates change all the time on idle links, so they don't count
+static void adapt(rl_session *session, rl_interface *iface)
+{
+	if (!session->motion)
+		return;
+	bool active = false;
+	session->adapting = iface;
+	for (size_t i = 0; i < iface->batch.size(); i++)
+		if (md_update(session->motion, &iface->batch[i]) == MD_MOVING)
+			active = true;
+	session->adapting = NULL;
+
+	const delta_event *events;
+	const int n = delta_update(iface->delta, iface->batch.data(), iface->batch.size(), &events);
+	for (int i = 0; i < n && !active; i++)
+		active = events[i].kind != DELTA_CHANGED || (events[i].changed & (DELTA_SIGNAL | DELTA_ACTIVITY));
+
+	const uint64_t now = monotonic_us();
+	if (active)
+		snap_back(session, iface, now + iface->interval_us);
+	else
+		back_off(session, iface, now);
+}
+
+static void dump_due(void *arg, tw_id id, uint64_t key, uint64_t now_us);
+
+// The ring's timerfd, armed for the wheel's next deadline
+static void session_tick(void *arg, uint64_t)
+{
+	rl_session *session = (rl_session*) arg;
+	tw_advance(session->wheel, monotonic_us(), 0, dump_due, session);
+}
+
+/***************
+ *  Lifecycle  *
+ ***************/
+struct rl_session *rl_session_create(const struct rl_session_config *config, rl_sample_fn fn, void *arg)
+{
+	const uint64_t start = monotonic_us();
+	rl_session *session = new rl_session;
+	session->config = *config;
+	session->fn = fn;
+	session->arg = arg;
+	session->io = NULL;
+	session->uring = false;
+	session->registry = NULL;
+	session->wheel = tw_create(SESSION_TICK_US, monotonic_us());
+	session->motion = NULL;
+	session->adapting = NULL;
+	session->returned = NULL;
+	session->delivered = 0;
+	session->woken = false;
+	session->stopping = false;
+	memset(&session->stats, 0, sizeof(session->stats));
+	rt_jitter_init(&session->stats.wakeup);
+
+	if (!(session->conn = rnl_conn_open(NETLINK_GENERIC)) || !resolve_nl80211(session) ||
+	    !(session->registry = rl_registry_create(session->conn, &session->nl80211, interface_event, session))) {
+		rl_session_destroy(session);
+		return NULL;
+	}
+	rnl_io_config io_config;
+	rnl_io_default_config(&io_config);
+	io_config.use_uring = config->use_uring;
+	io_config.watch_fd = rl_registry_fd(session->registry);
+	io_config.on_ready = registry_ready;
+	io_config.on_timer = session_tick;
+	io_config.arg = session;
+	io_config.output_fd = config->output_fd;
+	if (!(session->io = rnl_io_create(session->conn, &io_config))) {
+		rl_session_destroy(session);
+		return NULL;
+	}
+	session->uring = rnl_io_get_backend(session->io) == RNL_IO_URING;
+	if (config->max_interval_us) {
+		md_config motion;
+		md_default_config(&motion);
+		if (!(session->motion = md_create(&motion, motion_event, session)) ||
+		    tw_schedule(session->wheel, MOTION_TICK_KEY, MOTION_TICK_US, TW_PRIORITIES - 1,
+		                monotonic_us() + MOTION_TICK_US) == TW_INVALID) {
+			rl_session_destroy(session);
+			return NULL;
+		}
+	}
+	session->stats.startup_us = monotonic_us() - start;
+	return session;
+}
+
+void rl_session_destroy(struct rl_session *session)
+{
+	if (!session)
+		return;
+	// Dumps still running point at their interfaces: drop the socket first
+	rnl_io_destroy(session->io);
+	rl_registry_destroy(session->registry);
+	rnl_conn_close(session->conn);
+	tw_destroy(session->wheel);
+	md_destroy(session->motion);
+	for (size_t i = 0; i < session->interfaces.size(); i++) {
+		delta_destroy(session->interfaces[i]->delta);
+		delete session->interfaces[i];
+	}
+	delete session;
+}
+
+/*************
+ *  Polling  *
+ *************/
+static void station_reply(void *arg, const struct nlmsghdr *hdr)
+{
+	rl_interface *iface = (rl_interface*) arg;
+	// Interrupted and started over: the batch so far may be inconsistent
+	if (!hdr) {
+		iface->batch.clear();
+		return;
+	}
+	rl_sample sample;
+	if (rnl80211_parse_station(hdr, &sample)) {
+		sample.timestamp_us = monotonic_us();
+		iface->batch.push_back(sample);
+	}
+}
+
+static void station_done(void *arg, int error)
+{
+	rl_interface *iface = (rl_interface*) arg;
+	rl_session *session = iface->session;
+	iface->in_flight = false;
+	iface->error = error;
+	// The interface went away meanwhile, so the dump's error is expected
+	if (!iface->ifindex) {
+		iface->batch.clear();
+		return;
+	}
+	session->stats.dumps++;
+	session->stats.samples += iface->batch.size();
+	if (error)
+		session->stats.errors++;
+	session->delivered++;
+	// A failed dump may list only some of the stations: neither their
+	// motion nor the delta should see the others leave. The interval stays
+	if (!error)
+		adapt(session, iface);
+
+	if (session->fn) {
+		session->fn(session->arg, iface->ifindex, iface->batch.data(), iface->batch.size(), error);
+		iface->batch.clear();
+	} else {
+		iface->held = true;
+		session->completed.push_back(iface);
+	}
+}
+
+static void dump_due(void *arg, tw_id id, uint64_t key, uint64_t now_us)
+{
+	rl_session *session = (rl_session*) arg;
+	if (key == MOTION_TICK_KEY) {
+		md_tick(session->motion, now_us);
+		return;
+	}
+	if (key >= ALARM_KEY_BASE) {
+		tw_cancel(session->wheel, id);
+		const uint32_t slot = (uint32_t) (key - ALARM_KEY_BASE);
+		const rl_alarm alarm = session->alarms[slot];
+		session->free_alarms.push_back(slot);
+		alarm.fn(alarm.arg);
+		return;
+	}
+	rl_interface *iface = session->interfaces[key];
+	if (!iface->ifindex)
+		return;
+	if (iface->in_flight || iface->held) {
+		session->stats.overruns++;
+		return;
+	}
+
+	uint8_t storage[64] __attribute__((aligned(4)));
+	rnl_buffer buf;
+	rnl_buffer_init(&buf, storage, sizeof(storage));
+	const rnl_msg msg = iface->mac ? rnl80211_get_one_station(&buf, session->nl80211.id, 0, iface->ifindex, iface->mac)
+	                               : rnl80211_get_station(&buf, session->nl80211.id, 0, iface->ifindex);
+	if (msg == RNL_NO_MSG || !rnl_conn_submit(session->conn, rnl_header(&buf, msg), station_reply, station_done, iface)) {
+		session->stats.overruns++;
+		return;
+	}
+	iface->in_flight = true;
+}
+
+static bool add_query(rl_session *session, const char *ifname, mac_key mac, uint64_t interval_us)
+{
+	const rl_iface *found = rl_registry_find_name(session->registry, ifname);
+	if (!found) {
+		fprintf(stderr, "No wireless interface %s.\n", ifname);
+		return false;
+	}
+	rl_interface *iface = new rl_interface;
+	iface->session = session;
+	strncpy(iface->name, ifname, IFNAMSIZ - 1);
+	iface->name[IFNAMSIZ - 1] = '\0';
+	iface->ifindex = found->ifindex;
+	iface->mac = mac;
+	iface->interval_us = interval_us;
+	iface->current_us = interval_us;
+	iface->delta = NULL;
+	if (session->motion) {
+		delta_config delta;
+		delta_default_config(&delta);
+		delta.signal_db = session->config.change_db;
+		iface->delta = delta_create(&delta);
+	}
+	iface->in_flight = false;
+	iface->held = false;
+	iface->error = 0;
+	iface->timer = tw_schedule(session->wheel, session->interfaces.size(), interval_us, 0, monotonic_us());
+	if (iface->timer == TW_INVALID) {
+		delta_destroy(iface->delta);
+		delete iface;
+		return false;
+	}
+	session->interfaces.push_back(iface);
+	return true;
+}
+
+bool rl_session_add_interface(struct rl_session *session, const char *ifname, uint64_t interval_us)
+{
+	return add_query(session, ifname, 0, interval_us);
+}
+
+bool rl_session_add_target(struct rl_session *session, const char *ifname, mac_key mac, uint64_t interval_us)
+{
+	return mac && add_query(session, ifname, mac, interval_us);
+}
+
+static bool has_batch(const rl_session *session)
+{
+	if (session->woken)
+		return true;
+	return session->fn ? session->delivered > 0 : !session->completed.empty();
+}
+
+int rl_session_poll(struct rl_session *session, int64_t timeout_us)
+{
+	const uint64_t start = monotonic_us();
+	const uint64_t until = timeout_us < 0 ? UINT64_MAX : start + timeout_us;
+	const uint64_t spin = session->config.spin_us;
+	session->delivered = 0;
+	session->woken = false;
+
+	for (;;) {
+		uint64_t now = monotonic_us();
+		tw_advance(session->wheel, now, 0, dump_due, session);
+
+		// Busy-poll replies for a while before blocking
+		const uint64_t spin_until = now + spin;
+		while (spin && rnl_conn_pending(session->conn) && !has_batch(session) && now < spin_until) {
+			const int n = rnl_io_poll(session->io, 0);
+			if (n < 0)
+				return n;
+			now = monotonic_us();
+		}
+		if (has_batch(session) || now >= until)
+			break;
+
+		// Block until the next dump is due (or a reply arrives), waking up
+		// spin_us early to spin the rest. On io_uring the timerfd read with
+		// the replies wakes it for the dump, so the wait only times out
+		// for until
+		const uint64_t next = tw_next_deadline(session->wheel);
+		const uint64_t deadline = next < until ? next : until;
+		if (deadline > now + spin) {
+			uint64_t wake = deadline;
+			if (session->uring && rnl_io_set_timer(session->io, next == UINT64_MAX ? 0 : next - spin))
+				wake = until;
+			const int n = rnl_io_poll(session->io, wake == UINT64_MAX ? -1 : (int64_t) (wake - spin - now));
+			if (n < 0)
+				return n;
+			now = monotonic_us();
+		}
+		while (spin && now < deadline && !has_batch(session)) {
+			const int n = rnl_io_poll(session->io, 0);
+			if (n < 0)
+				return n;
+			now = monotonic_us();
+		}
+		if (deadline == next && now >= next)
+			rt_jitter_add(&session->stats.wakeup, next, now);
+		if (has_batch(session) || now >= until)
+			break;
+	}
+	return session->delivered;
+}
+
+int rl_session_run(struct rl_session *session, uint64_t duration_us)
+{
+	__atomic_store_n(&session->stopping, false, __ATOMIC_RELAXED);
+	const uint64_t end = duration_us ? monotonic_us() + duration_us : UINT64_MAX;
+	int batches = 0;
+	while (!__atomic_load_n(&session->stopping, __ATOMIC_RELAXED)) {
+		const uint64_t now = monotonic_us();
+		if (now >= end)
+			break;
+		const int n = rl_session_poll(session, end == UINT64_MAX ? -1 : (int64_t) (end - now));
+		if (n < 0)
+			return n;
+		batches += n;
+	}
+	return batches;
+}
+
+void rl_session_stop(struct rl_session *session)
+{
+	__atomic_store_n(&session->stopping, true, __ATOMIC_RELAXED);
+}
+
+int rl_session_next(struct rl_session *session, int64_t timeout_us, uint32_t *ifindex,
+                    const struct rl_sample **samples)
+{
+	if (session->returned) {
+		session->returned->batch.clear();
+		session->returned->held = false;
+		session->returned = NULL;
+	}
+	if (session->completed.empty()) {
+		const int n = rl_session_poll(session, timeout_us);
+		if (n < 0)
+			return n;
+		if (session->completed.empty())
+			return -ETIMEDOUT;
+	}
+	rl_interface *iface = session->completed.front();
+	session->completed.pop_front();
+	session->returned = iface;
+	*ifindex = iface->ifindex;
+	*samples = iface->batch.data();
+	return iface->batch.empty() && iface->error ? iface->error : (int) iface->batch.size();
+}
+
+const struct rl_registry *rl_session_registry(const struct rl_session *session)
+{
+	return session->registry;
+}
+
+uint16_t rl_session_family(const struct rl_session *session)
+{
+	return session->nl80211.id;
+}
+
+bool rl_session_submit(struct rl_session *session, const struct nlmsghdr *msg,
+                       rnl_message_fn on_message, rnl_done_fn on_done, void *arg)
+{
+	return rnl_conn_submit(session->conn, msg, on_message, on_done, arg) != 0;
+}
+
+bool rl_session_alarm(struct rl_session *session, uint64_t deadline_us, rl_alarm_fn fn, void *arg)
+{
+	uint32_t slot;
+	if (session->free_alarms.empty()) {
+		slot = (uint32_t) session->alarms.size();
+		session->alarms.push_back(rl_alarm());
+	} else {
+		slot = session->free_alarms.back();
+		session->free_alarms.pop_back();
+	}
+	if (tw_schedule(session->wheel, ALARM_KEY_BASE + slot, ALARM_PERIOD_US, 0, deadline_us) == TW_INVALID) {
+		session->free_alarms.push_back(slot);
+		return false;
+	}
+	session->alarms[slot].fn = fn;
+	session->alarms[slot].arg = arg;
+	return true;
+}
+
+void rl_session_wake(struct rl_session *session)
+{
+	session->woken = true;
+}
+
+bool rl_session_uses_uring(const struct rl_session *session)
+{
+	return session->uring;
+}
+
+bool rl_session_write(struct rl_session *session, const void *data, size_t len)
+{
+	return session->uring && rnl_io_write(session->io, data, len);
+}
+
+void rl_session_get_stats(const struct rl_session *session, struct rl_session_stats *stats)
+{
+	*stats = session->stats;
+}
@@ -0,0 +1,116 @@
+//============================================================================
+// Name        : Session.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : libradiolocate: an acquisition session polls station dumps
+//               of its interfaces on their own schedules and streams the
+//               readings out in batches. A session has no global state, so
+//               several can run in one process, one per thread
+//============================================================================
+
+#ifndef RADIOLOCATE_SESSION_H
+#define RADIOLOCATE_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "InterfaceRegistry.h"
+#include "NetlinkConn.h"
+#include "Realtime.h"
+#include "Sample.h"
+
+struct rl_session_config {
+	bool use_uring;        // else epoll, see NetlinkIo.h
+	uint64_t spin_us;      // busy-poll this long for replies and wakeups, 0 to always block
+	// Adaptive polling: a query whose stations neither moved nor changed
+	// waits backoff times longer before the next one, up to
+	// max_interval_us, and is back at its own interval as soon as they
+	// do. 0 keeps every interval fixed
+	uint64_t max_interval_us;
+	float backoff;
+	int change_db;         // signal change that counts as a change
+	int output_fd;         // where rl_session_write() goes, -1 for nowhere
+};
+
+void rl_session_default_config(struct rl_session_config *config);
+
+// One batch: every station of one interface's dump, in dump order, or the
+// one station of a target. The
+// samples live in the session and are only valid during the call. An
+// empty batch means the dump found no stations; error is a negative errno
+// if the dump failed part way
+typedef void (*rl_sample_fn)(void *arg, uint32_t ifindex, const struct rl_sample *samples, int count, int error);
+
+struct rl_session_stats {
+	uint64_t startup_us;   // spent in rl_session_create()
+	uint64_t dumps;        // station dumps completed
+	uint64_t samples;
+	uint64_t errors;       // dumps that failed
+	uint64_t overruns;     // dumps skipped because the last one was still running
+	uint64_t backoffs;     // queries slowed down
+	uint64_t snapbacks;    // back at their own interval
+	struct rt_jitter wakeup; // lateness of the scheduled wakeups
+};
+
+struct rl_session;
+
+// Opens the session's own netlink socket. fn may be NULL to use
+// rl_session_next() instead
+struct rl_session *rl_session_create(const struct rl_session_config *config, rl_sample_fn fn, void *arg);
+void rl_session_destroy(struct rl_session *session);
+
+// Dumps the interface's stations every interval_us, starting now. The
+// interface is followed by name: its dumps pause while it is gone and
+// resume when an interface by that name appears again
+bool rl_session_add_interface(struct rl_session *session, const char *ifname, uint64_t interval_us);
+// Queries one station on the interface every interval_us, which costs the
+// kernel far less than dumping all of them. A failed query (e.g. ENOENT
+// while it is not associated) is an empty batch with the error
+bool rl_session_add_target(struct rl_session *session, const char *ifname, mac_key mac, uint64_t interval_us);
+
+// Runs the session for up to timeout_us (-1: until the next batch or
+// forever): sends the dumps that are due and delivers the batches that
+// complete, returning early after rl_session_wake(). Returns the number of
+// batches delivered or a negative errno
+int rl_session_poll(struct rl_session *session, int64_t timeout_us);
+// Polls until rl_session_stop() or for duration_us (0 = no limit)
+int rl_session_run(struct rl_session *session, uint64_t duration_us);
+// May be called from any thread or from the callback
+void rl_session_stop(struct rl_session *session);
+
+// Iterator alternative to the callback: waits up to timeout_us for the
+// next batch and points *samples at it. The batch stays valid until the
+// next call; until then its interface skips its dumps. Returns the count,
+// the dump's error if it failed before any station, or -ETIMEDOUT
+// / another negative errno
+int rl_session_next(struct rl_session *session, int64_t timeout_us, uint32_t *ifindex,
+                    const struct rl_sample **samples);
+
+// Every wireless interface and radio, kept current while the session polls
+const struct rl_registry *rl_session_registry(const struct rl_session *session);
+
+// For front ends that make requests of their own on the session's socket
+// and loop, such as the coroutine API in NlCoroutine.h:
+//
+// nl80211's generic netlink family id
+uint16_t rl_session_family(const struct rl_session *session);
+// Sends the request with the session's next batch, see rnl_conn_submit()
+bool rl_session_submit(struct rl_session *session, const struct nlmsghdr *msg,
+                       rnl_message_fn on_message, rnl_done_fn on_done, void *arg);
+// Calls fn once at deadline_us (CLOCK_MONOTONIC), from rl_session_poll()
+typedef void (*rl_alarm_fn)(void *arg);
+bool rl_session_alarm(struct rl_session *session, uint64_t deadline_us, rl_alarm_fn fn, void *arg);
+// Has rl_session_poll() return as soon as it can, e.g. from a callback of
+// the above whose work is done
+void rl_session_wake(struct rl_session *session);
+
+// On io_uring the session's ring also carries output: rl_session_write()
+// queues bytes for config.output_fd, written by the same io_uring_enter()
+// that sends the next dump. False when the session runs on epoll, where
+// output belongs on a thread of its own (Output.h), or while the ring's
+// output can't keep up
+bool rl_session_uses_uring(const struct rl_session *session);
+bool rl_session_write(struct rl_session *session, const void *data, size_t len);
+
+void rl_session_get_stats(const struct rl_session *session, struct rl_session_stats *stats);
+
+#endif // RADIOLOCATE_SESSION_H
@@ -0,0 +1,289 @@
+//============================================================================
+// Name        : SharedSnapshot.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : POSIX shared-memory table of the latest reading of every
+//               device, for other processes on the sensor box
+//============================================================================
+
+#include "SharedSnapshot.h"
+#include "Seqlock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Region layout: one header page, then capacity (a power of two) entries
+// of one cache line each, as an open-addressing hash table keyed by MAC
+// with linear probing. A slot's MAC is written once and never changes, so
+// a reader can probe without any coordination beyond the entry seqlocks
+struct snapshot_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t entry_size;
+	uint32_t count;      // atomic, devices in the table
+	uint32_t writer_pid;
+};
+
+struct alignas(64) snapshot_entry {
+	struct seqlock lock;
+	uint32_t used;       // atomic, set once when the slot is claimed
+	struct snapshot_device device;
+};
+
+static_assert(sizeof(snapshot_entry) == 64, "a snapshot entry must fill one cache line");
+
+#define SNAPSHOT_HEADER_SIZE 4096
+
+struct snapshot_writer {
+	char name[256];
+	snapshot_header *header;
+	snapshot_entry *entries;
+	size_t size;
+	uint32_t mask;
+};
+
+struct snapshot_reader {
+	const snapshot_header *header;
+	const snapshot_entry *entries;
+	size_t size;
+	uint32_t mask;
+};
+
+static size_t region_size(uint32_t capacity)
+{
+	return SNAPSHOT_HEADER_SIZE + (size_t) capacity * sizeof(snapshot_entry);
+}
+
+/************
+ *  Writer  *
+ ************/
+struct snapshot_writer *snapshot_create(const char *name, uint32_t capacity)
+{
+	if (strlen(name) >= sizeof(((snapshot_writer*) 0)->name))
+		return NULL;
+
+	// Keep the table at most half full so that probes stay short
+	uint32_t slots = 2;
+	while (slots < 2 * capacity)
+		slots <<= 1;
+
+	// A reader still mapping an old region keeps its own copy alive
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create shared memory %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+	const size_t size = region_size(slots);
+	if (ftruncate(fd, size)) {
+		fprintf(stderr, "Failed to size shared memory %s: %s\n", name, strerror(errno));
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Failed to map shared memory %s: %s\n", name, strerror(errno));
+		shm_unlink(name);
+		return NULL;
+	}
+
+	snapshot_writer *writer = new snapshot_writer;
+	strcpy(writer->name, name);
+	writer->header = (snapshot_header*) base;
+	writer->entries = (snapshot_entry*) ((uint8_t*) base + SNAPSHOT_HEADER_SIZE);
+	writer->size = size;
+	writer->mask = slots - 1;
+
+	// ftruncate() zeroed everything; publishing the magic last tells
+	// readers the header is complete
+	writer->header->version = SNAPSHOT_VERSION;
+	writer->header->capacity = slots;
+	writer->header->entry_size = sizeof(snapshot_entry);
+	writer->header->writer_pid = getpid();
+	__atomic_store_n(&writer->header->magic, SNAPSHOT_MAGIC, __ATOMIC_RELEASE);
+	return writer;
+}
+
+void snapshot_destroy(struct snapshot_writer *writer, bool unlink)
+{
+	if (!writer)
+		return;
+	munmap(writer->header, writer->size);
+	if (unlink)
+		shm_unlink(writer->name);
+	delete writer;
+}
+
+// Finds the device's slot, claiming a free one on first sight
+static snapshot_entry *claim(snapshot_writer *writer, mac_key mac)
+{
+	const uint32_t hi = (uint32_t) (mac >> 32), lo = (uint32_t) mac;
+	uint32_t i = mac_hash(mac) & writer->mask;
+	for (uint32_t probes = 0; probes <= writer->mask; probes++, i = (i + 1) & writer->mask) {
+		snapshot_entry *e = &writer->entries[i];
+		// Only this process writes, so plain reads of our own stores are fine
+		if (e->used) {
+			if (e->device.mac_hi == hi && e->device.mac_lo == lo)
+				return e;
+			continue;
+		}
+		// Never let the table fill up completely, so misses terminate
+		if (writer->header->count + 1 > writer->header->capacity / 2)
+			return NULL;
+
+		snapshot_device fresh;
+		memset(&fresh, 0, sizeof(fresh));
+		fresh.mac_hi = hi;
+		fresh.mac_lo = lo;
+		seqlock_write_begin(&e->lock);
+		seqlock_store_words(&e->device, &fresh, sizeof(fresh));
+		seqlock_write_end(&e->lock);
+		__atomic_store_n(&e->used, 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&writer->header->count, writer->header->count + 1, __ATOMIC_RELEASE);
+		return e;
+	}
+	return NULL;
+}
+
+static void update(snapshot_entry *e, const snapshot_device *d)
+{
+	seqlock_write_begin(&e->lock);
+	seqlock_store_words(&e->device, d, sizeof(*d));
+	seqlock_write_end(&e->lock);
+}
+
+bool snapshot_publish(struct snapshot_writer *writer, const struct rl_sample *sample)
+{
+	snapshot_entry *e = claim(writer, sample->mac);
+	if (!e)
+		return false;
+
+	snapshot_device d = e->device;
+	d.time_hi = (uint32_t) (sample->timestamp_us >> 32);
+	d.time_lo = (uint32_t) sample->timestamp_us;
+	d.ifindex = sample->ifindex;
+	d.signal = sample->signal;
+	d.signal_avg = sample->signal_avg;
+	d.tx_bitrate = sample->tx_bitrate;
+	d.inactive_ms = sample->inactive_ms;
+	d.flags |= SNAPSHOT_HAS_READING;
+	d.updates++;
+	update(e, &d);
+	return true;
+}
+
+bool snapshot_publish_position(struct snapshot_writer *writer, mac_key mac, float x, float y, uint64_t timestamp_us)
+{
+	snapshot_entry *e = claim(writer, mac);
+	if (!e)
+		return false;
+
+	snapshot_device d = e->device;
+	d.time_hi = (uint32_t) (timestamp_us >> 32);
+	d.time_lo = (uint32_t) timestamp_us;
+	d.x = x;
+	d.y = y;
+	d.flags |= SNAPSHOT_HAS_POSITION;
+	update(e, &d);
+	return true;
+}
+
+/************
+ *  Reader  *
+ ************/
+struct snapshot_reader *snapshot_open(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open shared memory %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || (size_t) st.st_size < SNAPSHOT_HEADER_SIZE) {
+		fprintf(stderr, "Shared memory %s is not a snapshot.\n", name);
+		close(fd);
+		return NULL;
+	}
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Failed to map shared memory %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+
+	const snapshot_header *header = (const snapshot_header*) base;
+	if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SNAPSHOT_MAGIC ||
+	    header->version != SNAPSHOT_VERSION || header->entry_size != sizeof(snapshot_entry) ||
+	    region_size(header->capacity) > (size_t) st.st_size) {
+		fprintf(stderr, "Shared memory %s has an incompatible layout.\n", name);
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	snapshot_reader *reader = new snapshot_reader;
+	reader->header = header;
+	reader->entries = (const snapshot_entry*) ((const uint8_t*) base + SNAPSHOT_HEADER_SIZE);
+	reader->size = st.st_size;
+	reader->mask = header->capacity - 1;
+	return reader;
+}
+
+void snapshot_close(struct snapshot_reader *reader)
+{
+	if (!reader)
+		return;
+	munmap((void*) reader->header, reader->size);
+	delete reader;
+}
+
+uint32_t snapshot_capacity(const struct snapshot_reader *reader)
+{
+	return reader->header->capacity;
+}
+
+uint32_t snapshot_count(const struct snapshot_reader *reader)
+{
+	return __atomic_load_n(&reader->header->count, __ATOMIC_ACQUIRE);
+}
+
+static void copy_entry(const snapshot_entry *e, snapshot_device *device)
+{
+	uint32_t seq;
+	do {
+		seq = seqlock_read_begin(&e->lock);
+		seqlock_load_words(device, &e->device, sizeof(*device));
+	} while (seqlock_read_retry(&e->lock, seq));
+}
+
+bool snapshot_lookup(const struct snapshot_reader *reader, mac_key mac, struct snapshot_device *device)
+{
+	uint32_t i = mac_hash(mac) & reader->mask;
+	for (uint32_t probes = 0; probes <= reader->mask; probes++, i = (i + 1) & reader->mask) {
+		const snapshot_entry *e = &reader->entries[i];
+		if (!__atomic_load_n(&e->used, __ATOMIC_ACQUIRE))
+			return false;
+		copy_entry(e, device);
+		if (snapshot_device_mac(device) == mac)
+			return true;
+	}
+	return false;
+}
+
+bool snapshot_read_slot(const struct snapshot_reader *reader, uint32_t slot, struct snapshot_device *device)
+{
+	if (slot > reader->mask)
+		return false;
+	const snapshot_entry *e = &reader->entries[slot];
+	if (!__atomic_load_n(&e->used, __ATOMIC_ACQUIRE))
+		return false;
+	copy_entry(e, device);
+	return true;
+}
@@ -0,0 +1,83 @@
+//============================================================================
+// Name        : SharedSnapshot.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : POSIX shared-memory table of the latest reading of every
+//               device, for other processes on the sensor box. Each entry
+//               is published under a seqlock: readers take consistent
+//               copies without syscalls or locks (link with -lrt)
+//============================================================================
+
+#ifndef RADIOLOCATE_SHAREDSNAPSHOT_H
+#define RADIOLOCATE_SHAREDSNAPSHOT_H
+
+#include <stdint.h>
+
+#include "Sample.h"
+
+#define SNAPSHOT_MAGIC 0x524C534EU // "RLSN"
+#define SNAPSHOT_VERSION 1
+
+#define SNAPSHOT_HAS_READING  0x1
+#define SNAPSHOT_HAS_POSITION 0x2
+
+// What a reader gets for one device. Only 32-bit fields, so that it can be
+// copied word by word under the seqlock
+struct snapshot_device {
+	uint32_t mac_hi, mac_lo;  // mac_key split in two, see snapshot_device_mac()
+	uint32_t time_hi, time_lo; // CLOCK_MONOTONIC us of the last update
+	uint32_t ifindex;
+	int32_t signal;           // dBm
+	int32_t signal_avg;       // dBm, 0 if not reported
+	uint32_t tx_bitrate;      // 100 kbit/s
+	uint32_t inactive_ms;
+	float x, y;               // m, if SNAPSHOT_HAS_POSITION
+	uint32_t flags;
+	uint32_t updates;         // readings published for this device
+	uint32_t reserved;
+};
+
+static inline mac_key snapshot_device_mac(const struct snapshot_device *d)
+{
+	return ((mac_key) d->mac_hi << 32) | d->mac_lo;
+}
+
+static inline uint64_t snapshot_device_time(const struct snapshot_device *d)
+{
+	return ((uint64_t) d->time_hi << 32) | d->time_lo;
+}
+
+/************
+ *  Writer  *
+ ************/
+struct snapshot_writer;
+
+// Creates (or replaces) the region /dev/shm/<name>; name starts with '/'.
+// capacity is the most devices the table will ever hold; entries are never
+// reused, so size it for every device the box can hear over its lifetime
+struct snapshot_writer *snapshot_create(const char *name, uint32_t capacity);
+// Unmaps the region; unlink also removes the name
+void snapshot_destroy(struct snapshot_writer *writer, bool unlink);
+
+// Single writer. Wait-free for readers. Returns false if the table is full
+bool snapshot_publish(struct snapshot_writer *writer, const struct rl_sample *sample);
+bool snapshot_publish_position(struct snapshot_writer *writer, mac_key mac, float x, float y, uint64_t timestamp_us);
+
+/************
+ *  Reader  *
+ ************/
+struct snapshot_reader;
+
+// Maps an existing region read-only
+struct snapshot_reader *snapshot_open(const char *name);
+void snapshot_close(struct snapshot_reader *reader);
+
+uint32_t snapshot_capacity(const struct snapshot_reader *reader);
+// Devices published so far; they occupy no particular slots
+uint32_t snapshot_count(const struct snapshot_reader *reader);
+
+// Consistent copy of one device's latest entry, no syscalls, no locks
+bool snapshot_lookup(const struct snapshot_reader *reader, mac_key mac, struct snapshot_device *device);
+// Iteration: slots [0, capacity), false for unused ones
+bool snapshot_read_slot(const struct snapshot_reader *reader, uint32_t slot, struct snapshot_device *device);
+
+#endif // RADIOLOCATE_SHAREDSNAPSHOT_H
@@ -0,0 +1,97 @@
+//============================================================================
+// Name        : SpscRing.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Bounded lock-free single-producer/single-consumer ring
+//============================================================================
+
+#ifndef RADIOLOCATE_SPSCRING_H
+#define RADIOLOCATE_SPSCRING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+
+// Producer and consumer each keep a private copy of the other side's index
+// and only re-read the shared one when the copy says full/empty, so a busy
+// ring costs one shared cache-line transfer per batch, not per element.
+// T must be trivially copyable
+// The padding keeps the two sides a cache line apart however the ring is
+// allocated
+template <typename T>
+struct spsc_ring {
+	T *items;
+	uint32_t mask;
+
+	char pad0[64];
+	std::atomic<uint32_t> head; // next slot to write, owned by producer
+	uint32_t cached_tail;
+
+	char pad1[64];
+	std::atomic<uint32_t> tail; // next slot to read, owned by consumer
+	uint32_t cached_head;
+	char pad2[64];
+};
+
+// capacity is rounded up to a power of two
+template <typename T>
+static bool spsc_init(spsc_ring<T> *ring, uint32_t capacity)
+{
+	uint32_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	ring->items = (T*) malloc(sizeof(T) * size);
+	if (!ring->items)
+		return false;
+	ring->mask = size - 1;
+	ring->head.store(0, std::memory_order_relaxed);
+	ring->tail.store(0, std::memory_order_relaxed);
+	ring->cached_tail = 0;
+	ring->cached_head = 0;
+	return true;
+}
+
+template <typename T>
+static void spsc_free(spsc_ring<T> *ring)
+{
+	free(ring->items);
+	ring->items = NULL;
+}
+
+// Producer side. Pushes up to count items, returns how many fit
+template <typename T>
+static uint32_t spsc_push(spsc_ring<T> *ring, const T *items, uint32_t count)
+{
+	const uint32_t head = ring->head.load(std::memory_order_relaxed);
+	uint32_t room = ring->mask + 1 - (head - ring->cached_tail);
+	if (room < count) {
+		ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+		room = ring->mask + 1 - (head - ring->cached_tail);
+	}
+	if (count > room)
+		count = room;
+	for (uint32_t i = 0; i < count; i++)
+		ring->items[(head + i) & ring->mask] = items[i];
+	ring->head.store(head + count, std::memory_order_release);
+	return count;
+}
+
+// Consumer side. Pops up to max items, returns how many there were
+template <typename T>
+static uint32_t spsc_pop(spsc_ring<T> *ring, T *items, uint32_t max)
+{
+	const uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+	uint32_t avail = ring->cached_head - tail;
+	if (avail < max) {
+		ring->cached_head = ring->head.load(std::memory_order_acquire);
+		avail = ring->cached_head - tail;
+	}
+	if (max > avail)
+		max = avail;
+	for (uint32_t i = 0; i < max; i++)
+		items[i] = ring->items[(tail + i) & ring->mask];
+	ring->tail.store(tail + max, std::memory_order_release);
+	return max;
+}
+
+#endif // RADIOLOCATE_SPSCRING_H
@@ -0,0 +1,221 @@
+//============================================================================
+// Name        : StationDelta.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Dump-to-dump station differences
+//============================================================================
+
+#include "StationDelta.h"
+
+#include <string.h>
+
+#include <vector>
+
+using namespace std;
+
+// The compared readings of one dump, a column each
+struct columns {
+	vector<mac_key> mac;
+	vector<int8_t> signal;
+	vector<uint16_t> rate;
+	vector<uint8_t> idle;
+
+	void resize(size_t n)
+	{
+		mac.resize(n);
+		signal.resize(n);
+		rate.resize(n);
+		idle.resize(n);
+	}
+};
+
+struct station_delta {
+	delta_config config;
+	uint32_t generation;   // of the dump being compared
+
+	// The previous dump, in its own order
+	vector<rl_sample> prev;
+	columns before;
+	vector<uint32_t> stamp; // generation that last matched each station
+	vector<int32_t> table;  // MAC -> position in prev, -1 = empty
+	bool indexed;           // table is of prev
+
+	// The dump being compared
+	columns now;
+	columns old;            // before, gathered into the order of now
+	vector<int32_t> match;  // position in prev, -1 = added
+	vector<uint8_t> changed;
+	vector<delta_event> events;
+};
+
+void delta_default_config(struct delta_config *config)
+{
+	config->signal_db = 1;
+	config->idle_ms = 1000;
+}
+
+struct station_delta *delta_create(const struct delta_config *config)
+{
+	station_delta *delta = new station_delta;
+	delta->config = *config;
+	if (delta->config.signal_db < 1)
+		delta->config.signal_db = 1;
+	delta->generation = 0;
+	delta->indexed = false;
+	return delta;
+}
+
+void delta_destroy(struct station_delta *delta)
+{
+	delete delta;
+}
+
+void delta_reset(struct station_delta *delta)
+{
+	delta->prev.clear();
+	delta->before.resize(0);
+	delta->indexed = false;
+}
+
+/***********
+ *  Match  *
+ ***********/
+static void index_prev(station_delta *delta)
+{
+	const size_t n = delta->prev.size();
+	size_t size = 16;
+	while (size < 2 * n)
+		size *= 2;
+	delta->table.assign(size, -1);
+	const uint32_t mask = size - 1;
+	const mac_key *mac = delta->before.mac.data();
+	for (size_t j = 0; j < n; j++) {
+		uint32_t pos = mac_hash(mac[j]) & mask;
+		while (delta->table[pos] >= 0)
+			pos = (pos + 1) & mask;
+		delta->table[pos] = j;
+	}
+	delta->indexed = true;
+}
+
+static int32_t find_prev(const station_delta *delta, mac_key mac)
+{
+	const uint32_t mask = delta->table.size() - 1;
+	for (uint32_t pos = mac_hash(mac) & mask; delta->table[pos] >= 0; pos = (pos + 1) & mask)
+		if (delta->before.mac[delta->table[pos]] == mac)
+			return delta->table[pos];
+	return -1;
+}
+
+// Stations are listed in the order they associated, so from one dump to the
+// next the order rarely changes: then no lookups are needed at all
+static bool same_order(const station_delta *delta, size_t n)
+{
+	if (delta->prev.size() != n)
+		return false;
+	const mac_key *__restrict a = delta->now.mac.data();
+	const mac_key *__restrict b = delta->before.mac.data();
+	mac_key diff = 0;
+	for (size_t i = 0; i < n; i++)
+		diff |= a[i] ^ b[i];
+	return !diff;
+}
+
+// Pairs every station with its previous position (or none) and lines up the
+// previous readings with the current ones; new stations compare equal
+static void gather(station_delta *delta, size_t n)
+{
+	if (!delta->indexed)
+		index_prev(delta);
+	delta->old.resize(n);
+	const uint32_t generation = delta->generation;
+	for (size_t i = 0; i < n; i++) {
+		const int32_t j = find_prev(delta, delta->now.mac[i]);
+		delta->match[i] = j;
+		if (j < 0) {
+			delta->old.signal[i] = delta->now.signal[i];
+			delta->old.rate[i] = delta->now.rate[i];
+			delta->old.idle[i] = delta->now.idle[i];
+		} else {
+			delta->stamp[j] = generation;
+			delta->old.signal[i] = delta->before.signal[j];
+			delta->old.rate[i] = delta->before.rate[j];
+			delta->old.idle[i] = delta->before.idle[j];
+		}
+	}
+}
+
+/*************
+ *  Compare  *
+ *************/
+static void compare(station_delta *delta, const columns &old, size_t n)
+{
+	const int8_t *__restrict signal = delta->now.signal.data(), *__restrict old_signal = old.signal.data();
+	const uint16_t *__restrict rate = delta->now.rate.data(), *__restrict old_rate = old.rate.data();
+	const uint8_t *__restrict idle = delta->now.idle.data(), *__restrict old_idle = old.idle.data();
+	uint8_t *__restrict changed = delta->changed.data();
+	const int threshold = delta->config.signal_db;
+	// Branch-free, so that it vectorizes
+	for (size_t i = 0; i < n; i++) {
+		int diff = signal[i] - old_signal[i];
+		diff = diff < 0 ? -diff : diff;
+		changed[i] = (diff >= threshold ? DELTA_SIGNAL : 0) |
+		             (rate[i] != old_rate[i] ? DELTA_BITRATE : 0) |
+		             (idle[i] != old_idle[i] ? DELTA_ACTIVITY : 0);
+	}
+}
+
+static void emit(station_delta *delta, delta_kind kind, uint8_t changed, const rl_sample &sample)
+{
+	delta_event event;
+	event.kind = kind;
+	event.changed = changed;
+	event.sample = sample;
+	delta->events.push_back(event);
+}
+
+int delta_update(struct station_delta *delta, const struct rl_sample *samples, int count,
+                 const struct delta_event **events)
+{
+	const size_t n = count;
+	delta->generation++;
+	delta->events.clear();
+
+	delta->now.resize(n);
+	const uint32_t idle_ms = delta->config.idle_ms;
+	for (size_t i = 0; i < n; i++) {
+		delta->now.mac[i] = samples[i].mac;
+		delta->now.signal[i] = samples[i].signal;
+		delta->now.rate[i] = samples[i].tx_bitrate;
+		delta->now.idle[i] = samples[i].inactive_ms >= idle_ms;
+	}
+	delta->changed.resize(n);
+
+	const bool ordered = same_order(delta, n);
+	if (ordered)
+		compare(delta, delta->before, n);
+	else {
+		delta->match.resize(n);
+		gather(delta, n);
+		compare(delta, delta->old, n);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (!ordered && delta->match[i] < 0)
+			emit(delta, DELTA_ADDED, 0, samples[i]);
+		else if (delta->changed[i])
+			emit(delta, DELTA_CHANGED, delta->changed[i], samples[i]);
+	}
+	if (!ordered)
+		for (size_t j = 0; j < delta->prev.size(); j++)
+			if (delta->stamp[j] != delta->generation)
+				emit(delta, DELTA_REMOVED, 0, delta->prev[j]);
+
+	// This dump is the one to compare the next with
+	delta->prev.assign(samples, samples + n);
+	swap(delta->before, delta->now);
+	delta->stamp.resize(n);
+	delta->indexed = false;
+
+	*events = delta->events.data();
+	return delta->events.size();
+}
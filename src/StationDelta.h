@@ -0,0 +1,55 @@
+//============================================================================
+// Name        : StationDelta.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Differences between successive station dumps of one
+//               interface: which stations appeared, left or changed their
+//               readings, so that what is passed on scales with the rate
+//               of change rather than the number of stations
+//============================================================================
+
+#ifndef RADIOLOCATE_STATIONDELTA_H
+#define RADIOLOCATE_STATIONDELTA_H
+
+#include <stdint.h>
+
+#include "Sample.h"
+
+enum delta_kind {
+	DELTA_ADDED,
+	DELTA_CHANGED,
+	DELTA_REMOVED,         // sample is the last reading of the station
+};
+
+// What changed, for DELTA_CHANGED
+#define DELTA_SIGNAL   0x1
+#define DELTA_BITRATE  0x2
+#define DELTA_ACTIVITY 0x4     // went idle or became active again
+
+struct delta_config {
+	int signal_db;         // smallest signal change reported
+	uint32_t idle_ms;      // inactive at least this long counts as idle
+};
+
+void delta_default_config(struct delta_config *config);
+
+struct delta_event {
+	uint8_t kind;          // enum delta_kind
+	uint8_t changed;       // DELTA_* flags
+	struct rl_sample sample;
+};
+
+struct station_delta;
+
+struct station_delta *delta_create(const struct delta_config *config);
+void delta_destroy(struct station_delta *delta);
+
+// Compares a complete dump with the previous one and points *events at
+// what differs, in dump order with the removals last. The events are
+// valid until the next call. Returns their number
+int delta_update(struct station_delta *delta, const struct rl_sample *samples, int count,
+                 const struct delta_event **events);
+
+// Forgets the previous dump, so that the next one is reported as all added
+void delta_reset(struct station_delta *delta);
+
+#endif // RADIOLOCATE_STATIONDELTA_H
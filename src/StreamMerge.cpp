@@ -0,0 +1,256 @@
+//============================================================================
+// Name        : StreamMerge.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Loser-tree k-way merge of timestamped sample streams
+//============================================================================
+
+#include "StreamMerge.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+using namespace std;
+
+// What a source competes with in the tree: its oldest buffered sample once
+// the watermark has reached it, or else the watermark, which must not be
+// passed: until then the source may still send something older. Both in
+// one integer, timestamp * 2 + 1 for a watermark, so that at equal times a
+// sample goes before a source that may still send one
+#define KEY_DONE UINT64_MAX
+
+struct merge_source {
+	rl_sample *items;      // ring, sorted by timestamp
+	uint32_t head, tail;   // free-running; tail - head samples
+	uint64_t watermark;
+	bool closed;
+};
+
+struct stream_merge {
+	merge_config config;
+	uint32_t mask;
+	vector<merge_source> sources;
+
+	// Leaves are padded to a power of two; padding never wins. tree[0] is
+	// the overall winner, tree[n] the loser of the match at node n
+	uint32_t leaves;
+	vector<uint64_t> keys;
+	vector<uint32_t> tree;
+	vector<uint32_t> winners; // scratch for rebuilding
+	// A source other than the winner changed its key, which a loser tree
+	// can't replay: rebuilt before the next merge
+	bool dirty;
+
+	uint64_t merged_us;    // timestamp of the last sample merged
+	merge_stats stats;
+};
+
+void merge_default_config(struct merge_config *config)
+{
+	config->sources = 1;
+	config->capacity = 4096;
+	config->reorder_us = 0;
+	config->max_delay_us = 100000;
+}
+
+struct stream_merge *merge_create(const struct merge_config *config)
+{
+	if (!config->sources)
+		return NULL;
+	uint32_t size = 1;
+	while (size < config->capacity)
+		size <<= 1;
+	uint32_t leaves = 1;
+	while (leaves < config->sources)
+		leaves <<= 1;
+
+	stream_merge *merge = new stream_merge;
+	merge->config = *config;
+	merge->mask = size - 1;
+	merge->sources.resize(config->sources);
+	for (uint32_t i = 0; i < config->sources; i++) {
+		merge_source *src = &merge->sources[i];
+		src->items = (rl_sample*) malloc((size_t) size * sizeof(rl_sample));
+		src->head = src->tail = 0;
+		src->watermark = 0;
+		src->closed = false;
+	}
+	merge->leaves = leaves;
+	merge->keys.assign(leaves, KEY_DONE);
+	for (uint32_t i = 0; i < config->sources; i++)
+		merge->keys[i] = 1; // watermark 0
+	merge->tree.assign(leaves, 0);
+	merge->winners.assign(2 * leaves, 0);
+	merge->dirty = true;
+	merge->merged_us = 0;
+	memset(&merge->stats, 0, sizeof(merge->stats));
+	return merge;
+}
+
+void merge_destroy(struct stream_merge *merge)
+{
+	if (!merge)
+		return;
+	for (size_t i = 0; i < merge->sources.size(); i++)
+		free(merge->sources[i].items);
+	delete merge;
+}
+
+/****************
+ *  Loser tree  *
+ ****************/
+static inline bool beats(const stream_merge *merge, uint32_t a, uint32_t b)
+{
+	const uint64_t ka = merge->keys[a], kb = merge->keys[b];
+	return ka < kb || (ka == kb && a < b);
+}
+
+static void rebuild(stream_merge *merge)
+{
+	const uint32_t leaves = merge->leaves;
+	uint32_t *winners = merge->winners.data();
+	for (uint32_t i = 0; i < leaves; i++)
+		winners[leaves + i] = i;
+	for (uint32_t n = leaves - 1; n >= 1; n--) {
+		const uint32_t a = winners[2 * n], b = winners[2 * n + 1];
+		const bool a_wins = beats(merge, a, b);
+		winners[n] = a_wins ? a : b;
+		merge->tree[n] = a_wins ? b : a;
+	}
+	merge->tree[0] = leaves > 1 ? winners[1] : 0;
+	merge->dirty = false;
+}
+
+// The winner's key changed: it plays its way up again against the losers
+// on its path only, one comparison per level
+static void replay(stream_merge *merge, uint32_t leaf)
+{
+	uint32_t *tree = merge->tree.data();
+	uint32_t winner = leaf;
+	for (uint32_t node = (leaf + merge->leaves) >> 1; node; node >>= 1)
+		if (beats(merge, tree[node], winner)) {
+			const uint32_t loser = winner;
+			winner = tree[node];
+			tree[node] = loser;
+		}
+	tree[0] = winner;
+}
+
+static inline uint64_t key_of(const merge_source *src, uint32_t mask)
+{
+	if (src->tail != src->head) {
+		const uint64_t t = src->items[src->head & mask].timestamp_us;
+		if (t <= src->watermark || src->closed)
+			return t * 2;
+	} else if (src->closed)
+		return KEY_DONE;
+	return src->watermark * 2 + 1;
+}
+
+static void rekey(stream_merge *merge, uint32_t source)
+{
+	const uint64_t key = key_of(&merge->sources[source], merge->mask);
+	if (key == merge->keys[source])
+		return;
+	merge->keys[source] = key;
+	if (merge->dirty)
+		return;
+	if (merge->tree[0] == source)
+		replay(merge, source);
+	else
+		merge->dirty = true;
+}
+
+/*************
+ *  Sources  *
+ *************/
+bool merge_push(struct stream_merge *merge, uint32_t source, const struct rl_sample *sample)
+{
+	if (source >= merge->sources.size())
+		return false;
+	merge_source *src = &merge->sources[source];
+	const uint64_t t = sample->timestamp_us;
+	if (t < merge->merged_us || t < src->watermark) {
+		merge->stats.late++;
+		return false;
+	}
+	if (src->tail - src->head > merge->mask) {
+		merge->stats.overflows++;
+		return false;
+	}
+
+	// Insertion from the back: in order it costs nothing, and a sample
+	// out of order moves only the ones it overtakes
+	const uint32_t mask = merge->mask;
+	uint32_t pos = src->tail;
+	while (pos != src->head && src->items[(pos - 1) & mask].timestamp_us > t) {
+		src->items[pos & mask] = src->items[(pos - 1) & mask];
+		pos--;
+	}
+	src->items[pos & mask] = *sample;
+	src->tail++;
+	merge->stats.pushed++;
+
+	if (t > merge->config.reorder_us && t - merge->config.reorder_us > src->watermark)
+		src->watermark = t - merge->config.reorder_us;
+	rekey(merge, source);
+	return true;
+}
+
+void merge_watermark(struct stream_merge *merge, uint32_t source, uint64_t watermark_us)
+{
+	if (source >= merge->sources.size() || watermark_us <= merge->sources[source].watermark)
+		return;
+	merge->sources[source].watermark = watermark_us;
+	rekey(merge, source);
+}
+
+void merge_close(struct stream_merge *merge, uint32_t source)
+{
+	if (source >= merge->sources.size())
+		return;
+	merge->sources[source].closed = true;
+	rekey(merge, source);
+}
+
+/***********
+ *  Merge  *
+ ***********/
+int merge_pop(struct stream_merge *merge, uint64_t now_us, struct merge_item *out, int max)
+{
+	if (merge->dirty)
+		rebuild(merge);
+	const uint64_t floor = now_us > merge->config.max_delay_us ? now_us - merge->config.max_delay_us : 0;
+	const uint32_t mask = merge->mask;
+	int n = 0;
+	while (n < max) {
+		const uint32_t w = merge->tree[0];
+		const uint64_t key = merge->keys[w];
+		if (key == KEY_DONE)
+			break;
+		merge_source *src = &merge->sources[w];
+		if (key & 1) {
+			// Waiting on a source's watermark, unless it has been quiet
+			// for too long. Its samples up to the new one are released
+			if (src->watermark >= floor)
+				break;
+			src->watermark = floor;
+			merge->stats.forced++;
+		} else {
+			out[n].source = w;
+			out[n].sample = src->items[src->head++ & mask];
+			merge->merged_us = out[n].sample.timestamp_us;
+			n++;
+		}
+		merge->keys[w] = key_of(src, mask);
+		replay(merge, w);
+	}
+	merge->stats.merged += n;
+	return n;
+}
+
+void merge_get_stats(const struct stream_merge *merge, struct merge_stats *stats)
+{
+	*stats = merge->stats;
+}
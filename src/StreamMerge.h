@@ -0,0 +1,64 @@
+//============================================================================
+// Name        : StreamMerge.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Merges the sample streams of many sources (interfaces,
+//               sensors) into one stream in timestamp order, with a loser
+//               tree over bounded per-source reorder buffers and watermarks
+//               that say how long to wait for a source that has gone quiet
+//============================================================================
+
+#ifndef RADIOLOCATE_STREAMMERGE_H
+#define RADIOLOCATE_STREAMMERGE_H
+
+#include <stdint.h>
+
+#include "Sample.h"
+
+struct merge_config {
+	uint32_t sources;
+	uint32_t capacity;     // samples buffered per source, rounded up to a power of two
+	// How far out of order one source may deliver: its watermark trails
+	// its newest sample by this much, and its samples are held until the
+	// watermark reaches them. 0 for sources in timestamp order
+	uint64_t reorder_us;
+	// Longest the merge waits for a quiet source, see merge_pop()
+	uint64_t max_delay_us;
+};
+
+void merge_default_config(struct merge_config *config);
+
+struct merge_item {
+	uint32_t source;
+	struct rl_sample sample;
+};
+
+struct merge_stats {
+	uint64_t pushed;
+	uint64_t merged;
+	uint64_t late;         // older than what was already merged: dropped
+	uint64_t overflows;    // the source's buffer was full: dropped
+	uint64_t forced;       // quiet sources passed over after max_delay_us
+};
+
+struct stream_merge;
+
+struct stream_merge *merge_create(const struct merge_config *config);
+void merge_destroy(struct stream_merge *merge);
+
+// Buffers one sample of a source. False if it was dropped (late or full)
+bool merge_push(struct stream_merge *merge, uint32_t source, const struct rl_sample *sample);
+// The source promises nothing older than watermark_us from now on
+void merge_watermark(struct stream_merge *merge, uint32_t source, uint64_t watermark_us);
+// The source has ended; the merge no longer waits for it
+void merge_close(struct stream_merge *merge, uint32_t source);
+
+// Takes up to max samples in timestamp order (ties by source), as far as
+// every source's buffer or watermark allows. A source whose watermark is
+// older than now_us - max_delay_us is no longer waited for, and whatever
+// it sends later than that is late. now_us 0 waits on watermarks only.
+// Returns the number taken
+int merge_pop(struct stream_merge *merge, uint64_t now_us, struct merge_item *out, int max);
+
+void merge_get_stats(const struct stream_merge *merge, struct merge_stats *stats);
+
+#endif // RADIOLOCATE_STREAMMERGE_H
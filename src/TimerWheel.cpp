@@ -0,0 +1,327 @@
+//============================================================================
+// Name        : TimerWheel.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Hierarchical timer wheel for scheduling periodic netlink
+//               queries per interface and per station
+//============================================================================
+
+#include "TimerWheel.h"
+
+#include <string.h>
+
+#include <vector>
+
+// Level l holds entries that share every bit above 8 * (l + 1) with the
+// current tick, in the slot given by their bits 8 * l .. 8 * l + 7. When
+// the current tick crosses into a new slot of level l, that slot is
+// re-placed into the finer levels ("cascaded"). The top level also takes
+// everything further out, which is why deadlines are capped at 255 of its
+// slots ahead
+#define TW_WHEEL_LISTS (TW_LEVELS * TW_SLOTS)
+#define TW_LISTS (TW_WHEEL_LISTS + TW_PRIORITIES)
+#define TW_MAX_TICKS ((uint64_t) (TW_SLOTS - 1) << (TW_SLOT_BITS * (TW_LEVELS - 1)))
+#define TW_BITMAP_WORDS (TW_SLOTS / 64)
+
+// Entries and list heads share one array and link by index, so that the
+// array can grow from inside a callback. The first TW_LISTS nodes are the
+// sentinels of circular lists: the wheel slots, then the due entries of
+// each priority
+struct tw_node {
+	uint32_t next, prev;
+	uint32_t list;       // sentinel of the list the entry is on
+	uint32_t generation; // bumped on free, so stale ids fail
+	uint64_t key;
+	uint64_t deadline;   // tick
+	uint64_t interval;   // ticks
+	uint8_t priority;
+	bool live;
+};
+
+struct timer_wheel {
+	uint64_t tick_us;
+	uint64_t current;    // every entry due at or before this tick is on a ready list
+	std::vector<tw_node> nodes;
+	uint32_t free_head;  // chained through next, 0 = none
+	uint64_t bitmap[TW_LEVELS][TW_BITMAP_WORDS];
+	uint32_t ready;      // entries on the ready lists
+	tw_stats stats;
+};
+
+static inline void list_init(timer_wheel *w, uint32_t head)
+{
+	w->nodes[head].next = w->nodes[head].prev = head;
+}
+
+static inline bool list_empty(const timer_wheel *w, uint32_t head)
+{
+	return w->nodes[head].next == head;
+}
+
+static inline void list_append(timer_wheel *w, uint32_t head, uint32_t i)
+{
+	tw_node &n = w->nodes[i];
+	n.list = head;
+	n.next = head;
+	n.prev = w->nodes[head].prev;
+	w->nodes[n.prev].next = i;
+	w->nodes[head].prev = i;
+}
+
+static inline void bitmap_set(timer_wheel *w, uint32_t list)
+{
+	w->bitmap[list / TW_SLOTS][(list % TW_SLOTS) / 64] |= 1ULL << (list % 64);
+}
+
+static inline void bitmap_clear(timer_wheel *w, uint32_t list)
+{
+	w->bitmap[list / TW_SLOTS][(list % TW_SLOTS) / 64] &= ~(1ULL << (list % 64));
+}
+
+// First set slot of a level in [from, TW_SLOTS), or -1
+static int bitmap_find(const timer_wheel *w, int level, int from)
+{
+	for (int word = from / 64; word < TW_BITMAP_WORDS; word++) {
+		uint64_t bits = w->bitmap[level][word];
+		if (word == from / 64)
+			bits &= ~0ULL << (from % 64);
+		if (bits)
+			return word * 64 + __builtin_ctzll(bits);
+	}
+	return -1;
+}
+
+static void unlink(timer_wheel *w, uint32_t i)
+{
+	tw_node &n = w->nodes[i];
+	w->nodes[n.prev].next = n.next;
+	w->nodes[n.next].prev = n.prev;
+	if (n.list >= TW_WHEEL_LISTS)
+		w->ready--;
+	else if (list_empty(w, n.list))
+		bitmap_clear(w, n.list);
+}
+
+// Puts an unlinked entry on the list its deadline calls for
+static void place(timer_wheel *w, uint32_t i)
+{
+	tw_node &n = w->nodes[i];
+	if (n.deadline <= w->current) {
+		list_append(w, TW_WHEEL_LISTS + n.priority, i);
+		w->ready++;
+		return;
+	}
+	int level = 0;
+	while (level < TW_LEVELS - 1 &&
+	       n.deadline >> (TW_SLOT_BITS * (level + 1)) != w->current >> (TW_SLOT_BITS * (level + 1)))
+		level++;
+	const uint32_t list = level * TW_SLOTS + ((n.deadline >> (TW_SLOT_BITS * level)) & (TW_SLOTS - 1));
+	list_append(w, list, i);
+	bitmap_set(w, list);
+}
+
+// Moves a whole slot elsewhere: due entries to the ready lists, the rest
+// one level down
+static void drain(timer_wheel *w, uint32_t list, bool cascade)
+{
+	uint32_t i = w->nodes[list].next;
+	list_init(w, list);
+	bitmap_clear(w, list);
+	while (i != list) {
+		const uint32_t next = w->nodes[i].next;
+		place(w, i);
+		if (cascade)
+			w->stats.cascaded++;
+		i = next;
+	}
+}
+
+static uint64_t to_ticks(const timer_wheel *w, uint64_t us)
+{
+	return (us + w->tick_us - 1) / w->tick_us;
+}
+
+struct timer_wheel *tw_create(uint64_t tick_us, uint64_t now_us)
+{
+	if (!tick_us)
+		return NULL;
+
+	timer_wheel *w = new timer_wheel;
+	w->tick_us = tick_us;
+	w->current = now_us / tick_us;
+	w->nodes.resize(TW_LISTS);
+	for (uint32_t head = 0; head < TW_LISTS; head++)
+		list_init(w, head);
+	w->free_head = 0;
+	memset(w->bitmap, 0, sizeof(w->bitmap));
+	w->ready = 0;
+	memset(&w->stats, 0, sizeof(w->stats));
+	return w;
+}
+
+void tw_destroy(struct timer_wheel *wheel)
+{
+	delete wheel;
+}
+
+static inline tw_id make_id(const timer_wheel *w, uint32_t i)
+{
+	return ((uint64_t) w->nodes[i].generation << 32) | i;
+}
+
+// Index of a live entry, or 0
+static uint32_t lookup(const timer_wheel *w, tw_id id)
+{
+	const uint32_t i = (uint32_t) id;
+	if (i < TW_LISTS || i >= w->nodes.size())
+		return 0;
+	const tw_node &n = w->nodes[i];
+	return n.live && n.generation == (uint32_t) (id >> 32) ? i : 0;
+}
+
+static uint64_t clamp_deadline(const timer_wheel *w, uint64_t deadline)
+{
+	return deadline - w->current > TW_MAX_TICKS && deadline > w->current ? w->current + TW_MAX_TICKS : deadline;
+}
+
+tw_id tw_schedule(struct timer_wheel *wheel, uint64_t key, uint64_t interval_us, int priority, uint64_t first_us)
+{
+	const uint64_t interval = to_ticks(wheel, interval_us);
+	if (!interval || interval > TW_MAX_TICKS || priority < 0 || priority >= TW_PRIORITIES)
+		return TW_INVALID;
+
+	uint32_t i = wheel->free_head;
+	if (i)
+		wheel->free_head = wheel->nodes[i].next;
+	else {
+		i = wheel->nodes.size();
+		wheel->nodes.push_back(tw_node());
+		wheel->nodes[i].generation = 1;
+	}
+	tw_node &n = wheel->nodes[i];
+	n.key = key;
+	n.interval = interval;
+	n.priority = priority;
+	n.deadline = clamp_deadline(wheel, to_ticks(wheel, first_us));
+	n.live = true;
+	place(wheel, i);
+	wheel->stats.entries++;
+	return make_id(wheel, i);
+}
+
+bool tw_cancel(struct timer_wheel *wheel, tw_id id)
+{
+	const uint32_t i = lookup(wheel, id);
+	if (!i)
+		return false;
+	unlink(wheel, i);
+	tw_node &n = wheel->nodes[i];
+	n.live = false;
+	n.generation++;
+	n.next = wheel->free_head;
+	wheel->free_head = i;
+	wheel->stats.entries--;
+	return true;
+}
+
+bool tw_reschedule(struct timer_wheel *wheel, tw_id id, uint64_t interval_us, int priority, uint64_t next_us)
+{
+	const uint32_t i = lookup(wheel, id);
+	const uint64_t interval = to_ticks(wheel, interval_us);
+	if (!i || !interval || interval > TW_MAX_TICKS || priority < 0 || priority >= TW_PRIORITIES)
+		return false;
+	unlink(wheel, i);
+	tw_node &n = wheel->nodes[i];
+	n.interval = interval;
+	n.priority = priority;
+	n.deadline = clamp_deadline(wheel, to_ticks(wheel, next_us));
+	place(wheel, i);
+	return true;
+}
+
+// Brings current up to target, moving everything that comes due onto the
+// ready lists. Visits only occupied level-0 slots and one cascade point
+// per 256 ticks
+static void advance_to(timer_wheel *w, uint64_t target)
+{
+	while (w->current < target) {
+		if ((w->current & (TW_SLOTS - 1)) == TW_SLOTS - 1) {
+			w->current++;
+			for (int level = TW_LEVELS - 1; level > 0; level--) {
+				const int shift = TW_SLOT_BITS * level;
+				if (w->current & ((1ULL << shift) - 1))
+					continue;
+				const uint32_t list = level * TW_SLOTS + ((w->current >> shift) & (TW_SLOTS - 1));
+				if (!list_empty(w, list))
+					drain(w, list, true);
+			}
+			continue;
+		}
+
+		const uint64_t end = target < (w->current | (TW_SLOTS - 1)) ? target : (w->current | (TW_SLOTS - 1));
+		const int last = end & (TW_SLOTS - 1);
+		int slot = (w->current + 1) & (TW_SLOTS - 1);
+		while ((slot = bitmap_find(w, 0, slot)) >= 0 && slot <= last) {
+			w->current = (w->current & ~(uint64_t) (TW_SLOTS - 1)) | slot;
+			drain(w, slot, false);
+			slot++;
+		}
+		w->current = end;
+	}
+}
+
+int tw_advance(struct timer_wheel *wheel, uint64_t now_us, int budget, tw_fire_fn fn, void *arg)
+{
+	advance_to(wheel, now_us / wheel->tick_us);
+
+	int fired = 0;
+	for (int priority = 0; priority < TW_PRIORITIES; priority++) {
+		const uint32_t head = TW_WHEEL_LISTS + priority;
+		while (!list_empty(wheel, head) && (budget <= 0 || fired < budget)) {
+			const uint32_t i = wheel->nodes[head].next;
+			unlink(wheel, i);
+
+			// Next period keeps the phase; periods that already passed are
+			// skipped rather than fired in a burst
+			tw_node &n = wheel->nodes[i];
+			uint64_t next = n.deadline + n.interval;
+			if (next <= wheel->current) {
+				const uint64_t skipped = (wheel->current - n.deadline) / n.interval;
+				wheel->stats.late += skipped;
+				next = n.deadline + (skipped + 1) * n.interval;
+			}
+			n.deadline = next;
+			const uint64_t key = n.key;
+			place(wheel, i);
+
+			wheel->stats.fired++;
+			fired++;
+			fn(arg, make_id(wheel, i), key, now_us);
+		}
+	}
+	wheel->stats.deferred += wheel->ready;
+	return fired;
+}
+
+uint64_t tw_next_deadline(const struct timer_wheel *wheel)
+{
+	if (wheel->ready)
+		return wheel->current * wheel->tick_us;
+
+	for (int level = 0; level < TW_LEVELS; level++) {
+		const int shift = TW_SLOT_BITS * level;
+		const uint64_t block = wheel->current >> (shift + TW_SLOT_BITS);
+		const int index = (wheel->current >> shift) & (TW_SLOTS - 1);
+		int slot = index + 1 < TW_SLOTS ? bitmap_find(wheel, level, index + 1) : -1;
+		if (slot >= 0)
+			return (((block << TW_SLOT_BITS) | slot) << shift) * wheel->tick_us;
+		// The top level wraps around into the next block
+		if (level == TW_LEVELS - 1 && (slot = bitmap_find(wheel, level, 0)) >= 0 && slot <= index)
+			return ((((block + 1) << TW_SLOT_BITS) | slot) << shift) * wheel->tick_us;
+	}
+	return UINT64_MAX;
+}
+
+void tw_get_stats(const struct timer_wheel *wheel, struct tw_stats *stats)
+{
+	*stats = wheel->stats;
+}
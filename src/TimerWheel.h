@@ -0,0 +1,69 @@
+//============================================================================
+// Name        : TimerWheel.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Hierarchical timer wheel for scheduling periodic netlink
+//               queries per interface and per station, each with its own
+//               interval and priority
+//============================================================================
+
+#ifndef RADIOLOCATE_TIMERWHEEL_H
+#define RADIOLOCATE_TIMERWHEEL_H
+
+#include <stdint.h>
+
+// Four levels of 256 slots cover 2^32 ticks. Insert, cancel and
+// reschedule are O(1); advancing costs one bitmap search per 256 ticks
+// plus the entries that actually come due, never a scan of every entry
+#define TW_LEVELS 4
+#define TW_SLOT_BITS 8
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+
+// Priority 0 is the most urgent. Entries due in the same advance fire in
+// priority order, so a query budget goes to the urgent ones first
+#define TW_PRIORITIES 4
+
+typedef uint64_t tw_id;
+#define TW_INVALID ((tw_id) 0)
+
+// Called for every entry that comes due, after it has been rescheduled for
+// its next period. The callback may cancel or reschedule any entry,
+// including this one, and schedule new ones
+typedef void (*tw_fire_fn)(void *arg, tw_id id, uint64_t key, uint64_t now_us);
+
+struct tw_stats {
+	uint32_t entries;
+	uint64_t fired;
+	uint64_t deferred;   // due entries left over because the budget ran out
+	uint64_t late;       // periods skipped because an entry fired too late
+	uint64_t cascaded;   // moves from a coarse level to a finer one
+};
+
+struct timer_wheel;
+
+// tick_us is the resolution: deadlines are rounded up to a whole tick
+struct timer_wheel *tw_create(uint64_t tick_us, uint64_t now_us);
+void tw_destroy(struct timer_wheel *wheel);
+
+// Schedules key to fire first at first_us and then every interval_us.
+// Returns TW_INVALID for a zero interval, an interval beyond the wheel's
+// range or a bad priority
+tw_id tw_schedule(struct timer_wheel *wheel, uint64_t key, uint64_t interval_us, int priority, uint64_t first_us);
+// Returns false if the entry no longer exists
+bool tw_cancel(struct timer_wheel *wheel, tw_id id);
+// Changes an entry's period and priority and moves its next deadline to
+// next_us, e.g. to snap back to a fast rate immediately
+bool tw_reschedule(struct timer_wheel *wheel, tw_id id, uint64_t interval_us, int priority, uint64_t next_us);
+
+// Fires everything due at now_us, at most budget entries (0 for no limit).
+// Entries over budget stay due and fire first next time. Returns the
+// number fired
+int tw_advance(struct timer_wheel *wheel, uint64_t now_us, int budget, tw_fire_fn fn, void *arg);
+
+// Earliest time anything may come due, for sleeping until then; exact for
+// entries within the next 256 ticks and a safe lower bound beyond that.
+// UINT64_MAX if the wheel is empty
+uint64_t tw_next_deadline(const struct timer_wheel *wheel);
+
+void tw_get_stats(const struct timer_wheel *wheel, struct tw_stats *stats);
+
+#endif // RADIOLOCATE_TIMERWHEEL_H
@@ -0,0 +1,327 @@
+//============================================================================
+// Name        : WallModel.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Floor-plan walls and the extra path loss of crossing them
+//               (multi-wall model), found by ray casting against a BVH
+//============================================================================
+
+#include "WallModel.h"
+#include "WorkPool.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Boxes are grown by this much (m) so that a ray running exactly along a
+// box edge, where the slab test degenerates to 0 * huge, still enters it
+#define BVH_BOX_PAD 1e-3f
+
+// Walls per leaf. Small leaves keep the segment tests down, the tree is
+// only a few thousand nodes for a large building either way
+#define BVH_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 64
+
+// A crossing this close (m) to a wall's end is a crossing of its joint
+#define JOINT_EPS 1e-4f
+// Joints one ray can pass through before further ones are counted per wall
+#define MAX_JOINTS 16
+
+// Leaves reference walls[first, first + count); inner nodes have count 0
+// and their children at left and left + 1
+struct bvh_node {
+	float min_x, min_y, max_x, max_y;
+	int left_or_first;
+	int count;
+};
+
+struct wall_model {
+	vector<wall_segment> walls; // in leaf order
+	vector<bvh_node> nodes;
+};
+
+/******************
+ *  BVH building  *
+ ******************/
+static void node_bounds(bvh_node *node, const wall_segment *w, int count)
+{
+	node->min_x = node->min_y = 1e30f;
+	node->max_x = node->max_y = -1e30f;
+	for (int i = 0; i < count; i++) {
+		node->min_x = min(node->min_x, min(w[i].x1, w[i].x2));
+		node->min_y = min(node->min_y, min(w[i].y1, w[i].y2));
+		node->max_x = max(node->max_x, max(w[i].x1, w[i].x2));
+		node->max_y = max(node->max_y, max(w[i].y1, w[i].y2));
+	}
+	node->min_x -= BVH_BOX_PAD;
+	node->min_y -= BVH_BOX_PAD;
+	node->max_x += BVH_BOX_PAD;
+	node->max_y += BVH_BOX_PAD;
+}
+
+struct centre_less {
+	bool by_x;
+	bool operator()(const wall_segment &a, const wall_segment &b) const
+	{
+		return by_x ? a.x1 + a.x2 < b.x1 + b.x2 : a.y1 + a.y2 < b.y1 + b.y2;
+	}
+};
+
+// Median split on the longer axis of the node
+static void build(wall_model *model, int index, int first, int count, int depth)
+{
+	bvh_node *node = &model->nodes[index];
+	node_bounds(node, &model->walls[first], count);
+	if (count <= BVH_LEAF_SIZE || depth >= BVH_MAX_DEPTH - 1) {
+		node->left_or_first = first;
+		node->count = count;
+		return;
+	}
+
+	centre_less less;
+	less.by_x = node->max_x - node->min_x >= node->max_y - node->min_y;
+	const int half = count / 2;
+	nth_element(model->walls.begin() + first, model->walls.begin() + first + half,
+	            model->walls.begin() + first + count, less);
+
+	const int left = (int) model->nodes.size();
+	model->nodes.resize(left + 2);
+	// resize() may have moved the array
+	model->nodes[index].left_or_first = left;
+	model->nodes[index].count = 0;
+	build(model, left, first, half, depth + 1);
+	build(model, left + 1, first + half, count - half, depth + 1);
+}
+
+struct wall_model *wall_model_create(const struct wall_segment *walls, int count)
+{
+	wall_model *model = new wall_model;
+	model->walls.assign(walls, walls + count);
+	model->nodes.reserve(count > 0 ? 2 * count / BVH_LEAF_SIZE + 1 : 1);
+	model->nodes.resize(1);
+	build(model, 0, 0, count, 0);
+	return model;
+}
+
+struct wall_model *wall_model_load(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Failed to open floor plan %s.\n", path);
+		return NULL;
+	}
+
+	map<string, float> materials;
+	vector<wall_segment> walls;
+	char line[256], name[64];
+	int lineno = 0;
+	bool ok = true;
+
+	while (ok && fgets(line, sizeof(line), file)) {
+		lineno++;
+		char *hash = strchr(line, '#');
+		if (hash)
+			*hash = '\0';
+
+		char keyword[16];
+		if (sscanf(line, "%15s", keyword) != 1)
+			continue; // blank
+
+		wall_segment w;
+		float db;
+		if (!strcmp(keyword, "material") && sscanf(line, "%*s %63s %f", name, &db) == 2) {
+			materials[name] = db;
+		} else if (!strcmp(keyword, "wall") &&
+		           sscanf(line, "%*s %f %f %f %f %63s", &w.x1, &w.y1, &w.x2, &w.y2, name) == 5) {
+			map<string, float>::const_iterator it = materials.find(name);
+			char *end;
+			if (it != materials.end()) {
+				w.attenuation = it->second;
+			} else {
+				w.attenuation = strtof(name, &end);
+				if (*end != '\0') {
+					fprintf(stderr, "%s:%d: unknown material %s.\n", path, lineno, name);
+					ok = false;
+				}
+			}
+			walls.push_back(w);
+		} else {
+			fprintf(stderr, "%s:%d: malformed line.\n", path, lineno);
+			ok = false;
+		}
+	}
+	fclose(file);
+
+	if (!ok)
+		return NULL;
+	return wall_model_create(walls.empty() ? NULL : &walls[0], (int) walls.size());
+}
+
+void wall_model_destroy(struct wall_model *model)
+{
+	delete model;
+}
+
+int wall_model_count(const struct wall_model *model)
+{
+	return (int) model->walls.size();
+}
+
+/*****************
+ *  Ray casting  *
+ *****************/
+static inline float cross(float ax, float ay, float bx, float by)
+{
+	return ax * by - ay * bx;
+}
+
+enum crossing {
+	CROSS_NONE,
+	CROSS_WALL,
+	CROSS_START,           // through (x1, y1)
+	CROSS_END,             // through (x2, y2)
+};
+
+// Segment p + t*d, t in (0, 1], against the wall
+static inline crossing crosses(float px, float py, float dx, float dy, const wall_segment *w)
+{
+	const float ex = w->x2 - w->x1, ey = w->y2 - w->y1;
+	const float denom = cross(dx, dy, ex, ey);
+	if (denom == 0.0f)
+		return CROSS_NONE; // parallel, grazing along a wall costs nothing
+	const float qx = w->x1 - px, qy = w->y1 - py;
+	const float t = cross(qx, qy, ex, ey) / denom;
+	if (!(t > 0.0f && t <= 1.0f))
+		return CROSS_NONE;
+	const float u = cross(qx, qy, dx, dy) / denom;
+	const float slack = JOINT_EPS / sqrtf(ex * ex + ey * ey);
+	if (u < -slack || u > 1.0f + slack)
+		return CROSS_NONE;
+	return u <= slack ? CROSS_START : u >= 1.0f - slack ? CROSS_END : CROSS_WALL;
+}
+
+// Walls that meet at a point share its coordinates. A ray through it
+// passes one of them, whichever way they run: the heaviest, once
+struct joint_hit {
+	float x, y;
+	float attenuation;
+};
+
+static void add_joint(joint_hit *joints, int *count, float *loss, float x, float y, float attenuation)
+{
+	for (int i = 0; i < *count; i++)
+		if (joints[i].x == x && joints[i].y == y) {
+			if (attenuation > joints[i].attenuation)
+				joints[i].attenuation = attenuation;
+			return;
+		}
+	if (*count == MAX_JOINTS) {
+		*loss += attenuation;
+		return;
+	}
+	joints[*count].x = x;
+	joints[*count].y = y;
+	joints[*count].attenuation = attenuation;
+	++*count;
+}
+
+// Slab test of the segment against a node's box
+static inline bool hits_box(const bvh_node *n, float px, float py, float inv_dx, float inv_dy)
+{
+	float t0 = (n->min_x - px) * inv_dx, t1 = (n->max_x - px) * inv_dx;
+	float tmin = min(t0, t1), tmax = max(t0, t1);
+	t0 = (n->min_y - py) * inv_dy;
+	t1 = (n->max_y - py) * inv_dy;
+	tmin = max(tmin, min(t0, t1));
+	tmax = min(tmax, max(t0, t1));
+	return tmax >= max(tmin, 0.0f) && tmin <= 1.0f;
+}
+
+float wall_model_loss(const struct wall_model *model, float ax, float ay, float px, float py)
+{
+	if (model->walls.empty())
+		return 0.0f;
+
+	const float dx = px - ax, dy = py - ay;
+	// Axis-parallel rays get a huge rather than infinite inverse, which
+	// keeps 0 * inf NaNs out of the slab test
+	const float inv_dx = 1.0f / (dx != 0.0f ? dx : 1e-20f);
+	const float inv_dy = 1.0f / (dy != 0.0f ? dy : 1e-20f);
+	const bvh_node *nodes = &model->nodes[0];
+	const wall_segment *walls = &model->walls[0];
+
+	int stack[BVH_MAX_DEPTH];
+	int top = 0;
+	float loss = 0.0f;
+	joint_hit joints[MAX_JOINTS];
+	int joint_count = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const bvh_node *n = &nodes[stack[--top]];
+		if (!hits_box(n, ax, ay, inv_dx, inv_dy))
+			continue;
+		if (n->count) {
+			for (int i = n->left_or_first; i < n->left_or_first + n->count; i++) {
+				const wall_segment *w = &walls[i];
+				switch (crosses(ax, ay, dx, dy, w)) {
+				case CROSS_NONE:
+					break;
+				case CROSS_WALL:
+					loss += w->attenuation;
+					break;
+				case CROSS_START:
+					add_joint(joints, &joint_count, &loss, w->x1, w->y1, w->attenuation);
+					break;
+				case CROSS_END:
+					add_joint(joints, &joint_count, &loss, w->x2, w->y2, w->attenuation);
+					break;
+				}
+			}
+		} else {
+			stack[top++] = n->left_or_first;
+			stack[top++] = n->left_or_first + 1;
+		}
+	}
+	for (int i = 0; i < joint_count; i++)
+		loss += joints[i].attenuation;
+	return loss;
+}
+
+// Rays are handed out in chunks, one chunk per work item
+#define RAY_CHUNK 256
+
+struct ray_batch {
+	const wall_model *model;
+	float ax, ay;
+	const float *px, *py;
+	float *loss;
+	int n;
+};
+
+static void ray_chunk(void *arg, int index)
+{
+	const ray_batch *b = (const ray_batch*) arg;
+	const int end = min(b->n, (index + 1) * RAY_CHUNK);
+	for (int i = index * RAY_CHUNK; i < end; i++)
+		b->loss[i] = wall_model_loss(b->model, b->ax, b->ay, b->px[i], b->py[i]);
+}
+
+void wall_model_loss_batch(const struct wall_model *model, float ax, float ay,
+                           const float *px, const float *py, int n, float *loss,
+                           struct work_pool *pool)
+{
+	ray_batch b = { model, ax, ay, px, py, loss, n };
+	const int chunks = (n + RAY_CHUNK - 1) / RAY_CHUNK;
+	if (pool)
+		work_pool_run(pool, ray_chunk, &b, chunks);
+	else
+		for (int i = 0; i < chunks; i++)
+			ray_chunk(&b, i);
+}
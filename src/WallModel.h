@@ -0,0 +1,40 @@
+//============================================================================
+// Name        : WallModel.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Floor-plan walls and the extra path loss of crossing them
+//               (multi-wall model), found by ray casting against a BVH
+//============================================================================
+
+#ifndef RADIOLOCATE_WALLMODEL_H
+#define RADIOLOCATE_WALLMODEL_H
+
+struct work_pool;
+struct wall_model;
+
+struct wall_segment {
+	float x1, y1, x2, y2; // m, site coordinates
+	float attenuation;    // dB lost by a ray crossing it
+};
+
+// Loads a floor plan. The format is line based, '#' starts a comment:
+//     material <name> <attenuation dB>
+//     wall <x1> <y1> <x2> <y2> <material name | attenuation dB>
+// Materials must be declared before the walls that use them.
+// Returns NULL (after printing the offending line) on error
+struct wall_model *wall_model_load(const char *path);
+struct wall_model *wall_model_create(const struct wall_segment *walls, int count);
+void wall_model_destroy(struct wall_model *model);
+int wall_model_count(const struct wall_model *model);
+
+// Total attenuation (dB) of the walls crossed by the straight line from
+// (ax, ay) to (px, py). Where walls meet, at a joint or a corner, a line
+// through the point counts the heaviest of them once
+float wall_model_loss(const struct wall_model *model, float ax, float ay, float px, float py);
+
+// Casts n rays from one anchor, in parallel across pool if given. The BVH
+// is read-only after construction so any number of threads may cast at once
+void wall_model_loss_batch(const struct wall_model *model, float ax, float ay,
+                           const float *px, const float *py, int n, float *loss,
+                           struct work_pool *pool);
+
+#endif // RADIOLOCATE_WALLMODEL_H
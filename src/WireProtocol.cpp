@@ -0,0 +1,389 @@
+//============================================================================
+// Name        : WireProtocol.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Compact binary UDP protocol between sensors and the
+//               aggregator. Many samples are batched per datagram and
+//               many datagrams per sendmmsg()/recvmmsg() call
+//============================================================================
+
+#include "WireProtocol.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+/*****************
+ *  Byte layout  *
+ *****************/
+static inline void put_u16(uint8_t *p, uint16_t v) { v = htole16(v); memcpy(p, &v, 2); }
+static inline void put_u32(uint8_t *p, uint32_t v) { v = htole32(v); memcpy(p, &v, 4); }
+static inline void put_u64(uint8_t *p, uint64_t v) { v = htole64(v); memcpy(p, &v, 8); }
+static inline uint16_t get_u16(const uint8_t *p) { uint16_t v; memcpy(&v, p, 2); return le16toh(v); }
+static inline uint32_t get_u32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return le32toh(v); }
+static inline uint64_t get_u64(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return le64toh(v); }
+
+static void encode_header(uint8_t *p, uint32_t sensor_id, uint32_t sequence, uint16_t count,
+                          uint16_t session, uint64_t base_us)
+{
+	put_u16(p, WIRE_MAGIC);
+	p[2] = WIRE_VERSION;
+	p[3] = 0;
+	put_u32(p + 4, sensor_id);
+	put_u32(p + 8, sequence);
+	put_u16(p + 12, count);
+	put_u16(p + 14, session);
+	put_u64(p + 16, base_us);
+}
+
+static void encode_record(uint8_t *p, const rl_sample *s, uint64_t base_us)
+{
+	mac_from_key(s->mac, p);
+	put_u32(p + 6, (uint32_t) (s->timestamp_us - base_us));
+	put_u16(p + 10, (uint16_t) s->ifindex);
+	p[12] = (uint8_t) s->signal;
+	p[13] = (uint8_t) s->signal_avg;
+	put_u16(p + 14, s->tx_bitrate);
+	put_u32(p + 16, s->inactive_ms);
+}
+
+int wire_decode(const uint8_t *data, int length, uint32_t *sensor_id, uint32_t *sequence,
+                struct rl_sample *samples)
+{
+	if (length < WIRE_HEADER_SIZE || get_u16(data) != WIRE_MAGIC || data[2] != WIRE_VERSION)
+		return -1;
+	const int count = get_u16(data + 12);
+	if (count > WIRE_MAX_RECORDS || length != WIRE_HEADER_SIZE + count * WIRE_RECORD_SIZE)
+		return -1;
+
+	*sensor_id = get_u32(data + 4);
+	*sequence = get_u32(data + 8);
+	const uint64_t base_us = get_u64(data + 16);
+
+	const uint8_t *p = data + WIRE_HEADER_SIZE;
+	for (int i = 0; i < count; i++, p += WIRE_RECORD_SIZE) {
+		rl_sample *s = &samples[i];
+		s->mac = mac_to_key(p);
+		s->timestamp_us = base_us + get_u32(p + 6);
+		s->ifindex = get_u16(p + 10);
+		s->signal = (int8_t) p[12];
+		s->signal_avg = (int8_t) p[13];
+		s->tx_bitrate = get_u16(p + 14);
+		s->inactive_ms = get_u32(p + 16);
+	}
+	return count;
+}
+
+// Splits "host:port" (host may be empty or a [bracketed] IPv6 literal)
+static bool resolve(const char *address, bool passive, sockaddr_storage *out, socklen_t *out_len)
+{
+	string a(address);
+	size_t colon = a.rfind(':');
+	if (colon == string::npos) {
+		fprintf(stderr, "Address %s is missing a port.\n", address);
+		return false;
+	}
+	string host = a.substr(0, colon), port = a.substr(colon + 1);
+	if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']')
+		host = host.substr(1, host.size() - 2);
+
+	addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICSERV | (passive ? AI_PASSIVE : 0);
+	int err = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res);
+	if (err) {
+		fprintf(stderr, "Failed to resolve %s: %s\n", address, gai_strerror(err));
+		return false;
+	}
+	memcpy(out, res->ai_addr, res->ai_addrlen);
+	*out_len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return true;
+}
+
+/************
+ *  Sender  *
+ ************/
+struct wire_sender {
+	int fd;
+	sockaddr_storage dest;
+	socklen_t dest_len;
+	uint32_t sensor_id;
+	uint32_t sequence;
+	uint16_t session;
+	uint64_t max_delay_us;
+
+	uint8_t datagrams[WIRE_BATCH][WIRE_MAX_DATAGRAM];
+	int lengths[WIRE_BATCH];
+	int ready;           // complete datagrams waiting to be sent
+	int filling;         // records in datagrams[ready]
+	uint64_t base_us;    // of datagrams[ready]
+	uint64_t oldest_us;  // first sample waiting in any datagram
+
+	mmsghdr msgs[WIRE_BATCH];
+	iovec iovs[WIRE_BATCH];
+	wire_sender_stats stats;
+};
+
+struct wire_sender *wire_sender_create(const char *destination, uint32_t sensor_id, uint64_t max_delay_us)
+{
+	wire_sender *sender = new wire_sender;
+	memset(sender, 0, sizeof(*sender));
+	if (!resolve(destination, false, &sender->dest, &sender->dest_len)) {
+		delete sender;
+		return NULL;
+	}
+	sender->fd = socket(sender->dest.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sender->fd < 0) {
+		fprintf(stderr, "Failed to create UDP socket: %s\n", strerror(errno));
+		delete sender;
+		return NULL;
+	}
+
+	sender->sensor_id = sensor_id;
+	sender->max_delay_us = max_delay_us;
+	sender->session = (uint16_t) (getpid() ^ monotonic_us());
+	for (int i = 0; i < WIRE_BATCH; i++) {
+		sender->iovs[i].iov_base = sender->datagrams[i];
+		sender->msgs[i].msg_hdr.msg_iov = &sender->iovs[i];
+		sender->msgs[i].msg_hdr.msg_iovlen = 1;
+		sender->msgs[i].msg_hdr.msg_name = &sender->dest;
+		sender->msgs[i].msg_hdr.msg_namelen = sender->dest_len;
+	}
+	return sender;
+}
+
+void wire_sender_destroy(struct wire_sender *sender)
+{
+	if (!sender)
+		return;
+	wire_sender_flush(sender);
+	close(sender->fd);
+	delete sender;
+}
+
+// Completes the datagram being filled
+static void seal(wire_sender *sender)
+{
+	if (!sender->filling)
+		return;
+	encode_header(sender->datagrams[sender->ready], sender->sensor_id, sender->sequence++,
+	              (uint16_t) sender->filling, sender->session, sender->base_us);
+	sender->lengths[sender->ready] = WIRE_HEADER_SIZE + sender->filling * WIRE_RECORD_SIZE;
+	sender->ready++;
+	sender->filling = 0;
+}
+
+bool wire_sender_flush(struct wire_sender *sender)
+{
+	seal(sender);
+
+	bool ok = true;
+	int sent = 0;
+	while (sent < sender->ready) {
+		for (int i = sent; i < sender->ready; i++)
+			sender->iovs[i].iov_len = sender->lengths[i];
+		int n = sendmmsg(sender->fd, &sender->msgs[sent], sender->ready - sent, 0);
+		sender->stats.syscalls++;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			// Nobody listening (ECONNREFUSED) or a full queue: the sequence
+			// gap tells the aggregator what it missed
+			sender->stats.send_errors += sender->ready - sent;
+			ok = false;
+			break;
+		}
+		sent += n;
+		sender->stats.datagrams += n;
+	}
+	sender->ready = 0;
+	return ok;
+}
+
+bool wire_sender_add(struct wire_sender *sender, const struct rl_sample *sample)
+{
+	// Timestamps are stored as 32-bit offsets from the datagram's first
+	// sample; start a new datagram rather than let one wrap or go negative
+	if (sender->filling && (sample->timestamp_us < sender->base_us ||
+	                        sample->timestamp_us - sender->base_us > UINT32_MAX))
+		seal(sender);
+	// Failures are counted in send_errors; carry on with an empty queue
+	if (sender->ready == WIRE_BATCH)
+		wire_sender_flush(sender);
+
+	if (!sender->filling) {
+		sender->base_us = sample->timestamp_us;
+		if (!sender->ready)
+			sender->oldest_us = sample->timestamp_us;
+	}
+	encode_record(sender->datagrams[sender->ready] + WIRE_HEADER_SIZE + sender->filling * WIRE_RECORD_SIZE,
+	              sample, sender->base_us);
+	sender->filling++;
+	sender->stats.samples++;
+
+	if (sender->filling == WIRE_MAX_RECORDS)
+		seal(sender);
+	if (sender->ready == WIRE_BATCH || sample->timestamp_us - sender->oldest_us >= sender->max_delay_us)
+		return wire_sender_flush(sender);
+	return true;
+}
+
+uint64_t wire_sender_deadline(const struct wire_sender *sender)
+{
+	if (!sender->ready && !sender->filling)
+		return UINT64_MAX;
+	return sender->oldest_us + sender->max_delay_us;
+}
+
+bool wire_sender_poll(struct wire_sender *sender, uint64_t now_us)
+{
+	if (now_us < wire_sender_deadline(sender))
+		return true;
+	return wire_sender_flush(sender);
+}
+
+void wire_sender_get_stats(const struct wire_sender *sender, struct wire_sender_stats *stats)
+{
+	*stats = sender->stats;
+}
+
+/**************
+ *  Receiver  *
+ **************/
+struct wire_peer {
+	uint32_t next_sequence;
+	uint16_t session;
+};
+
+struct wire_receiver {
+	int fd;
+	uint8_t datagrams[WIRE_BATCH][WIRE_MAX_DATAGRAM];
+	mmsghdr msgs[WIRE_BATCH];
+	iovec iovs[WIRE_BATCH];
+	rl_sample samples[WIRE_MAX_RECORDS];
+	unordered_map<uint32_t, wire_peer> peers;
+	wire_receiver_stats stats;
+};
+
+struct wire_receiver *wire_receiver_create(const char *bind_address, int rcvbuf, bool reuse_port)
+{
+	sockaddr_storage addr;
+	socklen_t addr_len;
+	if (!resolve(bind_address, true, &addr, &addr_len))
+		return NULL;
+
+	int fd = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create UDP socket: %s\n", strerror(errno));
+		return NULL;
+	}
+	if (rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)))
+		fprintf(stderr, "Failed to set SO_RCVBUF: %s\n", strerror(errno));
+	int one = 1;
+	if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))) {
+		fprintf(stderr, "Failed to set SO_REUSEPORT: %s\n", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if (bind(fd, (sockaddr*) &addr, addr_len)) {
+		fprintf(stderr, "Failed to bind %s: %s\n", bind_address, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	wire_receiver *receiver = new wire_receiver;
+	receiver->fd = fd;
+	memset(&receiver->stats, 0, sizeof(receiver->stats));
+	memset(receiver->msgs, 0, sizeof(receiver->msgs));
+	for (int i = 0; i < WIRE_BATCH; i++) {
+		receiver->iovs[i].iov_base = receiver->datagrams[i];
+		receiver->iovs[i].iov_len = WIRE_MAX_DATAGRAM;
+		receiver->msgs[i].msg_hdr.msg_iov = &receiver->iovs[i];
+		receiver->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	return receiver;
+}
+
+void wire_receiver_destroy(struct wire_receiver *receiver)
+{
+	if (!receiver)
+		return;
+	close(receiver->fd);
+	delete receiver;
+}
+
+int wire_receiver_fd(const struct wire_receiver *receiver)
+{
+	return receiver->fd;
+}
+
+static void track_sequence(wire_receiver *receiver, uint32_t sensor_id, uint16_t session, uint32_t sequence)
+{
+	unordered_map<uint32_t, wire_peer>::iterator it = receiver->peers.find(sensor_id);
+	if (it == receiver->peers.end() || it->second.session != session) {
+		// New sensor, or a sensor that restarted
+		wire_peer peer = { sequence + 1, session };
+		receiver->peers[sensor_id] = peer;
+		receiver->stats.sensors = (uint32_t) receiver->peers.size();
+		return;
+	}
+
+	int32_t gap = (int32_t) (sequence - it->second.next_sequence);
+	if (gap >= 0) {
+		receiver->stats.lost += gap;
+		it->second.next_sequence = sequence + 1;
+	} else {
+		receiver->stats.reordered++;
+	}
+}
+
+int wire_receiver_poll(struct wire_receiver *receiver, int timeout_ms, wire_sample_fn fn, void *arg)
+{
+	if (timeout_ms != 0) {
+		pollfd pfd = { receiver->fd, POLLIN, 0 };
+		int ready = poll(&pfd, 1, timeout_ms);
+		if (ready <= 0)
+			return ready < 0 && errno != EINTR ? -1 : 0;
+	}
+
+	int n = recvmmsg(receiver->fd, receiver->msgs, WIRE_BATCH, MSG_DONTWAIT, NULL);
+	receiver->stats.syscalls++;
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+
+	for (int i = 0; i < n; i++) {
+		const uint8_t *data = receiver->datagrams[i];
+		uint32_t sensor_id, sequence;
+		int count = -1;
+		if (!(receiver->msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+			count = wire_decode(data, (int) receiver->msgs[i].msg_len, &sensor_id, &sequence, receiver->samples);
+		if (count < 0) {
+			receiver->stats.malformed++;
+			continue;
+		}
+		track_sequence(receiver, sensor_id, get_u16(data + 14), sequence);
+		receiver->stats.datagrams++;
+		receiver->stats.samples += count;
+		if (count)
+			fn(arg, sensor_id, receiver->samples, count);
+	}
+	return n;
+}
+
+void wire_receiver_get_stats(const struct wire_receiver *receiver, struct wire_receiver_stats *stats)
+{
+	*stats = receiver->stats;
+}
@@ -0,0 +1,106 @@
+//============================================================================
+// Name        : WireProtocol.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Compact binary UDP protocol between sensors and the
+//               aggregator. Many samples are batched per datagram and
+//               many datagrams per sendmmsg()/recvmmsg() call
+//============================================================================
+
+#ifndef RADIOLOCATE_WIREPROTOCOL_H
+#define RADIOLOCATE_WIREPROTOCOL_H
+
+#include <stdint.h>
+
+#include "Sample.h"
+
+// Datagram layout, all fields little-endian:
+//
+//   header (24 bytes)
+//     u16 magic 'R' 'L'   u8 version   u8 flags (0)
+//     u32 sensor id       u32 sequence (per sensor, +1 per datagram)
+//     u16 sample count    u16 session (random per sender, resets loss tracking)
+//     u64 base timestamp (us)
+//   count records (20 bytes each)
+//     u8[6] MAC           u32 timestamp - base (us)
+//     u16 ifindex         i8 signal     i8 signal avg
+//     u16 tx bitrate      u32 inactive time (ms)
+#define WIRE_MAGIC 0x4C52
+#define WIRE_VERSION 1
+#define WIRE_HEADER_SIZE 24
+#define WIRE_RECORD_SIZE 20
+// Fits an Ethernet MTU without IP fragmentation
+#define WIRE_MAX_DATAGRAM 1472
+#define WIRE_MAX_RECORDS ((WIRE_MAX_DATAGRAM - WIRE_HEADER_SIZE) / WIRE_RECORD_SIZE)
+// Datagrams per sendmmsg()/recvmmsg()
+#define WIRE_BATCH 64
+
+/************
+ *  Sender  *
+ ************/
+struct wire_sender_stats {
+	uint64_t samples;
+	uint64_t datagrams;
+	uint64_t syscalls;
+	uint64_t send_errors;  // datagrams the kernel refused
+};
+
+struct wire_sender;
+
+// destination is "host:port". max_delay_us bounds how long a sample may sit
+// in a partly filled datagram: wire_sender_add() flushes once a newer
+// sample comes that much later, wire_sender_poll() once the clock does
+struct wire_sender *wire_sender_create(const char *destination, uint32_t sensor_id, uint64_t max_delay_us);
+void wire_sender_destroy(struct wire_sender *sender);
+
+// Appends one sample. Full datagrams queue up and go out together in one
+// sendmmsg() once WIRE_BATCH are ready or the oldest sample is due
+bool wire_sender_add(struct wire_sender *sender, const struct rl_sample *sample);
+// Sends everything queued, including a partly filled datagram
+bool wire_sender_flush(struct wire_sender *sender);
+// When the oldest queued sample is due, UINT64_MAX while nothing is queued.
+// Sample timestamps and now_us are on the same clock (CLOCK_MONOTONIC)
+uint64_t wire_sender_deadline(const struct wire_sender *sender);
+// Flushes if the oldest queued sample is due by now_us. For the caller's
+// timer, so that the last samples before a lull don't wait for the next one
+bool wire_sender_poll(struct wire_sender *sender, uint64_t now_us);
+void wire_sender_get_stats(const struct wire_sender *sender, struct wire_sender_stats *stats);
+
+/**************
+ *  Receiver  *
+ **************/
+struct wire_receiver_stats {
+	uint64_t samples;
+	uint64_t datagrams;
+	uint64_t syscalls;
+	uint64_t lost;         // datagrams missing from a sensor's sequence
+	uint64_t reordered;    // datagrams older than the newest seen (late or duplicate)
+	uint64_t malformed;
+	uint32_t sensors;
+};
+
+// Called once per datagram with its decoded samples. The array is only
+// valid during the call
+typedef void (*wire_sample_fn)(void *arg, uint32_t sensor_id, const struct rl_sample *samples, int count);
+
+struct wire_receiver;
+
+// bind_address is "host:port" or ":port" for any address. rcvbuf sets
+// SO_RCVBUF (bytes) if positive; bursts from many sensors need a large one.
+// With reuse_port several receivers can bind the same port and the kernel
+// spreads the sensors across them
+struct wire_receiver *wire_receiver_create(const char *bind_address, int rcvbuf, bool reuse_port);
+void wire_receiver_destroy(struct wire_receiver *receiver);
+int wire_receiver_fd(const struct wire_receiver *receiver);
+
+// Waits up to timeout_ms (-1 forever, 0 not at all) for datagrams, then
+// drains up to WIRE_BATCH of them with one recvmmsg(). Returns the number
+// of datagrams handled, or -1 on error
+int wire_receiver_poll(struct wire_receiver *receiver, int timeout_ms, wire_sample_fn fn, void *arg);
+void wire_receiver_get_stats(const struct wire_receiver *receiver, struct wire_receiver_stats *stats);
+
+// Decodes one datagram; exposed for receivers with their own socket loop.
+// Returns the number of samples, or -1 if the datagram is malformed
+int wire_decode(const uint8_t *data, int length, uint32_t *sensor_id, uint32_t *sequence,
+                struct rl_sample *samples);
+
+#endif // RADIOLOCATE_WIREPROTOCOL_H
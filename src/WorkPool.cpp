@@ -0,0 +1,211 @@
+//============================================================================
+// Name        : WorkPool.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Work-stealing parallel-for over a fixed set of threads
+//============================================================================
+
+#include "WorkPool.h"
+
+#include <stdint.h>
+#include <stdlib.h> // for posix_memalign()
+#include <unistd.h> // for sysconf()
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// The remaining slice of one thread, packed as (begin << 32) | end so that
+// the owner taking from the front and thieves splitting off the back agree
+// through a single compare-and-swap
+struct work_range {
+	atomic<uint64_t> bounds;
+	char pad[64 - sizeof(atomic<uint64_t>)]; // one cache line per thread
+};
+
+static inline uint64_t range_pack(uint32_t begin, uint32_t end)
+{
+	return ((uint64_t) begin << 32) | end;
+}
+
+struct work_pool {
+	int thread_count;
+	vector<thread> threads;
+	work_range *ranges;
+
+	mutex lock;
+	condition_variable wake;
+	condition_variable done;
+	uint64_t generation;
+	int busy; // worker threads still inside the current job
+	bool quit;
+
+	work_fn fn;
+	void *arg;
+};
+
+// Takes the next index from the front of our own slice
+static bool range_pop(work_range *r, uint32_t *index)
+{
+	uint64_t cur = r->bounds.load(memory_order_relaxed);
+	for (;;) {
+		uint32_t begin = cur >> 32, end = (uint32_t) cur;
+		if (begin >= end)
+			return false;
+		if (r->bounds.compare_exchange_weak(cur, range_pack(begin + 1, end), memory_order_acquire))
+		{
+			*index = begin;
+			return true;
+		}
+	}
+}
+
+// Moves the upper half of a victim's slice into our (empty) slice
+static bool range_steal(work_range *victim, work_range *self)
+{
+	uint64_t cur = victim->bounds.load(memory_order_relaxed);
+	for (;;) {
+		uint32_t begin = cur >> 32, end = (uint32_t) cur;
+		if (begin >= end)
+			return false;
+		uint32_t split = end - (end - begin + 1) / 2;
+		if (victim->bounds.compare_exchange_weak(cur, range_pack(begin, split), memory_order_acquire))
+		{
+			self->bounds.store(range_pack(split, end), memory_order_release);
+			return true;
+		}
+	}
+}
+
+static void run_slices(work_pool *pool, int self)
+{
+	work_range *mine = &pool->ranges[self];
+	uint32_t index;
+	for (;;) {
+		while (range_pop(mine, &index))
+			pool->fn(pool->arg, (int) index);
+
+		// Look for the victim with the most work left, starting after
+		// ourselves so that thieves don't all pile onto thread 0
+		int victim = -1;
+		uint32_t most = 0;
+		for (int i = 1; i < pool->thread_count; i++) {
+			int v = (self + i) % pool->thread_count;
+			uint64_t b = pool->ranges[v].bounds.load(memory_order_relaxed);
+			uint32_t left = (uint32_t) b > (b >> 32) ? (uint32_t) b - (uint32_t) (b >> 32) : 0;
+			if (left > most) {
+				most = left;
+				victim = v;
+			}
+		}
+		if (victim < 0)
+			return;
+		// Losing the race just means rescanning
+		range_steal(&pool->ranges[victim], mine);
+	}
+}
+
+static void worker_main(work_pool *pool, int self)
+{
+	uint64_t seen = 0;
+	for (;;) {
+		{
+			unique_lock<mutex> guard(pool->lock);
+			pool->wake.wait(guard, [&] { return pool->quit || pool->generation != seen; });
+			if (pool->quit)
+				return;
+			seen = pool->generation;
+		}
+
+		run_slices(pool, self);
+
+		lock_guard<mutex> guard(pool->lock);
+		if (--pool->busy == 0)
+			pool->done.notify_one();
+	}
+}
+
+struct work_pool *work_pool_create(int threads)
+{
+	if (threads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (int) cpus : 1;
+	}
+
+	void *ranges;
+	if (posix_memalign(&ranges, 64, threads * sizeof(work_range)))
+		return NULL;
+
+	work_pool *pool = new work_pool;
+	pool->thread_count = threads;
+	pool->ranges = (work_range*) ranges;
+	for (int i = 0; i < threads; i++)
+		new (&pool->ranges[i].bounds) atomic<uint64_t>(0);
+	pool->generation = 0;
+	pool->busy = 0;
+	pool->quit = false;
+	pool->fn = NULL;
+	pool->arg = NULL;
+
+	// Slot 0 belongs to whoever calls work_pool_run()
+	for (int i = 1; i < threads; i++)
+		pool->threads.push_back(thread(worker_main, pool, i));
+	return pool;
+}
+
+void work_pool_destroy(struct work_pool *pool)
+{
+	if (!pool)
+		return;
+	{
+		lock_guard<mutex> guard(pool->lock);
+		pool->quit = true;
+	}
+	pool->wake.notify_all();
+	for (size_t i = 0; i < pool->threads.size(); i++)
+		pool->threads[i].join();
+	free(pool->ranges);
+	delete pool;
+}
+
+int work_pool_threads(const struct work_pool *pool)
+{
+	return pool->thread_count;
+}
+
+void work_pool_run(struct work_pool *pool, work_fn fn, void *arg, int count)
+{
+	if (count <= 0)
+		return;
+
+	// Not worth waking anyone for
+	if (pool->thread_count == 1 || count == 1) {
+		for (int i = 0; i < count; i++)
+			fn(arg, i);
+		return;
+	}
+
+	// Hand every thread an equal contiguous slice up front
+	uint32_t n = (uint32_t) count;
+	uint32_t t = (uint32_t) pool->thread_count;
+	for (uint32_t i = 0; i < t; i++)
+		pool->ranges[i].bounds.store(range_pack(n * i / t, n * (i + 1) / t), memory_order_relaxed);
+
+	{
+		lock_guard<mutex> guard(pool->lock);
+		pool->fn = fn;
+		pool->arg = arg;
+		pool->busy = pool->thread_count - 1;
+		pool->generation++;
+	}
+	pool->wake.notify_all();
+
+	run_slices(pool, 0);
+
+	unique_lock<mutex> guard(pool->lock);
+	pool->done.wait(guard, [&] { return pool->busy == 0; });
+}
@@ -0,0 +1,28 @@
+//============================================================================
+// Name        : WorkPool.h
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Work-stealing parallel-for over a fixed set of threads
+//============================================================================
+
+#ifndef RADIOLOCATE_WORKPOOL_H
+#define RADIOLOCATE_WORKPOOL_H
+
+// Called once per index of the job, from any thread of the pool
+typedef void (*work_fn)(void *arg, int index);
+
+struct work_pool;
+
+// threads <= 0 uses one thread per online CPU. The calling thread of
+// work_pool_run() counts as one of them
+struct work_pool *work_pool_create(int threads);
+void work_pool_destroy(struct work_pool *pool);
+int work_pool_threads(const struct work_pool *pool);
+
+// Runs fn(arg, i) for every i in [0, count) and returns when all are done.
+// Each thread starts on its own contiguous slice of the range; a thread that
+// runs dry steals the upper half of the fullest-looking victim's remainder,
+// so uneven per-index cost (e.g. targets with many observations) balances out.
+// Not reentrant: one job at a time per pool
+void work_pool_run(struct work_pool *pool, work_fn fn, void *arg, int count);
+
+#endif // RADIOLOCATE_WORKPOOL_H
@@ -0,0 +1,118 @@
+//============================================================================
+// Name        : AssignmentCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks assign_solve() against exhaustive search on random
+//               sparse problems. Build with
+//               g++ -O2 AssignmentCheck.cpp ../Assignment.cpp
+//============================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "../Assignment.h"
+
+using namespace std;
+
+#define MAX_SIDE 7
+
+static int failures = 0;
+
+struct best {
+	int pairs;
+	double cost;
+};
+
+// Every matching of rows [row, rows) onto the free columns
+static void search(const double cost[MAX_SIDE][MAX_SIDE], int rows, int cols, int row,
+                   bool *taken, int pairs, double total, best *b)
+{
+	if (row == rows) {
+		if (pairs > b->pairs || (pairs == b->pairs && total < b->cost)) {
+			b->pairs = pairs;
+			b->cost = total;
+		}
+		return;
+	}
+	search(cost, rows, cols, row + 1, taken, pairs, total, b);
+	for (int c = 0; c < cols; c++)
+		if (!taken[c] && cost[row][c] < INFINITY) {
+			taken[c] = true;
+			search(cost, rows, cols, row + 1, taken, pairs + 1, total + cost[row][c], b);
+			taken[c] = false;
+		}
+}
+
+int main()
+{
+	srand(1);
+	assign_solver *solver = assign_solver_create(0);
+	for (int problem = 0; problem < 20000; problem++) {
+		const int rows = 1 + rand() % MAX_SIDE, cols = 1 + rand() % MAX_SIDE;
+		const float density = (rand() % 100) / 100.0f;
+		double cost[MAX_SIDE][MAX_SIDE];
+		vector<assign_edge> edges;
+		for (int r = 0; r < rows; r++)
+			for (int c = 0; c < cols; c++) {
+				cost[r][c] = INFINITY;
+				if (rand() % 100 < density * 100) {
+					assign_edge e = { r, c, (float) (rand() % 1000) / 10.0f };
+					cost[r][c] = e.cost;
+					edges.push_back(e);
+				}
+			}
+
+		int row_to_col[MAX_SIDE];
+		assign_stats stats;
+		const int pairs = assign_solve(solver, edges.empty() ? NULL : &edges[0], (int) edges.size(),
+		                               rows, cols, row_to_col, &stats);
+
+		// A valid matching of allowed pairs...
+		bool taken[MAX_SIDE] = { false };
+		int counted = 0;
+		double total = 0.0;
+		bool valid = true;
+		for (int r = 0; r < rows; r++) {
+			const int c = row_to_col[r];
+			if (c < 0)
+				continue;
+			if (c >= cols || taken[c] || cost[r][c] == INFINITY)
+				valid = false;
+			else {
+				taken[c] = true;
+				total += cost[r][c];
+			}
+			counted++;
+		}
+		// ...with as many pairs as possible and the least cost among those
+		bool none[MAX_SIDE] = { false };
+		best b = { 0, 0.0 };
+		search(cost, rows, cols, 0, none, 0, 0.0, &b);
+		if (!valid || counted != pairs || pairs != b.pairs || fabs(total - b.cost) > 1e-3) {
+			printf("FAIL problem %d (%dx%d, %d edges): %d pairs cost %.1f%s, best %d pairs cost %.1f\n",
+			       problem, rows, cols, (int) edges.size(), pairs, total, valid ? "" : " (invalid)",
+			       b.pairs, b.cost);
+			if (++failures > 10)
+				break;
+		}
+	}
+	assign_solver_destroy(solver);
+
+	// Greedy fallback: still a valid matching
+	solver = assign_solver_create(3);
+	assign_edge edges[] = { { 0, 0, 1 }, { 0, 1, 2 }, { 1, 0, 2 }, { 1, 1, 5 }, { 2, 2, 1 } };
+	int row_to_col[3];
+	assign_stats stats;
+	const int pairs = assign_solve(solver, edges, 5, 3, 3, row_to_col, &stats);
+	if (pairs != 3 || row_to_col[0] != 0 || row_to_col[1] != 1 || row_to_col[2] != 2 ||
+	    stats.components != 2 || stats.greedy != 1) {
+		printf("FAIL greedy: %d pairs, %d components, %d greedy\n", pairs, stats.components, stats.greedy);
+		failures++;
+	}
+	assign_solver_destroy(solver);
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
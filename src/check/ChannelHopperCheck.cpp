@@ -0,0 +1,142 @@
+//============================================================================
+// Name        : ChannelHopperCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks the channel hopper's requests and its shares of the
+//               cycle on simulated channels of known traffic, with some of
+//               the switches failing. Build with
+//               g++ -O2 ChannelHopperCheck.cpp ../ChannelHopper.cpp ../Nl80211Messages.cpp
+//============================================================================
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../ChannelHopper.h"
+#include "../nl80211.h"
+
+#define FAMILY 28
+#define IFINDEX 3
+#define CHANNELS 5
+#define SECONDS 20
+
+static int failures = 0;
+
+static void fail(const char *what)
+{
+	printf("FAIL %s\n", what);
+	failures++;
+}
+
+// A SET_CHANNEL request of the interface to the frequency
+static bool is_hop(const struct nlmsghdr *msg, uint32_t frequency)
+{
+	const struct nlattr *tb[NL80211_ATTR_WIPHY_CHANNEL_TYPE + 1];
+	if (!msg || msg->nlmsg_type != FAMILY || rnl_genl_cmd(msg) != NL80211_CMD_SET_CHANNEL ||
+	    !(msg->nlmsg_flags & NLM_F_ACK) || !rnl_parse_genl(msg, tb, NL80211_ATTR_WIPHY_CHANNEL_TYPE))
+		return false;
+	return tb[NL80211_ATTR_IFINDEX] && rnl_get_u32(tb[NL80211_ATTR_IFINDEX]) == IFINDEX &&
+	       tb[NL80211_ATTR_WIPHY_FREQ] && rnl_get_u32(tb[NL80211_ATTR_WIPHY_FREQ]) == frequency &&
+	       tb[NL80211_ATTR_WIPHY_CHANNEL_TYPE] &&
+	       rnl_get_u32(tb[NL80211_ATTR_WIPHY_CHANNEL_TYPE]) == NL80211_CHAN_HT20;
+}
+
+int main()
+{
+	srand(2);
+	ch_config c;
+	ch_default_config(&c);
+	const uint32_t freqs[CHANNELS] = { 2412, 2437, 2462, 5180, 5200 };
+	// Frames per second on each channel, and of them from tracked targets
+	const double rate[CHANNELS] = { 2000, 300, 50, 0, 800 };
+	const double target_rate[CHANNELS] = { 0, 20, 0, 0, 0 };
+	channel_hopper *hopper = ch_create(&c, FAMILY, IFINDEX, freqs, CHANNELS);
+
+	// The first call hops to the first channel, and nothing more happens
+	// until the switch is done
+	uint64_t now_us = 0;
+	if (!is_hop(ch_next(hopper, now_us), freqs[0]))
+		fail("first request");
+	if (ch_next(hopper, now_us + 1000000) || ch_deadline(hopper) != UINT64_MAX || ch_current(hopper))
+		fail("hopped while switching");
+	now_us += 3000;
+	ch_switched(hopper, now_us, 0);
+	if (ch_current(hopper) != freqs[0] || ch_deadline(hopper) <= now_us || ch_next(hopper, now_us))
+		fail("dwell");
+
+	// 1 ms steps. The channel heard is the one hopped to, in order, and a
+	// failed switch hears nothing until the next hop
+	uint32_t expect = 1, hops = 1, injected = 0;
+	uint64_t heard = 0;
+	for (int step = 0; step < SECONDS * 1000; step++) {
+		now_us += 1000;
+		const uint32_t current = ch_current(hopper);
+		for (int i = 0; i < CHANNELS; i++)
+			if (freqs[i] == current) {
+				const double mean = rate[i] / 1000;
+				const uint32_t frames = (uint32_t) mean + (rand() % 1000 < 1000 * (mean - (int) mean));
+				const uint32_t targets = rand() % 1000 < 1000 * target_rate[i] / 1000;
+				ch_heard(hopper, frames, targets);
+				heard += frames;
+			}
+		const struct nlmsghdr *msg = ch_next(hopper, now_us);
+		if (!msg)
+			continue;
+		if (!is_hop(msg, freqs[expect])) {
+			fail("request out of order");
+			break;
+		}
+		expect = (expect + 1) % CHANNELS;
+		hops++;
+		now_us += 2000 + rand() % 2000;
+		const int error = rand() % 20 ? 0 : -EBUSY;
+		ch_switched(hopper, now_us, error);
+		if (error) {
+			injected++;
+			if (ch_current(hopper))
+				fail("listening after a failed switch");
+			ch_heard(hopper, 100, 0);
+		}
+	}
+
+	// Each channel's share is its even part of the explored share plus the
+	// rest by its frames and the weighted frames of targets, and the time
+	// spent listening follows the shares
+	double total = 0.0, shares = 0.0, coverage = 0.0;
+	for (int i = 0; i < CHANNELS; i++)
+		total += rate[i] + c.target_weight * target_rate[i];
+	ch_channel_stats channels[CHANNELS];
+	ch_stats stats;
+	ch_get_stats(hopper, &stats);
+	if (ch_get_channel_stats(hopper, channels, CHANNELS) != CHANNELS)
+		fail("channel stats");
+	uint64_t frames = 0;
+	for (int i = 0; i < CHANNELS; i++) {
+		const ch_channel_stats *ch = &channels[i];
+		const double share = c.explore / CHANNELS + (1.0 - c.explore) * (rate[i] + c.target_weight * target_rate[i]) / total;
+		if (ch->frequency != freqs[i] || fabs(ch->share - share) > 0.02 || fabs(ch->coverage - share) > 0.05 ||
+		    ch->visits < SECONDS * 3 / 4) {
+			printf("FAIL %u MHz: share %.3f (expected %.3f), coverage %.3f, %lu visits\n", ch->frequency,
+			       ch->share, share, ch->coverage, (unsigned long) ch->visits);
+			failures++;
+		}
+		shares += ch->share;
+		coverage += ch->coverage;
+		frames += ch->frames;
+	}
+	const double switching = (double) stats.switch_us / (stats.dwell_us + stats.switch_us);
+	if (fabs(shares - 1.0) > 1e-3 || fabs(coverage + switching - 1.0) > 1e-3)
+		fail("shares and coverage don't add up");
+	if (channels[3].dwell_us < channels[3].visits * c.min_dwell_us - c.min_dwell_us)
+		fail("quiet channel dwelled less than min_dwell_us");
+	if (stats.failures != injected || !injected || stats.frames != heard || frames != heard ||
+	    stats.hops != hops || hops < SECONDS * CHANNELS * 9 / 10) {
+		printf("FAIL stats: %lu hops, %lu failures (%u), %lu frames (%lu)\n", (unsigned long) stats.hops,
+		       (unsigned long) stats.failures, injected, (unsigned long) stats.frames, (unsigned long) heard);
+		failures++;
+	}
+	ch_destroy(hopper);
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+//============================================================================
+// Name        : ClockAlignCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks the clock alignment on simulated scan results of two
+//               access points with drifting TSF clocks, one of which
+//               reboots part way. Build with
+//               g++ -O2 ClockAlignCheck.cpp ../ClockAlign.cpp
+//============================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../ClockAlign.h"
+
+#define QUIET_AP 0x112233445566ULL
+#define NOISY_AP 0x0a0b0c0d0e0fULL
+#define SCANS 600
+#define REBOOT 400         // scan at which the quiet AP reboots
+
+static int failures = 0;
+
+static void fail(const char *what)
+{
+	printf("FAIL %s\n", what);
+	failures++;
+}
+
+struct access_point {
+	mac_key bssid;
+	double tsf_base;       // TSF at local time 0
+	double drift;
+	uint32_t jitter_us;    // when the TSF is stamped against when it is heard
+};
+
+// The TSF the AP stamped on a frame received at local time rx_us
+static uint64_t tsf_at(const access_point *ap, uint64_t rx_us)
+{
+	return (uint64_t) (ap->tsf_base + rx_us * (1.0 + ap->drift));
+}
+
+static bool observe(clock_align *align, const access_point *ap, uint64_t read_us)
+{
+	// Heard up to 3 s before the scan is read, its age rounded down to the
+	// millisecond like the kernel does
+	const uint64_t rx_us = read_us - rand() % 3000000;
+	rnl80211_bss bss;
+	memset(&bss, 0, sizeof(bss));
+	bss.bssid = ap->bssid;
+	bss.tsf = tsf_at(ap, rx_us) + (ap->jitter_us ? rand() % ap->jitter_us : 0);
+	bss.seen_ms_ago = (uint32_t) ((read_us - rx_us) / 1000);
+	return ca_observe(align, &bss, read_us);
+}
+
+int main()
+{
+	srand(1);
+	ca_config c;
+	ca_default_config(&c);
+	clock_align *align = ca_create(&c);
+
+	access_point quiet = { QUIET_AP, 5e12, 30e-6, 0 };
+	access_point noisy = { NOISY_AP, 7e11, -12e-6, 2000 };
+	uint64_t local_us = 1000000000ULL;
+	ca_mapping map;
+	for (int scan = 0; scan < SCANS; scan++) {
+		local_us += 1000000 + rand() % 100000;
+		if (scan == REBOOT)
+			quiet.tsf_base -= 4e12;
+		observe(align, &quiet, local_us);
+		observe(align, &noisy, local_us);
+		if (scan == (int) c.min_points - 2 && ca_get_mapping(align, 0, &map))
+			fail("mapping before min_points");
+	}
+
+	// The scan of the same beacon again is skipped
+	rnl80211_bss bss;
+	memset(&bss, 0, sizeof(bss));
+	bss.bssid = QUIET_AP;
+	bss.tsf = tsf_at(&quiet, local_us);
+	ca_observe(align, &bss, local_us);
+	if (ca_observe(align, &bss, local_us + 1000000))
+		fail("same TSF observed twice");
+
+	ca_estimate e;
+	if (!ca_get(align, QUIET_AP, &e) || fabs(e.drift_ppm - 30.0) > 0.5 || e.resets != 1 ||
+	    e.points != SCANS - REBOOT + 1 || e.residual_us > 400.0) {
+		printf("FAIL quiet AP: drift %.3f ppm, residual %.1f us, %u points, %u resets\n",
+		       e.drift_ppm, e.residual_us, e.points, e.resets);
+		failures++;
+	}
+	if (!ca_get(align, NOISY_AP, &e) || fabs(e.drift_ppm + 12.0) > 5.0 || e.resets) {
+		printf("FAIL noisy AP: drift %.3f ppm, %u resets\n", e.drift_ppm, e.resets);
+		failures++;
+	}
+
+	// The tightest fit is the quiet AP's, and it maps local time onto its
+	// TSF since the reboot to well within a millisecond over +-100 s
+	if (!ca_get_mapping(align, 0, &map) || map.bssid != QUIET_AP)
+		fail("tightest mapping");
+	double worst = 0.0;
+	for (uint64_t t = local_us - 100000000; t < local_us + 100000000; t += 999983) {
+		const double error = (double) (int64_t) (ca_to_tsf(&map, t) - tsf_at(&quiet, t));
+		if (fabs(error) > worst)
+			worst = fabs(error);
+	}
+	if (worst > 100.0) {
+		printf("FAIL mapping off by up to %.1f us\n", worst);
+		failures++;
+	}
+	if (!ca_get_mapping(align, NOISY_AP, &map) || map.bssid != NOISY_AP)
+		fail("mapping of a given AP");
+
+	rl_sample samples[16];
+	for (int i = 0; i < 16; i++)
+		samples[i].timestamp_us = local_us + i * 123457;
+	ca_retime(&map, samples, 16);
+	for (int i = 0; i < 16; i++)
+		if (samples[i].timestamp_us != ca_to_tsf(&map, local_us + i * 123457)) {
+			fail("retime");
+			break;
+		}
+	ca_destroy(align);
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+//============================================================================
+// Name        : LikelihoodGridCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks lg_locate() maps against the path-loss model cell by
+//               cell, through recalibration, moves and walls. Build with
+//               g++ -O2 LikelihoodGridCheck.cpp ../LikelihoodGrid.cpp
+//                   ../WallModel.cpp ../WorkPool.cpp -lpthread
+//============================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "../LikelihoodGrid.h"
+#include "../WallModel.h"
+
+using namespace std;
+
+#define ANCHORS 6
+#define READINGS 4
+
+static int failures = 0;
+
+static float uniform(float lo, float hi)
+{
+	return lo + (hi - lo) * (rand() / (float) RAND_MAX);
+}
+
+// The map lg_locate() should produce, from the model alone
+static void expected_map(const lg_config *c, const anchor *anchors, const wall_model *walls,
+                         const lg_reading *readings, int cells_x, int cells_y, vector<float> *map)
+{
+	const float k = -0.5f / (c->rssi_sigma * c->rssi_sigma);
+	for (int y = 0; y < cells_y; y++)
+		for (int x = 0; x < cells_x; x++) {
+			const float px = c->min_x + (x + 0.5f) * c->cell_size, py = c->min_y + (y + 0.5f) * c->cell_size;
+			double score = 0.0;
+			for (int i = 0; i < READINGS; i++) {
+				const anchor *a = &anchors[readings[i].anchor_id];
+				float rssi = path_loss_rssi(a, px, py, c->anchor_height);
+				if (walls)
+					rssi -= wall_model_loss(walls, a->x, a->y, px, py);
+				const double d = readings[i].rssi - rssi;
+				score += k * d * d;
+			}
+			(*map)[(size_t) y * cells_x + x] = (float) score;
+		}
+}
+
+static void compare(const char *stage, lg_grid *grid, const lg_config *c, const anchor *anchors,
+                    const wall_model *walls)
+{
+	const int cells_x = lg_cells_x(grid), cells_y = lg_cells_y(grid);
+	vector<float> got((size_t) cells_x * cells_y), want(got.size());
+	for (int round = 0; round < 10; round++) {
+		lg_reading readings[READINGS];
+		for (int i = 0; i < READINGS; i++) {
+			readings[i].anchor_id = rand() % ANCHORS;
+			readings[i].rssi = uniform(-90, -40);
+		}
+		lg_fix fix;
+		if (!lg_locate(grid, readings, READINGS, &fix, &got[0])) {
+			printf("FAIL %s: no fix\n", stage);
+			failures++;
+			return;
+		}
+		expected_map(c, anchors, walls, readings, cells_x, cells_y, &want);
+		float best = -INFINITY;
+		for (size_t i = 0; i < got.size(); i++) {
+			best = got[i] > best ? got[i] : best;
+			if (fabsf(got[i] - want[i]) > 1e-3f * (1.0f + fabsf(want[i]))) {
+				printf("FAIL %s: cell %d,%d %.4f, model %.4f\n", stage, (int) (i % cells_x),
+				       (int) (i / cells_x), got[i], want[i]);
+				failures++;
+				return;
+			}
+		}
+		if (fix.log_likelihood != best) {
+			printf("FAIL %s: fix at %.4f, best cell %.4f\n", stage, fix.log_likelihood, best);
+			failures++;
+		}
+	}
+}
+
+int main()
+{
+	srand(1);
+	lg_config c;
+	c.min_x = -3.0f;
+	c.min_y = 2.0f;
+	c.max_x = 45.0f; // not a whole number of tiles
+	c.max_y = 31.0f;
+	c.cell_size = 0.5f;
+	c.anchor_height = 2.0f;
+	c.rssi_sigma = 4.0f;
+
+	anchor anchors[ANCHORS];
+	for (int i = 0; i < ANCHORS; i++) {
+		anchors[i].x = uniform(c.min_x, c.max_x);
+		anchors[i].y = uniform(c.min_y, c.max_y);
+		anchors[i].model.ref_power = uniform(-45, -30);
+		anchors[i].model.exponent = uniform(2, 4);
+	}
+	lg_grid *grid = lg_create(&c, anchors, ANCHORS);
+	compare("fresh", grid, &c, anchors, NULL);
+
+	// Reference power only: tiles are shifted, not recomputed
+	lg_stats before, after;
+	lg_get_stats(grid, &before);
+	for (int i = 0; i < ANCHORS; i++) {
+		anchors[i].model.ref_power += uniform(-3, 3);
+		lg_set_anchor(grid, i, &anchors[i]);
+	}
+	compare("ref power", grid, &c, anchors, NULL);
+	lg_get_stats(grid, &after);
+	if (after.tiles_shifted == before.tiles_shifted || after.tiles_computed != before.tiles_computed) {
+		printf("FAIL ref power: %llu tiles recomputed, %llu shifted\n",
+		       (unsigned long long) (after.tiles_computed - before.tiles_computed),
+		       (unsigned long long) (after.tiles_shifted - before.tiles_shifted));
+		failures++;
+	}
+
+	for (int i = 0; i < ANCHORS; i++) {
+		anchors[i].model.exponent = uniform(2, 4);
+		anchors[i].x += uniform(-2, 2);
+		lg_set_anchor(grid, i, &anchors[i]);
+	}
+	compare("exponent and move", grid, &c, anchors, NULL);
+
+	wall_segment walls[40];
+	for (int i = 0; i < 40; i++) {
+		walls[i].x1 = uniform(c.min_x, c.max_x);
+		walls[i].y1 = uniform(c.min_y, c.max_y);
+		walls[i].x2 = walls[i].x1 + uniform(-8, 8);
+		walls[i].y2 = walls[i].y1 + uniform(-8, 8);
+		walls[i].attenuation = uniform(2, 12);
+	}
+	wall_model *model = wall_model_create(walls, 40);
+	lg_set_walls(grid, model, NULL);
+	lg_refresh_all(grid);
+	compare("walls", grid, &c, anchors, model);
+	for (int i = 0; i < ANCHORS; i++) {
+		anchors[i].model.ref_power += uniform(-3, 3);
+		lg_set_anchor(grid, i, &anchors[i]);
+	}
+	compare("walls, ref power", grid, &c, anchors, model);
+	lg_set_walls(grid, NULL, NULL);
+	compare("walls removed", grid, &c, anchors, NULL);
+
+	lg_destroy(grid);
+	wall_model_destroy(model);
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+//============================================================================
+// Name        : MotionDetectorCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks the hysteresis of the motion detector: a state
+//               needs hold_samples in a row to take over, rates between
+//               the two thresholds keep the current state, and presence
+//               changes at once. Samples without a signal must not move
+//               the statistics. Build with
+//               g++ -O2 MotionDetectorCheck.cpp ../MotionDetector.cpp
+//============================================================================
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "../MotionDetector.h"
+
+using namespace std;
+
+// Samples this far apart with a much shorter tau_us leave the smoothed
+// signal at the last reading, its variance at 0 and its rate at the step
+// over 2 s
+#define STEP_US 2000000
+
+static int failures = 0;
+
+static void fail(const char *what, int step)
+{
+	printf("FAIL %s at step %d\n", what, step);
+	failures++;
+}
+
+static vector<md_event> events;
+
+static void on_event(void *, const struct md_event *event)
+{
+	events.push_back(*event);
+}
+
+static void config(md_config *c, uint32_t hold_samples)
+{
+	md_default_config(c);
+	c->tau_us = 100000;
+	c->hold_samples = hold_samples;
+}
+
+static md_state update(motion_detector *detector, mac_key mac, uint64_t timestamp_us, int8_t signal,
+                       uint32_t inactive_ms = 0)
+{
+	rl_sample sample;
+	memset(&sample, 0, sizeof(sample));
+	sample.mac = mac;
+	sample.ifindex = 3;
+	sample.timestamp_us = timestamp_us;
+	sample.signal = signal;
+	sample.inactive_ms = inactive_ms;
+	return md_update(detector, &sample);
+}
+
+static void hysteresis()
+{
+	md_config c;
+	config(&c, 3);
+	motion_detector *detector = md_create(&c, on_event, NULL);
+	events.clear();
+
+	// Rates of 3 dB/s (> moving_rate), 1.5 (between the thresholds) and 0
+	// (< still_rate)
+	static const struct {
+		int8_t signal;
+		md_state want;
+	} steps[] = {
+		{ -50, MD_STATIONARY },    // heard: at once
+		{ -50, MD_STATIONARY },
+		{ -44, MD_STATIONARY },    // moving for 1 sample
+		{ -38, MD_STATIONARY },    // 2
+		{ -38, MD_STATIONARY },    // still again: starts over
+		{ -32, MD_STATIONARY },
+		{ -26, MD_STATIONARY },
+		{ -20, MD_MOVING },        // 3 in a row
+		{ -17, MD_MOVING },        // not slow enough to stop
+		{ -17, MD_MOVING },
+		{ -17, MD_MOVING },
+		{ -17, MD_STATIONARY },    // 3 still in a row
+		{ -14, MD_STATIONARY },    // not fast enough to move
+		{ -17, MD_STATIONARY },
+	};
+	const int n = sizeof(steps) / sizeof(steps[0]);
+	for (int i = 0; i < n; i++)
+		if (update(detector, 1, (uint64_t) i * STEP_US, steps[i].signal) != steps[i].want)
+			fail("hysteresis", i);
+	if (events.size() != 3 || events[0].from != MD_ABSENT || events[1].to != MD_MOVING ||
+	    events[1].timestamp_us != 7ULL * STEP_US || events[2].to != MD_STATIONARY || events[2].rate >= c.still_rate)
+		fail("hysteresis events", n);
+
+	// Idle and back, both at once and whatever the signal says
+	if (update(detector, 1, (uint64_t) n * STEP_US, 0, c.idle_ms) != MD_ABSENT)
+		fail("idle", n);
+	if (update(detector, 1, (uint64_t) (n + 1) * STEP_US, -17) != MD_STATIONARY || events.size() != 5)
+		fail("back from idle", n + 1);
+
+	// Not sampled: absent, then forgotten
+	const uint64_t last_us = (uint64_t) (n + 1) * STEP_US;
+	md_stats stats;
+	if (md_tick(detector, last_us + c.absent_after_us) != 0 || md_tick(detector, last_us + c.absent_after_us + 1) != 1 ||
+	    md_get(detector, 1) != MD_ABSENT)
+		fail("absent", n + 2);
+	md_tick(detector, last_us + c.forget_after_us + 1);
+	md_get_stats(detector, &stats);
+	if (stats.stations != 0)
+		fail("forget", n + 3);
+	md_destroy(detector);
+}
+
+static void without_signal()
+{
+	md_config c;
+	config(&c, 1);
+	motion_detector *detector = md_create(&c, on_event, NULL);
+
+	// Heard first without a signal: the first reading is no change from 0
+	update(detector, 1, 0, 0);
+	if (update(detector, 1, STEP_US, -50) != MD_STATIONARY || update(detector, 1, 2 * STEP_US, -50) != MD_STATIONARY)
+		fail("first sample without a signal", 1);
+
+	// 3 dB over 2 s is slow, however many samples without a signal came
+	// in between
+	update(detector, 2, 0, -50);
+	if (update(detector, 2, STEP_US / 2, 0) != MD_STATIONARY || update(detector, 2, STEP_US, -53) != MD_STATIONARY)
+		fail("sample without a signal in between", 2);
+	md_destroy(detector);
+}
+
+int main()
+{
+	hysteresis();
+	without_signal();
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
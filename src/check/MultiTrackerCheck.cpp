@@ -0,0 +1,140 @@
+//============================================================================
+// Name        : MultiTrackerCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Runs the multi-target tracker on simulated walkers with
+//               missed detections and clutter, and checks that every walker
+//               keeps one confirmed track close by. Build with
+//               g++ -O2 MultiTrackerCheck.cpp ../MultiTracker.cpp ../Assignment.cpp
+//============================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "../MultiTracker.h"
+
+using namespace std;
+
+#define WALKERS 20
+#define CYCLES 400
+#define CYCLE_US 500000
+#define SITE 100.0f
+#define FIX_SIGMA 1.0f
+#define DETECTION 0.9f
+#define CLUTTER 1
+
+static float uniform(float lo, float hi)
+{
+	return lo + (hi - lo) * (rand() / (float) RAND_MAX);
+}
+
+static float normal()
+{
+	float sum = 0.0f;
+	for (int i = 0; i < 12; i++)
+		sum += uniform(0, 1);
+	return sum - 6.0f;
+}
+
+// Walk at a steady 1 m/s, turning slowly and at random
+struct walker {
+	float x, y, heading;
+	uint32_t track;        // nearest confirmed track last cycle
+};
+
+int main()
+{
+	srand(1);
+	mtt_config config;
+	mtt_default_config(&config);
+	mtt_tracker *tracker = mtt_create(&config);
+
+	walker walkers[WALKERS];
+	for (int i = 0; i < WALKERS; i++) {
+		walkers[i].x = uniform(0, SITE);
+		walkers[i].y = uniform(0, SITE);
+		walkers[i].heading = uniform(0, 2 * (float) M_PI);
+		walkers[i].track = 0;
+	}
+
+	int lost = 0, switches = 0, excess = 0, worst_excess = 0;
+	double error_sum = 0.0;
+	int error_count = 0;
+	for (int cycle = 0; cycle < CYCLES; cycle++) {
+		const float dt = CYCLE_US * 1e-6f;
+		vector<mtt_observation> obs;
+		for (int i = 0; i < WALKERS; i++) {
+			walker *w = &walkers[i];
+			w->heading += 0.2f * normal() * dt;
+			w->x += cosf(w->heading) * dt;
+			w->y += sinf(w->heading) * dt;
+			// Turning back at the edge of the site is abrupt, and may
+			// cost the walker its track now and then
+			if (w->x < 0 || w->x > SITE)
+				w->heading = (float) M_PI - w->heading;
+			if (w->y < 0 || w->y > SITE)
+				w->heading = -w->heading;
+			if (uniform(0, 1) < DETECTION) {
+				mtt_observation o = { w->x + FIX_SIGMA * normal(), w->y + FIX_SIGMA * normal(), FIX_SIGMA, 0 };
+				obs.push_back(o);
+			}
+		}
+		for (int i = 0; i < CLUTTER; i++) {
+			mtt_observation o = { uniform(0, SITE), uniform(0, SITE), FIX_SIGMA, 0 };
+			obs.push_back(o);
+		}
+		mtt_update(tracker, &obs[0], (int) obs.size(), (uint64_t) (cycle + 1) * CYCLE_US, NULL);
+
+		// Judged once the tracks had time to confirm
+		if (cycle < 20)
+			continue;
+		int confirmed = 0;
+		for (int t = 0; t < mtt_track_count(tracker); t++) {
+			mtt_track track;
+			mtt_get_track(tracker, t, &track);
+			confirmed += track.confirmed;
+		}
+		excess += confirmed > WALKERS ? confirmed - WALKERS : 0;
+		worst_excess = confirmed - WALKERS > worst_excess ? confirmed - WALKERS : worst_excess;
+		for (int i = 0; i < WALKERS; i++) {
+			walker *w = &walkers[i];
+			float nearest = INFINITY;
+			uint32_t id = 0;
+			for (int t = 0; t < mtt_track_count(tracker); t++) {
+				mtt_track track;
+				mtt_get_track(tracker, t, &track);
+				const float d = hypotf(track.x - w->x, track.y - w->y);
+				if (track.confirmed && d < nearest) {
+					nearest = d;
+					id = track.id;
+				}
+			}
+			if (nearest > 3 * FIX_SIGMA) {
+				lost++;
+				continue;
+			}
+			error_sum += nearest;
+			error_count++;
+			if (w->track && id != w->track)
+				switches++;
+			w->track = id;
+		}
+	}
+	mtt_destroy(tracker);
+
+	const int judged = (CYCLES - 20) * WALKERS;
+	printf("%d of %d walker-cycles without a track, %d track switches, mean error %.2f m, "
+	       "%.2f excess confirmed tracks per cycle (worst %d)\n", lost, judged, switches,
+	       error_sum / error_count, (double) excess / (CYCLES - 20), worst_excess);
+	// Walkers cross paths and bounce off the edges, and a clutter fix now
+	// and then starts a short-lived track: allow a switch per walker every
+	// half minute, a few gaps and about one spare track. Runs with other
+	// seeds stay within these by a margin
+	const double walker_seconds = judged * (CYCLE_US * 1e-6);
+	const bool ok = lost < judged / 200 && switches * 30.0 < walker_seconds &&
+	                error_sum / error_count < FIX_SIGMA && excess < 1.5 * (CYCLES - 20) && worst_excess <= 6;
+	printf("%s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+//============================================================================
+// Name        : NetlinkConnCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks the receive path of NetlinkConn on synthetic reply
+//               datagrams: multipart dumps of thousands of entries, dumps
+//               interrupted part way (NLM_F_DUMP_INTR), refused ones
+//               (EBUSY) and receive queue overruns (ENOBUFS). Nothing is
+//               sent; the socket only provides the port. Build with
+//               g++ -O2 NetlinkConnCheck.cpp ../NetlinkConn.cpp
+//============================================================================
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <vector>
+
+#include "../NetlinkConn.h"
+
+using namespace std;
+
+#define FAMILY 28
+#define CMD 5
+#define PER_DATAGRAM 40    // entries
+
+static int failures = 0;
+static uint32_t port;
+
+static void fail(const char *what)
+{
+	printf("FAIL %s\n", what);
+	failures++;
+}
+
+// What a request got back
+struct reply {
+	vector<uint32_t> entries;
+	int restarts;          // on_message(NULL)
+	int done;
+	int error;
+};
+
+static void on_entry(void *arg, const struct nlmsghdr *hdr)
+{
+	reply *r = (reply*) arg;
+	if (!hdr) {
+		r->restarts++;
+		r->entries.clear();
+		return;
+	}
+	uint32_t entry;
+	memcpy(&entry, (const uint8_t*) NLMSG_DATA(hdr) + GENL_HDRLEN, sizeof(entry));
+	r->entries.push_back(entry);
+}
+
+static void on_done(void *arg, int error)
+{
+	reply *r = (reply*) arg;
+	r->done++;
+	r->error = error;
+}
+
+static int notified_lost = 0;
+
+static void on_notify(void *, const struct nlmsghdr *hdr)
+{
+	if (!hdr)
+		notified_lost++;
+}
+
+static void put(vector<uint8_t> *datagram, uint16_t type, uint16_t flags, uint32_t seq, const void *payload, size_t len)
+{
+	const size_t start = datagram->size();
+	datagram->resize(start + NLMSG_SPACE(len));
+	struct nlmsghdr *hdr = (struct nlmsghdr*) &(*datagram)[start];
+	memset(hdr, 0, NLMSG_SPACE(len));
+	hdr->nlmsg_len = NLMSG_LENGTH(len);
+	hdr->nlmsg_type = type;
+	hdr->nlmsg_flags = flags;
+	hdr->nlmsg_seq = seq;
+	hdr->nlmsg_pid = port;
+	memcpy(NLMSG_DATA(hdr), payload, len);
+}
+
+static void put_entry(vector<uint8_t> *datagram, uint32_t seq, uint32_t entry, bool interrupted)
+{
+	uint8_t payload[GENL_HDRLEN + sizeof(entry)];
+	memset(payload, 0, GENL_HDRLEN);
+	payload[0] = CMD;
+	memcpy(payload + GENL_HDRLEN, &entry, sizeof(entry));
+	put(datagram, FAMILY, NLM_F_MULTI | (interrupted ? NLM_F_DUMP_INTR : 0), seq, payload, sizeof(payload));
+}
+
+static void put_done(vector<uint8_t> *datagram, uint32_t seq, int error, bool interrupted)
+{
+	put(datagram, NLMSG_DONE, NLM_F_MULTI | (interrupted ? NLM_F_DUMP_INTR : 0), seq, &error, sizeof(error));
+}
+
+static void put_ack(vector<uint8_t> *datagram, uint32_t seq, int error)
+{
+	struct nlmsgerr err;
+	memset(&err, 0, sizeof(err));
+	err.error = error;
+	err.msg.nlmsg_seq = seq;
+	put(datagram, NLMSG_ERROR, 0, seq, &err, sizeof(err));
+}
+
+// A dump of count entries, PER_DATAGRAM to a datagram like the kernel
+// sends them, NLMSG_DONE in the last one. interrupt_at flags that entry
+// and everything after it. Returns the number of datagrams
+static int deliver_dump(rnl_conn *conn, uint32_t seq, uint32_t count, uint32_t interrupt_at = UINT32_MAX)
+{
+	int datagrams = 0;
+	for (uint32_t first = 0; first <= count; first += PER_DATAGRAM) {
+		vector<uint8_t> datagram;
+		for (uint32_t i = first; i < count && i < first + PER_DATAGRAM; i++)
+			put_entry(&datagram, seq, i, i >= interrupt_at);
+		if (first + PER_DATAGRAM > count)
+			put_done(&datagram, seq, 0, count >= interrupt_at);
+		rnl_conn_dispatch(conn, datagram.data(), datagram.size());
+		datagrams++;
+	}
+	return datagrams;
+}
+
+static uint32_t submit(rnl_conn *conn, bool dump, reply *r)
+{
+	uint8_t storage[64];
+	rnl_buffer buf;
+	rnl_buffer_init(&buf, storage, sizeof(storage));
+	const rnl_msg msg = rnl_begin_genl(&buf, FAMILY, NLM_F_REQUEST | (dump ? NLM_F_DUMP : 0), 0, CMD, 1);
+	r->entries.clear();
+	r->restarts = r->done = r->error = 0;
+	return rnl_conn_submit(conn, rnl_header(&buf, msg), on_entry, on_done, r);
+}
+
+// The requests take_output() hands over, by sequence number
+static vector<uint32_t> sent(rnl_conn *conn)
+{
+	static uint8_t tx[RNL_SEND_BUFFER];
+	vector<uint32_t> seqs;
+	int len = (int) rnl_conn_take_output(conn, tx);
+	for (const struct nlmsghdr *hdr = (const struct nlmsghdr*) tx; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len))
+		seqs.push_back(hdr->nlmsg_seq);
+	return seqs;
+}
+
+static bool complete(const reply *r, uint32_t count)
+{
+	if (r->done != 1 || r->error || r->entries.size() != count)
+		return false;
+	for (uint32_t i = 0; i < count; i++)
+		if (r->entries[i] != i)
+			return false;
+	return true;
+}
+
+int main()
+{
+	rnl_conn *conn = rnl_conn_open(NETLINK_GENERIC);
+	if (!conn) {
+		printf("FAILED\n");
+		return 1;
+	}
+	struct sockaddr_nl local;
+	socklen_t addrlen = sizeof(local);
+	getsockname(rnl_conn_fd(conn), (struct sockaddr*) &local, &addrlen);
+	port = local.nl_pid;
+	rnl_conn_set_notify(conn, on_notify, NULL);
+	rnl_conn_stats stats;
+
+	// More than a thousand entries over many datagrams, each one counted
+	// once for the dump's recv count
+	reply big;
+	uint32_t seq = submit(conn, true, &big);
+	if (sent(conn) != vector<uint32_t>(1, seq))
+		fail("dump request");
+	const int datagrams = deliver_dump(conn, seq, 1500);
+	rnl_conn_get_stats(conn, &stats);
+	if (!complete(&big, 1500) || big.restarts)
+		fail("large dump");
+	if (stats.dumps != 1 || stats.dump_datagrams != (uint64_t) datagrams || stats.max_dump_datagrams != (uint64_t) datagrams ||
+	    stats.messages != 1500 || rnl_conn_pending(conn)) {
+		printf("FAIL large dump stats: %llu dumps, %llu datagrams (%d)\n", (unsigned long long) stats.dumps,
+		       (unsigned long long) stats.dump_datagrams, datagrams);
+		failures++;
+	}
+
+	// Interrupted part way: the caller is told to drop what it has, the
+	// same request goes out again, and the second run is what it keeps.
+	// Both runs' datagrams count for the dump
+	reply intr;
+	seq = submit(conn, true, &intr);
+	sent(conn);
+	int intr_datagrams = deliver_dump(conn, seq, 1200, 700);
+	if (intr.done || intr.restarts != 1 || !intr.entries.empty())
+		fail("interrupted dump not restarted");
+	if (sent(conn) != vector<uint32_t>(1, seq))
+		fail("interrupted dump not resent");
+	intr_datagrams += deliver_dump(conn, seq, 1200);
+	rnl_conn_get_stats(conn, &stats);
+	if (!complete(&intr, 1200) || intr.restarts != 1 || stats.dumps_restarted != 1 ||
+	    stats.dump_datagrams != (uint64_t) (datagrams + intr_datagrams) ||
+	    stats.max_dump_datagrams != (uint64_t) intr_datagrams)
+		fail("restarted dump");
+
+	// Interrupted every time: EINTR after RNL_MAX_RESTARTS
+	seq = submit(conn, true, &intr);
+	sent(conn);
+	for (int run = 0; run <= RNL_MAX_RESTARTS; run++) {
+		deliver_dump(conn, seq, 100, 50);
+		if (run < RNL_MAX_RESTARTS && sent(conn) != vector<uint32_t>(1, seq))
+			fail("interrupted dump not resent");
+	}
+	if (intr.done != 1 || intr.error != -EINTR || intr.restarts != RNL_MAX_RESTARTS || !sent(conn).empty())
+		fail("dump interrupted past RNL_MAX_RESTARTS");
+
+	// A second dump is refused while the first runs, and resent once it
+	// is done
+	reply first, second;
+	const uint32_t first_seq = submit(conn, true, &first), second_seq = submit(conn, true, &second);
+	sent(conn);
+	vector<uint8_t> refusal;
+	put_ack(&refusal, second_seq, -EBUSY);
+	rnl_conn_dispatch(conn, refusal.data(), refusal.size());
+	if (second.done || !sent(conn).empty())
+		fail("refused dump resent while another runs");
+	deliver_dump(conn, first_seq, 10);
+	if (sent(conn) != vector<uint32_t>(1, second_seq))
+		fail("refused dump not resent");
+	deliver_dump(conn, second_seq, 20);
+	if (!complete(&first, 10) || !complete(&second, 20))
+		fail("refused dump");
+
+	// An overrun in the middle of a dump: the two gets in flight fail,
+	// their acks may have been lost, while the dump goes on and completes
+	reply dump, get1, get2;
+	seq = submit(conn, true, &dump);
+	const uint32_t get1_seq = submit(conn, false, &get1);
+	submit(conn, false, &get2);
+	sent(conn);
+	vector<uint8_t> part;
+	for (uint32_t i = 0; i < 500; i++)
+		put_entry(&part, seq, i, false);
+	put_ack(&part, get1_seq, 0);
+	rnl_conn_dispatch(conn, part.data(), part.size());
+	if (get1.done != 1 || get1.error || rnl_conn_read_error(conn, -ENOBUFS) || get2.done != 1 ||
+	    get2.error != -ENOBUFS || dump.done || notified_lost != 1)
+		fail("overrun");
+	part.clear();
+	for (uint32_t i = 500; i < 1100; i++)
+		put_entry(&part, seq, i, false);
+	put_done(&part, seq, 0, false);
+	rnl_conn_dispatch(conn, part.data(), part.size());
+	rnl_conn_get_stats(conn, &stats);
+	if (!complete(&dump, 1100) || stats.overruns != 1 || rnl_conn_pending(conn))
+		fail("dump through an overrun");
+	if (rnl_conn_read_error(conn, -EIO) != -EIO)
+		fail("other read errors");
+
+	// Replies to requests that are done, and others' messages
+	vector<uint8_t> stray;
+	put_entry(&stray, seq, 0, false);
+	put(&stray, FAMILY, 0, 0, "x", 1);
+	rnl_conn_dispatch(conn, stray.data(), stray.size());
+	rnl_conn_get_stats(conn, &stats);
+	if (stats.unexpected != 1 || stats.notifications != 1)
+		fail("stray messages");
+	rnl_conn_close(conn);
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+//============================================================================
+// Name        : NetlinkIoBench.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Counts the syscalls per cycle of the epoll and io_uring
+//               backends. A cycle is two family lookups and a dump of
+//               every family from nlctrl, which needs no wireless hardware,
+//               plus a line of output; paced cycles also wait for a 1 ms
+//               tick, from the ring's timerfd on io_uring. Build with
+//               g++ -O2 NetlinkIoBench.cpp ../NetlinkIo.cpp ../NetlinkConn.cpp ../Nl80211Messages.cpp
+//               and run with the number of cycles (default 20000)
+//============================================================================
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../NetlinkIo.h"
+#include "../Nl80211Messages.h"
+#include "../Sample.h"
+
+#define PERIOD_US 1000
+
+static int failures = 0;
+
+struct bench {
+	int done;
+	int errors;
+	uint64_t families;     // dumped
+	bool ticked;
+};
+
+static void on_family(void *arg, const struct nlmsghdr *hdr)
+{
+	if (hdr)
+		((bench*) arg)->families++;
+}
+
+static void on_done(void *arg, int error)
+{
+	bench *b = (bench*) arg;
+	b->done++;
+	b->errors += error != 0;
+}
+
+static void on_tick(void *arg, uint64_t)
+{
+	((bench*) arg)->ticked = true;
+}
+
+static void run(bool uring, bool paced, int cycles, int out_fd)
+{
+	bench b = { 0, 0, 0, false };
+	rnl_conn *conn = rnl_conn_open(NETLINK_GENERIC);
+	rnl_io_config config;
+	rnl_io_default_config(&config);
+	config.use_uring = uring;
+	config.on_timer = on_tick;
+	config.arg = &b;
+	config.output_fd = out_fd;
+	rnl_io *io = conn ? rnl_io_create(conn, &config) : NULL;
+	if (!io || (rnl_io_get_backend(io) == RNL_IO_URING) != uring) {
+		printf("%s unavailable\n", uring ? "io_uring" : "epoll");
+		rnl_io_destroy(io);
+		rnl_conn_close(conn);
+		return;
+	}
+
+	uint8_t storage[3][RNL_MAX_REQUEST];
+	const nlmsghdr *requests[3];
+	for (int i = 0; i < 3; i++) {
+		rnl_buffer buf;
+		rnl_buffer_init(&buf, storage[i], sizeof(storage[i]));
+		const rnl_msg msg = i < 2 ? rnl_get_family(&buf, 0, "nlctrl")
+		                          : rnl_begin_genl(&buf, GENL_ID_CTRL, NLM_F_REQUEST | NLM_F_DUMP, 0, CTRL_CMD_GETFAMILY, 1);
+		requests[i] = rnl_header(&buf, msg);
+	}
+
+	rnl_io_stats before, after;
+	rnl_io_get_stats(io, &before);
+	const uint64_t start = monotonic_us();
+	uint64_t next = start;
+	for (int cycle = 0; cycle < cycles; cycle++) {
+		if (paced) {
+			next += PERIOD_US;
+			if (uring) {
+				b.ticked = false;
+				rnl_io_set_timer(io, next);
+				while (!b.ticked && rnl_io_poll(io, -1) >= 0)
+					;
+			} else
+				for (uint64_t now = monotonic_us(); now < next; now = monotonic_us())
+					rnl_io_poll(io, next - now);
+		}
+		b.done = 0;
+		for (int i = 0; i < 3; i++)
+			rnl_conn_submit(conn, requests[i], on_family, on_done, &b);
+		while (b.done < 3)
+			if (rnl_io_poll(io, -1) < 0) {
+				failures++;
+				break;
+			}
+		char line[64];
+		rnl_io_write(io, line, snprintf(line, sizeof(line), "cycle %d: %d errors\n", cycle, b.errors));
+	}
+	const double elapsed_us = (double) (monotonic_us() - start);
+	rnl_io_get_stats(io, &after);
+
+	printf("%-8s %-6s %.2f syscalls/cycle, %.2f wakeups/cycle, %.2f datagrams/cycle, %.1f us/cycle\n",
+	       uring ? "io_uring" : "epoll", paced ? "paced" : "busy", (double) (after.syscalls - before.syscalls) / cycles,
+	       (double) (after.wakeups - before.wakeups) / cycles, (double) (after.datagrams - before.datagrams) / cycles,
+	       elapsed_us / cycles);
+	if (b.errors || b.families < (uint64_t) cycles) {
+		printf("FAIL %d errors, %llu families dumped\n", b.errors, (unsigned long long) b.families);
+		failures++;
+	}
+	rnl_io_destroy(io);
+	rnl_conn_close(conn);
+}
+
+int main(int argc, char **argv)
+{
+	const int cycles = argc > 1 ? atoi(argv[1]) : 20000;
+	const int out_fd = open("/dev/null", O_WRONLY);
+	for (int paced = 0; paced < 2; paced++)
+		for (int uring = 0; uring < 2; uring++)
+			run(uring, paced, paced ? cycles / 10 : cycles, out_fd);
+	close(out_fd);
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,190 @@
+//============================================================================
+// Name        : RollingStatsCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks the rolling statistics against a naive window that
+//               keeps every sample, over random streams with gaps of a
+//               whole window and more, timestamps that go backwards and
+//               samples without a signal. Build with
+//               g++ -O2 RollingStatsCheck.cpp ../RollingStats.cpp
+//============================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "../RollingStats.h"
+
+using namespace std;
+
+#define STATIONS 4
+
+static int failures = 0;
+
+static void fail(const char *what, int trial, int step)
+{
+	printf("FAIL %s in trial %d, step %d\n", what, trial, step);
+	failures++;
+}
+
+struct naive_sample {
+	uint64_t bucket;
+	int8_t signal;
+};
+
+// One station's window: every sample with the bucket it was counted in
+struct naive_window {
+	uint64_t head;         // newest bucket, as far as the window has moved
+	vector<naive_sample> samples;
+};
+
+struct naive_station {
+	bool known;
+	naive_window windows[RS_WINDOWS];
+};
+
+static int edge_of(int8_t signal)
+{
+	const int bin = signal >= 0 ? RS_BINS - 1 : (signal + 128) >> 1;
+	return 2 * bin - 128;
+}
+
+// What rs_query() should say of the window ending with bucket
+static bool naive_query(naive_window *w, uint64_t bucket, rs_summary *summary)
+{
+	w->head = max(w->head, bucket);
+	const uint64_t oldest = w->head >= RS_BUCKETS ? w->head + 1 - RS_BUCKETS : 0;
+	vector<int> in;
+	for (size_t i = 0; i < w->samples.size(); i++)
+		if (w->samples[i].bucket >= oldest)
+			in.push_back(w->samples[i].signal);
+	if (in.empty())
+		return false;
+
+	double sum = 0.0;
+	for (size_t i = 0; i < in.size(); i++)
+		sum += in[i];
+	const double mean = sum / in.size();
+	double squares = 0.0;
+	for (size_t i = 0; i < in.size(); i++)
+		squares += (in[i] - mean) * (in[i] - mean);
+	sort(in.begin(), in.end());
+	const uint32_t n = in.size();
+	summary->count = n;
+	summary->mean = (float) mean;
+	summary->variance = n > 1 ? (float) (squares / (n - 1)) : 0.0f;
+	summary->min = in.front();
+	summary->max = in.back();
+	summary->p10 = edge_of(in[n / 10]);
+	summary->p50 = edge_of(in[n / 2]);
+	summary->p90 = edge_of(in[n * 9 / 10]);
+	return true;
+}
+
+static bool same(const rs_summary &a, const rs_summary &b)
+{
+	return a.count == b.count && fabs(a.mean - b.mean) < 1e-3 &&
+	       fabs(a.variance - b.variance) < 1e-3 * (1.0 + b.variance) && a.min == b.min && a.max == b.max &&
+	       a.p10 == b.p10 && a.p50 == b.p50 && a.p90 == b.p90;
+}
+
+static void random_stream(int trial)
+{
+	rs_config c;
+	rs_default_config(&c);
+	c.window_us[RS_SHORT] = 10000;
+	c.window_us[RS_MEDIUM] = 100000;
+	c.window_us[RS_LONG] = 1000000;
+	rolling_stats *stats = rs_create(&c);
+	naive_station naive[STATIONS];
+	for (int s = 0; s < STATIONS; s++)
+		naive[s].known = false;
+
+	uint64_t now_us = (uint64_t) rand() * 1000;
+	for (int step = 0; step < 20000 && failures <= 10; step++) {
+		// Mostly a little later, sometimes a gap of one of the windows'
+		// RS_BUCKETS buckets or more, sometimes back in time
+		const int jump = rand() % 1000;
+		if (jump < 5)
+			now_us += c.window_us[rand() % RS_WINDOWS] * (1 + rand() % 3) + rand() % 1000;
+		else if (jump < 50)
+			now_us -= rand() % 3000;
+		else
+			now_us += rand() % 300;
+
+		const int s = rand() % STATIONS;
+		rl_sample sample;
+		memset(&sample, 0, sizeof(sample));
+		sample.mac = 0x020000000000ULL + s;
+		sample.timestamp_us = now_us;
+		sample.signal = rand() % 20 ? -20 - rand() % 90 + s * 5 : 0;
+		if (rs_add(stats, &sample) != (sample.signal != 0))
+			fail("rs_add", trial, step);
+		if (sample.signal) {
+			for (int w = 0; w < RS_WINDOWS; w++) {
+				naive_window *nw = &naive[s].windows[w];
+				const uint64_t bucket = now_us / (c.window_us[w] / RS_BUCKETS);
+				if (!naive[s].known) {
+					nw->head = bucket;
+					nw->samples.clear();
+				}
+				// Earlier than the newest bucket counts in it
+				nw->head = max(nw->head, bucket);
+				naive_sample ns = { nw->head, sample.signal };
+				nw->samples.push_back(ns);
+			}
+			naive[s].known = true;
+		}
+
+		// Query some station and window, now or a bit later
+		if (rand() % 4)
+			continue;
+		const int q = rand() % STATIONS;
+		const rs_window w = (rs_window) (rand() % RS_WINDOWS);
+		const uint64_t at_us = now_us + (rand() % 4 ? 0 : rand() % c.window_us[w]);
+		rs_summary got = rs_summary(), want = rs_summary();
+		const bool found = rs_query(stats, 0x020000000000ULL + q, w, at_us, &got);
+		const bool expected = naive[q].known &&
+		                      naive_query(&naive[q].windows[w], at_us / (c.window_us[w] / RS_BUCKETS), &want);
+		if (found != expected || (found && !same(got, want))) {
+			printf("FAIL trial %d step %d, window %d: %s %u samples, mean %.2f, var %.2f, %d..%d, %d/%d/%d; "
+			       "expected %s %u, %.2f, %.2f, %d..%d, %d/%d/%d\n", trial, step, w,
+			       found ? "found" : "none", got.count, got.mean, got.variance, got.min, got.max, got.p10,
+			       got.p50, got.p90, expected ? "found" : "none", want.count, want.mean, want.variance, want.min,
+			       want.max, want.p10, want.p50, want.p90);
+			failures++;
+		}
+	}
+	rs_destroy(stats);
+}
+
+int main()
+{
+	srand(1);
+	for (int trial = 0; trial < 20 && failures <= 10; trial++)
+		random_stream(trial);
+
+	// Stations not heard for drop_after_us go, the others stay
+	rs_config c;
+	rs_default_config(&c);
+	rolling_stats *stats = rs_create(&c);
+	rl_sample sample;
+	memset(&sample, 0, sizeof(sample));
+	sample.signal = -50;
+	for (int i = 0; i < 3; i++) {
+		sample.mac = i + 1;
+		sample.timestamp_us = i * c.drop_after_us;
+		rs_add(stats, &sample);
+	}
+	rs_summary summary;
+	if (rs_expire(stats, 2 * c.drop_after_us + 1) != 2 || rs_count(stats) != 1 || rs_query(stats, 1, RS_LONG, 0, &summary) ||
+	    !rs_query(stats, 3, RS_LONG, 2 * c.drop_after_us, &summary) || summary.count != 1)
+		fail("expire", 0, 0);
+	rs_destroy(stats);
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,193 @@
+//============================================================================
+// Name        : StationDeltaCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks the station delta against a reference that looks
+//               every station up in a map, over random dumps whose
+//               stations come and go, change their readings and are
+//               listed in the same or a shuffled order. Build with
+//               g++ -O2 StationDeltaCheck.cpp ../StationDelta.cpp
+//============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "../StationDelta.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static void fail(const char *what, int dump)
+{
+	if (++failures <= 10)
+		printf("FAIL %s in dump %d\n", what, dump);
+}
+
+static int random_index(int n)
+{
+	return rand() % n;
+}
+
+// What delta_update() should report for the dump after prev
+static vector<delta_event> expected(const delta_config *c, const vector<rl_sample> &prev,
+                                    const vector<rl_sample> &dump)
+{
+	map<mac_key, rl_sample> before, now;
+	for (size_t i = 0; i < prev.size(); i++)
+		before[prev[i].mac] = prev[i];
+	vector<delta_event> events;
+	for (size_t i = 0; i < dump.size(); i++) {
+		delta_event e;
+		e.sample = dump[i];
+		e.changed = 0;
+		now[dump[i].mac] = dump[i];
+		map<mac_key, rl_sample>::const_iterator it = before.find(dump[i].mac);
+		if (it == before.end()) {
+			e.kind = DELTA_ADDED;
+			events.push_back(e);
+			continue;
+		}
+		const rl_sample &old = it->second;
+		if (abs(dump[i].signal - old.signal) >= c->signal_db)
+			e.changed |= DELTA_SIGNAL;
+		if (dump[i].tx_bitrate != old.tx_bitrate)
+			e.changed |= DELTA_BITRATE;
+		if ((dump[i].inactive_ms >= c->idle_ms) != (old.inactive_ms >= c->idle_ms))
+			e.changed |= DELTA_ACTIVITY;
+		e.kind = DELTA_CHANGED;
+		if (e.changed)
+			events.push_back(e);
+	}
+	for (size_t i = 0; i < prev.size(); i++)
+		if (!now.count(prev[i].mac)) {
+			delta_event e;
+			e.kind = DELTA_REMOVED;
+			e.changed = 0;
+			e.sample = prev[i];
+			events.push_back(e);
+		}
+	return events;
+}
+
+static bool same(const delta_event *events, int n, const vector<delta_event> &want)
+{
+	if ((size_t) n != want.size())
+		return false;
+	for (int i = 0; i < n; i++)
+		if (events[i].kind != want[i].kind || events[i].changed != want[i].changed ||
+		    memcmp(&events[i].sample, &want[i].sample, sizeof(rl_sample)))
+			return false;
+	return true;
+}
+
+static rl_sample station(mac_key mac)
+{
+	rl_sample s;
+	memset(&s, 0, sizeof(s));
+	s.mac = mac;
+	s.ifindex = 3;
+	s.signal = -40 - rand() % 50;
+	s.tx_bitrate = 60 + rand() % 4 * 60;
+	s.inactive_ms = rand() % 2000;
+	return s;
+}
+
+static void random_dumps(int trial)
+{
+	delta_config c;
+	delta_default_config(&c);
+	c.signal_db = 1 + rand() % 6;
+	station_delta *delta = delta_create(&c);
+
+	// Small populations often repeat the exact same dump, large ones need
+	// the hash table to grow
+	const int population = rand() % 2 ? 1 + rand() % 8 : 100 + rand() % 900;
+	vector<rl_sample> prev, dump;
+	mac_key next_mac = 0x020000000000ULL + (mac_key) trial * 100000;
+	for (int d = 0; d < 300 && failures <= 10; d++) {
+		dump = prev;
+		// Stations leave and associate, at the end of the listing like the
+		// kernel adds them
+		for (size_t i = 0; i < dump.size(); )
+			if (rand() % 20 == 0)
+				dump.erase(dump.begin() + i);
+			else
+				i++;
+		while (dump.size() < (size_t) population && rand() % 3)
+			dump.push_back(station(next_mac++));
+		// Some of the readings change, some by less than signal_db
+		for (size_t i = 0; i < dump.size(); i++) {
+			dump[i].timestamp_us = d * 1000;
+			switch (rand() % 8) {
+			case 0:
+				dump[i].signal += rand() % 11 - 5;
+				break;
+			case 1:
+				dump[i].tx_bitrate = 60 + rand() % 4 * 60;
+				break;
+			case 2:
+				dump[i].inactive_ms = rand() % 2000;
+				break;
+			}
+		}
+		// Mostly in the last order, sometimes shuffled or a pair swapped
+		const int order = rand() % 4;
+		if (order == 0)
+			random_shuffle(dump.begin(), dump.end(), random_index);
+		else if (order == 1 && dump.size() > 1)
+			swap(dump[rand() % dump.size()], dump[rand() % dump.size()]);
+
+		const delta_event *events;
+		const int n = delta_update(delta, dump.data(), dump.size(), &events);
+		if (!same(events, n, expected(&c, prev, dump))) {
+			printf("FAIL trial %d (%d stations, signal_db %d): %d events, %d expected\n", trial,
+			       (int) dump.size(), c.signal_db, n, (int) expected(&c, prev, dump).size());
+			failures++;
+			break;
+		}
+		prev = dump;
+	}
+	delta_destroy(delta);
+}
+
+int main()
+{
+	srand(1);
+	for (int trial = 0; trial < 100 && failures <= 10; trial++)
+		random_dumps(trial);
+
+	delta_config c;
+	delta_default_config(&c);
+	station_delta *delta = delta_create(&c);
+	const delta_event *events;
+	vector<rl_sample> dump;
+	for (int i = 0; i < 5; i++)
+		dump.push_back(station(0x0a0000000000ULL + i));
+
+	// The same stations reversed, with one reading changed: only that one
+	delta_update(delta, dump.data(), dump.size(), &events);
+	vector<rl_sample> reversed(dump.rbegin(), dump.rend());
+	reversed[1].tx_bitrate += 60;
+	if (delta_update(delta, reversed.data(), reversed.size(), &events) != 1 || events[0].kind != DELTA_CHANGED ||
+	    events[0].changed != DELTA_BITRATE || events[0].sample.mac != reversed[1].mac)
+		fail("reordered dump", 1);
+
+	// An empty dump removes them all, in the last dump's order; after a
+	// reset everything is new
+	if (delta_update(delta, NULL, 0, &events) != 5 || events[0].kind != DELTA_REMOVED ||
+	    events[0].sample.mac != reversed[0].mac)
+		fail("empty dump", 2);
+	delta_update(delta, dump.data(), dump.size(), &events);
+	delta_reset(delta);
+	if (delta_update(delta, dump.data(), dump.size(), &events) != 5 || events[4].kind != DELTA_ADDED)
+		fail("reset", 4);
+	delta_destroy(delta);
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
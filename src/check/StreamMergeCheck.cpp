@@ -0,0 +1,164 @@
+//============================================================================
+// Name        : StreamMergeCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks the stream merge on random sources delivering out of
+//               order within their reorder window, with pushes and pops
+//               interleaved, and on the watermark and max_delay_us edge
+//               cases. Build with
+//               g++ -O2 StreamMergeCheck.cpp ../StreamMerge.cpp
+//============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "../StreamMerge.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static void fail(const char *what)
+{
+	printf("FAIL %s\n", what);
+	failures++;
+}
+
+static void push(stream_merge *merge, uint32_t source, uint64_t timestamp_us)
+{
+	rl_sample sample;
+	memset(&sample, 0, sizeof(sample));
+	sample.timestamp_us = timestamp_us;
+	merge_push(merge, source, &sample);
+}
+
+static void random_sources(int trial)
+{
+	merge_config c;
+	merge_default_config(&c);
+	c.sources = 1 + rand() % (rand() % 2 ? 4 : 40);
+	c.reorder_us = rand() % 3 ? 1 + rand() % 500 : 0;
+	stream_merge *merge = merge_create(&c);
+
+	vector<uint64_t> newest(c.sources, 1000);
+	vector<pair<uint64_t, uint32_t> > in, out;
+	merge_item items[256];
+	uint64_t last = 0;
+	bool ordered = true;
+	for (int step = 0; step < 5000; step++) {
+		// Never older than the newest sample of the source less reorder_us:
+		// every one of them must come out
+		const uint32_t s = rand() % c.sources;
+		newest[s] += rand() % 20;
+		const uint64_t t = newest[s] - (c.reorder_us ? rand() % c.reorder_us : 0);
+		rl_sample sample;
+		memset(&sample, 0, sizeof(sample));
+		sample.timestamp_us = t;
+		if (!merge_push(merge, s, &sample))
+			continue;
+		in.push_back(make_pair(t, s));
+
+		for (int pops = rand() % 3 ? 0 : 1 + rand() % 3; pops; pops--) {
+			int n;
+			while ((n = merge_pop(merge, 0, items, 1 + rand() % 256)) > 0)
+				for (int i = 0; i < n; i++) {
+					if (items[i].sample.timestamp_us < last)
+						ordered = false;
+					last = items[i].sample.timestamp_us;
+					out.push_back(make_pair(last, items[i].source));
+				}
+		}
+	}
+	for (uint32_t i = 0; i < c.sources; i++)
+		merge_close(merge, i);
+	int n;
+	while ((n = merge_pop(merge, 0, items, 256)) > 0)
+		for (int i = 0; i < n; i++) {
+			if (items[i].sample.timestamp_us < last)
+				ordered = false;
+			last = items[i].sample.timestamp_us;
+			out.push_back(make_pair(last, items[i].source));
+		}
+
+	merge_stats stats;
+	merge_get_stats(merge, &stats);
+	sort(in.begin(), in.end());
+	sort(out.begin(), out.end());
+	if (!ordered || in != out || stats.late || stats.overflows || stats.merged != stats.pushed) {
+		printf("FAIL trial %d (%u sources, reorder %lu us): %s, %d in, %d out, %lu late, %lu overflows\n",
+		       trial, c.sources, (unsigned long) c.reorder_us, ordered ? "ordered" : "out of order",
+		       (int) in.size(), (int) out.size(), (unsigned long) stats.late, (unsigned long) stats.overflows);
+		failures++;
+	}
+	merge_destroy(merge);
+}
+
+int main()
+{
+	srand(1);
+	for (int trial = 0; trial < 200 && failures <= 10; trial++)
+		random_sources(trial);
+
+	merge_config c;
+	merge_default_config(&c);
+	merge_item items[4];
+	merge_stats stats;
+
+	// A sample newer than its source's watermark waits for it: the one that
+	// arrives after it, still within the reorder window, is not late
+	c.reorder_us = 10000;
+	stream_merge *merge = merge_create(&c);
+	push(merge, 0, 100000);
+	if (merge_pop(merge, 0, items, 4) != 0)
+		fail("released a sample ahead of its watermark");
+	push(merge, 0, 95000);
+	merge_close(merge, 0);
+	merge_get_stats(merge, &stats);
+	if (merge_pop(merge, 0, items, 4) != 2 || items[0].sample.timestamp_us != 95000 || stats.late)
+		fail("reordered sample within the window");
+	merge_destroy(merge);
+
+	// max_delay_us is the only way past a watermark, and only up to
+	// now_us - max_delay_us
+	merge = merge_create(&c);
+	push(merge, 0, 100000);
+	if (merge_pop(merge, 150000, items, 4) != 0)
+		fail("forced past now_us - max_delay_us");
+	if (merge_pop(merge, 200000, items, 4) != 1)
+		fail("not forced after max_delay_us");
+	merge_destroy(merge);
+
+	// A quiet source is passed over after max_delay_us, and whatever it
+	// sends from before then is late
+	c.sources = 2;
+	c.reorder_us = 0;
+	merge = merge_create(&c);
+	push(merge, 0, 10);
+	if (merge_pop(merge, 50000, items, 4) != 0)
+		fail("did not wait for the quiet source");
+	if (merge_pop(merge, 200000, items, 4) != 1)
+		fail("waited for the quiet source past max_delay_us");
+	push(merge, 1, 20);
+	merge_get_stats(merge, &stats);
+	if (stats.late != 1 || !stats.forced)
+		fail("quiet source's sample not late");
+	merge_destroy(merge);
+
+	// A full buffer drops
+	c.sources = 1;
+	c.capacity = 4;
+	merge = merge_create(&c);
+	for (int i = 0; i < 5; i++)
+		push(merge, 0, 100 + i);
+	merge_get_stats(merge, &stats);
+	if (stats.overflows != 1 || stats.pushed != 4)
+		fail("full buffer");
+	merge_destroy(merge);
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
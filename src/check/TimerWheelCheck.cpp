@@ -0,0 +1,286 @@
+//============================================================================
+// Name        : TimerWheelCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks the timer wheel against a reference model that keeps
+//               every entry's deadline in a map, over random schedules,
+//               cancels and reschedules, from inside the callback too, with
+//               jumps far enough to cascade from every level. Build with
+//               g++ -O2 TimerWheelCheck.cpp ../TimerWheel.cpp
+//============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <vector>
+
+#include "../TimerWheel.h"
+
+using namespace std;
+
+#define TICK_US 1000
+#define MAX_TICKS ((uint64_t) (TW_SLOTS - 1) << (TW_SLOT_BITS * (TW_LEVELS - 1)))
+
+static int failures = 0;
+
+static void fail(const char *what, uint64_t now_us)
+{
+	if (++failures <= 10)
+		printf("FAIL %s at %llu us\n", what, (unsigned long long) now_us);
+}
+
+struct model_entry {
+	uint64_t key;
+	uint64_t deadline;     // tick
+	uint64_t interval;     // ticks
+	int priority;
+};
+
+struct model {
+	timer_wheel *wheel;
+	map<tw_id, model_entry> entries;
+	uint64_t current;      // tick
+	uint64_t late;
+	uint64_t fired;
+	vector<tw_id> due;     // of the advance under way
+	vector<int> fired_priorities;
+};
+
+static uint64_t ticks(uint64_t us)
+{
+	return (us + TICK_US - 1) / TICK_US;
+}
+
+static uint64_t clamp(const model *m, uint64_t deadline)
+{
+	return deadline > m->current && deadline - m->current > MAX_TICKS ? m->current + MAX_TICKS : deadline;
+}
+
+// Intervals from one tick to about a quarter of the wheel's range
+static uint64_t random_interval_us()
+{
+	const int bits = rand() % 23;
+	return 1 + ((uint64_t) rand() << 8 ^ rand()) % ((uint64_t) TICK_US << bits);
+}
+
+static uint64_t random_time_us(uint64_t now_us)
+{
+	switch (rand() % 4) {
+	case 0:
+		return now_us > 5000 ? now_us - rand() % 5000 : now_us; // already due
+	case 1:
+		return now_us + rand() % (TW_SLOTS * TICK_US);
+	default:
+		return now_us + random_interval_us();
+	}
+}
+
+static void schedule(model *m, uint64_t now_us, uint64_t first_us)
+{
+	const uint64_t key = rand();
+	const uint64_t interval_us = random_interval_us();
+	const int priority = rand() % TW_PRIORITIES;
+	const tw_id id = tw_schedule(m->wheel, key, interval_us, priority, first_us);
+	if (id == TW_INVALID) {
+		fail("schedule", now_us);
+		return;
+	}
+	model_entry e = { key, clamp(m, ticks(first_us)), ticks(interval_us), priority };
+	m->entries[id] = e;
+}
+
+static void reschedule(model *m, tw_id id, uint64_t next_us, uint64_t now_us)
+{
+	const uint64_t interval_us = random_interval_us();
+	const int priority = rand() % TW_PRIORITIES;
+	if (!tw_reschedule(m->wheel, id, interval_us, priority, next_us)) {
+		fail("reschedule", now_us);
+		return;
+	}
+	model_entry *e = &m->entries[id];
+	e->deadline = clamp(m, ticks(next_us));
+	e->interval = ticks(interval_us);
+	e->priority = priority;
+}
+
+static void cancel(model *m, tw_id id, uint64_t now_us)
+{
+	if (!tw_cancel(m->wheel, id) || tw_cancel(m->wheel, id) ||
+	    tw_reschedule(m->wheel, id, TICK_US, 0, now_us + TICK_US))
+		fail("cancel", now_us);
+	m->entries.erase(id);
+}
+
+static tw_id random_entry(const model *m)
+{
+	map<tw_id, model_entry>::const_iterator it = m->entries.begin();
+	advance(it, rand() % m->entries.size());
+	return it->first;
+}
+
+static void on_fire(void *arg, tw_id id, uint64_t key, uint64_t now_us)
+{
+	model *m = (model*) arg;
+	map<tw_id, model_entry>::iterator it = m->entries.find(id);
+	if (it == m->entries.end() || it->second.key != key || it->second.deadline > m->current) {
+		fail("fired an entry that was not due", now_us);
+		return;
+	}
+	for (size_t i = 0; i < m->due.size(); i++)
+		if (m->due[i] == id)
+			m->due[i] = TW_INVALID;
+
+	// The next period keeps the phase and skips the ones already past
+	model_entry *e = &it->second;
+	m->fired_priorities.push_back(e->priority);
+	uint64_t next = e->deadline + e->interval;
+	if (next <= m->current) {
+		const uint64_t skipped = (m->current - e->deadline) / e->interval;
+		m->late += skipped;
+		next = e->deadline + (skipped + 1) * e->interval;
+	}
+	e->deadline = next;
+	m->fired++;
+
+	// Changes from inside the callback: to this entry and others, but
+	// never making one due again in this advance
+	switch (rand() % 8) {
+	case 0:
+		cancel(m, id, now_us);
+		break;
+	case 1:
+		reschedule(m, id, now_us + TICK_US + rand() % (100 * TICK_US), now_us);
+		break;
+	case 2:
+		schedule(m, now_us, now_us + TICK_US + random_interval_us());
+		break;
+	case 3:
+		if (m->entries.size() > 1) {
+			const tw_id other = random_entry(m);
+			bool pending = false;
+			for (size_t i = 0; i < m->due.size(); i++)
+				pending |= m->due[i] == other;
+			if (!pending)
+				reschedule(m, other, now_us + TICK_US + rand() % (100 * TICK_US), now_us);
+		}
+		break;
+	}
+}
+
+static void check_deadline(const model *m, uint64_t now_us)
+{
+	uint64_t earliest = UINT64_MAX;
+	for (map<tw_id, model_entry>::const_iterator it = m->entries.begin(); it != m->entries.end(); ++it)
+		if (it->second.deadline < earliest)
+			earliest = it->second.deadline;
+	const uint64_t next = tw_next_deadline(m->wheel);
+	if (earliest == UINT64_MAX) {
+		if (next != UINT64_MAX)
+			fail("deadline of an empty wheel", now_us);
+	} else if (earliest <= m->current) {
+		if (next != m->current * TICK_US)
+			fail("deadline with entries left over", now_us);
+	} else if (next > earliest * TICK_US || next <= m->current * TICK_US ||
+	           (earliest >> TW_SLOT_BITS == m->current >> TW_SLOT_BITS && next != earliest * TICK_US))
+		fail("next deadline", now_us);
+}
+
+static void run(int trial)
+{
+	// Every other run starts short of the top level's wrap at 2^32 ticks
+	uint64_t now_us = (uint64_t) rand() * TICK_US + rand() % TICK_US;
+	if (trial % 2)
+		now_us = ((1ULL << 32) - rand() % (1 << 24)) * TICK_US;
+	model m;
+	m.wheel = tw_create(TICK_US, now_us);
+	m.current = now_us / TICK_US;
+	m.late = m.fired = 0;
+
+	for (int step = 0; step < 4000 && failures <= 10; step++) {
+		const int op = rand() % 10;
+		if (op < 4 || m.entries.empty())
+			schedule(&m, now_us, random_time_us(now_us));
+		else if (op < 6)
+			cancel(&m, random_entry(&m), now_us);
+		else if (op < 8)
+			reschedule(&m, random_entry(&m), random_time_us(now_us), now_us);
+
+		// Mostly short steps, sometimes a jump over a whole level
+		const int jump = rand() % 100;
+		now_us += jump < 90 ? rand() % (50 * TICK_US)
+		        : jump < 99 ? ((uint64_t) rand() << 8) % (TICK_US << 18)
+		        : ((uint64_t) rand() << 16) % ((uint64_t) TICK_US << 26);
+		m.current = now_us / TICK_US;
+
+		m.due.clear();
+		for (map<tw_id, model_entry>::const_iterator it = m.entries.begin(); it != m.entries.end(); ++it)
+			if (it->second.deadline <= m.current)
+				m.due.push_back(it->first);
+		const size_t due = m.due.size();
+		const int budget = rand() % 4 ? 0 : 1 + rand() % 8;
+		m.fired_priorities.clear();
+		const int fired = tw_advance(m.wheel, now_us, budget, on_fire, &m);
+
+		// Everything due fires, in priority order, unless the budget ran
+		// out: then what is left is no more urgent than what fired
+		const size_t expected = budget && (size_t) budget < due ? budget : due;
+		if ((size_t) fired != expected || m.fired_priorities.size() != expected)
+			fail("fired count", now_us);
+		int lowest = TW_PRIORITIES;
+		for (size_t i = 0; i < m.due.size(); i++)
+			if (m.due[i] != TW_INVALID && m.entries.count(m.due[i]) && m.entries[m.due[i]].priority < lowest)
+				lowest = m.entries[m.due[i]].priority;
+		for (size_t i = 0; i < m.fired_priorities.size(); i++)
+			if ((i && m.fired_priorities[i] < m.fired_priorities[i - 1]) || m.fired_priorities[i] > lowest) {
+				fail("priority order", now_us);
+				break;
+			}
+
+		check_deadline(&m, now_us);
+		tw_stats stats;
+		tw_get_stats(m.wheel, &stats);
+		if (stats.entries != m.entries.size() || stats.fired != m.fired || stats.late != m.late) {
+			printf("FAIL trial %d: %u entries (%u), %llu fired (%llu), %llu late (%llu)\n", trial,
+			       stats.entries, (unsigned) m.entries.size(), (unsigned long long) stats.fired,
+			       (unsigned long long) m.fired, (unsigned long long) stats.late, (unsigned long long) m.late);
+			failures++;
+			break;
+		}
+	}
+	tw_destroy(m.wheel);
+}
+
+int main()
+{
+	srand(1);
+	for (int trial = 0; trial < 20 && failures <= 10; trial++)
+		run(trial);
+
+	// Alone on the top level past its wrap: still found, and fires on time
+	const uint64_t wrap_us = ((1ULL << 32) - 10) * TICK_US;
+	timer_wheel *wheel = tw_create(TICK_US, wrap_us);
+	model m;
+	m.wheel = wheel;
+	m.current = wrap_us / TICK_US;
+	m.late = m.fired = 0;
+	schedule(&m, wrap_us, wrap_us + 1000 * TICK_US);
+	const uint64_t due_us = m.entries.begin()->second.deadline * TICK_US;
+	bool on_time = tw_next_deadline(wheel) <= due_us;
+	m.current = due_us / TICK_US - 1;
+	on_time &= !tw_advance(wheel, due_us - TICK_US, 0, on_fire, &m);
+	m.current++;
+	if (!on_time || tw_advance(wheel, due_us, 0, on_fire, &m) != 1)
+		fail("past the top level's wrap", due_us);
+	tw_destroy(wheel);
+
+	// What the wheel refuses
+	wheel = tw_create(TICK_US, 0);
+	if (tw_schedule(wheel, 1, 0, 0, 0) != TW_INVALID || tw_schedule(wheel, 1, TICK_US, TW_PRIORITIES, 0) != TW_INVALID ||
+	    tw_schedule(wheel, 1, (MAX_TICKS + 1) * TICK_US, 0, 0) != TW_INVALID || tw_cancel(wheel, TW_INVALID) ||
+	    tw_next_deadline(wheel) != UINT64_MAX)
+		fail("invalid entries", 0);
+	tw_destroy(wheel);
+
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
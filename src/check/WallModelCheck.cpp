@@ -0,0 +1,114 @@
+//============================================================================
+// Name        : WallModelCheck.cpp
+// Copyright   : Copyright (C) 2011 Garrett Brown <garbearucla@gmail.com>
+// Description : Checks wall_model_loss() at joints and corners and against
+//               a brute-force cast over random floor plans. Build with
+//               g++ -O2 WallModelCheck.cpp ../WallModel.cpp ../WorkPool.cpp -lpthread
+//============================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../WallModel.h"
+
+static int failures = 0;
+
+static void expect(const char *name, float got, float want)
+{
+	if (fabsf(got - want) > 1e-3f) {
+		printf("FAIL %s: %.3f dB, expected %.3f\n", name, got, want);
+		failures++;
+	}
+}
+
+static float cast(const wall_segment *walls, int count, float ax, float ay, float px, float py)
+{
+	wall_model *model = wall_model_create(walls, count);
+	const float loss = wall_model_loss(model, ax, ay, px, py);
+	wall_model_destroy(model);
+	return loss;
+}
+
+static void joints()
+{
+	// Every way two walls along x = 5 can meet at (5, 0), crossed there
+	const wall_segment head_to_tail[] = { { 5, -5, 5, 0, 3 }, { 5, 0, 5, 5, 3 } };
+	const wall_segment both_start[] = { { 5, 0, 5, -5, 3 }, { 5, 0, 5, 5, 3 } };
+	const wall_segment both_end[] = { { 5, -5, 5, 0, 3 }, { 5, 5, 5, 0, 3 } };
+	expect("head to tail", cast(head_to_tail, 2, 0, 0, 10, 0), 3);
+	expect("both start", cast(both_start, 2, 0, 0, 10, 0), 3);
+	expect("both end", cast(both_end, 2, 0, 0, 10, 0), 3);
+	expect("reverse ray", cast(both_end, 2, 10, 0, 0, 0), 3);
+
+	// A corner and a T-joint, crossed diagonally: the heaviest wall once
+	const wall_segment corner[] = { { 3, 3, 3, 8, 4 }, { 3, 3, 8, 3, 6 } };
+	expect("corner", cast(corner, 2, 0, 0, 6, 6), 6);
+	const wall_segment tee[] = { { 0, 4, 4, 4, 2 }, { 4, 4, 8, 4, 2 }, { 4, 4, 4, 8, 5 } };
+	expect("tee", cast(tee, 3, 1, 1, 7, 7), 5);
+
+	// Walls crossed away from their ends all count, and a wall ending
+	// exactly on the ray still does
+	const wall_segment parallel[] = { { 2, -1, 2, 1, 3 }, { 4, -1, 4, 1, 4 }, { 6, 0, 6, 1, 5 } };
+	expect("parallel walls", cast(parallel, 3, 0, 0, 10, 0), 12);
+	expect("short of the wall", cast(parallel, 3, 0, 0, 1.5f, 0), 0);
+}
+
+static float brute_force(const wall_segment *walls, int count, float ax, float ay, float px, float py)
+{
+	float loss = 0.0f;
+	for (int i = 0; i < count; i++) {
+		const wall_segment *w = &walls[i];
+		const double dx = px - ax, dy = py - ay, ex = w->x2 - w->x1, ey = w->y2 - w->y1;
+		const double denom = dx * ey - dy * ex;
+		if (denom == 0.0)
+			continue;
+		const double qx = w->x1 - ax, qy = w->y1 - ay;
+		const double t = (qx * ey - qy * ex) / denom, u = (qx * dy - qy * dx) / denom;
+		// Walls reach 0.1 mm past their ends, as in the model
+		const double slack = 1e-4 / sqrt(ex * ex + ey * ey);
+		if (t > 0.0 && t <= 1.0 && u >= -slack && u <= 1.0 + slack)
+			loss += w->attenuation;
+	}
+	return loss;
+}
+
+static float uniform(float lo, float hi)
+{
+	return lo + (hi - lo) * (rand() / (float) RAND_MAX);
+}
+
+static void random_plans()
+{
+	srand(1);
+	for (int plan = 0; plan < 50; plan++) {
+		wall_segment walls[200];
+		const int count = 1 + rand() % 200;
+		for (int i = 0; i < count; i++) {
+			walls[i].x1 = uniform(0, 50);
+			walls[i].y1 = uniform(0, 50);
+			walls[i].x2 = walls[i].x1 + uniform(-10, 10);
+			walls[i].y2 = walls[i].y1 + uniform(-10, 10);
+			walls[i].attenuation = uniform(1, 10);
+		}
+		wall_model *model = wall_model_create(walls, count);
+		for (int ray = 0; ray < 1000; ray++) {
+			const float ax = uniform(0, 50), ay = uniform(0, 50), px = uniform(0, 50), py = uniform(0, 50);
+			const float got = wall_model_loss(model, ax, ay, px, py);
+			const float want = brute_force(walls, count, ax, ay, px, py);
+			if (fabsf(got - want) > 1e-3f) {
+				printf("FAIL plan %d ray %d: %.3f dB, brute force %.3f\n", plan, ray, got, want);
+				failures++;
+			}
+		}
+		wall_model_destroy(model);
+	}
+}
+
+int main()
+{
+	joints();
+	random_plans();
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}